@@ -1,12 +1,25 @@
+#include "BenchmarkReport.h"
 #include "KVS.h"
+#include "LatencyHistogram.h"
+#include "PerfCounters.h"
+#include "Workload.h"
+#include "WorkloadDriver.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <chrono>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <limits>
+#include <optional>
 #include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
 #include <unordered_set>
 
 namespace std {
@@ -25,76 +38,343 @@ namespace benchmark {
 
 using namespace kvs;
 
-std::random_device rd;
-std::mt19937_64 gen(rd());
-std::uniform_int_distribution<char> charDistr(std::numeric_limits<char>::min(),
-                                              std::numeric_limits<char>::max());
+// thread_local, since the multi-threaded benchmark generates operations in every thread
+thread_local std::random_device rd;
+thread_local std::mt19937_64 gen(rd());
+thread_local std::uniform_int_distribution<char>
+    charDistr(std::numeric_limits<char>::min(),
+              std::numeric_limits<char>::max());
 constexpr uint32_t maxOpDistrRange = 1e6;
-std::uniform_int_distribution<uint32_t> opDistr(0, maxOpDistrRange);
+thread_local std::uniform_int_distribution<uint32_t> opDistr(0,
+                                                             maxOpDistrRange);
 
 constexpr size_t DEFAULT_RECENT_KEYS_SIZE = CACHE_MAP_SIZE;
 double removeOperationsRate = 0.2; // between write and remove operations
 
+constexpr size_t OPERATIONS_CNT = 3;
+// indexed by the codes of generateRandomOperationCode()
+constexpr const char* OPERATION_NAMES[OPERATIONS_CNT] = {"get", "remove",
+                                                         "add"};
+constexpr double CACHE_ACCESS_PROBABILITIES[] = {0.1, 0.5, 0.95};
+
+/**
+ * @brief Latencies of the benchmarked operations in nanoseconds, separately for every operation.
+ *
+ */
 struct Stats {
-  uint32_t sumOperationsMicros = 0;
-  uint32_t sumReadOperationsMicros = 0;
-  uint32_t sumWriteOperationsMicros = 0;
+  std::array<LatencyHistogram, OPERATIONS_CNT> histograms;
+
+  /**
+   * @brief Operations per second of every part of the benchmark loop, see ThroughputSampler.
+   *
+   */
+  std::vector<double> throughputs;
 
-  uint32_t operationsCnt = 0;
-  uint32_t readOperationsCnt = 0;
-  uint32_t writeOperationsCnt = 0;
+  /**
+   * @brief The events of the benchmark loop, generating keys and values included. Empty if they weren't counted.
+   *
+   */
+  PerfCounts perfCounts;
+};
+
+void applyDuration(uint64_t nanos, Stats& stats, uint8_t operationCode) {
+  stats.histograms[operationCode].record(nanos);
+}
 
-  uint32_t maxReadOperationMicros = 0;
-  uint32_t maxWriteOperationMicros = 0;
+/**
+ * @brief Splits a benchmark loop into parts of about the same number of operations and takes the throughput of every
+ * part, generating keys and values included, as a sample. A single run of the loop is thereby enough for the
+ * Mann-Whitney test of its throughput against a baseline.
+ *
+ */
+class ThroughputSampler final {
+public:
+  /**
+   * @param samplesCnt Capped by the number of operations.
+   */
+  ThroughputSampler(size_t operationsCnt, size_t samplesCnt,
+                    std::vector<double>& throughputs)
+      : operationsCnt(operationsCnt),
+        samplesCnt(std::max<size_t>(1, std::min(samplesCnt, operationsCnt))),
+        throughputs(throughputs),
+        partBegin(std::chrono::steady_clock::now()) {}
 
-  uint32_t minReadOperationMicros = std::numeric_limits<uint32_t>::max();
-  uint32_t minWriteOperationMicros = std::numeric_limits<uint32_t>::max();
+  /**
+   * @brief Count a finished operation, taking the sample of the part it ends.
+   *
+   */
+  void count() {
+    ++doneOperationsCnt;
+    if (doneOperationsCnt * samplesCnt / operationsCnt == takenSamplesCnt)
+      return;
+    auto partEnd = std::chrono::steady_clock::now();
+    throughputs.push_back((doneOperationsCnt - partBeginOperationsCnt) /
+                          std::chrono::duration<double>(partEnd - partBegin)
+                              .count());
+    ++takenSamplesCnt;
+    partBegin = partEnd;
+    partBeginOperationsCnt = doneOperationsCnt;
+  }
+
+private:
+  const size_t operationsCnt;
+  const size_t samplesCnt;
+  std::vector<double>& throughputs;
+  std::chrono::steady_clock::time_point partBegin;
+  size_t partBeginOperationsCnt = 0;
+  size_t doneOperationsCnt = 0;
+  size_t takenSamplesCnt = 0;
 };
 
-void applyDuration(uint32_t duration, Stats& stats, uint8_t operationCode) {
-  stats.sumOperationsMicros += duration;
-  ++stats.operationsCnt;
-  if (operationCode == 0) {
-    ++stats.readOperationsCnt;
-    stats.sumReadOperationsMicros += duration;
-    stats.maxReadOperationMicros = duration > stats.maxReadOperationMicros
-                                       ? duration
-                                       : stats.maxReadOperationMicros;
-    stats.minReadOperationMicros = duration < stats.minReadOperationMicros
-                                       ? duration
-                                       : stats.minReadOperationMicros;
-  } else { // read or write operation
-    ++stats.writeOperationsCnt;
-    stats.sumWriteOperationsMicros += duration;
-    stats.maxWriteOperationMicros = duration > stats.maxWriteOperationMicros
-                                        ? duration
-                                        : stats.maxWriteOperationMicros;
-    stats.minWriteOperationMicros = duration < stats.minWriteOperationMicros
-                                        ? duration
-                                        : stats.minWriteOperationMicros;
-  }
-}
-
-void printCSVFormatAverageStats(std::ostream& outs, const Stats& stats) {
-  outs << stats.sumOperationsMicros / stats.operationsCnt << ","
-       << stats.sumReadOperationsMicros / stats.readOperationsCnt << ","
-       << stats.sumWriteOperationsMicros / stats.writeOperationsCnt << ",";
+/**
+ * @brief Print "mean,p50,p90,p99,p99.9,max" of every operation, separated by commas.
+ *
+ */
+void printCSVFormatStats(std::ostream& outs, const Stats& stats) {
+  for (size_t i = 0; i < OPERATIONS_CNT; ++i) {
+    const LatencyHistogram& histogram = stats.histograms[i];
+    outs << (i == 0 ? "" : ",") << histogram.getMean() << ","
+         << histogram.getPercentile(50) << "," << histogram.getPercentile(90)
+         << "," << histogram.getPercentile(99) << ","
+         << histogram.getPercentile(99.9) << "," << histogram.getMax();
+  }
+}
+
+/**
+ * @brief Print a "operation,count,min,mean,p50,p90,p99,p99.9,max" table of the given histograms.
+ *
+ */
+template <size_t N>
+void printLatencyTable(std::ostream& outs, const char* const (&names)[N],
+                       const std::array<LatencyHistogram, N>& histograms) {
+  outs << "Benchmark stats in nanoseconds:\n";
+  outs << "operation,count,min,mean,p50,p90,p99,p99.9,max\n";
+  for (size_t i = 0; i < N; ++i) {
+    const LatencyHistogram& histogram = histograms[i];
+    outs << names[i] << "," << histogram.getCount() << ","
+         << histogram.getMin() << "," << histogram.getMean() << ","
+         << histogram.getPercentile(50) << "," << histogram.getPercentile(90)
+         << "," << histogram.getPercentile(99) << ","
+         << histogram.getPercentile(99.9) << "," << histogram.getMax() << "\n";
+  }
+  outs << "\n";
+}
+
+/**
+ * @brief Print a "phase,<events>,IPC" table of the events per operation of every phase, if any were counted.
+ *
+ */
+void printPerfCountsTable(
+    std::ostream& outs,
+    const std::vector<std::tuple<std::string, PerfCounts, uint64_t>>& phases) {
+  if (std::none_of(phases.begin(), phases.end(), [](const auto& phase) {
+        return std::get<1>(phase).isAvailable();
+      }))
+    return;
+  outs << "Events per operation:\n";
+  outs << "phase,";
+  PerfCounts::printCSVHeader(outs);
+  outs << "\n";
+  for (const auto& [phase, perfCounts, operationsCnt] : phases) {
+    outs << phase << ",";
+    perfCounts.printCSV(outs, operationsCnt);
+    outs << "\n";
+  }
+  outs << "\n";
+}
+
+uint64_t getOperationsCnt(const Stats& stats) noexcept {
+  uint64_t operationsCnt = 0;
+  for (const LatencyHistogram& histogram : stats.histograms)
+    operationsCnt += histogram.getCount();
+  return operationsCnt;
 }
 
 void printFullStats(std::ostream& outs, const Stats& stats) {
-  outs << "Benchmark stats in microseconds:\n";
+  printLatencyTable(outs, OPERATION_NAMES, stats.histograms);
+  printPerfCountsTable(outs,
+                       {{"benchmark", stats.perfCounts, getOperationsCnt(stats)}});
+}
 
-  outs << "avg operation = " << stats.sumOperationsMicros / stats.operationsCnt
-       << "\n";
-  outs << "avg read operation = "
-       << stats.sumReadOperationsMicros / stats.readOperationsCnt << "\n";
-  outs << "avg write operation = "
-       << stats.sumWriteOperationsMicros / stats.writeOperationsCnt << "\n";
+/**
+ * @brief Dump the histograms for plotting: as a JSON object keyed by operation if the path ends with ".json", as CSV
+ * with an operation column otherwise.
+ *
+ */
+void dumpHistograms(const std::string& filePath, const Stats& stats) {
+  std::ofstream file(filePath);
+  file.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+  if (std::filesystem::path(filePath).extension() == ".json") {
+    file << "{";
+    for (size_t i = 0; i < OPERATIONS_CNT; ++i) {
+      file << (i == 0 ? "" : ", ") << "\"" << OPERATION_NAMES[i] << "\": ";
+      stats.histograms[i].printJSON(file);
+    }
+    file << "}\n";
+    return;
+  }
+  for (size_t i = 0; i < OPERATIONS_CNT; ++i) {
+    std::stringstream csv;
+    stats.histograms[i].printCSV(csv);
+    std::string line;
+    std::getline(csv, line);
+    if (i == 0)
+      file << "operation," << line << "\n";
+    while (std::getline(csv, line))
+      file << OPERATION_NAMES[i] << "," << line << "\n";
+  }
+}
+
+/**
+ * @brief What to measure besides latencies, where to save the report of the run and which report to compare it with.
+ *
+ */
+struct ReportConfig final {
+  /**
+   * @brief Whether to count hardware and software events around the benchmarked phases ("perfcounters").
+   *
+   */
+  bool collectPerfCounters = false;
+
+  /**
+   * @brief The file to save the JSON report to ("resultfile"). Empty means no report.
+   *
+   */
+  std::string resultFilePath;
+
+  /**
+   * @brief The report to compare the run with ("baseline"). Empty means no comparison.
+   *
+   */
+  std::string baselineFilePath;
+
+  /**
+   * @brief "alpha" and "threshold" of the comparison.
+   *
+   */
+  ComparisonConfig comparisonConfig;
 
-  outs << "min/max read operation = " << stats.minReadOperationMicros << " / "
-       << stats.maxReadOperationMicros << "\n";
-  outs << "min/max write operation = " << stats.minWriteOperationMicros << " / "
-       << stats.maxWriteOperationMicros << "\n\n";
+  /**
+   * @brief The number of throughput samples of every benchmark ("repetitions"), see getRepetitionsCnt().
+   *
+   */
+  std::optional<size_t> repetitionsCnt;
+
+  /**
+   * @brief The number of throughput samples of every benchmark: the one given, otherwise just enough for the
+   * comparison to reach alpha if the run is reported, otherwise 1.
+   *
+   */
+  size_t getRepetitionsCnt() const noexcept {
+    if (repetitionsCnt.has_value())
+      return repetitionsCnt.value();
+    if (resultFilePath.empty() && baselineFilePath.empty())
+      return 1;
+    return getMinSampleSize(comparisonConfig.significanceLevel);
+  }
+
+  /**
+   * @brief Set a property given as "name=value".
+   *
+   * @return Whether the property belongs to the report.
+   * @throws std::invalid_argument if its value is invalid.
+   */
+  bool set(const std::string& property) {
+    size_t separatorPos = property.find('=');
+    if (separatorPos == std::string::npos)
+      return false;
+    std::string name = property.substr(0, separatorPos);
+    std::string value = property.substr(separatorPos + 1);
+    try {
+      if (name == "resultfile")
+        resultFilePath = value;
+      else if (name == "baseline")
+        baselineFilePath = value;
+      else if (name == "alpha")
+        comparisonConfig.significanceLevel = std::stod(value);
+      else if (name == "threshold")
+        comparisonConfig.threshold = std::stod(value);
+      else if (name == "perfcounters")
+        collectPerfCounters = std::stoul(value) != 0;
+      else if (name == "repetitions")
+        repetitionsCnt = std::max<size_t>(1, std::stoul(value));
+      else
+        return false;
+    } catch (const std::exception& exc) {
+      throw std::invalid_argument("invalid value of " + name + ": " + value);
+    }
+    return true;
+  }
+};
+
+BenchmarkResult toBenchmarkResult(const std::string& name,
+                                  const Stats& stats) {
+  BenchmarkResult result{name, stats.throughputs, {}, {}};
+  for (size_t i = 0; i < OPERATIONS_CNT; ++i) {
+    if (stats.histograms[i].getCount() != 0)
+      result.latencies.emplace_back(OPERATION_NAMES[i], stats.histograms[i]);
+  }
+  result.perfCountsPerOperation =
+      stats.perfCounts.getPerOperation(getOperationsCnt(stats));
+  return result;
+}
+
+/**
+ * @brief Print the comparison of the report with the baseline, warning if the runs aren't comparable.
+ *
+ * @return Whether a metric regressed.
+ */
+bool compareWithBaseline(std::ostream& outs, const BenchmarkReport& baseline,
+                         const BenchmarkReport& report,
+                         const ComparisonConfig& config) {
+  const JsonValue& baselineMetadata = baseline.getMetadata();
+  const JsonValue& metadata = report.getMetadata();
+  for (const char* name : {"constants", "compile flags", "host"}) {
+    std::stringstream baselineValue;
+    std::stringstream value;
+    if (baselineMetadata.contains(name))
+      baselineMetadata[name].print(baselineValue);
+    if (metadata.contains(name))
+      metadata[name].print(value);
+    if (baselineValue.str() != value.str())
+      std::cerr << "warning: " << name << " differ from the baseline\n";
+  }
+
+  std::vector<MetricComparison> comparisons =
+      compareReports(baseline, report, config);
+  for (const MetricComparison& comparison : comparisons) {
+    if (!comparison.isTested)
+      std::cerr << "warning: " << comparison.benchmark << " "
+                << comparison.metric
+                << " has too few samples to reach alpha, compared by the "
+                   "threshold alone\n";
+  }
+  outs << "Comparison with the baseline";
+  if (baselineMetadata.contains("git revision"))
+    outs << " at " << baselineMetadata["git revision"].getString();
+  outs << ":\n";
+  printComparison(outs, comparisons);
+  outs << "\n";
+  return std::any_of(
+      comparisons.begin(), comparisons.end(),
+      [](const MetricComparison& comparison) { return comparison.isRegression; });
+}
+
+/**
+ * @brief Save the report and compare it with the baseline as configured.
+ *
+ * @return The exit code: 2 if a metric regressed, 0 otherwise.
+ */
+int finishReport(const BenchmarkReport& report, const ReportConfig& config) {
+  if (!config.resultFilePath.empty())
+    report.save(config.resultFilePath);
+  if (config.baselineFilePath.empty())
+    return 0;
+  BenchmarkReport baseline = BenchmarkReport::load(config.baselineFilePath);
+  return compareWithBaseline(std::cout, baseline, report,
+                             config.comparisonConfig)
+             ? 2
+             : 0;
 }
 
 uint8_t generateRandomOperationCode(
@@ -106,7 +386,8 @@ uint8_t generateRandomOperationCode(
     return 0;
   }
   uint32_t writeRemoveNum = num - maxReadNum;
-  if (writeRemoveNum < writeRemoveNum * removeOperationsRate) {
+  // removals take their share of the range left after reads
+  if (writeRemoveNum < (maxOpDistrRange - maxReadNum) * removeOperationsRate) {
     return 1;
   }
   return 2;
@@ -147,26 +428,34 @@ Key generateNewRandomKey(std::unordered_set<Key>& keys) {
   return key;
 }
 
-KVS setupKVS(size_t setupElementsSize) {
-  std::filesystem::create_directories(STORAGE_DIRECTORY_PATH);
-  KVS kvs{};
+void setupKVS(KVS& kvs, size_t setupElementsSize) {
   std::unordered_set<Key> keys;
   for (size_t i = 0; i < setupElementsSize; ++i) {
     kvs.add(generateNewRandomKey(keys), generateRandomValue());
     // TODO: (?) make random operation
   }
   //std::cerr << "KVS set up finished\n";
-  return kvs;
 }
 
 void clearUp() { std::filesystem::remove_all(STORAGE_DIRECTORY_PATH); }
 
-void testRandomAccess(size_t setupElementsSize,
-                      size_t benchmarkOperationsNumber,
-                      double readOperationsRate) {
-  KVS kvs = setupKVS(setupElementsSize);
+/**
+ * @param throughputSamplesCnt The number of parts of the benchmark loop whose throughput is sampled.
+ * @param perfCounters Counts the events of the benchmark loop if not null.
+ */
+Stats testRandomAccess(size_t setupElementsSize,
+                       size_t benchmarkOperationsNumber,
+                       double readOperationsRate, size_t throughputSamplesCnt,
+                       PerfCounters* perfCounters = nullptr) {
+  std::filesystem::create_directories(STORAGE_DIRECTORY_PATH);
+  KVS kvs{};
+  setupKVS(kvs, setupElementsSize);
 
   Stats stats{};
+  ThroughputSampler throughputSampler(benchmarkOperationsNumber,
+                                      throughputSamplesCnt, stats.throughputs);
+  if (perfCounters != nullptr)
+    perfCounters->start();
 
   for (size_t i = 0; i < benchmarkOperationsNumber; ++i) {
     Key key = generateRandomKey();
@@ -192,22 +481,30 @@ void testRandomAccess(size_t setupElementsSize,
     }
     }
     auto duration =
-        std::chrono::duration_cast<std::chrono::microseconds>(end - begin)
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin)
             .count();
     applyDuration(duration, stats, operationCode);
+    throughputSampler.count();
   }
+  if (perfCounters != nullptr)
+    stats.perfCounts = perfCounters->stop();
 
-  printCSVFormatAverageStats(std::cerr, stats);
   clearUp();
+  return stats;
 }
 
-void testCacheAccessWithProbability(size_t setupElementsSize,
-                                    size_t benchmarkOperationsNumber,
-                                    double readOperationsRate,
-                                    double cacheAccessProbability) {
-  KVS kvs = setupKVS(setupElementsSize);
+Stats testCacheAccessWithProbability(size_t setupElementsSize,
+                                     size_t benchmarkOperationsNumber,
+                                     double readOperationsRate,
+                                     double cacheAccessProbability,
+                                     size_t throughputSamplesCnt) {
+  std::filesystem::create_directories(STORAGE_DIRECTORY_PATH);
+  KVS kvs{};
+  setupKVS(kvs, setupElementsSize);
 
   Stats stats{};
+  ThroughputSampler throughputSampler(benchmarkOperationsNumber,
+                                      throughputSamplesCnt, stats.throughputs);
   std::vector<Key> recentKeys(DEFAULT_RECENT_KEYS_SIZE);
   size_t recentKeysSize = 0;
   size_t recentKeysPos = 0;
@@ -237,7 +534,7 @@ void testCacheAccessWithProbability(size_t setupElementsSize,
     }
     }
     auto duration =
-        std::chrono::duration_cast<std::chrono::microseconds>(end - begin)
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin)
             .count();
     applyDuration(duration, stats, operationCode);
 
@@ -252,12 +549,328 @@ void testCacheAccessWithProbability(size_t setupElementsSize,
       recentKeys[recentKeysPos] = key;
       ++recentKeysPos;
     }
+    throughputSampler.count();
+  }
+
+  clearUp();
+  return stats;
+}
+
+/**
+ * @brief Run the same random workload on one KVS repetitionsCnt times with 1, 2, 4, ... up to maxThreadsCnt threads.
+ *
+ * Prints a line "threads,operations per second" for every repetition, followed by the events per operation if
+ * perfCounters isn't null.
+ *
+ */
+void testThreadsScaling(size_t setupElementsSize,
+                        size_t operationsPerThreadNumber,
+                        double readOperationsRate, size_t maxThreadsCnt,
+                        size_t repetitionsCnt, BenchmarkReport& report,
+                        PerfCounters* perfCounters) {
+  std::filesystem::create_directories(STORAGE_DIRECTORY_PATH);
+  KVS kvs{};
+  setupKVS(kvs, setupElementsSize);
+
+  std::cout << "threads,operations per second";
+  if (perfCounters != nullptr) {
+    std::cout << ",";
+    PerfCounts::printCSVHeader(std::cout);
   }
+  std::cout << "\n";
+
+  for (size_t threadsCnt = 1; threadsCnt <= maxThreadsCnt; threadsCnt *= 2) {
+    auto worker = [&kvs, operationsPerThreadNumber, readOperationsRate]() {
+      for (size_t i = 0; i < operationsPerThreadNumber; ++i) {
+        Key key = generateRandomKey();
+        switch (generateRandomOperationCode(readOperationsRate)) {
+        case 0: {
+          std::optional<Value> value = kvs.get(key);
+          break;
+        }
+        case 1: {
+          kvs.remove(key);
+          break;
+        }
+        case 2: {
+          kvs.add(key, generateRandomValue());
+          break;
+        }
+        }
+      }
+    };
+
+    BenchmarkResult result{
+        "threads " + std::to_string(threadsCnt), {}, {}, {}};
+    PerfCounts perfCounts;
+    for (size_t repetition = 0; repetition < repetitionsCnt; ++repetition) {
+      if (perfCounters != nullptr)
+        perfCounters->start();
+      auto begin = std::chrono::high_resolution_clock::now();
+      std::vector<std::thread> threads;
+      for (size_t i = 0; i < threadsCnt; ++i) threads.emplace_back(worker);
+      for (std::thread& thread : threads) thread.join();
+      auto end = std::chrono::high_resolution_clock::now();
+      PerfCounts repetitionPerfCounts;
+      if (perfCounters != nullptr)
+        repetitionPerfCounts = perfCounters->stop();
 
-  printCSVFormatAverageStats(std::cerr, stats);
+      double seconds = std::chrono::duration<double>(end - begin).count();
+      uint64_t operationsCnt = threadsCnt * operationsPerThreadNumber;
+      double throughput = operationsCnt / seconds;
+      std::cout << threadsCnt << "," << throughput;
+      if (perfCounters != nullptr) {
+        std::cout << ",";
+        repetitionPerfCounts.printCSV(std::cout, operationsCnt);
+      }
+      std::cout << "\n";
+      result.throughputs.push_back(throughput);
+      perfCounts += repetitionPerfCounts;
+    }
+    result.perfCountsPerOperation = perfCounts.getPerOperation(
+        threadsCnt * operationsPerThreadNumber * repetitionsCnt);
+    report.addResult(std::move(result));
+  }
   clearUp();
 }
 
+/**
+ * @brief Print a "phase,thread,operations,seconds,operations per second,p50,p99,p99.9,max" line for every thread and
+ * one for all of them, the latencies taken over all operations.
+ *
+ */
+void printThreadResults(std::ostream& outs, const char* phase,
+                        const std::vector<ThreadResult>& results) {
+  auto printResult = [&outs, phase](const std::string& thread,
+                                    const ThreadResult& result) {
+    LatencyHistogram histogram;
+    for (const LatencyHistogram& operationHistogram : result.histograms)
+      histogram.merge(operationHistogram);
+    outs << phase << "," << thread << "," << result.operationsCnt << ","
+         << result.seconds << "," << result.operationsCnt / result.seconds
+         << "," << histogram.getPercentile(50) << ","
+         << histogram.getPercentile(99) << "," << histogram.getPercentile(99.9)
+         << "," << histogram.getMax() << "\n";
+  };
+  ThreadResult total;
+  for (size_t i = 0; i < results.size(); ++i) {
+    printResult(std::to_string(i), results[i]);
+    total.merge(results[i]);
+  }
+  printResult("all", total);
+}
+
+/**
+ * @brief Merge the results of the threads of a phase into a benchmark result, with the throughput of the phase as one
+ * more sample.
+ *
+ */
+void addPhaseResult(BenchmarkResult& result,
+                    const std::vector<ThreadResult>& threadResults) {
+  ThreadResult total;
+  for (const ThreadResult& threadResult : threadResults)
+    total.merge(threadResult);
+  result.throughputs.push_back(total.operationsCnt / total.seconds);
+  if (result.latencies.empty()) {
+    for (size_t i = 0; i < WORKLOAD_OPERATIONS_CNT; ++i)
+      result.latencies.emplace_back(WORKLOAD_OPERATION_NAMES[i],
+                                    LatencyHistogram{});
+  }
+  for (size_t i = 0; i < WORKLOAD_OPERATIONS_CNT; ++i)
+    result.latencies[i].second.merge(total.histograms[i]);
+}
+
+/**
+ * @brief The system calls made between two snapshots of KVS::getSyscallStats().
+ *
+ */
+storage::SyscallStats
+getSyscallStatsDelta(const storage::SyscallStats& before,
+                     const storage::SyscallStats& after) {
+  storage::SyscallStats delta = after;
+  for (size_t i = 0; i < storage::IO_OPERATIONS_CNT; ++i) {
+    const storage::IOOperationStats& beforeStats = before.operationStats[i];
+    storage::IOOperationStats& deltaStats = delta.operationStats[i];
+    deltaStats.operationsCnt =
+        deltaStats.operationsCnt - beforeStats.operationsCnt;
+    for (size_t j = 0; j < storage::SYSCALLS_CNT; ++j)
+      deltaStats.syscallsCnts[j] =
+          deltaStats.syscallsCnts[j] - beforeStats.syscallsCnts[j];
+    deltaStats.readBytesCnt =
+        deltaStats.readBytesCnt - beforeStats.readBytesCnt;
+    deltaStats.writtenBytesCnt =
+        deltaStats.writtenBytesCnt - beforeStats.writtenBytesCnt;
+  }
+  return delta;
+}
+
+/**
+ * @brief Run a YCSB-style workload: insert config.recordsCnt records, then run config.operationsCnt operations
+ * driverConfig.repetitionsCnt times, both by driverConfig.threadsCnt threads.
+ *
+ * Prints the throughput and latencies of every thread in both phases, then the latencies of every operation of the run
+ * phase, the events per operation of both phases if perfCounters isn't null, the system calls per KVS operation of the
+ * run phase and the stats of the KVS.
+ *
+ * @param perfCounters Must be opened before the call to count the background threads of the KVS too.
+ */
+void testWorkload(const WorkloadConfig& config,
+                  const DriverConfig& driverConfig, BenchmarkReport& report,
+                  PerfCounters* perfCounters) {
+  std::filesystem::create_directories(STORAGE_DIRECTORY_PATH);
+  KVS kvs{};
+  std::atomic<uint64_t> recordsCnt{0};
+  if (!driverConfig.traceFilePath.empty())
+    kvs.startTrace(driverConfig.traceFilePath, driverConfig.traceFullKeys);
+
+  std::cout << "phase,thread,operations,seconds,operations per "
+               "second,p50,p99,p99.9,max\n";
+  auto startPerfCounters = [perfCounters]() {
+    if (perfCounters != nullptr)
+      perfCounters->start();
+  };
+  auto stopPerfCounters = [perfCounters]() {
+    return perfCounters != nullptr ? perfCounters->stop() : PerfCounts{};
+  };
+  BenchmarkResult loadResult{"ycsb load", {}, {}, {}};
+  startPerfCounters();
+  std::vector<ThreadResult> results =
+      loadWorkload(kvs, config, driverConfig, recordsCnt);
+  PerfCounts loadPerfCounts = stopPerfCounters();
+  printThreadResults(std::cout, "load", results);
+  addPhaseResult(loadResult, results);
+  BenchmarkResult runResult{"ycsb run", {}, {}, {}};
+  PerfCounts runPerfCounts;
+  storage::SyscallStats syscallStatsBefore = kvs.getSyscallStats();
+  for (size_t i = 0; i < driverConfig.repetitionsCnt; ++i) {
+    startPerfCounters();
+    results = runWorkload(kvs, config, driverConfig, recordsCnt);
+    runPerfCounts += stopPerfCounters();
+    printThreadResults(std::cout, "run", results);
+    addPhaseResult(runResult, results);
+  }
+  storage::SyscallStats runSyscallStats =
+      getSyscallStatsDelta(syscallStatsBefore, kvs.getSyscallStats());
+  uint64_t loadOperationsCnt = config.recordsCnt;
+  uint64_t runOperationsCnt =
+      config.operationsCnt * driverConfig.repetitionsCnt;
+  loadResult.perfCountsPerOperation =
+      loadPerfCounts.getPerOperation(loadOperationsCnt);
+  runResult.perfCountsPerOperation =
+      runPerfCounts.getPerOperation(runOperationsCnt);
+  std::cout << "\n";
+  if (!driverConfig.traceFilePath.empty())
+    kvs.stopTrace();
+
+  std::array<LatencyHistogram, WORKLOAD_OPERATIONS_CNT> histograms;
+  for (size_t i = 0; i < WORKLOAD_OPERATIONS_CNT; ++i)
+    histograms[i] = runResult.latencies[i].second;
+  printLatencyTable(std::cout, WORKLOAD_OPERATION_NAMES, histograms);
+  std::cout << "\n";
+  printPerfCountsTable(std::cout, {{"load", loadPerfCounts, loadOperationsCnt},
+                                   {"run", runPerfCounts, runOperationsCnt}});
+  std::cout << "System calls per operation of the run phase:\n";
+  runSyscallStats.printPerOperation(std::cout);
+  std::cout << "\n";
+  kvs.stats().printText(std::cout);
+  clearUp();
+
+  for (BenchmarkResult* result : {&loadResult, &runResult}) {
+    // operations the workload doesn't issue aren't compared
+    result->latencies.erase(
+        std::remove_if(result->latencies.begin(), result->latencies.end(),
+                       [](const auto& latencies) {
+                         return latencies.second.getCount() == 0;
+                       }),
+        result->latencies.end());
+    report.addResult(std::move(*result));
+  }
+}
+
+/**
+ * @brief Overwrite and remove random keys of a fixed pool, then report how much disk traffic and space the churn cost.
+ *
+ * Prints "operations,user bytes,rebuilds,rebuilt bytes,punched bytes,write amplification,values files bytes,live bytes".
+ *
+ * @param perfCounters Counts the events of the churn and of the compactions it causes if not null.
+ * @return The latencies and throughput of the churn, with the rebuilds and their bytes per operation as extra metrics.
+ */
+BenchmarkResult testChurn(size_t keyPoolSize, size_t operationsNumber,
+                          size_t throughputSamplesCnt,
+                          PerfCounters* perfCounters) {
+  std::filesystem::create_directories(STORAGE_DIRECTORY_PATH);
+  KVS kvs{};
+  shard::RebuildStats rebuildStatsBefore = kvs.getRebuildStats();
+
+  std::vector<Key> keyPool;
+  for (size_t i = 0; i < keyPoolSize; ++i)
+    keyPool.push_back(generateRandomKey());
+  std::unordered_set<Key> liveKeys;
+  std::uniform_int_distribution<size_t> keyDistr(0, keyPoolSize - 1);
+
+  Stats stats{};
+  ThroughputSampler throughputSampler(operationsNumber, throughputSamplesCnt,
+                                      stats.throughputs);
+  if (perfCounters != nullptr)
+    perfCounters->start();
+  uint64_t userBytesCnt = 0;
+  for (size_t i = 0; i < operationsNumber; ++i) {
+    const Key& key = keyPool[keyDistr(gen)];
+    uint8_t operationCode =
+        opDistr(gen) < maxOpDistrRange * removeOperationsRate ? 1 : 2;
+    auto begin = std::chrono::high_resolution_clock::now();
+    if (operationCode == 1)
+      kvs.remove(key);
+    else
+      kvs.add(key, generateRandomValue());
+    auto end = std::chrono::high_resolution_clock::now();
+    applyDuration(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin)
+            .count(),
+        stats, operationCode);
+    throughputSampler.count();
+    if (operationCode == 1) {
+      liveKeys.erase(key);
+    } else {
+      liveKeys.insert(key);
+      userBytesCnt += VALUE_SIZE;
+    }
+  }
+  kvs.waitForCompactions();
+  if (perfCounters != nullptr)
+    stats.perfCounts = perfCounters->stop();
+
+  const shard::RebuildStats& rebuildStats = kvs.getRebuildStats();
+  uint64_t rebuildsCnt =
+      rebuildStats.rebuildsCnt - rebuildStatsBefore.rebuildsCnt;
+  uint64_t copiedBytesCnt =
+      rebuildStats.copiedBytesCnt - rebuildStatsBefore.copiedBytesCnt;
+  uint64_t punchedBytesCnt =
+      rebuildStats.punchedBytesCnt - rebuildStatsBefore.punchedBytesCnt;
+  uint64_t valuesFilesBytesCnt = 0;
+  // the shards in use change with splits and merges, so the files are found on disk
+  for (const auto& file : std::filesystem::recursive_directory_iterator(
+           shard::Shard::storageDirectoryPath))
+    if (file.is_regular_file() && file.path().filename() == "values")
+      valuesFilesBytesCnt += file.file_size();
+
+  std::cout << operationsNumber << "," << userBytesCnt << "," << rebuildsCnt
+            << "," << copiedBytesCnt << "," << punchedBytesCnt << ","
+            << static_cast<double>(userBytesCnt + copiedBytesCnt) /
+                   std::max<uint64_t>(userBytesCnt, 1)
+            << "," << valuesFilesBytesCnt << ","
+            << liveKeys.size() * VALUE_SIZE << "\n";
+  clearUp();
+
+  BenchmarkResult result = toBenchmarkResult("churn", stats);
+  double operationsCnt = std::max<size_t>(operationsNumber, 1);
+  result.extraMetrics = {
+      {"rebuilds", rebuildsCnt / operationsCnt},
+      {"rebuilt bytes", copiedBytesCnt / operationsCnt},
+      {"punched bytes", punchedBytesCnt / operationsCnt}};
+  return result;
+}
+
 namespace disk {
 
 constexpr size_t ENTRY_SIZE = VALUE_SIZE + KEY_SIZE;
@@ -294,9 +907,12 @@ std::pair<std::string, size_t> generateEntryLocationFromKey(const Key& key) {
                         secondPart * ENTRY_SIZE);
 }
 
-void testDiskOperations(size_t benchmarkOperationsNumber,
-                        double readOperationsRate) {
+Stats testDiskOperations(size_t benchmarkOperationsNumber,
+                         double readOperationsRate,
+                         size_t throughputSamplesCnt) {
   Stats stats{};
+  ThroughputSampler throughputSampler(benchmarkOperationsNumber,
+                                      throughputSamplesCnt, stats.throughputs);
   ByteArray bytes = generateRandomByteArray(ENTRY_SIZE);
 
   for (size_t i = 0; i < benchmarkOperationsNumber; ++i) {
@@ -325,43 +941,213 @@ void testDiskOperations(size_t benchmarkOperationsNumber,
       end = std::chrono::high_resolution_clock::now();
     }
     auto duration =
-        std::chrono::duration_cast<std::chrono::microseconds>(end - begin)
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin)
             .count();
-    applyDuration(duration, stats, operationCode);
+    // every write is an "add" of the entry
+    applyDuration(duration, stats, operationCode == 0 ? 0 : 2);
+    throughputSampler.count();
   }
-  printCSVFormatAverageStats(std::cout, stats);
+  return stats;
 }
 
 } // namespace disk
 } // namespace benchmark
 
-void testAll(size_t benchmarkOperationsNumber) {
+/**
+ * @brief The benchmarks of testAll() in the order they run.
+ *
+ */
+std::vector<std::string> getTestAllNames() {
+  std::vector<std::string> names = {"random access"};
+  for (double cacheAccessProbability : benchmark::CACHE_ACCESS_PROBABILITIES) {
+    std::stringstream name;
+    name << "cache access " << cacheAccessProbability;
+    names.push_back(name.str());
+  }
+  names.push_back("disk");
+  return names;
+}
+
+/**
+ * @brief Print the header of the lines of testAll(): the number of operations, then the "mean,p50,p90,p99,p99.9,max"
+ * of every operation of every benchmark.
+ *
+ */
+void printTestAllHeader(std::ostream& outs) {
+  outs << "operations";
+  for (const std::string& name : getTestAllNames()) {
+    for (const char* operation : benchmark::OPERATION_NAMES) {
+      for (const char* stat : {"mean", "p50", "p90", "p99", "p99.9", "max"})
+        outs << "," << name << " " << operation << " " << stat;
+    }
+  }
+  outs << "\n";
+}
+
+void testAll(size_t benchmarkOperationsNumber, size_t throughputSamplesCnt,
+             benchmark::BenchmarkReport& report) {
   size_t setupElementsSize = 10000;
   double readOperationsRate = 0.2;
-  std::cout << benchmarkOperationsNumber << ",";
-  benchmark::testRandomAccess(setupElementsSize, benchmarkOperationsNumber,
-                              readOperationsRate);
-  benchmark::testCacheAccessWithProbability(
-      setupElementsSize, benchmarkOperationsNumber, readOperationsRate, 0.1);
-  benchmark::testCacheAccessWithProbability(
-      setupElementsSize, benchmarkOperationsNumber, readOperationsRate, 0.5);
-  benchmark::testCacheAccessWithProbability(
-      setupElementsSize, benchmarkOperationsNumber, readOperationsRate, 0.95);
-  benchmark::disk::testDiskOperations(benchmarkOperationsNumber,
-                                      readOperationsRate);
+  std::vector<benchmark::Stats> stats;
+  stats.push_back(benchmark::testRandomAccess(
+      setupElementsSize, benchmarkOperationsNumber, readOperationsRate,
+      throughputSamplesCnt));
+  for (double cacheAccessProbability : benchmark::CACHE_ACCESS_PROBABILITIES)
+    stats.push_back(benchmark::testCacheAccessWithProbability(
+        setupElementsSize, benchmarkOperationsNumber, readOperationsRate,
+        cacheAccessProbability, throughputSamplesCnt));
+  stats.push_back(benchmark::disk::testDiskOperations(
+      benchmarkOperationsNumber, readOperationsRate, throughputSamplesCnt));
+
+  std::vector<std::string> names = getTestAllNames();
+  std::cout << benchmarkOperationsNumber;
+  for (size_t i = 0; i < stats.size(); ++i) {
+    std::cout << ",";
+    benchmark::printCSVFormatStats(std::cout, stats[i]);
+    report.addResult(benchmark::toBenchmarkResult(
+        names[i] + " " + std::to_string(benchmarkOperationsNumber), stats[i]));
+  }
   std::cout << "\n";
 }
 
-int main() {
+/**
+ * @brief Every mode also takes "resultfile=<path>" to save a JSON report of the run, and "baseline=<path>" to compare
+ * the run with a saved report, exiting with 2 if a metric regressed. "alpha" and "threshold" set up the comparison.
+ * "repetitions=N" sets the number of throughput samples of every benchmark: repetitions of every thread count and of
+ * the ycsb run phase, equal parts of the loops of the other modes. "perfcounters=1" counts hardware and software events
+ * in the threads, latency, churn and ycsb modes.
+ *
+ */
+int main(int argc, char* argv[]) {
+  std::string command = argv[0];
+  benchmark::ReportConfig reportConfig;
+  std::vector<char*> args = {argv[0]};
+  try {
+    for (int i = 1; i < argc; ++i) {
+      command += std::string(" ") + argv[i];
+      if (!reportConfig.set(argv[i]))
+        args.push_back(argv[i]);
+    }
+  } catch (const std::invalid_argument& exc) {
+    std::cerr << exc.what() << "\n";
+    return 1;
+  }
+  argc = args.size();
+  argv = args.data();
+  benchmark::BenchmarkReport report(command);
+  // opened before any KVS, so that the threads of the KVS inherit them
+  std::optional<benchmark::PerfCounters> perfCounters;
+  if (reportConfig.collectPerfCounters) {
+    perfCounters.emplace();
+    if (!perfCounters->getUnavailableReason().empty())
+      std::cerr << "some counters are unavailable ("
+                << perfCounters->getUnavailableReason() << ")\n";
+    if (!perfCounters->isAvailable())
+      perfCounters.reset();
+  }
+  benchmark::PerfCounters* perfCountersPtr =
+      perfCounters.has_value() ? &perfCounters.value() : nullptr;
+  auto finishReport = [&report, &reportConfig]() {
+    try {
+      return benchmark::finishReport(report, reportConfig);
+    } catch (const std::exception& exc) {
+      std::cerr << exc.what() << "\n";
+      return 1;
+    }
+  };
 
   benchmark::removeOperationsRate = 0.2; // between write and remove operations
 
+  // "bench compare <baseline file> <result file>" compares two saved reports
+  if (argc > 3 && std::string(argv[1]) == "compare") {
+    try {
+      benchmark::BenchmarkReport baseline =
+          benchmark::BenchmarkReport::load(argv[2]);
+      benchmark::BenchmarkReport result = benchmark::BenchmarkReport::load(argv[3]);
+      return benchmark::compareWithBaseline(std::cout, baseline, result,
+                                            reportConfig.comparisonConfig)
+                 ? 2
+                 : 0;
+    } catch (const std::invalid_argument& exc) {
+      std::cerr << exc.what() << "\n";
+      return 1;
+    }
+  }
+
+  // "bench threads [max threads]" measures how throughput scales with the number of threads
+  if (argc > 1 && std::string(argv[1]) == "threads") {
+    size_t maxThreadsCnt = argc > 2 ? std::stoul(argv[2])
+                                    : std::thread::hardware_concurrency();
+    benchmark::testThreadsScaling(10000, 10000, 0.5, maxThreadsCnt,
+                                  reportConfig.getRepetitionsCnt(), report,
+                                  perfCountersPtr);
+    return finishReport();
+  }
+
+  // "bench latency [setup size] [operations] [histograms file]" reports latency percentiles of a random workload
+  if (argc > 1 && std::string(argv[1]) == "latency") {
+    size_t setupElementsSize = argc > 2 ? std::stoul(argv[2]) : 10000;
+    size_t operationsNumber = argc > 3 ? std::stoul(argv[3]) : 100000;
+    benchmark::Stats stats = benchmark::testRandomAccess(
+        setupElementsSize, operationsNumber, 0.5,
+        reportConfig.getRepetitionsCnt(), perfCountersPtr);
+    benchmark::printFullStats(std::cout, stats);
+    if (argc > 4)
+      benchmark::dumpHistograms(argv[4], stats);
+    report.addResult(benchmark::toBenchmarkResult("latency", stats));
+    return finishReport();
+  }
+
+  // "bench ycsb <a-f | workload file> [property=value ...]" runs a YCSB core workload or one described by a file,
+  // "threadcount" and "target" (operations per second, 0 for a closed loop) properties set up the client threads,
+  // "repetitions" repeats the run phase, "tracefile" and "tracefullkeys" (0 or 1) record a trace for the replay tool
+  if (argc > 2 && std::string(argv[1]) == "ycsb") {
+    try {
+      std::string workload = argv[2];
+      benchmark::WorkloadConfig config;
+      benchmark::DriverConfig driverConfig;
+      driverConfig.repetitionsCnt = reportConfig.getRepetitionsCnt();
+      if (workload.size() == 1)
+        config = benchmark::WorkloadConfig::getCoreWorkload(workload[0]);
+      else
+        config.load(workload);
+      for (int i = 3; i < argc; ++i) {
+        std::string property = argv[i];
+        size_t separatorPos = property.find('=');
+        if (separatorPos == std::string::npos)
+          throw std::invalid_argument("expected property=value: " + property);
+        std::string name = property.substr(0, separatorPos);
+        std::string value = property.substr(separatorPos + 1);
+        if (!driverConfig.set(name, value))
+          config.set(name, value);
+      }
+      config.validate();
+      benchmark::testWorkload(config, driverConfig, report, perfCountersPtr);
+    } catch (const std::invalid_argument& exc) {
+      std::cerr << exc.what() << "\n";
+      return 1;
+    }
+    return finishReport();
+  }
+
+  // "bench churn [key pool size] [operations]" measures rebuilds and write amplification of overwrites and removals
+  if (argc > 1 && std::string(argv[1]) == "churn") {
+    size_t keyPoolSize = argc > 2 ? std::stoul(argv[2]) : 100000;
+    size_t operationsNumber = argc > 3 ? std::stoul(argv[3]) : 500000;
+    benchmark::removeOperationsRate = 0.5;
+    report.addResult(benchmark::testChurn(keyPoolSize, operationsNumber,
+                                          reportConfig.getRepetitionsCnt(),
+                                          perfCountersPtr));
+    return finishReport();
+  }
+
   benchmark::disk::setUpDiskBenchmarkDirectory();
+  printTestAllHeader(std::cout);
   size_t steps = 10;
   for (size_t i = 1; i < steps; ++i) {
-    testAll(i * 10000);
+    testAll(i * 10000, reportConfig.getRepetitionsCnt(), report);
   }
   benchmark::disk::clearUpDiskBenchmarkDirectory();
 
-  return 0;
+  return finishReport();
 }
@@ -0,0 +1,402 @@
+#include "BenchmarkReport.h"
+#include "KeyValueTypes.h"
+
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <sys/utsname.h>
+#include <unistd.h>
+
+// set by the build, see CMakeLists.txt
+#ifndef KVS_GIT_REVISION
+#define KVS_GIT_REVISION "unknown"
+#endif
+#ifndef KVS_BUILD_TYPE
+#define KVS_BUILD_TYPE ""
+#endif
+#ifndef KVS_CXX_FLAGS
+#define KVS_CXX_FLAGS ""
+#endif
+
+namespace benchmark {
+
+namespace {
+
+using namespace kvs::utils;
+
+std::string getTimestamp() {
+  std::time_t now = std::time(nullptr);
+  std::tm utc;
+  gmtime_r(&now, &utc);
+  char timestamp[32];
+  std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", &utc);
+  return timestamp;
+}
+
+std::string getCPUModel() {
+  std::ifstream cpuInfo("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(cpuInfo, line)) {
+    if (line.rfind("model name", 0) != 0)
+      continue;
+    size_t separatorPos = line.find(':');
+    if (separatorPos != std::string::npos && separatorPos + 2 <= line.size())
+      return line.substr(separatorPos + 2);
+  }
+  return "unknown";
+}
+
+JsonValue collectHostMetadata() {
+  JsonValue::Object host;
+  utsname name;
+  if (uname(&name) == 0) {
+    host["name"] = name.nodename;
+    host["os"] = std::string(name.sysname) + " " + name.release;
+    host["machine"] = name.machine;
+  }
+  host["cpu"] = getCPUModel();
+  host["cpus"] = static_cast<double>(std::thread::hardware_concurrency());
+  host["memory bytes"] = static_cast<double>(sysconf(_SC_PHYS_PAGES)) *
+                         static_cast<double>(sysconf(_SC_PAGE_SIZE));
+  return host;
+}
+
+/**
+ * @brief The constants of KeyValueTypes.h that shape the KVS, so that runs with different ones aren't mistaken for a
+ * regression.
+ *
+ */
+JsonValue collectConstants() {
+  return JsonValue::Object{
+      {"VALUE_SIZE", static_cast<double>(VALUE_SIZE)},
+      {"KEY_SIZE", static_cast<double>(KEY_SIZE)},
+      {"CACHE_MAP_SIZE", static_cast<double>(CACHE_MAP_SIZE)},
+      {"MAP_LOAD_FACTOR", MAP_LOAD_FACTOR},
+      {"MAX_OUTDATED_RECORDS_LOAD_FACTOR", MAX_OUTDATED_RECORDS_LOAD_FACTOR},
+      {"BLOOM_FILTER_FALSE_POSITIVE_RATE", BLOOM_FILTER_FALSE_POSITIVE_RATE},
+      {"COMPACTION_REWRITE_FRAGMENTATION", COMPACTION_REWRITE_FRAGMENTATION},
+      {"SHARD_EXPECTED_SIZE", static_cast<double>(SHARD_EXPECTED_SIZE)},
+      {"STORAGE_HASH_TABLE_EXPANSION_FACTOR",
+       STORAGE_HASH_TABLE_EXPANSION_FACTOR},
+      {"STORAGE_HASH_TABLE_LOAD_FACTOR", STORAGE_HASH_TABLE_LOAD_FACTOR},
+      {"STORAGE_HASH_TABLE_INITIAL_SIZE",
+       static_cast<double>(STORAGE_HASH_TABLE_INITIAL_SIZE)},
+      {"STORAGE_HASH_TABLE_MAX_SIZE",
+       static_cast<double>(STORAGE_HASH_TABLE_MAX_SIZE)},
+      {"SHARD_MAX_KEYS_CNT", static_cast<double>(SHARD_MAX_KEYS_CNT)},
+      {"SHARD_MERGE_LOAD_FACTOR", SHARD_MERGE_LOAD_FACTOR},
+      {"INITIAL_SHARD_DEPTH", static_cast<double>(INITIAL_SHARD_DEPTH)},
+      {"MAX_SHARD_DEPTH", static_cast<double>(MAX_SHARD_DEPTH)}};
+}
+
+double getMean(const std::vector<double>& values) noexcept {
+  double sum = 0;
+  for (double value : values) sum += value;
+  return values.empty() ? 0 : sum / values.size();
+}
+
+std::vector<std::pair<double, uint64_t>>
+getSample(const std::vector<double>& values) {
+  std::vector<std::pair<double, uint64_t>> sample;
+  for (double value : values) sample.emplace_back(value, 1);
+  return sample;
+}
+
+/**
+ * @brief The latencies of a histogram as a sample: every value is taken as the lower bound of its bucket, so values
+ * of the same bucket tie.
+ *
+ */
+std::vector<std::pair<double, uint64_t>>
+getSample(const LatencyHistogram& histogram) {
+  std::vector<std::pair<double, uint64_t>> sample;
+  for (const LatencyHistogram::Bucket& bucket : histogram.getBuckets())
+    sample.emplace_back(bucket.lower, bucket.count);
+  return sample;
+}
+
+const BenchmarkResult* findResult(const std::vector<BenchmarkResult>& results,
+                                  const std::string& name) noexcept {
+  for (const BenchmarkResult& result : results) {
+    if (result.name == name)
+      return &result;
+  }
+  return nullptr;
+}
+
+const LatencyHistogram* findLatencies(const BenchmarkResult& result,
+                                      const std::string& operation) noexcept {
+  for (const auto& [name, histogram] : result.latencies) {
+    if (name == operation)
+      return &histogram;
+  }
+  return nullptr;
+}
+
+} // namespace
+
+BenchmarkReport::BenchmarkReport(const std::string& command) {
+  metadata = JsonValue::Object{{"git revision", KVS_GIT_REVISION},
+                               {"compiler", __VERSION__},
+                               {"build type", KVS_BUILD_TYPE},
+                               {"compile flags", KVS_CXX_FLAGS},
+                               {"command", command},
+                               {"timestamp", getTimestamp()},
+                               {"host", collectHostMetadata()},
+                               {"constants", collectConstants()}};
+}
+
+BenchmarkReport BenchmarkReport::load(const std::string& filePath) {
+  std::ifstream file(filePath);
+  if (!file)
+    throw std::invalid_argument("can't read report: " + filePath);
+  std::stringstream text;
+  text << file.rdbuf();
+  JsonValue json = JsonValue::parse(text.str());
+
+  BenchmarkReport report;
+  report.metadata = json["metadata"];
+  for (const JsonValue& benchmark : json["benchmarks"].getArray()) {
+    BenchmarkResult result;
+    result.name = benchmark["name"].getString();
+    for (const JsonValue& throughput : benchmark["throughputs"].getArray())
+      result.throughputs.push_back(throughput.getNumber());
+    for (const auto& [operation, latencies] :
+         benchmark["latencies"].getObject()) {
+      LatencyHistogram histogram;
+      for (const JsonValue& bucket : latencies["buckets"].getArray()) {
+        // [lower, upper, count]
+        const JsonValue::Array& bounds = bucket.getArray();
+        if (bounds.size() != 3)
+          throw std::invalid_argument("invalid histogram bucket in report: " +
+                                      filePath);
+        histogram.record(bounds[0].getNumber(), bounds[2].getNumber());
+      }
+      result.latencies.emplace_back(operation, histogram);
+    }
+    if (benchmark.contains("counters")) {
+      for (const auto& [event, count] : benchmark["counters"].getObject())
+        result.perfCountsPerOperation.emplace_back(event, count.getNumber());
+    }
+    if (benchmark.contains("metrics")) {
+      for (const auto& [name, value] : benchmark["metrics"].getObject())
+        result.extraMetrics.emplace_back(name, value.getNumber());
+    }
+    report.results.push_back(std::move(result));
+  }
+  return report;
+}
+
+void BenchmarkReport::addResult(BenchmarkResult result) {
+  results.push_back(std::move(result));
+}
+
+const JsonValue& BenchmarkReport::getMetadata() const noexcept {
+  return metadata;
+}
+
+const std::vector<BenchmarkResult>&
+BenchmarkReport::getResults() const noexcept {
+  return results;
+}
+
+void BenchmarkReport::printJSON(std::ostream& outs) const {
+  std::ios_base::fmtflags flags = outs.flags();
+  std::streamsize precision = outs.precision(15);
+  outs << "{\"metadata\": ";
+  metadata.print(outs);
+  outs << ",\n\"benchmarks\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchmarkResult& result = results[i];
+    outs << (i == 0 ? "\n" : ",\n") << "{\"name\": ";
+    printJSONString(outs, result.name);
+    outs << ", \"throughputs\": [";
+    for (size_t j = 0; j < result.throughputs.size(); ++j)
+      outs << (j == 0 ? "" : ", ") << result.throughputs[j];
+    outs << "], \"latencies\": {";
+    for (size_t j = 0; j < result.latencies.size(); ++j) {
+      outs << (j == 0 ? "" : ", ");
+      printJSONString(outs, result.latencies[j].first);
+      outs << ": ";
+      result.latencies[j].second.printJSON(outs);
+    }
+    outs << "}, \"counters\": {";
+    for (size_t j = 0; j < result.perfCountsPerOperation.size(); ++j) {
+      outs << (j == 0 ? "" : ", ");
+      printJSONString(outs, result.perfCountsPerOperation[j].first);
+      outs << ": " << result.perfCountsPerOperation[j].second;
+    }
+    outs << "}, \"metrics\": {";
+    for (size_t j = 0; j < result.extraMetrics.size(); ++j) {
+      outs << (j == 0 ? "" : ", ");
+      printJSONString(outs, result.extraMetrics[j].first);
+      outs << ": " << result.extraMetrics[j].second;
+    }
+    outs << "}}";
+  }
+  outs << "\n]}\n";
+  outs.precision(precision);
+  outs.flags(flags);
+}
+
+void BenchmarkReport::save(const std::string& filePath) const {
+  std::ofstream file(filePath);
+  file.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+  printJSON(file);
+}
+
+double MetricComparison::getRelativeChange() const noexcept {
+  return baseline == 0 ? 0 : current / baseline - 1;
+}
+
+std::vector<MetricComparison> compareReports(const BenchmarkReport& baseline,
+                                             const BenchmarkReport& current,
+                                             const ComparisonConfig& config) {
+  std::vector<MetricComparison> comparisons;
+  for (const BenchmarkResult& result : current.getResults()) {
+    const BenchmarkResult* baselineResult =
+        findResult(baseline.getResults(), result.name);
+    if (baselineResult == nullptr)
+      continue;
+
+    auto compare = [&](const std::string& metric, double baselineValue,
+                       double currentValue, double pValue, bool isTested,
+                       bool isLowerBetter) {
+      MetricComparison comparison{result.name,  metric,   baselineValue,
+                                  currentValue, pValue,   isTested,
+                                  false};
+      double change = comparison.getRelativeChange();
+      comparison.isRegression =
+          (!isTested || pValue < config.significanceLevel) &&
+          (isLowerBetter ? change > config.threshold
+                         : change < -config.threshold);
+      comparisons.push_back(comparison);
+    };
+    auto canReachSignificance = [&config](uint64_t baselineCnt, uint64_t currentCnt) {
+      return getMinMannWhitneyPValue(baselineCnt, currentCnt) <
+             config.significanceLevel;
+    };
+
+    if (!result.throughputs.empty() && !baselineResult->throughputs.empty())
+      compare("throughput", getMean(baselineResult->throughputs),
+              getMean(result.throughputs),
+              getMannWhitneyPValue(getSample(baselineResult->throughputs),
+                                   getSample(result.throughputs)),
+              canReachSignificance(baselineResult->throughputs.size(),
+                                   result.throughputs.size()),
+              false);
+
+    for (const auto& [operation, histogram] : result.latencies) {
+      const LatencyHistogram* baselineHistogram =
+          findLatencies(*baselineResult, operation);
+      if (baselineHistogram == nullptr || histogram.getCount() == 0 ||
+          baselineHistogram->getCount() == 0)
+        continue;
+      double pValue = getMannWhitneyPValue(getSample(*baselineHistogram),
+                                           getSample(histogram));
+      bool areLatenciesTested = canReachSignificance(
+          baselineHistogram->getCount(), histogram.getCount());
+      compare(operation + " mean", baselineHistogram->getMean(),
+              histogram.getMean(), pValue, areLatenciesTested, true);
+      compare(operation + " p50", baselineHistogram->getPercentile(50),
+              histogram.getPercentile(50), pValue, areLatenciesTested, true);
+      compare(operation + " p99", baselineHistogram->getPercentile(99),
+              histogram.getPercentile(99), pValue, areLatenciesTested, true);
+    }
+  }
+  return comparisons;
+}
+
+void printComparison(std::ostream& outs,
+                     const std::vector<MetricComparison>& comparisons) {
+  outs << "benchmark,metric,baseline,current,relative change,p-value,"
+          "regression\n";
+  for (const MetricComparison& comparison : comparisons) {
+    outs << comparison.benchmark << "," << comparison.metric << ","
+         << comparison.baseline << "," << comparison.current << ","
+         << comparison.getRelativeChange() << ",";
+    if (comparison.isTested)
+      outs << comparison.pValue;
+    else
+      outs << "-";
+    outs << "," << (comparison.isRegression ? "yes" : "no") << "\n";
+  }
+}
+
+double getMannWhitneyPValue(
+    const std::vector<std::pair<double, uint64_t>>& first,
+    const std::vector<std::pair<double, uint64_t>>& second) {
+  // every value with the number of times it occurs in the first and in the second sample
+  std::vector<std::pair<double, std::pair<uint64_t, uint64_t>>> values;
+  double firstCnt = 0;
+  double secondCnt = 0;
+  for (const auto& [value, count] : first) {
+    values.push_back({value, {count, 0}});
+    firstCnt += count;
+  }
+  for (const auto& [value, count] : second) {
+    values.push_back({value, {0, count}});
+    secondCnt += count;
+  }
+  if (firstCnt < 2 || secondCnt < 2)
+    return 1;
+  std::sort(values.begin(), values.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  // tied values share the mean of the ranks they span
+  double firstRanksSum = 0;
+  double tiesCorrection = 0;
+  double precedingCnt = 0;
+  for (size_t i = 0; i < values.size();) {
+    double tiedFirstCnt = 0;
+    double tiedCnt = 0;
+    size_t j = i;
+    for (; j < values.size() && values[j].first == values[i].first; ++j) {
+      tiedFirstCnt += values[j].second.first;
+      tiedCnt += values[j].second.first + values[j].second.second;
+    }
+    firstRanksSum += tiedFirstCnt * (precedingCnt + (tiedCnt + 1) / 2);
+    tiesCorrection += tiedCnt * tiedCnt * tiedCnt - tiedCnt;
+    precedingCnt += tiedCnt;
+    i = j;
+  }
+
+  double u = firstRanksSum - firstCnt * (firstCnt + 1) / 2;
+  double totalCnt = firstCnt + secondCnt;
+  double variance = firstCnt * secondCnt / 12 *
+                    (totalCnt + 1 - tiesCorrection / (totalCnt * (totalCnt - 1)));
+  if (variance <= 0)
+    return 1;
+  // with the continuity correction
+  double z = std::max(0.0, std::abs(u - firstCnt * secondCnt / 2) - 0.5) /
+             std::sqrt(variance);
+  return std::erfc(z / std::sqrt(2.0));
+}
+
+double getMinMannWhitneyPValue(uint64_t firstCnt, uint64_t secondCnt) noexcept {
+  if (firstCnt < 2 || secondCnt < 2)
+    return 1;
+  // U is 0 and there are no ties
+  double uDeviation = static_cast<double>(firstCnt) * secondCnt / 2;
+  double variance = uDeviation / 6 * (firstCnt + secondCnt + 1);
+  double z = (uDeviation - 0.5) / std::sqrt(variance);
+  return std::erfc(z / std::sqrt(2.0));
+}
+
+size_t getMinSampleSize(double significanceLevel) noexcept {
+  // beyond that, the significance level is too small to be meant
+  constexpr size_t MAX_SAMPLE_SIZE = 1000;
+  size_t sampleSize = 2;
+  while (sampleSize < MAX_SAMPLE_SIZE &&
+         getMinMannWhitneyPValue(sampleSize, sampleSize) >= significanceLevel)
+    ++sampleSize;
+  return sampleSize;
+}
+
+} // namespace benchmark
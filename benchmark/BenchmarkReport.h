@@ -0,0 +1,188 @@
+#pragma once
+
+#include "Json.h"
+#include "LatencyHistogram.h"
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace benchmark {
+
+/**
+ * @brief What one benchmark measured.
+ *
+ */
+struct BenchmarkResult final {
+  std::string name;
+
+  /**
+   * @brief Operations per second of every repetition, the samples throughput is compared by. Empty if the benchmark
+   * doesn't measure throughput.
+   *
+   */
+  std::vector<double> throughputs;
+
+  /**
+   * @brief The latencies of every operation by its name, in the order they are reported.
+   *
+   */
+  std::vector<std::pair<std::string, LatencyHistogram>> latencies;
+
+  /**
+   * @brief The hardware and software events per operation by their names, see PerfCounts::getPerOperation(). Empty
+   * if they weren't counted.
+   *
+   */
+  std::vector<std::pair<std::string, double>> perfCountsPerOperation;
+
+  /**
+   * @brief Other figures of the benchmark by their names, e.g. the bytes rebuilt per operation. Reported, but not
+   * compared with a baseline.
+   *
+   */
+  std::vector<std::pair<std::string, double>> extraMetrics;
+};
+
+/**
+ * @brief The results of a benchmark run along with everything needed to tell whether two runs are comparable: the
+ * revision and flags the benchmark was built with, the constants of the KVS, the host and the command line.
+ *
+ */
+class BenchmarkReport final {
+public:
+  /**
+   * @brief Start a report of the current run, collecting its metadata.
+   *
+   */
+  explicit BenchmarkReport(const std::string& command);
+
+  /**
+   * @brief Load a report saved by save().
+   *
+   * The histograms are restored from their buckets, so their means, minimums and maximums are rounded to the bucket
+   * precision.
+   *
+   * @throws std::invalid_argument if the file can't be read or isn't a report.
+   */
+  static BenchmarkReport load(const std::string& filePath);
+
+  void addResult(BenchmarkResult result);
+
+  const JsonValue& getMetadata() const noexcept;
+  const std::vector<BenchmarkResult>& getResults() const noexcept;
+
+  /**
+   * @brief Print {"metadata": {...}, "benchmarks": [{"name", "throughputs", "latencies": {operation: histogram},
+   * "counters": {event: count per operation}, "metrics": {name: value}}]}.
+   *
+   */
+  void printJSON(std::ostream& outs) const;
+
+  void save(const std::string& filePath) const;
+
+private:
+  BenchmarkReport() = default;
+
+  JsonValue metadata;
+  std::vector<BenchmarkResult> results;
+};
+
+/**
+ * @brief When a difference between two runs is reported as a regression.
+ *
+ */
+struct ComparisonConfig final {
+  /**
+   * @brief The largest p-value of the Mann-Whitney test at which the difference is taken as real ("alpha").
+   *
+   */
+  double significanceLevel = 0.01;
+
+  /**
+   * @brief The smallest relative change that matters ("threshold"). With the hundreds of thousands of latencies of a
+   * run, even a negligible difference is significant, so the test alone would flag every run.
+   *
+   */
+  double threshold = 0.05;
+};
+
+/**
+ * @brief A metric of a benchmark in both runs.
+ *
+ */
+struct MetricComparison final {
+  std::string benchmark;
+  std::string metric;
+  double baseline;
+  double current;
+
+  /**
+   * @brief The two-sided p-value of the Mann-Whitney test of the samples the metric is taken from. 1 if there are too
+   * few of them to tell.
+   *
+   */
+  double pValue;
+
+  /**
+   * @brief Whether the samples are large enough for the test to reach the significance level at all, see
+   * getMinMannWhitneyPValue(). If not, the metric is compared by the threshold alone.
+   *
+   */
+  bool isTested;
+
+  bool isRegression;
+
+  double getRelativeChange() const noexcept;
+};
+
+/**
+ * @brief Compare every metric of the benchmarks present in both reports.
+ *
+ * Throughput is compared by the mean of the repetitions, latencies by the mean, p50 and p99 of every operation, and a
+ * metric regresses if it got worse by more than the threshold while the samples differ significantly. Samples too small
+ * to ever differ significantly, like a single throughput, are compared by the threshold alone.
+ *
+ */
+std::vector<MetricComparison> compareReports(const BenchmarkReport& baseline,
+                                             const BenchmarkReport& current,
+                                             const ComparisonConfig& config);
+
+/**
+ * @brief Print a "benchmark,metric,baseline,current,relative change,p-value,regression" table. The p-value of a metric
+ * compared by the threshold alone is "-".
+ *
+ */
+void printComparison(std::ostream& outs,
+                     const std::vector<MetricComparison>& comparisons);
+
+/**
+ * @brief Get the two-sided p-value of the Mann-Whitney U test of whether the values of one sample tend to be larger than
+ * those of the other.
+ *
+ * Uses the normal approximation with the correction for ties, which is close enough from about 8 values per sample.
+ *
+ * @param first,second The samples as values with the number of times each occurs, in any order.
+ * @return 1 if either sample has less than 2 values.
+ */
+double getMannWhitneyPValue(
+    const std::vector<std::pair<double, uint64_t>>& first,
+    const std::vector<std::pair<double, uint64_t>>& second);
+
+/**
+ * @brief Get the smallest p-value getMannWhitneyPValue() returns for samples of the given sizes, the one of samples
+ * that don't overlap. 1 if either sample has less than 2 values.
+ *
+ */
+double getMinMannWhitneyPValue(uint64_t firstCnt, uint64_t secondCnt) noexcept;
+
+/**
+ * @brief Get the smallest number of values per sample at which the Mann-Whitney test can reach the significance level,
+ * e.g. 6 at 0.01.
+ *
+ */
+size_t getMinSampleSize(double significanceLevel) noexcept;
+
+} // namespace benchmark
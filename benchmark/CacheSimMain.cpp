@@ -0,0 +1,87 @@
+#include "CacheSimulator.h"
+#include "KVSException.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace benchmark {
+
+/**
+ * @brief The simulated capacities: the default capacity of the KVS and maxCapacity halved pointsCnt - 1 times.
+ *
+ */
+std::vector<uint64_t> getCapacities(uint64_t maxCapacity, size_t pointsCnt) {
+  std::vector<uint64_t> capacities{
+      static_cast<uint64_t>(CACHE_MAP_SIZE / MAP_LOAD_FACTOR)};
+  for (size_t i = 0; i < pointsCnt && (maxCapacity >> i) > 0; ++i)
+    capacities.push_back(maxCapacity >> i);
+  std::sort(capacities.begin(), capacities.end());
+  capacities.erase(std::unique(capacities.begin(), capacities.end()),
+                   capacities.end());
+  return capacities;
+}
+
+void printResultsCSV(std::ostream& outs,
+                     const std::vector<SimulationResult>& results) {
+  outs << "policy,capacity,memory budget,hits,negative hits,misses,miss "
+          "ratio,pushes\n";
+  for (const SimulationResult& result : results) {
+    outs << DISPLACEMENT_POLICY_NAMES[static_cast<size_t>(result.policy)]
+         << "," << result.capacity << "," << result.getMemoryBudget() << ","
+         << result.hitsCnt << "," << result.negativeHitsCnt << ","
+         << result.missesCnt << "," << result.getMissRatio() << ","
+         << result.pushesCnt << "\n";
+  }
+}
+
+} // namespace benchmark
+
+/**
+ * @brief "cachesim <trace file> [sampling rate] [points] [max capacity]" simulates the CacheMap on the keys of a trace
+ * recorded by KVS::startTrace() with every displacement policy at several capacities, and prints the miss ratio curves
+ * as CSV.
+ *
+ * The sampling rate defaults to 0.01; 1 simulates every Key exactly. The max capacity defaults to the estimated number
+ * of distinct keys, beyond which only the first accesses to every Key miss.
+ *
+ */
+int main(int argc, char* argv[]) {
+  if (argc < 2 || argc > 5) {
+    std::cerr << "usage: " << argv[0]
+              << " <trace file> [sampling rate] [points] [max capacity]\n";
+    return 1;
+  }
+  try {
+    double samplingRate = argc > 2 ? std::stod(argv[2]) : 0.01;
+    size_t pointsCnt = argc > 3 ? std::stoul(argv[3]) : 12;
+    kvs::trace::TraceReader reader{argv[1]};
+    benchmark::SampledTrace trace{reader, samplingRate};
+    uint64_t maxCapacity =
+        argc > 4 ? std::stoull(argv[4])
+                 : static_cast<uint64_t>(trace.getSampledKeysCnt() /
+                                         trace.getSamplingRate());
+    std::cerr << "records: " << trace.getRecordsCnt()
+              << ", sampled accesses: " << trace.getAccesses().size()
+              << ", sampled keys: " << trace.getSampledKeysCnt() << "\n";
+
+    std::vector<benchmark::SimulationResult> results;
+    for (size_t i = 0; i < benchmark::DISPLACEMENT_POLICIES_CNT; ++i) {
+      for (uint64_t capacity :
+           benchmark::getCapacities(maxCapacity, pointsCnt)) {
+        results.push_back(benchmark::simulate(
+            trace, static_cast<benchmark::DisplacementPolicy>(i), capacity));
+      }
+    }
+    benchmark::printResultsCSV(std::cout, results);
+  } catch (const kvs::KVSException& exc) {
+    std::cerr << exc.what() << "\n";
+    return 1;
+  } catch (const std::invalid_argument& exc) {
+    std::cerr << "invalid argument: " << exc.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,266 @@
+#include "CacheSimulator.h"
+#include "CacheMap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <list>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace benchmark {
+
+using kvs::trace::TraceOperation;
+
+namespace {
+
+/**
+ * @brief Sampling compares the upper 24 bits of the traced hash. The CacheMap takes its slots from the other half of
+ * the hash, so the sample is unbiased with respect to them.
+ *
+ */
+constexpr unsigned SAMPLING_SHIFT = 40;
+constexpr uint64_t SAMPLING_MODULUS = uint64_t(1) << (64 - SAMPLING_SHIFT);
+
+/**
+ * @brief Tracks the order in which a policy displaces the keys of the simulated map.
+ *
+ */
+class Displacer {
+public:
+  virtual ~Displacer() = default;
+  virtual void insert(hash_t keyHash) = 0;
+  virtual void touch(hash_t keyHash) = 0;
+
+  /**
+   * @brief Choose a Key to displace and forget it.
+   *
+   */
+  virtual hash_t displace() = 0;
+};
+
+class RandomDisplacer final : public Displacer {
+public:
+  void insert(hash_t keyHash) override {
+    positions[keyHash] = keys.size();
+    keys.push_back(keyHash);
+  }
+
+  void touch(hash_t) override {}
+
+  hash_t displace() override {
+    size_t position =
+        std::uniform_int_distribution<size_t>(0, keys.size() - 1)(gen);
+    hash_t keyHash = keys[position];
+    keys[position] = keys.back();
+    positions[keys[position]] = position;
+    keys.pop_back();
+    positions.erase(keyHash);
+    return keyHash;
+  }
+
+private:
+  std::vector<hash_t> keys;
+  std::unordered_map<hash_t, size_t> positions;
+  // fixed, so that runs are comparable
+  std::minstd_rand gen{0};
+};
+
+/**
+ * @brief LRU or, if touches are ignored, FIFO.
+ *
+ */
+class ListDisplacer final : public Displacer {
+public:
+  explicit ListDisplacer(bool lru) : lru(lru) {}
+
+  void insert(hash_t keyHash) override {
+    keys.push_front(keyHash);
+    positions[keyHash] = keys.begin();
+  }
+
+  void touch(hash_t keyHash) override {
+    if (lru)
+      keys.splice(keys.begin(), keys, positions[keyHash]);
+  }
+
+  hash_t displace() override {
+    hash_t keyHash = keys.back();
+    keys.pop_back();
+    positions.erase(keyHash);
+    return keyHash;
+  }
+
+private:
+  const bool lru;
+  std::list<hash_t> keys;
+  std::unordered_map<hash_t, std::list<hash_t>::iterator> positions;
+};
+
+/**
+ * @brief Second chance: the hand skips and clears referenced keys.
+ *
+ */
+class ClockDisplacer final : public Displacer {
+public:
+  void insert(hash_t keyHash) override {
+    size_t position;
+    if (freePositions.empty()) {
+      position = keys.size();
+      keys.push_back(keyHash);
+      referenced.push_back(false);
+    } else {
+      position = freePositions.back();
+      freePositions.pop_back();
+      keys[position] = keyHash;
+      referenced[position] = false;
+    }
+    positions[keyHash] = position;
+  }
+
+  void touch(hash_t keyHash) override { referenced[positions[keyHash]] = true; }
+
+  hash_t displace() override {
+    while (true) {
+      if (hand >= keys.size())
+        hand = 0;
+      auto it = positions.find(keys[hand]);
+      if (it != positions.end() && it->second == hand) {
+        if (!referenced[hand])
+          break;
+        referenced[hand] = false;
+      }
+      hand++;
+    }
+    hash_t keyHash = keys[hand];
+    positions.erase(keyHash);
+    freePositions.push_back(hand);
+    hand++;
+    return keyHash;
+  }
+
+private:
+  std::vector<hash_t> keys;
+  std::vector<bool> referenced;
+  std::vector<size_t> freePositions;
+  std::unordered_map<hash_t, size_t> positions;
+  size_t hand = 0;
+};
+
+std::unique_ptr<Displacer> createDisplacer(DisplacementPolicy policy) {
+  switch (policy) {
+  case DisplacementPolicy::RANDOM:
+    return std::make_unique<RandomDisplacer>();
+  case DisplacementPolicy::FIFO:
+    return std::make_unique<ListDisplacer>(false);
+  case DisplacementPolicy::LRU:
+    return std::make_unique<ListDisplacer>(true);
+  case DisplacementPolicy::CLOCK:
+    return std::make_unique<ClockDisplacer>();
+  }
+  return nullptr;
+}
+
+} // namespace
+
+SampledTrace::SampledTrace(kvs::trace::TraceReader& reader,
+                           double samplingRate)
+    : samplingRate(std::clamp(samplingRate, 1.0 / SAMPLING_MODULUS, 1.0)),
+      recordsCnt(0), sampledKeysCnt(0) {
+  uint64_t threshold =
+      static_cast<uint64_t>(std::ceil(this->samplingRate * SAMPLING_MODULUS));
+  std::unordered_set<hash_t> sampledKeys;
+  while (std::optional<kvs::trace::TraceRecord> record = reader.next()) {
+    recordsCnt++;
+    if ((record->keyHash >> SAMPLING_SHIFT) >= threshold)
+      continue;
+    accesses.push_back(CacheAccess{record->keyHash, record->operation});
+    sampledKeys.insert(record->keyHash);
+  }
+  sampledKeysCnt = sampledKeys.size();
+}
+
+const std::vector<CacheAccess>& SampledTrace::getAccesses() const noexcept {
+  return accesses;
+}
+
+double SampledTrace::getSamplingRate() const noexcept { return samplingRate; }
+
+uint64_t SampledTrace::getRecordsCnt() const noexcept { return recordsCnt; }
+
+uint64_t SampledTrace::getSampledKeysCnt() const noexcept {
+  return sampledKeysCnt;
+}
+
+double SimulationResult::getMissRatio() const noexcept {
+  double accessesCnt = hitsCnt + negativeHitsCnt + missesCnt;
+  return accessesCnt == 0 ? 0 : missesCnt / accessesCnt;
+}
+
+size_t SimulationResult::getMemoryBudget() const noexcept {
+  return static_cast<size_t>(std::ceil(capacity * MAP_LOAD_FACTOR)) *
+         kvs::cache_map::CacheMap::SLOT_MEMORY_SIZE;
+}
+
+SimulationResult simulate(const SampledTrace& trace, DisplacementPolicy policy,
+                          uint64_t capacity) {
+  double samplingRate = trace.getSamplingRate();
+  uint64_t sampledCapacity = std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::llround(capacity * samplingRate)));
+  std::unique_ptr<Displacer> displacer = createDisplacer(policy);
+  std::unordered_map<hash_t, PtrType> entries;
+  std::unordered_set<hash_t> existingKeys;
+  uint64_t hitsCnt = 0;
+  uint64_t negativeHitsCnt = 0;
+  uint64_t missesCnt = 0;
+  uint64_t pushesCnt = 0;
+
+  for (const CacheAccess& access : trace.getAccesses()) {
+    auto it = entries.find(access.keyHash);
+    if (it != entries.end()) {
+      if (it->second == PtrType::PRESENT)
+        hitsCnt++;
+      else
+        negativeHitsCnt++;
+      displacer->touch(access.keyHash);
+      if (access.operation == TraceOperation::ADD)
+        it->second = PtrType::PRESENT;
+      else if (access.operation == TraceOperation::REMOVE &&
+               it->second == PtrType::PRESENT)
+        it->second = PtrType::DELETED;
+    } else {
+      missesCnt++;
+      PtrType type = PtrType::NONEXISTENT;
+      if (access.operation == TraceOperation::ADD ||
+          (access.operation == TraceOperation::GET &&
+           existingKeys.count(access.keyHash) != 0))
+        type = PtrType::PRESENT;
+      // like CacheMap::putOrDisplace(), which displaces before a new Key would exceed the capacity
+      if (entries.size() >= sampledCapacity) {
+        auto displaced = entries.find(displacer->displace());
+        if (displaced->second == PtrType::DELETED)
+          pushesCnt++;
+        entries.erase(displaced);
+      }
+      entries.emplace(access.keyHash, type);
+      displacer->insert(access.keyHash);
+    }
+
+    if (access.operation == TraceOperation::ADD)
+      existingKeys.insert(access.keyHash);
+    else if (access.operation == TraceOperation::REMOVE)
+      existingKeys.erase(access.keyHash);
+  }
+
+  SimulationResult result;
+  result.policy = policy;
+  result.capacity = capacity;
+  result.hitsCnt = hitsCnt / samplingRate;
+  result.negativeHitsCnt = negativeHitsCnt / samplingRate;
+  result.missesCnt = missesCnt / samplingRate;
+  result.pushesCnt = pushesCnt / samplingRate;
+  return result;
+}
+
+} // namespace benchmark
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "KeyValueTypes.h"
+#include "Trace.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace benchmark {
+
+using namespace kvs::utils;
+
+/**
+ * @brief How the simulated CacheMap chooses the Entry to displace once it is full. RANDOM is what CacheMap does.
+ *
+ */
+enum class DisplacementPolicy : uint8_t { RANDOM, FIFO, LRU, CLOCK };
+
+constexpr size_t DISPLACEMENT_POLICIES_CNT = 4;
+constexpr const char* DISPLACEMENT_POLICY_NAMES[DISPLACEMENT_POLICIES_CNT] = {
+    "random", "fifo", "lru", "clock"};
+
+/**
+ * @brief A traced operation on a sampled Key.
+ *
+ */
+struct CacheAccess final {
+  hash_t keyHash;
+  kvs::trace::TraceOperation operation;
+};
+
+/**
+ * @brief The accesses of a trace to a spatially sampled subset of its keys, as in SHARDS: a Key is sampled if its hash
+ * falls below samplingRate of the hash space, so either all accesses to a Key are kept or none.
+ *
+ * A cache of capacity * samplingRate entries fed with the sampled accesses behaves like a cache of the full capacity
+ * fed with the whole trace, with the counts scaled down by samplingRate.
+ *
+ */
+class SampledTrace final {
+public:
+  SampledTrace(kvs::trace::TraceReader& reader, double samplingRate);
+
+  const std::vector<CacheAccess>& getAccesses() const noexcept;
+  double getSamplingRate() const noexcept;
+
+  /**
+   * @brief The number of records of the whole trace.
+   *
+   */
+  uint64_t getRecordsCnt() const noexcept;
+
+  /**
+   * @brief The number of distinct sampled keys.
+   *
+   */
+  uint64_t getSampledKeysCnt() const noexcept;
+
+private:
+  std::vector<CacheAccess> accesses;
+  double samplingRate;
+  uint64_t recordsCnt;
+  uint64_t sampledKeysCnt;
+};
+
+/**
+ * @brief What a simulated CacheMap did, scaled up to the whole trace.
+ *
+ */
+struct SimulationResult final {
+  DisplacementPolicy policy = DisplacementPolicy::RANDOM;
+
+  /**
+   * @brief The number of entries the CacheMap holds before it starts displacing, see CacheMap::getCapacity().
+   *
+   */
+  uint64_t capacity = 0;
+
+  /**
+   * @brief Accesses that found a PRESENT Entry.
+   *
+   */
+  double hitsCnt = 0;
+
+  /**
+   * @brief Accesses that found a DELETED or NONEXISTENT Entry.
+   *
+   */
+  double negativeHitsCnt = 0;
+
+  /**
+   * @brief Accesses that found nothing and went to the shard.
+   *
+   */
+  double missesCnt = 0;
+
+  /**
+   * @brief Displaced DELETED entries, every one of which the KVS pushes to its shard with an index read and write.
+   *
+   */
+  double pushesCnt = 0;
+
+  double getMissRatio() const noexcept;
+
+  /**
+   * @brief The memory budget of a KVS whose CacheMap has the capacity.
+   *
+   */
+  size_t getMemoryBudget() const noexcept;
+};
+
+/**
+ * @brief Replay the sampled accesses against a model of the CacheMap of the given capacity.
+ *
+ * Every operation leaves its Key in the map like the KVS does: add() as PRESENT, remove() turns PRESENT into DELETED
+ * and a missing Key into NONEXISTENT, get() of a missing Key puts PRESENT or NONEXISTENT. A missing Key is taken to
+ * exist if it was added and not removed since, so keys that existed before the trace started are taken as nonexistent,
+ * which only shifts hits to negative hits. The map isn't split into stripes.
+ *
+ */
+SimulationResult simulate(const SampledTrace& trace, DisplacementPolicy policy,
+                          uint64_t capacity);
+
+} // namespace benchmark
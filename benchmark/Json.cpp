@@ -0,0 +1,304 @@
+#include "Json.h"
+
+#include <cctype>
+#include <cstdio>
+#include <stdexcept>
+
+namespace benchmark {
+
+namespace {
+
+/**
+ * @brief A recursive descent parser over the whole text of a document.
+ *
+ */
+class Parser final {
+public:
+  explicit Parser(const std::string& text) : text(text) {}
+
+  JsonValue parseDocument() {
+    JsonValue value = parseValue();
+    skipWhitespace();
+    if (pos != text.size())
+      fail("trailing characters");
+    return value;
+  }
+
+private:
+  [[noreturn]] void fail(const std::string& what) const {
+    throw std::invalid_argument("invalid JSON at " + std::to_string(pos) +
+                                ": " + what);
+  }
+
+  void skipWhitespace() noexcept {
+    while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos])))
+      ++pos;
+  }
+
+  bool consume(char c) {
+    skipWhitespace();
+    if (pos < text.size() && text[pos] == c) {
+      ++pos;
+      return true;
+    }
+    return false;
+  }
+
+  void expect(char c) {
+    if (!consume(c))
+      fail(std::string("expected '") + c + "'");
+  }
+
+  bool consumeLiteral(const char* literal) {
+    std::string str = literal;
+    if (text.compare(pos, str.size(), str) != 0)
+      return false;
+    pos += str.size();
+    return true;
+  }
+
+  JsonValue parseValue() {
+    skipWhitespace();
+    if (pos == text.size())
+      fail("unexpected end");
+    char c = text[pos];
+    if (c == '{')
+      return parseObject();
+    if (c == '[')
+      return parseArray();
+    if (c == '"')
+      return parseString();
+    if (consumeLiteral("true"))
+      return JsonValue(true);
+    if (consumeLiteral("false"))
+      return JsonValue(false);
+    if (consumeLiteral("null"))
+      return JsonValue();
+    return parseNumber();
+  }
+
+  JsonValue parseObject() {
+    expect('{');
+    JsonValue::Object object;
+    if (consume('}'))
+      return object;
+    do {
+      skipWhitespace();
+      std::string name = parseString();
+      expect(':');
+      object[name] = parseValue();
+    } while (consume(','));
+    expect('}');
+    return object;
+  }
+
+  JsonValue parseArray() {
+    expect('[');
+    JsonValue::Array array;
+    if (consume(']'))
+      return array;
+    do {
+      array.push_back(parseValue());
+    } while (consume(','));
+    expect(']');
+    return array;
+  }
+
+  std::string parseString() {
+    if (pos == text.size() || text[pos] != '"')
+      fail("expected a string");
+    ++pos;
+    std::string str;
+    while (pos < text.size() && text[pos] != '"') {
+      char c = text[pos++];
+      if (c != '\\') {
+        str += c;
+        continue;
+      }
+      if (pos == text.size())
+        break;
+      char escaped = text[pos++];
+      switch (escaped) {
+      case 'b':
+        str += '\b';
+        break;
+      case 'f':
+        str += '\f';
+        break;
+      case 'n':
+        str += '\n';
+        break;
+      case 'r':
+        str += '\r';
+        break;
+      case 't':
+        str += '\t';
+        break;
+      case 'u': {
+        if (pos + 4 > text.size())
+          fail("truncated escape");
+        unsigned long codePoint = std::stoul(text.substr(pos, 4), nullptr, 16);
+        pos += 4;
+        // only what printJSONString() writes, i.e. control characters, is expected here
+        str += codePoint < 0x80 ? static_cast<char>(codePoint) : '?';
+        break;
+      }
+      default:
+        str += escaped;
+      }
+    }
+    if (pos == text.size())
+      fail("unterminated string");
+    ++pos;
+    return str;
+  }
+
+  JsonValue parseNumber() {
+    size_t begin = pos;
+    while (pos < text.size() &&
+           (std::isdigit(static_cast<unsigned char>(text[pos])) ||
+            text[pos] == '-' || text[pos] == '+' || text[pos] == '.' ||
+            text[pos] == 'e' || text[pos] == 'E'))
+      ++pos;
+    if (begin == pos)
+      fail("unexpected character");
+    try {
+      return JsonValue(std::stod(text.substr(begin, pos - begin)));
+    } catch (const std::exception& exc) {
+      pos = begin;
+      fail("invalid number");
+    }
+  }
+
+  const std::string& text;
+  size_t pos = 0;
+};
+
+} // namespace
+
+JsonValue::JsonValue(bool value) noexcept : value(value) {}
+
+JsonValue::JsonValue(double value) noexcept : value(value) {}
+
+JsonValue::JsonValue(const char* value) : value(std::string(value)) {}
+
+JsonValue::JsonValue(std::string value) noexcept : value(std::move(value)) {}
+
+JsonValue::JsonValue(Array value) noexcept : value(std::move(value)) {}
+
+JsonValue::JsonValue(Object value) noexcept : value(std::move(value)) {}
+
+JsonValue JsonValue::parse(const std::string& text) {
+  return Parser(text).parseDocument();
+}
+
+bool JsonValue::isNull() const noexcept {
+  return std::holds_alternative<std::nullptr_t>(value);
+}
+
+bool JsonValue::isNumber() const noexcept {
+  return std::holds_alternative<double>(value);
+}
+
+bool JsonValue::isString() const noexcept {
+  return std::holds_alternative<std::string>(value);
+}
+
+bool JsonValue::isArray() const noexcept {
+  return std::holds_alternative<Array>(value);
+}
+
+bool JsonValue::isObject() const noexcept {
+  return std::holds_alternative<Object>(value);
+}
+
+bool JsonValue::getBool() const {
+  if (!std::holds_alternative<bool>(value))
+    throw std::invalid_argument("JSON value isn't a boolean");
+  return std::get<bool>(value);
+}
+
+double JsonValue::getNumber() const {
+  if (!isNumber())
+    throw std::invalid_argument("JSON value isn't a number");
+  return std::get<double>(value);
+}
+
+const std::string& JsonValue::getString() const {
+  if (!isString())
+    throw std::invalid_argument("JSON value isn't a string");
+  return std::get<std::string>(value);
+}
+
+const JsonValue::Array& JsonValue::getArray() const {
+  if (!isArray())
+    throw std::invalid_argument("JSON value isn't an array");
+  return std::get<Array>(value);
+}
+
+const JsonValue::Object& JsonValue::getObject() const {
+  if (!isObject())
+    throw std::invalid_argument("JSON value isn't an object");
+  return std::get<Object>(value);
+}
+
+bool JsonValue::contains(const std::string& name) const noexcept {
+  return isObject() && std::get<Object>(value).count(name) != 0;
+}
+
+const JsonValue& JsonValue::operator[](const std::string& name) const {
+  const Object& object = getObject();
+  auto it = object.find(name);
+  if (it == object.end())
+    throw std::invalid_argument("JSON object has no member " + name);
+  return it->second;
+}
+
+void JsonValue::print(std::ostream& outs) const {
+  if (isNull()) {
+    outs << "null";
+  } else if (std::holds_alternative<bool>(value)) {
+    outs << (std::get<bool>(value) ? "true" : "false");
+  } else if (isNumber()) {
+    outs << std::get<double>(value);
+  } else if (isString()) {
+    printJSONString(outs, std::get<std::string>(value));
+  } else if (isArray()) {
+    outs << "[";
+    const Array& array = std::get<Array>(value);
+    for (size_t i = 0; i < array.size(); ++i) {
+      outs << (i == 0 ? "" : ", ");
+      array[i].print(outs);
+    }
+    outs << "]";
+  } else {
+    outs << "{";
+    bool isFirst = true;
+    for (const auto& [name, member] : std::get<Object>(value)) {
+      outs << (isFirst ? "" : ", ");
+      printJSONString(outs, name);
+      outs << ": ";
+      member.print(outs);
+      isFirst = false;
+    }
+    outs << "}";
+  }
+}
+
+void printJSONString(std::ostream& outs, const std::string& str) {
+  outs << '"';
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      outs << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[7];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      outs << escaped;
+    } else {
+      outs << c;
+    }
+  }
+  outs << '"';
+}
+
+} // namespace benchmark
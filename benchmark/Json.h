@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace benchmark {
+
+/**
+ * @brief A JSON value, just enough to build benchmark metadata and to read back stored results.
+ *
+ * Numbers are doubles, which holds every count a benchmark reports exactly up to 2^53.
+ *
+ */
+class JsonValue final {
+public:
+  using Array = std::vector<JsonValue>;
+  using Object = std::map<std::string, JsonValue>;
+
+  JsonValue() noexcept = default;
+  JsonValue(bool value) noexcept;
+  JsonValue(double value) noexcept;
+  JsonValue(const char* value);
+  JsonValue(std::string value) noexcept;
+  JsonValue(Array value) noexcept;
+  JsonValue(Object value) noexcept;
+
+  /**
+   * @brief Parse a whole document.
+   *
+   * @throws std::invalid_argument if it isn't valid JSON.
+   */
+  static JsonValue parse(const std::string& text);
+
+  bool isNull() const noexcept;
+  bool isNumber() const noexcept;
+  bool isString() const noexcept;
+  bool isArray() const noexcept;
+  bool isObject() const noexcept;
+
+  /**
+   * @brief Getters of the value as the given type.
+   *
+   * @throws std::invalid_argument if the value is of another type.
+   */
+  bool getBool() const;
+  double getNumber() const;
+  const std::string& getString() const;
+  const Array& getArray() const;
+  const Object& getObject() const;
+
+  bool contains(const std::string& name) const noexcept;
+
+  /**
+   * @brief Get a member of an object.
+   *
+   * @throws std::invalid_argument if the value isn't an object or has no such member.
+   */
+  const JsonValue& operator[](const std::string& name) const;
+
+  void print(std::ostream& outs) const;
+
+private:
+  std::variant<std::nullptr_t, bool, double, std::string, Array, Object>
+      value = nullptr;
+};
+
+/**
+ * @brief Print a string as a JSON string literal, escaping what has to be.
+ *
+ */
+void printJSONString(std::ostream& outs, const std::string& str);
+
+} // namespace benchmark
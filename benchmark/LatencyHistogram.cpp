@@ -0,0 +1,125 @@
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace benchmark {
+
+namespace {
+
+constexpr uint64_t SUB_BUCKETS_CNT = uint64_t{1}
+                                     << LatencyHistogram::SUB_BUCKET_BITS;
+constexpr uint64_t HALF_SUB_BUCKETS_CNT = SUB_BUCKETS_CNT / 2;
+
+// exact buckets below SUB_BUCKETS_CNT, then HALF_SUB_BUCKETS_CNT buckets per power of two up to 2^64
+constexpr size_t BUCKETS_CNT =
+    SUB_BUCKETS_CNT + (64 - LatencyHistogram::SUB_BUCKET_BITS) *
+                          HALF_SUB_BUCKETS_CNT;
+
+} // namespace
+
+LatencyHistogram::LatencyHistogram() : counts(BUCKETS_CNT, 0) {}
+
+size_t LatencyHistogram::getBucketIndex(uint64_t nanos) noexcept {
+  if (nanos < SUB_BUCKETS_CNT)
+    return nanos;
+  uint8_t msb = 63 - __builtin_clzll(nanos);
+  // the shifted value keeps SUB_BUCKET_BITS - 1 bits below its top bit
+  uint8_t shift = msb - (SUB_BUCKET_BITS - 1);
+  return SUB_BUCKETS_CNT + (shift - 1) * HALF_SUB_BUCKETS_CNT +
+         ((nanos >> shift) - HALF_SUB_BUCKETS_CNT);
+}
+
+uint64_t LatencyHistogram::getBucketLowerBound(size_t bucketIndex) noexcept {
+  if (bucketIndex < SUB_BUCKETS_CNT)
+    return bucketIndex;
+  size_t i = bucketIndex - SUB_BUCKETS_CNT;
+  uint8_t shift = i / HALF_SUB_BUCKETS_CNT + 1;
+  return (i % HALF_SUB_BUCKETS_CNT + HALF_SUB_BUCKETS_CNT) << shift;
+}
+
+uint64_t LatencyHistogram::getBucketUpperBound(size_t bucketIndex) noexcept {
+  if (bucketIndex + 1 == BUCKETS_CNT)
+    return UINT64_MAX;
+  return getBucketLowerBound(bucketIndex + 1) - 1;
+}
+
+void LatencyHistogram::record(uint64_t nanos) noexcept { record(nanos, 1); }
+
+void LatencyHistogram::record(uint64_t nanos, uint64_t count) noexcept {
+  if (count == 0)
+    return;
+  counts[getBucketIndex(nanos)] += count;
+  this->count += count;
+  sum += nanos * count;
+  min = std::min(min, nanos);
+  max = std::max(max, nanos);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) noexcept {
+  for (size_t i = 0; i < BUCKETS_CNT; i++) counts[i] += other.counts[i];
+  count += other.count;
+  sum += other.sum;
+  min = std::min(min, other.min);
+  max = std::max(max, other.max);
+}
+
+uint64_t LatencyHistogram::getCount() const noexcept { return count; }
+
+uint64_t LatencyHistogram::getMin() const noexcept {
+  return count == 0 ? 0 : min;
+}
+
+uint64_t LatencyHistogram::getMax() const noexcept { return max; }
+
+double LatencyHistogram::getMean() const noexcept {
+  return count == 0 ? 0 : static_cast<double>(sum) / count;
+}
+
+uint64_t LatencyHistogram::getPercentile(double percentile) const noexcept {
+  if (count == 0)
+    return 0;
+  uint64_t rank = std::max<uint64_t>(
+      1, std::ceil(std::clamp(percentile, 0.0, 100.0) / 100 * count));
+  uint64_t seenCnt = 0;
+  for (size_t i = 0; i < BUCKETS_CNT; i++) {
+    seenCnt += counts[i];
+    if (seenCnt >= rank)
+      return std::clamp(getBucketUpperBound(i), getMin(), max);
+  }
+  return max;
+}
+
+std::vector<LatencyHistogram::Bucket> LatencyHistogram::getBuckets() const {
+  std::vector<Bucket> buckets;
+  for (size_t i = 0; i < BUCKETS_CNT; i++) {
+    if (counts[i] != 0)
+      buckets.push_back(
+          {getBucketLowerBound(i), getBucketUpperBound(i), counts[i]});
+  }
+  return buckets;
+}
+
+void LatencyHistogram::printCSV(std::ostream& outs) const {
+  outs << "lower ns,upper ns,count\n";
+  for (const Bucket& bucket : getBuckets())
+    outs << bucket.lower << "," << bucket.upper << "," << bucket.count << "\n";
+}
+
+void LatencyHistogram::printJSON(std::ostream& outs) const {
+  outs << "{\"count\": " << count << ", \"min\": " << getMin()
+       << ", \"mean\": " << getMean() << ", \"p50\": " << getPercentile(50)
+       << ", \"p90\": " << getPercentile(90)
+       << ", \"p99\": " << getPercentile(99)
+       << ", \"p99.9\": " << getPercentile(99.9) << ", \"max\": " << max
+       << ", \"buckets\": [";
+  bool isFirst = true;
+  for (const Bucket& bucket : getBuckets()) {
+    outs << (isFirst ? "" : ", ") << "[" << bucket.lower << ", "
+         << bucket.upper << ", " << bucket.count << "]";
+    isFirst = false;
+  }
+  outs << "]}";
+}
+
+} // namespace benchmark
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace benchmark {
+
+/**
+ * @brief A histogram of latencies in nanoseconds with log-bucketed precision, in the manner of HdrHistogram.
+ *
+ * Values below 2^SUB_BUCKET_BITS are counted exactly. Above that, every power of two is split into
+ * 2^(SUB_BUCKET_BITS - 1) equal buckets, so a recorded value is off by less than 2^-(SUB_BUCKET_BITS - 1) of itself,
+ * whatever its magnitude. Recording is a constant-time increment, so it doesn't distort the measured latencies.
+ *
+ * Not thread-safe: every thread records into its own histogram, merge() adds them up afterwards.
+ *
+ */
+class LatencyHistogram final {
+public:
+  static constexpr uint8_t SUB_BUCKET_BITS = 8;
+
+  /**
+   * @brief The values from lower to upper, both inclusive, and how many of them were recorded.
+   *
+   */
+  struct Bucket final {
+    uint64_t lower;
+    uint64_t upper;
+    uint64_t count;
+  };
+
+  LatencyHistogram();
+
+  void record(uint64_t nanos) noexcept;
+
+  /**
+   * @brief Record the same value count times, e.g. to restore a histogram from its buckets.
+   *
+   */
+  void record(uint64_t nanos, uint64_t count) noexcept;
+
+  /**
+   * @brief Add all values recorded by the other histogram.
+   *
+   */
+  void merge(const LatencyHistogram& other) noexcept;
+
+  uint64_t getCount() const noexcept;
+  uint64_t getMin() const noexcept;
+  uint64_t getMax() const noexcept;
+  double getMean() const noexcept;
+
+  /**
+   * @brief Get the value below or at which the given percentage of recorded values lie.
+   *
+   * @param percentile In [0, 100].
+   * @return The upper bound of the bucket the percentile falls into, but not above the maximum. 0 if nothing was recorded.
+   */
+  uint64_t getPercentile(double percentile) const noexcept;
+
+  /**
+   * @brief Get the non-empty buckets in increasing order.
+   *
+   */
+  std::vector<Bucket> getBuckets() const;
+
+  /**
+   * @brief Print "bucket lower bound,bucket upper bound,count" lines of the non-empty buckets, with a header.
+   *
+   */
+  void printCSV(std::ostream& outs) const;
+
+  /**
+   * @brief Print the summary and the non-empty buckets as a JSON object.
+   *
+   */
+  void printJSON(std::ostream& outs) const;
+
+private:
+  static size_t getBucketIndex(uint64_t nanos) noexcept;
+
+  /**
+   * @brief Get the smallest value counted by the bucket. The bucket ends right before the next one begins.
+   *
+   */
+  static uint64_t getBucketLowerBound(size_t bucketIndex) noexcept;
+  static uint64_t getBucketUpperBound(size_t bucketIndex) noexcept;
+
+  std::vector<uint64_t> counts;
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  uint64_t min = UINT64_MAX;
+  uint64_t max = 0;
+};
+
+} // namespace benchmark
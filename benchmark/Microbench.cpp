@@ -0,0 +1,136 @@
+#include "Microbench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+
+namespace benchmark {
+
+double MicrobenchResult::getMean() const noexcept {
+  if (nanosPerOperation.empty())
+    return 0;
+  return std::accumulate(nanosPerOperation.begin(), nanosPerOperation.end(),
+                         0.0) /
+         nanosPerOperation.size();
+}
+
+double MicrobenchResult::getStdDev() const noexcept {
+  if (nanosPerOperation.size() < 2)
+    return 0;
+  double mean = getMean();
+  double sum = 0;
+  for (double nanos : nanosPerOperation) sum += (nanos - mean) * (nanos - mean);
+  return std::sqrt(sum / (nanosPerOperation.size() - 1));
+}
+
+double MicrobenchResult::getMin() const noexcept {
+  if (nanosPerOperation.empty())
+    return 0;
+  return *std::min_element(nanosPerOperation.begin(), nanosPerOperation.end());
+}
+
+double MicrobenchResult::getMedian() const {
+  if (nanosPerOperation.empty())
+    return 0;
+  std::vector<double> sorted = nanosPerOperation;
+  std::sort(sorted.begin(), sorted.end());
+  size_t middle = sorted.size() / 2;
+  return sorted.size() % 2 == 1 ? sorted[middle]
+                                : (sorted[middle - 1] + sorted[middle]) / 2;
+}
+
+double MicrobenchResult::getMax() const noexcept {
+  if (nanosPerOperation.empty())
+    return 0;
+  return *std::max_element(nanosPerOperation.begin(), nanosPerOperation.end());
+}
+
+MicrobenchResult runMicrobenchmark(const Microbenchmark& microbenchmark,
+                                   const MicrobenchConfig& config) {
+  MicrobenchResult result;
+  result.name = microbenchmark.name;
+  for (size_t i = 0; i < config.warmupRepetitionsCnt + config.repetitionsCnt;
+       ++i) {
+    if (microbenchmark.setUp)
+      microbenchmark.setUp();
+    if (config.perfCounters != nullptr)
+      config.perfCounters->start();
+    auto begin = std::chrono::steady_clock::now();
+    size_t operationsCnt = microbenchmark.run();
+    auto end = std::chrono::steady_clock::now();
+    PerfCounts perfCounts;
+    if (config.perfCounters != nullptr)
+      perfCounts = config.perfCounters->stop();
+    if (i < config.warmupRepetitionsCnt)
+      continue;
+    result.operationsCnt = operationsCnt;
+    result.perfCounts += perfCounts;
+    result.nanosPerOperation.push_back(
+        std::chrono::duration<double, std::nano>(end - begin).count() /
+        std::max<size_t>(1, operationsCnt));
+  }
+  return result;
+}
+
+void printMicrobenchCSV(std::ostream& outs,
+                        const std::vector<MicrobenchResult>& results) {
+  bool hasPerfCounts = std::any_of(
+      results.begin(), results.end(), [](const MicrobenchResult& result) {
+        return result.perfCounts.isAvailable();
+      });
+  outs << "benchmark,operations,repetitions,mean ns,stddev ns,relative "
+          "stddev,min ns,median ns,max ns";
+  if (hasPerfCounts) {
+    outs << ",";
+    PerfCounts::printCSVHeader(outs);
+  }
+  outs << "\n";
+  for (const MicrobenchResult& result : results) {
+    double mean = result.getMean();
+    outs << result.name << "," << result.operationsCnt << ","
+         << result.nanosPerOperation.size() << "," << mean << ","
+         << result.getStdDev() << ","
+         << (mean == 0 ? 0 : result.getStdDev() / mean) << ","
+         << result.getMin() << "," << result.getMedian() << ","
+         << result.getMax();
+    if (hasPerfCounts) {
+      outs << ",";
+      result.perfCounts.printCSV(outs, result.operationsCnt *
+                                           result.nanosPerOperation.size());
+    }
+    outs << "\n";
+  }
+}
+
+void printMicrobenchJSON(std::ostream& outs,
+                         const std::vector<MicrobenchResult>& results) {
+  outs << "[";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const MicrobenchResult& result = results[i];
+    outs << (i == 0 ? "\n" : ",\n") << "  {\"name\": \"" << result.name
+         << "\", \"operations\": " << result.operationsCnt
+         << ", \"mean\": " << result.getMean()
+         << ", \"stddev\": " << result.getStdDev()
+         << ", \"min\": " << result.getMin()
+         << ", \"median\": " << result.getMedian()
+         << ", \"max\": " << result.getMax() << ", \"repetitions\": [";
+    for (size_t j = 0; j < result.nanosPerOperation.size(); ++j)
+      outs << (j == 0 ? "" : ", ") << result.nanosPerOperation[j];
+    outs << "]";
+    if (result.perfCounts.isAvailable()) {
+      outs << ", \"counters\": {";
+      std::vector<std::pair<std::string, double>> perOperation =
+          result.perfCounts.getPerOperation(result.operationsCnt *
+                                            result.nanosPerOperation.size());
+      for (size_t j = 0; j < perOperation.size(); ++j)
+        outs << (j == 0 ? "" : ", ") << "\"" << perOperation[j].first
+             << "\": " << perOperation[j].second;
+      outs << "}";
+    }
+    outs << "}";
+  }
+  outs << "\n]\n";
+}
+
+} // namespace benchmark
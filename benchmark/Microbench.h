@@ -0,0 +1,99 @@
+#pragma once
+
+#include "PerfCounters.h"
+
+#include <cstddef>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace benchmark {
+
+/**
+ * @brief A benchmark of a single component, run repeatedly by runMicrobenchmark().
+ *
+ */
+struct Microbenchmark final {
+  std::string name;
+
+  /**
+   * @brief Prepares a repetition, e.g. fills a fresh structure. Not timed, may be empty.
+   *
+   */
+  std::function<void()> setUp;
+
+  /**
+   * @brief Runs a timed repetition.
+   *
+   * @return The number of operations it did, the results are per operation.
+   */
+  std::function<size_t()> run;
+};
+
+struct MicrobenchConfig final {
+  /**
+   * @brief Repetitions run before the measured ones to warm up caches, the branch predictor and the page cache.
+   *
+   */
+  size_t warmupRepetitionsCnt = 3;
+
+  size_t repetitionsCnt = 10;
+
+  /**
+   * @brief The counters to read around every measured repetition, none if null.
+   *
+   */
+  PerfCounters* perfCounters = nullptr;
+};
+
+/**
+ * @brief The time per operation of every measured repetition and its spread.
+ *
+ */
+struct MicrobenchResult final {
+  std::string name;
+  size_t operationsCnt = 0;
+  std::vector<double> nanosPerOperation;
+
+  /**
+   * @brief The events of all measured repetitions together.
+   *
+   */
+  PerfCounts perfCounts;
+
+  double getMean() const noexcept;
+
+  /**
+   * @brief The sample standard deviation over the repetitions.
+   *
+   */
+  double getStdDev() const noexcept;
+
+  double getMin() const noexcept;
+  double getMedian() const;
+  double getMax() const noexcept;
+};
+
+MicrobenchResult runMicrobenchmark(const Microbenchmark& microbenchmark,
+                                   const MicrobenchConfig& config);
+
+/**
+ * @brief Print the results as CSV with a header, or as a JSON array that also holds every repetition. The events per
+ * operation follow if any were counted.
+ *
+ */
+void printMicrobenchCSV(std::ostream& outs,
+                        const std::vector<MicrobenchResult>& results);
+void printMicrobenchJSON(std::ostream& outs,
+                         const std::vector<MicrobenchResult>& results);
+
+/**
+ * @brief Keep the compiler from optimizing away the computation of the value.
+ *
+ */
+template <typename T> inline void doNotOptimize(const T& value) noexcept {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+} // namespace benchmark
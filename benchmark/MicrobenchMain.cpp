@@ -0,0 +1,474 @@
+#include "BloomFilter.h"
+#include "CacheMap.h"
+#include "KVSException.h"
+#include "KeyValueTypes.h"
+#include "Microbench.h"
+#include "Shard.h"
+#include "ShardBuilder.h"
+#include "Storage.h"
+#include "StorageHashTable.h"
+
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace benchmark {
+
+using namespace kvs;
+using namespace kvs::utils;
+using kvs::bloom_filter::BloomFilter;
+using kvs::cache_map::CacheMap;
+using kvs::shard::Shard;
+using kvs::shard::ShardBuilder;
+using kvs::storage::Storage;
+using kvs::storage_hash_table::StorageHashTable;
+
+const std::string MICROBENCH_DIRECTORY_PATH = "./microbench-data/";
+
+/**
+ * @brief The number of keys every benchmark works through. Twice as many are generated, so that there are absent ones.
+ *
+ */
+constexpr size_t KEYS_CNT = 1 << 16;
+
+/**
+ * @brief CacheMap benchmarks use a map of this many slots, filled up to a share of its capacity.
+ *
+ */
+constexpr size_t CACHE_MAP_SLOTS_CNT = 1 << 16;
+constexpr size_t CACHE_MAP_PUTS_CNT = 1 << 12;
+constexpr double CACHE_MAP_FILL_LEVELS[] = {0.25, 0.5, 0.75, 1};
+
+/**
+ * @brief StorageHashTable benchmarks repeat the operation on this many tables of the size of a shard index.
+ *
+ */
+constexpr size_t TABLES_CNT = 1 << 10;
+
+/**
+ * @brief Storage benchmarks access values of a file of this many values, which stays in the page cache.
+ *
+ */
+constexpr size_t STORAGE_VALUES_CNT = 1 << 12;
+constexpr size_t STORAGE_OPERATIONS_CNT = 1 << 10;
+
+// fixed, so that repeated runs work on the same data
+std::mt19937_64 gen(0);
+
+std::vector<HashedKey> generateKeys(size_t keysCnt) {
+  std::vector<HashedKey> keys;
+  keys.reserve(keysCnt);
+  for (size_t i = 0; i < keysCnt; ++i) {
+    ByteArray bytes(KEY_SIZE);
+    for (size_t j = 0; j < KEY_SIZE; j += sizeof(uint64_t)) {
+      uint64_t word = gen();
+      std::memcpy(bytes.get() + j, &word, sizeof(uint64_t));
+    }
+    keys.emplace_back(Key{bytes});
+  }
+  return keys;
+}
+
+Value generateValue() {
+  ByteArray bytes(VALUE_SIZE);
+  for (size_t j = 0; j < VALUE_SIZE; j += sizeof(uint64_t)) {
+    uint64_t word = gen();
+    std::memcpy(bytes.get() + j, &word, sizeof(uint64_t));
+  }
+  return Value{bytes};
+}
+
+/**
+ * @brief A present Ptr to one of the values of a shard.
+ *
+ */
+Ptr getPtr(size_t i) noexcept {
+  return Ptr{i % SHARD_MAX_KEYS_CNT * VALUE_SIZE, true};
+}
+
+/**
+ * @brief The number of keys whose put() into an empty StorageHashTable expands it.
+ *
+ */
+size_t getExpandingKeysCnt() noexcept {
+  size_t keysCnt = 1;
+  while (keysCnt * MAP_LOAD_FACTOR <= STORAGE_HASH_TABLE_INITIAL_SIZE)
+    keysCnt++;
+  return keysCnt;
+}
+
+StorageHashTable createFullStorageHashTable(const std::vector<HashedKey>& keys) {
+  StorageHashTable table{STORAGE_HASH_TABLE_INITIAL_SIZE};
+  for (size_t i = 0; i < SHARD_MAX_KEYS_CNT; ++i)
+    table.put(keys[i], getPtr(i));
+  return table;
+}
+
+void addHashBenchmarks(std::vector<Microbenchmark>& benchmarks,
+                       const std::shared_ptr<std::vector<HashedKey>>& keys) {
+  benchmarks.push_back({"hashKey", nullptr, [keys]() {
+                          for (size_t i = 0; i < KEYS_CNT; ++i)
+                            doNotOptimize(hashKey((*keys)[i].getKey()));
+                          return KEYS_CNT;
+                        }});
+  benchmarks.push_back({"HashedKey", nullptr, [keys]() {
+                          for (size_t i = 0; i < KEYS_CNT; ++i) {
+                            HashedKey hashedKey{(*keys)[i].getKey()};
+                            doNotOptimize(hashedKey.getLowHash());
+                          }
+                          return KEYS_CNT;
+                        }});
+}
+
+/**
+ * @brief The filter is sized for all KEYS_CNT keys and holds half of them, so it is far larger than the caches of a
+ * shard-sized one and measures cache misses as well.
+ *
+ */
+void addBloomFilterBenchmarks(
+    std::vector<Microbenchmark>& benchmarks,
+    const std::shared_ptr<std::vector<HashedKey>>& keys) {
+  auto filter = std::make_shared<BloomFilter>(KEYS_CNT);
+  for (size_t i = 0; i < KEYS_CNT / 2; ++i) filter->add((*keys)[i]);
+  auto batch = std::make_shared<std::vector<HashedKey>>(
+      keys->begin(), keys->begin() + KEYS_CNT);
+
+  benchmarks.push_back({"BloomFilter::checkExist present", nullptr,
+                        [keys, filter]() {
+                          for (size_t i = 0; i < KEYS_CNT / 2; ++i)
+                            doNotOptimize(filter->checkExist((*keys)[i]));
+                          return KEYS_CNT / 2;
+                        }});
+  benchmarks.push_back({"BloomFilter::checkExist absent", nullptr,
+                        [keys, filter]() {
+                          for (size_t i = KEYS_CNT / 2; i < KEYS_CNT; ++i)
+                            doNotOptimize(filter->checkExist((*keys)[i]));
+                          return KEYS_CNT / 2;
+                        }});
+  benchmarks.push_back({"BloomFilter::checkExist batch", nullptr,
+                        [batch, filter]() {
+                          std::vector<bool> exist = filter->checkExist(*batch);
+                          doNotOptimize(exist.size());
+                          return batch->size();
+                        }});
+
+  auto emptyFilter = std::make_shared<std::optional<BloomFilter>>();
+  benchmarks.push_back(
+      {"BloomFilter::add", [emptyFilter]() { emptyFilter->emplace(KEYS_CNT); },
+       [keys, emptyFilter]() {
+         for (size_t i = 0; i < KEYS_CNT; ++i)
+           emptyFilter->value().add((*keys)[i]);
+         return KEYS_CNT;
+       }});
+}
+
+void addCacheMapBenchmarks(
+    std::vector<Microbenchmark>& benchmarks,
+    const std::shared_ptr<std::vector<HashedKey>>& keys) {
+  for (double fillLevel : CACHE_MAP_FILL_LEVELS) {
+    std::string suffix =
+        " fill=" + std::to_string(static_cast<int>(fillLevel * 100)) + "%";
+    auto fill = [keys, fillLevel](CacheMap& cacheMap) {
+      size_t keysCnt = cacheMap.getCapacity() * fillLevel;
+      for (size_t i = 0; i < keysCnt; ++i)
+        cacheMap.putOrDisplace((*keys)[i], getPtr(i));
+      return keysCnt;
+    };
+
+    // the map is filled once, lookups don't change it
+    auto filledMap = std::make_shared<CacheMap>(CACHE_MAP_SLOTS_CNT);
+    size_t filledKeysCnt = fill(*filledMap);
+    benchmarks.push_back({"CacheMap::get hit" + suffix, nullptr,
+                          [keys, filledMap, filledKeysCnt]() {
+                            for (size_t i = 0; i < KEYS_CNT; ++i)
+                              doNotOptimize(filledMap->get(
+                                  (*keys)[i % filledKeysCnt]));
+                            return KEYS_CNT;
+                          }});
+    benchmarks.push_back({"CacheMap::get miss" + suffix, nullptr,
+                          [keys, filledMap]() {
+                            for (size_t i = KEYS_CNT; i < 2 * KEYS_CNT; ++i)
+                              doNotOptimize(filledMap->get((*keys)[i]));
+                            return KEYS_CNT;
+                          }});
+
+    auto map = std::make_shared<std::optional<CacheMap>>();
+    benchmarks.push_back({"CacheMap::putOrDisplace" + suffix,
+                          [map, fill]() {
+                            map->emplace(CACHE_MAP_SLOTS_CNT);
+                            fill(map->value());
+                          },
+                          [keys, map]() {
+                            for (size_t i = KEYS_CNT;
+                                 i < KEYS_CNT + CACHE_MAP_PUTS_CNT; ++i)
+                              doNotOptimize(map->value().putOrDisplace(
+                                  (*keys)[i], getPtr(i)));
+                            return CACHE_MAP_PUTS_CNT;
+                          }});
+  }
+}
+
+void addStorageHashTableBenchmarks(
+    std::vector<Microbenchmark>& benchmarks,
+    const std::shared_ptr<std::vector<HashedKey>>& keys) {
+  auto fullTable =
+      std::make_shared<StorageHashTable>(createFullStorageHashTable(*keys));
+  auto serialized =
+      std::make_shared<ByteArray>(fullTable->serializeToByteArray());
+
+  benchmarks.push_back(
+      {"StorageHashTable construct", nullptr, []() {
+         for (size_t i = 0; i < TABLES_CNT; ++i) {
+           StorageHashTable table{STORAGE_HASH_TABLE_INITIAL_SIZE};
+           doNotOptimize(table.getUsedSize());
+         }
+         return TABLES_CNT;
+       }});
+  benchmarks.push_back({"StorageHashTable deserialize", nullptr,
+                        [serialized]() {
+                          for (size_t i = 0; i < TABLES_CNT; ++i) {
+                            StorageHashTable table{*serialized};
+                            doNotOptimize(table.getUsedSize());
+                          }
+                          return TABLES_CNT;
+                        }});
+  benchmarks.push_back({"StorageHashTable serialize", nullptr, [fullTable]() {
+                          for (size_t i = 0; i < TABLES_CNT; ++i) {
+                            ByteArray bytes = fullTable->serializeToByteArray();
+                            doNotOptimize(bytes.get());
+                          }
+                          return TABLES_CNT;
+                        }});
+  benchmarks.push_back({"StorageHashTable get", nullptr, [keys, fullTable]() {
+                          for (size_t i = 0; i < TABLES_CNT; ++i) {
+                            for (size_t j = 0; j < SHARD_MAX_KEYS_CNT; ++j)
+                              doNotOptimize(fullTable->get((*keys)[j]));
+                          }
+                          return TABLES_CNT * SHARD_MAX_KEYS_CNT;
+                        }});
+
+  // puts right below the expansion, then the expanding put alone
+  size_t expandingKeysCnt = getExpandingKeysCnt();
+  auto tables = std::make_shared<std::vector<StorageHashTable>>();
+  auto createTables = [tables](size_t keysCnt,
+                               const std::vector<HashedKey>& keys) {
+    tables->assign(TABLES_CNT,
+                   StorageHashTable{STORAGE_HASH_TABLE_INITIAL_SIZE});
+    for (StorageHashTable& table : *tables) {
+      for (size_t j = 0; j < keysCnt; ++j)
+        table.put(keys[j], getPtr(j));
+    }
+  };
+  benchmarks.push_back(
+      {"StorageHashTable put", [keys, createTables]() { createTables(0, *keys); },
+       [keys, tables, expandingKeysCnt]() {
+         for (StorageHashTable& table : *tables) {
+           for (size_t j = 0; j < expandingKeysCnt - 1; ++j)
+             table.put((*keys)[j], getPtr(j));
+         }
+         return TABLES_CNT * (expandingKeysCnt - 1);
+       }});
+  benchmarks.push_back(
+      {"StorageHashTable expand",
+       [keys, createTables, expandingKeysCnt]() {
+         createTables(expandingKeysCnt - 1, *keys);
+       },
+       [keys, tables, expandingKeysCnt]() {
+         size_t j = expandingKeysCnt - 1;
+         for (StorageHashTable& table : *tables)
+           table.put((*keys)[j], getPtr(j));
+         return TABLES_CNT;
+       }});
+}
+
+void addStorageBenchmarks(std::vector<Microbenchmark>& benchmarks,
+                          const std::shared_ptr<std::vector<HashedKey>>& keys) {
+  const std::string valuesFilePath = MICROBENCH_DIRECTORY_PATH + "values";
+  const std::string appendFilePath = MICROBENCH_DIRECTORY_PATH + "append";
+  const std::string indexFilePath = MICROBENCH_DIRECTORY_PATH + "index";
+  auto value = std::make_shared<Value>(generateValue());
+  {
+    ByteArray values(STORAGE_VALUES_CNT * VALUE_SIZE);
+    for (size_t i = 0; i < STORAGE_VALUES_CNT; ++i)
+      std::memcpy(values.get() + i * VALUE_SIZE, value->getBytes().get(),
+                  VALUE_SIZE);
+    storage::writeFile(valuesFilePath, values);
+  }
+  auto index = std::make_shared<ByteArray>(
+      createFullStorageHashTable(*keys).serializeToByteArray());
+  storage::writeFile(indexFilePath, *index);
+  auto offsets = std::make_shared<std::vector<size_t>>();
+  for (size_t i = 0; i < STORAGE_OPERATIONS_CNT; ++i)
+    offsets->push_back(gen() % STORAGE_VALUES_CNT * VALUE_SIZE);
+
+  auto valuesFile = std::make_shared<Storage>(valuesFilePath);
+  benchmarks.push_back({"Storage::read", nullptr, [valuesFile, offsets]() {
+                          for (size_t offset : *offsets) {
+                            ByteArray bytes =
+                                valuesFile->read(offset, VALUE_SIZE);
+                            doNotOptimize(bytes.get());
+                          }
+                          return offsets->size();
+                        }});
+  benchmarks.push_back({"Storage::write", nullptr,
+                        [valuesFile, offsets, value]() {
+                          for (size_t offset : *offsets)
+                            valuesFile->write(offset, value->getBytes());
+                          return offsets->size();
+                        }});
+
+  auto appendFile = std::make_shared<std::optional<Storage>>();
+  benchmarks.push_back({"Storage::append",
+                        [appendFile, appendFilePath]() {
+                          appendFile->reset();
+                          storage::writeFile(appendFilePath, ByteArray(0));
+                          appendFile->emplace(appendFilePath);
+                        },
+                        [appendFile, value]() {
+                          for (size_t i = 0; i < STORAGE_OPERATIONS_CNT; ++i)
+                            appendFile->value().append(value->getBytes());
+                          return STORAGE_OPERATIONS_CNT;
+                        }});
+
+  benchmarks.push_back({"storage::readFile index", nullptr, [indexFilePath]() {
+                          for (size_t i = 0; i < STORAGE_OPERATIONS_CNT; ++i) {
+                            ByteArray bytes = storage::readFile(indexFilePath);
+                            doNotOptimize(bytes.get());
+                          }
+                          return STORAGE_OPERATIONS_CNT;
+                        }});
+  benchmarks.push_back({"storage::writeFile index", nullptr,
+                        [indexFilePath, index]() {
+                          for (size_t i = 0; i < STORAGE_OPERATIONS_CNT; ++i)
+                            storage::writeFile(indexFilePath, *index);
+                          return STORAGE_OPERATIONS_CNT;
+                        }});
+}
+
+/**
+ * @brief A full shard with removed values until it needs a rebuild, rebuilt once per repetition in either mode.
+ *
+ */
+void addShardBuilderBenchmarks(
+    std::vector<Microbenchmark>& benchmarks,
+    const std::shared_ptr<std::vector<HashedKey>>& keys) {
+  constexpr shard_index_t shardIndex = 0;
+  auto value = std::make_shared<Value>(generateValue());
+  auto counters = std::make_shared<shard::ShardCounters>();
+  auto shard = std::make_shared<std::optional<Shard>>();
+  for (bool punchHoles : {false, true}) {
+    benchmarks.push_back(
+        {std::string("ShardBuilder::rebuildShard ") +
+             (punchHoles ? "punch holes" : "rewrite"),
+         [keys, value, counters, shard, punchHoles]() {
+           ShardBuilder::rewriteFragmentation = punchHoles ? 1 : 0;
+           ShardBuilder::removeShard(shardIndex);
+           shard->emplace(ShardBuilder::createShard(shardIndex, *counters));
+           for (size_t i = 0; i < SHARD_MAX_KEYS_CNT; ++i)
+             shard->value().writeValue(shardIndex, (*keys)[i], *value);
+           for (size_t i = 0; !shard->value().isRebuildRequired(shardIndex);
+                ++i)
+             shard->value().removeEntry(shardIndex, (*keys)[i]);
+         },
+         [shard]() {
+           auto rebuilt = ShardBuilder::rebuildShard(
+               shard->value(), shardIndex,
+               [](const HashedKey&) { return Ptr{PtrType::EMPTY_PTR}; });
+           doNotOptimize(rebuilt.second.data());
+           return size_t{1};
+         }});
+  }
+}
+
+std::vector<Microbenchmark> createMicrobenchmarks() {
+  auto keys = std::make_shared<std::vector<HashedKey>>(generateKeys(2 * KEYS_CNT));
+  std::vector<Microbenchmark> benchmarks;
+  addHashBenchmarks(benchmarks, keys);
+  addBloomFilterBenchmarks(benchmarks, keys);
+  addCacheMapBenchmarks(benchmarks, keys);
+  addStorageHashTableBenchmarks(benchmarks, keys);
+  addStorageBenchmarks(benchmarks, keys);
+  addShardBuilderBenchmarks(benchmarks, keys);
+  return benchmarks;
+}
+
+} // namespace benchmark
+
+/**
+ * @brief "microbench [filter=<substring>] [repetitions=N] [warmup=N] [format=csv|json] [perfcounters=0|1]" runs the
+ * benchmarks of single components whose names contain the filter and prints the time per operation of every one, with
+ * its spread over the repetitions, and the hardware events per operation if asked to.
+ *
+ */
+int main(int argc, char* argv[]) {
+  std::string filter;
+  std::string format = "csv";
+  bool collectPerfCounters = false;
+  benchmark::MicrobenchConfig config;
+  try {
+    for (int i = 1; i < argc; ++i) {
+      std::string property = argv[i];
+      size_t separatorPos = property.find('=');
+      if (separatorPos == std::string::npos)
+        throw std::invalid_argument("expected property=value: " + property);
+      std::string name = property.substr(0, separatorPos);
+      std::string value = property.substr(separatorPos + 1);
+      if (name == "filter")
+        filter = value;
+      else if (name == "repetitions")
+        config.repetitionsCnt = std::max<size_t>(1, std::stoul(value));
+      else if (name == "warmup")
+        config.warmupRepetitionsCnt = std::stoul(value);
+      else if (name == "format" && (value == "csv" || value == "json"))
+        format = value;
+      else if (name == "perfcounters")
+        collectPerfCounters = std::stoul(value) != 0;
+      else
+        throw std::invalid_argument("unknown property: " + property);
+    }
+  } catch (const std::exception& exc) {
+    std::cerr << exc.what() << "\n";
+    return 1;
+  }
+
+  std::optional<benchmark::PerfCounters> perfCounters;
+  if (collectPerfCounters) {
+    perfCounters.emplace();
+    if (!perfCounters->getUnavailableReason().empty())
+      std::cerr << "some counters are unavailable ("
+                << perfCounters->getUnavailableReason() << ")\n";
+    if (perfCounters->isAvailable())
+      config.perfCounters = &perfCounters.value();
+  }
+
+  std::filesystem::create_directories(benchmark::MICROBENCH_DIRECTORY_PATH);
+  kvs::shard::Shard::storageDirectoryPath =
+      benchmark::MICROBENCH_DIRECTORY_PATH;
+  std::vector<benchmark::MicrobenchResult> results;
+  try {
+    for (const benchmark::Microbenchmark& microbenchmark :
+         benchmark::createMicrobenchmarks()) {
+      if (microbenchmark.name.find(filter) == std::string::npos)
+        continue;
+      std::cerr << microbenchmark.name << "\n";
+      results.push_back(benchmark::runMicrobenchmark(microbenchmark, config));
+    }
+  } catch (const kvs::KVSException& exc) {
+    std::cerr << exc.what() << "\n";
+    std::filesystem::remove_all(benchmark::MICROBENCH_DIRECTORY_PATH);
+    return 1;
+  }
+  std::filesystem::remove_all(benchmark::MICROBENCH_DIRECTORY_PATH);
+
+  if (format == "json")
+    benchmark::printMicrobenchJSON(std::cout, results);
+  else
+    benchmark::printMicrobenchCSV(std::cout, results);
+  return 0;
+}
@@ -0,0 +1,177 @@
+#include "PerfCounters.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace benchmark {
+
+namespace {
+
+struct EventConfig final {
+  uint32_t type;
+  uint64_t config;
+};
+
+// indexed by PerfEvent
+constexpr EventConfig EVENT_CONFIGS[PERF_EVENTS_CNT] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS}};
+
+int openEvent(const EventConfig& eventConfig, bool excludeKernel) noexcept {
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = eventConfig.type;
+  attr.config = eventConfig.config;
+  attr.disabled = 1;
+  // the client and background threads of the KVS are counted too
+  attr.inherit = 1;
+  attr.exclude_kernel = excludeKernel;
+  attr.exclude_hv = 1;
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+} // namespace
+
+PerfCounts& PerfCounts::operator+=(const PerfCounts& other) noexcept {
+  for (size_t i = 0; i < PERF_EVENTS_CNT; ++i) {
+    if (counts[i].has_value() && other.counts[i].has_value())
+      counts[i] = counts[i].value() + other.counts[i].value();
+    else if (!counts[i].has_value())
+      counts[i] = other.counts[i];
+  }
+  return *this;
+}
+
+bool PerfCounts::isAvailable() const noexcept {
+  for (const std::optional<double>& count : counts) {
+    if (count.has_value())
+      return true;
+  }
+  return false;
+}
+
+std::optional<double> PerfCounts::getInstructionsPerCycle() const noexcept {
+  const std::optional<double>& cycles =
+      counts[static_cast<size_t>(PerfEvent::CYCLES)];
+  const std::optional<double>& instructions =
+      counts[static_cast<size_t>(PerfEvent::INSTRUCTIONS)];
+  if (!cycles.has_value() || !instructions.has_value() || cycles.value() == 0)
+    return std::nullopt;
+  return instructions.value() / cycles.value();
+}
+
+std::vector<std::pair<std::string, double>>
+PerfCounts::getPerOperation(uint64_t operationsCnt) const {
+  std::vector<std::pair<std::string, double>> perOperation;
+  double divisor = std::max<uint64_t>(1, operationsCnt);
+  for (size_t i = 0; i < PERF_EVENTS_CNT; ++i) {
+    if (counts[i].has_value())
+      perOperation.emplace_back(PERF_EVENT_NAMES[i], counts[i].value() / divisor);
+  }
+  if (std::optional<double> ipc = getInstructionsPerCycle(); ipc.has_value())
+    perOperation.emplace_back("IPC", ipc.value());
+  return perOperation;
+}
+
+void PerfCounts::printCSVHeader(std::ostream& outs) {
+  for (const char* name : PERF_EVENT_NAMES) outs << name << ",";
+  outs << "IPC";
+}
+
+void PerfCounts::printCSV(std::ostream& outs, uint64_t operationsCnt) const {
+  double divisor = std::max<uint64_t>(1, operationsCnt);
+  for (const std::optional<double>& count : counts) {
+    if (count.has_value())
+      outs << count.value() / divisor << ",";
+    else
+      outs << "n/a,";
+  }
+  std::optional<double> ipc = getInstructionsPerCycle();
+  if (ipc.has_value())
+    outs << ipc.value();
+  else
+    outs << "n/a";
+}
+
+PerfCounters::PerfCounters() noexcept {
+  // whether kernel events are off limits is only learned from the first try
+  bool excludeKernel = false;
+  for (size_t i = 0; i < PERF_EVENTS_CNT; ++i) {
+    fds[i] = openEvent(EVENT_CONFIGS[i], excludeKernel);
+    if (fds[i] < 0 && (errno == EACCES || errno == EPERM) && !excludeKernel) {
+      excludeKernel = true;
+      fds[i] = openEvent(EVENT_CONFIGS[i], excludeKernel);
+    }
+    if (fds[i] < 0) {
+      unavailableReason += std::string(unavailableReason.empty() ? "" : ", ") +
+                           PERF_EVENT_NAMES[i] + ": " + std::strerror(errno);
+    }
+  }
+  if (excludeKernel && isAvailable())
+    unavailableReason += std::string(unavailableReason.empty() ? "" : ", ") +
+                         "kernel: counting user space only";
+}
+
+PerfCounters::~PerfCounters() {
+  for (int fd : fds) {
+    if (fd >= 0)
+      close(fd);
+  }
+}
+
+bool PerfCounters::isAvailable() const noexcept {
+  for (int fd : fds) {
+    if (fd >= 0)
+      return true;
+  }
+  return false;
+}
+
+const std::string& PerfCounters::getUnavailableReason() const noexcept {
+  return unavailableReason;
+}
+
+void PerfCounters::start() noexcept {
+  for (int fd : fds) {
+    if (fd < 0)
+      continue;
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+PerfCounts PerfCounters::stop() noexcept {
+  PerfCounts perfCounts;
+  for (size_t i = 0; i < PERF_EVENTS_CNT; ++i) {
+    if (fds[i] < 0)
+      continue;
+    ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    // the value, the time enabled and the time running
+    uint64_t values[3];
+    if (read(fds[i], values, sizeof(values)) != sizeof(values))
+      continue;
+    // the counter was only scheduled for a part of the time if the kernel multiplexed it
+    perfCounts.counts[i] = values[2] == 0 ? 0
+                                          : static_cast<double>(values[0]) *
+                                                values[1] / values[2];
+  }
+  return perfCounts;
+}
+
+} // namespace benchmark
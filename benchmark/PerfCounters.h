@@ -0,0 +1,121 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace benchmark {
+
+enum class PerfEvent {
+  CYCLES,
+  INSTRUCTIONS,
+  L1D_MISSES,
+  LLC_MISSES,
+  BRANCH_MISSES,
+  CONTEXT_SWITCHES,
+  PAGE_FAULTS
+};
+constexpr size_t PERF_EVENTS_CNT = 7;
+// indexed by PerfEvent
+constexpr const char* PERF_EVENT_NAMES[PERF_EVENTS_CNT] = {
+    "cycles",        "instructions",     "L1D misses", "LLC misses",
+    "branch misses", "context switches", "page faults"};
+
+/**
+ * @brief The counts of the events over a measured span of time.
+ *
+ */
+struct PerfCounts final {
+  /**
+   * @brief The counts indexed by PerfEvent, empty for the events that can't be counted. Scaled up if the kernel had to
+   * multiplex the counters, so they are estimates then.
+   *
+   */
+  std::array<std::optional<double>, PERF_EVENTS_CNT> counts;
+
+  PerfCounts& operator+=(const PerfCounts& other) noexcept;
+
+  /**
+   * @brief Whether any event was counted.
+   *
+   */
+  bool isAvailable() const noexcept;
+
+  std::optional<double> getInstructionsPerCycle() const noexcept;
+
+  /**
+   * @brief Get the counts divided by the number of operations, with the instructions per cycle, by their names.
+   * Events that weren't counted are left out.
+   *
+   */
+  std::vector<std::pair<std::string, double>>
+  getPerOperation(uint64_t operationsCnt) const;
+
+  /**
+   * @brief Print the header of printCSV(): the names of the events, then "IPC", separated by commas.
+   *
+   */
+  static void printCSVHeader(std::ostream& outs);
+
+  /**
+   * @brief Print the counts divided by the number of operations, then the instructions per cycle, separated by commas.
+   * "n/a" stands for the events that weren't counted.
+   *
+   */
+  void printCSV(std::ostream& outs, uint64_t operationsCnt) const;
+};
+
+/**
+ * @brief Hardware and software event counters of the calling thread and of the threads it creates while they are
+ * open, read with perf_event_open(2).
+ *
+ * Every event is opened on its own, so one that the CPU or the VM doesn't support, or that perf_event_paranoid
+ * forbids, is just left out. If the kernel is off limits, only the user space part of the events is counted.
+ *
+ * Not thread-safe.
+ *
+ */
+class PerfCounters final {
+public:
+  PerfCounters() noexcept;
+  ~PerfCounters();
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  /**
+   * @brief Whether any event can be counted.
+   *
+   */
+  bool isAvailable() const noexcept;
+
+  /**
+   * @brief Describe why the events that can't be counted aren't, e.g. for a note in the output. Empty if all are.
+   *
+   */
+  const std::string& getUnavailableReason() const noexcept;
+
+  /**
+   * @brief Reset the counts and start counting.
+   *
+   */
+  void start() noexcept;
+
+  /**
+   * @brief Stop counting.
+   *
+   * @return The counts since start().
+   */
+  PerfCounts stop() noexcept;
+
+private:
+  std::array<int, PERF_EVENTS_CNT> fds;
+  std::string unavailableReason;
+};
+
+} // namespace benchmark
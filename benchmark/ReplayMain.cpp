@@ -0,0 +1,208 @@
+#include "KVS.h"
+#include "KVSException.h"
+#include "LatencyHistogram.h"
+#include "Trace.h"
+
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace replay {
+
+using namespace kvs;
+using namespace kvs::trace;
+using Clock = std::chrono::steady_clock;
+using benchmark::LatencyHistogram;
+
+constexpr size_t OPERATIONS_CNT = 3;
+constexpr const char* OPERATION_NAMES[OPERATIONS_CNT] = {"add", "get",
+                                                         "remove"};
+
+constexpr size_t OUTCOMES_CNT = 4;
+constexpr const char* OUTCOME_NAMES[OUTCOMES_CNT] = {
+    "cache hit", "bloom reject", "disk read", "rebuild triggered"};
+
+/**
+ * @brief Added values cycle through a few ones generated from a fixed seed, so that replays write the same data.
+ *
+ */
+constexpr size_t VALUES_POOL_SIZE = 16;
+
+struct ReplayResult final {
+  std::array<LatencyHistogram, OPERATIONS_CNT> histograms;
+
+  /**
+   * @brief How many recorded operations had every outcome, by operation.
+   *
+   */
+  std::array<std::array<uint64_t, OUTCOMES_CNT>, OPERATIONS_CNT>
+      recordedOutcomeCnts{};
+
+  uint64_t operationsCnt = 0;
+  double seconds = 0;
+};
+
+std::vector<Value> generateValuesPool() {
+  std::mt19937_64 gen(0);
+  std::vector<Value> values;
+  for (size_t i = 0; i < VALUES_POOL_SIZE; ++i) {
+    ByteArray bytes(VALUE_SIZE);
+    for (size_t j = 0; j < VALUE_SIZE; j += sizeof(uint64_t)) {
+      uint64_t word = gen();
+      std::memcpy(bytes.get() + j, &word, sizeof(uint64_t));
+    }
+    values.emplace_back(bytes);
+  }
+  return values;
+}
+
+/**
+ * @brief Replay the trace against the KVS from a single thread, in the order of the records.
+ *
+ * @param recordedSpeed Whether to issue every operation at its recorded time since the start rather than as soon as the
+ * previous one completes. A late operation is charged with the time it waited, like in an open loop of the benchmark.
+ */
+ReplayResult replayTrace(KVS& kvs, TraceReader& reader, bool recordedSpeed) {
+  std::vector<Value> values = generateValuesPool();
+  ReplayResult result;
+  Clock::time_point start = Clock::now();
+  while (std::optional<TraceRecord> record = reader.next()) {
+    Key key = record->getReplayKey();
+    size_t operationIndex = static_cast<size_t>(record->operation);
+    for (size_t i = 0; i < OUTCOMES_CNT; ++i) {
+      if (record->outcome & (1 << i))
+        result.recordedOutcomeCnts[operationIndex][i]++;
+    }
+
+    Clock::time_point begin = Clock::now();
+    if (recordedSpeed) {
+      Clock::time_point intendedBegin = start + record->timestamp;
+      std::this_thread::sleep_until(intendedBegin);
+      begin = intendedBegin;
+    }
+    switch (record->operation) {
+    case TraceOperation::ADD:
+      kvs.add(key, values[result.operationsCnt % VALUES_POOL_SIZE]);
+      break;
+    case TraceOperation::GET: {
+      std::optional<Value> value = kvs.get(key);
+      break;
+    }
+    case TraceOperation::REMOVE:
+      kvs.remove(key);
+      break;
+    }
+    result.histograms[operationIndex].record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                             begin)
+            .count());
+    result.operationsCnt++;
+  }
+  result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  return result;
+}
+
+void printResult(std::ostream& outs, const ReplayResult& result) {
+  outs << "operations,seconds,operations per second\n"
+       << result.operationsCnt << "," << result.seconds << ","
+       << result.operationsCnt / result.seconds << "\n\n";
+
+  outs << "Replay latencies in nanoseconds:\n";
+  outs << "operation,count,min,mean,p50,p90,p99,p99.9,max\n";
+  for (size_t i = 0; i < OPERATIONS_CNT; ++i) {
+    const LatencyHistogram& histogram = result.histograms[i];
+    outs << OPERATION_NAMES[i] << "," << histogram.getCount() << ","
+         << histogram.getMin() << "," << histogram.getMean() << ","
+         << histogram.getPercentile(50) << "," << histogram.getPercentile(90)
+         << "," << histogram.getPercentile(99) << ","
+         << histogram.getPercentile(99.9) << "," << histogram.getMax() << "\n";
+  }
+  outs << "\n";
+
+  outs << "Recorded outcomes:\noperation";
+  for (const char* outcomeName : OUTCOME_NAMES) outs << "," << outcomeName;
+  outs << "\n";
+  for (size_t i = 0; i < OPERATIONS_CNT; ++i) {
+    outs << OPERATION_NAMES[i];
+    for (uint64_t outcomeCnt : result.recordedOutcomeCnts[i])
+      outs << "," << outcomeCnt;
+    outs << "\n";
+  }
+  outs << "\n";
+}
+
+/**
+ * @brief Parse a memory budget in bytes.
+ *
+ * @throws std::invalid_argument unless the whole string is a non-negative integer.
+ */
+size_t parseMemoryBudget(const std::string& value) {
+  try {
+    // std::stoul negates a leading minus instead of failing
+    if (value.find('-') != std::string::npos)
+      throw std::invalid_argument(value);
+    size_t parsedCnt = 0;
+    size_t budget = std::stoul(value, &parsedCnt);
+    if (parsedCnt != value.size())
+      throw std::invalid_argument(value);
+    return budget;
+  } catch (const std::exception& exc) {
+    throw std::invalid_argument("invalid cache map memory budget: " + value);
+  }
+}
+
+} // namespace replay
+
+/**
+ * @brief "replay <trace file> [max | recorded] [CacheMap memory budget in bytes]" replays a trace recorded by
+ * KVS::startTrace() against a fresh store, as fast as possible or at the recorded speed.
+ *
+ * Prints the throughput and latencies of the replay, the outcomes the operations had when they were recorded, and the
+ * stats of the KVS after the replay to compare them with.
+ *
+ */
+int main(int argc, char* argv[]) {
+  std::string speed = "max";
+  size_t cacheMapMemoryBudget =
+      kvs::CACHE_MAP_SIZE * kvs::CacheMap::SLOT_MEMORY_SIZE;
+  try {
+    if (argc < 2 || argc > 4)
+      throw std::invalid_argument("wrong number of arguments");
+    if (argc > 2)
+      speed = argv[2];
+    if (speed != "max" && speed != "recorded")
+      throw std::invalid_argument("unknown speed: " + speed);
+    if (argc > 3)
+      cacheMapMemoryBudget = replay::parseMemoryBudget(argv[3]);
+  } catch (const std::exception& exc) {
+    std::cerr << exc.what() << "\n"
+              << "usage: " << argv[0]
+              << " <trace file> [max | recorded] [cache map memory budget]\n";
+    return 1;
+  }
+
+  try {
+    kvs::trace::TraceReader reader{argv[1]};
+    std::filesystem::remove_all(kvs::STORAGE_DIRECTORY_PATH);
+    std::filesystem::create_directories(kvs::STORAGE_DIRECTORY_PATH);
+    replay::ReplayResult result;
+    {
+      kvs::KVS kvs{cacheMapMemoryBudget};
+      result = replay::replayTrace(kvs, reader, speed == "recorded");
+      replay::printResult(std::cout, result);
+      kvs.stats().printText(std::cout);
+    }
+    std::filesystem::remove_all(kvs::STORAGE_DIRECTORY_PATH);
+  } catch (const std::exception& exc) {
+    std::cerr << exc.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,228 @@
+#include "Workload.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace benchmark {
+
+namespace {
+
+/**
+ * @brief The item count and the normalization constant YCSB uses for scrambled zipfian, with the constant 0.99.
+ *
+ */
+constexpr uint64_t SCRAMBLED_ZIPFIAN_ITEMS_CNT = 10000000000;
+constexpr double SCRAMBLED_ZIPFIAN_CONSTANT = 0.99;
+constexpr double SCRAMBLED_ZIPFIAN_ZETA = 26.46902820178302;
+
+constexpr const char* PROPORTION_NAMES[WORKLOAD_OPERATIONS_CNT] = {
+    "readproportion",   "updateproportion", "insertproportion",
+    "removeproportion", "scanproportion",   "readmodifywriteproportion"};
+
+uint64_t fnvHash64(uint64_t value) noexcept {
+  uint64_t hash = 0xCBF29CE484222325;
+  for (size_t i = 0; i < sizeof(uint64_t); i++) {
+    hash ^= value & 0xFF;
+    hash *= 1099511628211;
+    value >>= 8;
+  }
+  return hash;
+}
+
+double parseDouble(const std::string& name, const std::string& value) {
+  try {
+    return std::stod(value);
+  } catch (const std::exception& exc) {
+    throw std::invalid_argument("invalid value of " + name + ": " + value);
+  }
+}
+
+uint64_t parseUInt(const std::string& name, const std::string& value) {
+  // std::stoull negates a leading minus instead of failing
+  if (value.find('-') != std::string::npos)
+    throw std::invalid_argument("invalid value of " + name + ": " + value);
+  try {
+    return std::stoull(value);
+  } catch (const std::exception& exc) {
+    throw std::invalid_argument("invalid value of " + name + ": " + value);
+  }
+}
+
+} // namespace
+
+WorkloadConfig WorkloadConfig::getCoreWorkload(char workload) {
+  WorkloadConfig config;
+  config.keyDistribution = KeyDistribution::ZIPFIAN;
+  switch (workload) {
+  case 'a':
+    config.proportions = {0.5, 0.5, 0, 0, 0, 0};
+    break;
+  case 'b':
+    config.proportions = {0.95, 0.05, 0, 0, 0, 0};
+    break;
+  case 'c':
+    config.proportions = {1, 0, 0, 0, 0, 0};
+    break;
+  case 'd':
+    config.proportions = {0.95, 0, 0.05, 0, 0, 0};
+    config.keyDistribution = KeyDistribution::LATEST;
+    break;
+  case 'e':
+    config.proportions = {0, 0, 0.05, 0, 0.95, 0};
+    break;
+  case 'f':
+    config.proportions = {0.5, 0, 0, 0, 0, 0.5};
+    break;
+  default:
+    throw std::invalid_argument(std::string("unknown core workload: ") +
+                                workload);
+  }
+  return config;
+}
+
+void WorkloadConfig::set(const std::string& name, const std::string& value) {
+  for (size_t i = 0; i < WORKLOAD_OPERATIONS_CNT; i++) {
+    if (name == PROPORTION_NAMES[i]) {
+      double proportion = parseDouble(name, value);
+      if (!(std::isfinite(proportion) && proportion >= 0))
+        throw std::invalid_argument("invalid value of " + name + ": " + value);
+      proportions[i] = proportion;
+      return;
+    }
+  }
+  if (name == "recordcount") {
+    recordsCnt = parseUInt(name, value);
+  } else if (name == "operationcount") {
+    operationsCnt = parseUInt(name, value);
+  } else if (name == "zipfianconstant") {
+    double constant = parseDouble(name, value);
+    if (!(constant > 0 && constant < 1))
+      throw std::invalid_argument("invalid value of " + name + ": " + value);
+    zipfianConstant = constant;
+  } else if (name == "maxscanlength") {
+    maxScanLength = std::max<uint64_t>(1, parseUInt(name, value));
+  } else if (name == "requestdistribution") {
+    if (value == "uniform")
+      keyDistribution = KeyDistribution::UNIFORM;
+    else if (value == "zipfian")
+      keyDistribution = KeyDistribution::ZIPFIAN;
+    else if (value == "scrambledzipfian")
+      keyDistribution = KeyDistribution::SCRAMBLED_ZIPFIAN;
+    else if (value == "latest")
+      keyDistribution = KeyDistribution::LATEST;
+    else
+      throw std::invalid_argument("unknown request distribution: " + value);
+  } else {
+    throw std::invalid_argument("unknown workload property: " + name);
+  }
+}
+
+void WorkloadConfig::load(const std::string& filePath) {
+  std::ifstream file(filePath);
+  if (!file)
+    throw std::invalid_argument("can't read workload file: " + filePath);
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+    size_t separatorPos = line.find('=');
+    if (separatorPos == std::string::npos)
+      throw std::invalid_argument("invalid workload line: " + line);
+    set(line.substr(0, separatorPos), line.substr(separatorPos + 1));
+  }
+}
+
+void WorkloadConfig::validate() const {
+  if (std::all_of(proportions.begin(), proportions.end(),
+                  [](double proportion) { return proportion == 0; }))
+    throw std::invalid_argument("all operation proportions are zero");
+}
+
+ZipfianGenerator::ZipfianGenerator(uint64_t itemsCnt, double zipfianConstant)
+    : ZipfianGenerator(itemsCnt, zipfianConstant,
+                       getZeta(0, itemsCnt, zipfianConstant, 0)) {}
+
+ZipfianGenerator::ZipfianGenerator(uint64_t itemsCnt, double zipfianConstant,
+                                   double zeta)
+    : itemsCnt(itemsCnt), theta(zipfianConstant),
+      alpha(1 / (1 - zipfianConstant)),
+      zeta2(getZeta(0, 2, zipfianConstant, 0)), zetaN(zeta),
+      eta((1 - std::pow(2.0 / itemsCnt, 1 - theta)) / (1 - zeta2 / zetaN)) {}
+
+double ZipfianGenerator::getZeta(uint64_t fromCnt, uint64_t toCnt,
+                                 double theta, double initialSum) {
+  double sum = initialSum;
+  for (uint64_t i = fromCnt; i < toCnt; i++) sum += 1 / std::pow(i + 1, theta);
+  return sum;
+}
+
+uint64_t ZipfianGenerator::next(std::mt19937_64& gen, uint64_t newItemsCnt) {
+  if (newItemsCnt != itemsCnt) {
+    // only the terms of the new items are added, the key space of a workload never shrinks
+    zetaN = newItemsCnt > itemsCnt
+                ? getZeta(itemsCnt, newItemsCnt, theta, zetaN)
+                : getZeta(0, newItemsCnt, theta, 0);
+    itemsCnt = newItemsCnt;
+    eta = (1 - std::pow(2.0 / itemsCnt, 1 - theta)) / (1 - zeta2 / zetaN);
+  }
+  double u = std::uniform_real_distribution<double>(0, 1)(gen);
+  double uz = u * zetaN;
+  if (uz < 1)
+    return 0;
+  if (uz < 1 + std::pow(0.5, theta))
+    return 1;
+  uint64_t item = itemsCnt * std::pow(eta * u - eta + 1, alpha);
+  return std::min(item, itemsCnt - 1);
+}
+
+Workload::Workload(const WorkloadConfig& config,
+                   std::atomic<uint64_t>& recordsCnt, uint64_t seed)
+    : config(config), recordsCnt(recordsCnt), gen(seed),
+      operationDistr(config.proportions.begin(), config.proportions.end()),
+      zipfian(config.keyDistribution == KeyDistribution::SCRAMBLED_ZIPFIAN
+                  ? ZipfianGenerator(SCRAMBLED_ZIPFIAN_ITEMS_CNT,
+                                     SCRAMBLED_ZIPFIAN_CONSTANT,
+                                     SCRAMBLED_ZIPFIAN_ZETA)
+                  : ZipfianGenerator(std::max<uint64_t>(1, config.recordsCnt),
+                                     config.zipfianConstant)) {}
+
+WorkloadOperation Workload::getNextOperation() {
+  return static_cast<WorkloadOperation>(operationDistr(gen));
+}
+
+uint64_t Workload::getNextKeyNumber() {
+  uint64_t keysCnt =
+      std::max<uint64_t>(1, recordsCnt.load(std::memory_order_relaxed));
+  switch (config.keyDistribution) {
+  case KeyDistribution::UNIFORM:
+    return std::uniform_int_distribution<uint64_t>(0, keysCnt - 1)(gen);
+  case KeyDistribution::ZIPFIAN:
+    return zipfian.next(gen, keysCnt);
+  case KeyDistribution::SCRAMBLED_ZIPFIAN:
+    return fnvHash64(zipfian.next(gen, SCRAMBLED_ZIPFIAN_ITEMS_CNT)) % keysCnt;
+  case KeyDistribution::LATEST:
+    return keysCnt - 1 - zipfian.next(gen, keysCnt);
+  }
+  return 0;
+}
+
+uint64_t Workload::getInsertKeyNumber() noexcept {
+  return recordsCnt.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t Workload::getNextScanLength() {
+  return std::uniform_int_distribution<uint64_t>(1, config.maxScanLength)(gen);
+}
+
+Key Workload::getKey(uint64_t keyNumber) noexcept {
+  ByteArray bytes(KEY_SIZE);
+  uint64_t hash = fnvHash64(keyNumber);
+  std::memcpy(bytes.get(), &hash, sizeof(uint64_t));
+  std::memcpy(bytes.get() + sizeof(uint64_t), &keyNumber, sizeof(uint64_t));
+  return Key{bytes};
+}
+
+} // namespace benchmark
@@ -0,0 +1,193 @@
+#pragma once
+
+#include "KeyValueTypes.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <random>
+#include <string>
+
+namespace benchmark {
+
+using namespace kvs::utils;
+
+/**
+ * @brief How the Key of an operation is chosen among the inserted records, as in YCSB.
+ *
+ */
+enum class KeyDistribution : uint8_t {
+  UNIFORM,
+  // popular records are skewed towards the first inserted ones
+  ZIPFIAN,
+  // popular records are spread over the whole key space
+  SCRAMBLED_ZIPFIAN,
+  // popular records are the most recently inserted ones
+  LATEST,
+};
+
+enum class WorkloadOperation : uint8_t {
+  READ,
+  UPDATE,
+  INSERT,
+  REMOVE,
+  SCAN,
+  READ_MODIFY_WRITE,
+};
+
+constexpr size_t WORKLOAD_OPERATIONS_CNT = 6;
+constexpr const char* WORKLOAD_OPERATION_NAMES[WORKLOAD_OPERATIONS_CNT] = {
+    "read", "update", "insert", "remove", "scan", "read-modify-write"};
+
+/**
+ * @brief Parameters of a YCSB-style workload. Names of the properties follow YCSB's core workload where there is one.
+ *
+ */
+struct WorkloadConfig final {
+  /**
+   * @brief The number of records inserted by the load phase ("recordcount").
+   *
+   */
+  uint64_t recordsCnt = 10000;
+
+  /**
+   * @brief The number of operations of the run phase ("operationcount").
+   *
+   */
+  uint64_t operationsCnt = 100000;
+
+  /**
+   * @brief Relative frequencies of the operations ("readproportion", "updateproportion", "insertproportion",
+   * "removeproportion", "scanproportion", "readmodifywriteproportion"). They don't have to add up to 1, but must not be
+   * negative or all zero.
+   *
+   */
+  std::array<double, WORKLOAD_OPERATIONS_CNT> proportions{1, 0, 0, 0, 0, 0};
+
+  /**
+   * @brief "requestdistribution": uniform, zipfian, scrambledzipfian or latest.
+   *
+   */
+  KeyDistribution keyDistribution = KeyDistribution::SCRAMBLED_ZIPFIAN;
+
+  /**
+   * @brief The skew of zipfian and latest distributions ("zipfianconstant"), in (0, 1). Scrambled zipfian always uses
+   * 0.99.
+   *
+   */
+  double zipfianConstant = 0.99;
+
+  /**
+   * @brief The largest number of records read by a scan ("maxscanlength"), the length is uniform in [1, max].
+   *
+   */
+  uint64_t maxScanLength = 100;
+
+  /**
+   * @brief Get the parameters of a YCSB core workload.
+   *
+   * @param workload One of 'a' (update heavy), 'b' (read mostly), 'c' (read only), 'd' (read latest), 'e' (short
+   * scans), 'f' (read-modify-write).
+   * @throws std::invalid_argument for any other letter.
+   */
+  static WorkloadConfig getCoreWorkload(char workload);
+
+  /**
+   * @brief Set a property by its name.
+   *
+   * @throws std::invalid_argument if the property or its value is unknown.
+   */
+  void set(const std::string& name, const std::string& value);
+
+  /**
+   * @brief Set properties from "name=value" lines of a file. Empty lines and lines starting with '#' are skipped.
+   *
+   * @throws std::invalid_argument if the file can't be read or has an unknown property.
+   */
+  void load(const std::string& filePath);
+
+  /**
+   * @brief Check what single properties can't, once all of them are set.
+   *
+   * @throws std::invalid_argument if all proportions are zero.
+   */
+  void validate() const;
+};
+
+/**
+ * @brief Draws item numbers in [0, itemsCnt) from a Zipfian distribution, item 0 being the most popular one. The
+ * constant must be in (0, 1), the algorithm has no limit at 1.
+ *
+ * The algorithm of Gray et al., "Quickly Generating Billion-Record Synthetic Databases", as used by YCSB. The
+ * normalization constant is extended incrementally when itemsCnt grows, so a growing key space is cheap.
+ *
+ */
+class ZipfianGenerator final {
+public:
+  ZipfianGenerator(uint64_t itemsCnt, double zipfianConstant);
+
+  /**
+   * @brief Use a precomputed normalization constant instead of summing it up, for very large item counts.
+   *
+   */
+  ZipfianGenerator(uint64_t itemsCnt, double zipfianConstant, double zeta);
+
+  uint64_t next(std::mt19937_64& gen, uint64_t itemsCnt);
+
+private:
+  static double getZeta(uint64_t fromCnt, uint64_t toCnt, double theta,
+                        double initialSum);
+
+  uint64_t itemsCnt;
+  double theta;
+  double alpha;
+  double zeta2;
+  double zetaN;
+  double eta;
+};
+
+/**
+ * @brief Generates the operations and keys of a workload. Not thread-safe, but several instances may share the
+ * counter of inserted records and run in different threads.
+ *
+ */
+class Workload final {
+public:
+  /**
+   * @param recordsCnt The number of records inserted so far, increased by getInsertKeyNumber().
+   */
+  Workload(const WorkloadConfig& config, std::atomic<uint64_t>& recordsCnt,
+           uint64_t seed);
+
+  WorkloadOperation getNextOperation();
+
+  /**
+   * @brief Choose an inserted record for a read, an update, a removal or the start of a scan.
+   *
+   */
+  uint64_t getNextKeyNumber();
+
+  /**
+   * @brief Claim the number of the next record to insert.
+   *
+   */
+  uint64_t getInsertKeyNumber() noexcept;
+
+  uint64_t getNextScanLength();
+
+  /**
+   * @brief Get the Key of a record. Records are numbered sequentially, their keys are hashed, so that consecutive
+   * records don't share shards.
+   *
+   */
+  static Key getKey(uint64_t keyNumber) noexcept;
+
+private:
+  WorkloadConfig config;
+  std::atomic<uint64_t>& recordsCnt;
+  std::mt19937_64 gen;
+  std::discrete_distribution<size_t> operationDistr;
+  ZipfianGenerator zipfian;
+};
+
+} // namespace benchmark
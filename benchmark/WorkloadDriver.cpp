@@ -0,0 +1,252 @@
+#include "WorkloadDriver.h"
+
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+namespace benchmark {
+
+using namespace kvs;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Writes cycle through a few values generated in advance, generating a fresh one would dominate a closed loop.
+ *
+ */
+constexpr size_t VALUES_POOL_SIZE = 16;
+
+/**
+ * @brief The threads start together a bit after all of them are ready, so that waking them up isn't measured.
+ *
+ */
+constexpr std::chrono::milliseconds START_DELAY{10};
+
+std::vector<Value> generateValuesPool(std::mt19937_64& gen) {
+  std::vector<Value> values;
+  for (size_t i = 0; i < VALUES_POOL_SIZE; ++i) {
+    ByteArray bytes(VALUE_SIZE);
+    for (size_t j = 0; j < VALUE_SIZE; j += sizeof(uint64_t)) {
+      uint64_t word = gen();
+      std::memcpy(bytes.get() + j, &word, sizeof(uint64_t));
+    }
+    values.emplace_back(bytes);
+  }
+  return values;
+}
+
+/**
+ * @brief The Keys an operation works on, chosen before it is timed.
+ *
+ */
+std::vector<Key> prepareKeys(Workload& workload, WorkloadOperation operation) {
+  if (operation == WorkloadOperation::INSERT)
+    return {Workload::getKey(workload.getInsertKeyNumber())};
+  uint64_t keyNumber = workload.getNextKeyNumber();
+  uint64_t keysCnt =
+      operation == WorkloadOperation::SCAN ? workload.getNextScanLength() : 1;
+  std::vector<Key> keys;
+  for (uint64_t i = 0; i < keysCnt; ++i)
+    keys.push_back(Workload::getKey(keyNumber + i));
+  return keys;
+}
+
+/**
+ * @brief Execute an operation. The KVS keeps no key order, so a scan reads the records following the chosen one by
+ * number with a single multiGet().
+ *
+ */
+void executeOperation(KVS& kvs, WorkloadOperation operation,
+                      const std::vector<Key>& keys, const Value& value) {
+  switch (operation) {
+  case WorkloadOperation::READ: {
+    std::optional<Value> readValue = kvs.get(keys[0]);
+    break;
+  }
+  case WorkloadOperation::UPDATE:
+    [[fallthrough]];
+  case WorkloadOperation::INSERT: {
+    kvs.add(keys[0], value);
+    break;
+  }
+  case WorkloadOperation::REMOVE: {
+    kvs.remove(keys[0]);
+    break;
+  }
+  case WorkloadOperation::SCAN: {
+    std::vector<std::optional<Value>> readValues = kvs.multiGet(keys);
+    break;
+  }
+  case WorkloadOperation::READ_MODIFY_WRITE: {
+    std::optional<Value> readValue = kvs.get(keys[0]);
+    kvs.add(keys[0], value);
+    break;
+  }
+  }
+}
+
+/**
+ * @brief Run operationsCnt operations of the workload in one thread, starting at the given time.
+ *
+ * @param ratePerThread The arrival rate of the thread's open loop, 0 for a closed loop.
+ */
+ThreadResult runThread(KVS& kvs, Workload& workload,
+                       std::optional<WorkloadOperation> fixedOperation,
+                       uint64_t operationsCnt, double ratePerThread,
+                       Clock::time_point start, uint64_t seed) {
+  std::mt19937_64 gen(seed);
+  std::vector<Value> values = generateValuesPool(gen);
+  std::exponential_distribution<double> interarrivalDistr(
+      ratePerThread > 0 ? ratePerThread : 1);
+  ThreadResult result;
+  std::this_thread::sleep_until(start);
+
+  Clock::time_point intendedBegin = start;
+  for (uint64_t i = 0; i < operationsCnt; ++i) {
+    WorkloadOperation operation = fixedOperation.has_value()
+                                      ? fixedOperation.value()
+                                      : workload.getNextOperation();
+    std::vector<Key> keys = prepareKeys(workload, operation);
+
+    Clock::time_point begin;
+    if (ratePerThread > 0) {
+      intendedBegin += std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(interarrivalDistr(gen)));
+      std::this_thread::sleep_until(intendedBegin);
+      // a late operation is charged with the time it waited
+      begin = intendedBegin;
+    } else {
+      begin = Clock::now();
+    }
+    executeOperation(kvs, operation, keys, values[i % VALUES_POOL_SIZE]);
+    Clock::time_point end = Clock::now();
+    result.histograms[static_cast<size_t>(operation)].record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin)
+            .count());
+  }
+  result.operationsCnt = operationsCnt;
+  result.seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  return result;
+}
+
+/**
+ * @brief Lets the threads wait until every one of them has prepared its Workload, which takes a while for the zipfian
+ * distributions, and hands them a common start time taken only then.
+ *
+ */
+class StartBarrier final {
+public:
+  explicit StartBarrier(size_t threadsCnt) noexcept
+      : waitingThreadsCnt(threadsCnt) {}
+
+  Clock::time_point arriveAndWait() {
+    std::unique_lock lock{mutex};
+    if (--waitingThreadsCnt == 0) {
+      start = Clock::now() + START_DELAY;
+      condition.notify_all();
+    } else {
+      condition.wait(lock, [this]() { return start.has_value(); });
+    }
+    return start.value();
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable condition;
+  size_t waitingThreadsCnt;
+  std::optional<Clock::time_point> start;
+};
+
+std::vector<ThreadResult>
+runThreads(KVS& kvs, const WorkloadConfig& workloadConfig,
+           const DriverConfig& driverConfig, std::atomic<uint64_t>& recordsCnt,
+           std::optional<WorkloadOperation> fixedOperation,
+           uint64_t operationsCnt, double targetRate) {
+  size_t threadsCnt = std::max<size_t>(1, driverConfig.threadsCnt);
+  std::vector<ThreadResult> results(threadsCnt);
+  std::vector<std::thread> threads;
+  std::random_device rd;
+  StartBarrier startBarrier{threadsCnt};
+  for (size_t i = 0; i < threadsCnt; ++i) {
+    uint64_t threadOperationsCnt = operationsCnt * (i + 1) / threadsCnt -
+                                   operationsCnt * i / threadsCnt;
+    threads.emplace_back([&, i, threadOperationsCnt, workloadSeed = rd(),
+                          seed = rd()]() {
+      Workload workload{workloadConfig, recordsCnt, workloadSeed};
+      Clock::time_point start = startBarrier.arriveAndWait();
+      results[i] =
+          runThread(kvs, workload, fixedOperation, threadOperationsCnt,
+                    targetRate / threadsCnt, start, seed);
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  return results;
+}
+
+} // namespace
+
+bool DriverConfig::set(const std::string& name, const std::string& value) {
+  try {
+    if (name == "threadcount") {
+      // std::stoul negates a leading minus instead of failing
+      if (value.find('-') != std::string::npos)
+        throw std::invalid_argument(value);
+      threadsCnt = std::max<size_t>(1, std::stoul(value));
+      return true;
+    }
+    if (name == "target") {
+      double rate = std::stod(value);
+      if (!(std::isfinite(rate) && rate >= 0))
+        throw std::invalid_argument(value);
+      targetRate = rate;
+      return true;
+    }
+    if (name == "tracefile") {
+      traceFilePath = value;
+      return true;
+    }
+    if (name == "tracefullkeys") {
+      traceFullKeys = std::stoul(value) != 0;
+      return true;
+    }
+  } catch (const std::exception& exc) {
+    throw std::invalid_argument("invalid value of " + name + ": " + value);
+  }
+  return false;
+}
+
+void ThreadResult::merge(const ThreadResult& other) {
+  for (size_t i = 0; i < WORKLOAD_OPERATIONS_CNT; ++i)
+    histograms[i].merge(other.histograms[i]);
+  operationsCnt += other.operationsCnt;
+  seconds = std::max(seconds, other.seconds);
+}
+
+std::vector<ThreadResult> loadWorkload(KVS& kvs,
+                                       const WorkloadConfig& workloadConfig,
+                                       const DriverConfig& driverConfig,
+                                       std::atomic<uint64_t>& recordsCnt) {
+  // records are inserted as fast as possible, the target rate is for the run phase
+  return runThreads(kvs, workloadConfig, driverConfig, recordsCnt,
+                    WorkloadOperation::INSERT, workloadConfig.recordsCnt, 0);
+}
+
+std::vector<ThreadResult> runWorkload(KVS& kvs,
+                                      const WorkloadConfig& workloadConfig,
+                                      const DriverConfig& driverConfig,
+                                      std::atomic<uint64_t>& recordsCnt) {
+  return runThreads(kvs, workloadConfig, driverConfig, recordsCnt,
+                    std::nullopt, workloadConfig.operationsCnt,
+                    driverConfig.targetRate);
+}
+
+} // namespace benchmark
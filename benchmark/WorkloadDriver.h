@@ -0,0 +1,101 @@
+#pragma once
+
+#include "KVS.h"
+#include "LatencyHistogram.h"
+#include "Workload.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace benchmark {
+
+/**
+ * @brief How the client threads issue the operations of a workload.
+ *
+ */
+struct DriverConfig final {
+  /**
+   * @brief The number of client threads ("threadcount").
+   *
+   */
+  size_t threadsCnt = 1;
+
+  /**
+   * @brief The total arrival rate in operations per second ("target"), not negative. 0 means a closed loop: every
+   * thread issues its next operation as soon as the previous one completes. Otherwise the loop is open: operations
+   * arrive at exponentially distributed intervals, i.e. as a Poisson process, regardless of how long the previous ones
+   * took.
+   *
+   */
+  double targetRate = 0;
+
+  /**
+   * @brief The file to record the operations of both phases to ("tracefile"), see kvs::KVS::startTrace(). Empty means
+   * no trace. Scans are batched, so they aren't recorded.
+   *
+   */
+  std::string traceFilePath;
+
+  /**
+   * @brief Whether the trace records the keys rather than their hashes ("tracefullkeys").
+   *
+   */
+  bool traceFullKeys = false;
+
+  /**
+   * @brief How many times the run phase is repeated on the loaded KVS. Every repetition is one throughput sample for
+   * the comparison with a baseline. Not a property of the driver, the benchmark sets it for all of its modes.
+   *
+   */
+  size_t repetitionsCnt = 1;
+
+  /**
+   * @brief Set a property by its name.
+   *
+   * @return Whether the property belongs to the driver.
+   * @throws std::invalid_argument if its value is invalid.
+   */
+  bool set(const std::string& name, const std::string& value);
+};
+
+/**
+ * @brief What one client thread measured.
+ *
+ * In an open loop, the latency of an operation is measured from the time it was scheduled to arrive, not from the time
+ * the thread got to it, so that a stall shows up in the latencies of all operations that queued up behind it rather
+ * than hiding them (coordinated omission).
+ *
+ */
+struct ThreadResult final {
+  std::array<LatencyHistogram, WORKLOAD_OPERATIONS_CNT> histograms;
+  uint64_t operationsCnt = 0;
+  double seconds = 0;
+
+  void merge(const ThreadResult& other);
+};
+
+/**
+ * @brief Insert the records of the workload, with every thread inserting its share of them in a closed loop.
+ *
+ * @param recordsCnt Shared with the workloads of the run phase.
+ * @return The result of every thread.
+ */
+std::vector<ThreadResult> loadWorkload(kvs::KVS& kvs,
+                                       const WorkloadConfig& workloadConfig,
+                                       const DriverConfig& driverConfig,
+                                       std::atomic<uint64_t>& recordsCnt);
+
+/**
+ * @brief Run the operations of the workload, split evenly among the threads.
+ *
+ * @return The result of every thread.
+ */
+std::vector<ThreadResult> runWorkload(kvs::KVS& kvs,
+                                      const WorkloadConfig& workloadConfig,
+                                      const DriverConfig& driverConfig,
+                                      std::atomic<uint64_t>& recordsCnt);
+
+} // namespace benchmark
@@ -1,7 +1,9 @@
 #pragma once
 
 #include "KeyValueTypes.h"
-#include <bitset>
+#include "Metrics.h"
+#include <atomic>
+#include <cstdint>
 #include <vector>
 
 namespace kvs::bloom_filter {
@@ -9,33 +11,164 @@ namespace kvs::bloom_filter {
 using namespace kvs::utils;
 
 /**
- * @brief Bloom filter!!!
+ * @brief Cache-line-blocked counting Bloom filter!!!
+ *
+ * Only the low half of the HashedKey hash is used. Its lower 32 bits select a 512-bit block of 128 4-bit counters, its
+ * upper 32 bits give the probe positions inside the block via double hashing, so a check touches a single cache line.
+ * Counters make it possible to remove keys; a counter that reaches its maximum value stays there.
+ *
+ * The number of blocks and probes is chosen from the expected number of keys and the target false positive rate.
  *
  */
 class BloomFilter final {
 public:
-  BloomFilter() noexcept;
+  /**
+   * @brief Construct a new empty filter.
+   *
+   * @param expectedKeysCnt The number of keys the filter is sized for.
+   * @param falsePositiveRate The target false positive rate when expectedKeysCnt keys are added.
+   */
+  explicit BloomFilter(
+      size_t expectedKeysCnt = SHARD_EXPECTED_SIZE,
+      double falsePositiveRate = BLOOM_FILTER_FALSE_POSITIVE_RATE) noexcept;
+
+  /**
+   * @brief Deserialize a BloomFilter from serializedBloomFilter.
+   *
+   * @throws KVSException if the data is corrupted.
+   */
+  explicit BloomFilter(const ByteArray& serializedBloomFilter);
+
+  /**
+   * @brief Serialize the filter into a ByteArray.
+   *
+   */
+  ByteArray serializeToByteArray() const noexcept;
+
+  /**
+   * @brief Get the number of bits per key required to reach the false positive rate.
+   *
+   */
+  static double getBitsPerKey(double falsePositiveRate) noexcept;
 
   /**
      * @brief Check if the Key is present.
      *
      */
-  bool checkExist(const Key& key) const noexcept;
+  bool checkExist(const HashedKey& key) const noexcept;
+
+  /**
+   * @brief Check if each of the keys is present. Uses AVX2 if the build enables it.
+   *
+   * @return The check results in the order of keys.
+   */
+  std::vector<bool> checkExist(const std::vector<HashedKey>& keys) const noexcept;
 
   /**
      * @brief Add the Key to the filter.
      *
      */
-  void add(const Key& key) noexcept;
+  void add(const HashedKey& key) noexcept;
+
+  /**
+   * @brief Remove the Key from the filter. Removing a Key that was not added causes false negatives.
+   *
+   */
+  void remove(const HashedKey& key) noexcept;
+
+  /**
+   * @brief Check if the filter holds more keys than it was sized for, so it should be rebuilt larger.
+   *
+   */
+  bool isOverflowed() const noexcept;
+
+  size_t getExpectedKeysCnt() const noexcept;
+
+  size_t getKeysCnt() const noexcept;
+
+  size_t getCountersCnt() const noexcept;
+
+  size_t getHashFunctionsCnt() const noexcept;
 
 private:
-  std::bitset<BLOOM_FILTER_SIZE> bitset;
+  static constexpr size_t BLOCK_BITS = 512;
+  static constexpr size_t BLOCK_WORDS = BLOCK_BITS / 64;
+  static constexpr size_t COUNTER_BITS = 4;
+  static constexpr size_t BLOCK_COUNTERS = BLOCK_BITS / COUNTER_BITS;
+  static constexpr uint64_t COUNTER_MAX = (1 << COUNTER_BITS) - 1;
 
   /**
-     * @brief The seeds for different hash functions.
-     *
-     */
-  std::vector<seed_t> seeds;
+   * @brief A group of counters that fits into one cache line.
+   *
+   */
+  struct alignas(64) Block final {
+    uint64_t words[BLOCK_WORDS] = {};
+  };
+
+  /**
+   * @brief The fixed-size part of the serialized filter.
+   *
+   */
+  struct Header final {
+    uint64_t blocksCnt;
+    uint64_t hashFunctionsCnt;
+    uint64_t expectedKeysCnt;
+    uint64_t keysCnt;
+  };
+
+  size_t getBlockIndex(hash_t hash) const noexcept;
+
+  /**
+   * @brief Call f(wordIndex, shift) for every counter in the block the Key with this hash maps to.
+   *
+   */
+  template <typename F>
+  void forEachCounter(hash_t hash, F f) const noexcept;
+
+  bool checkHash(hash_t hash) const noexcept;
+
+  std::vector<Block> blocks;
+
+  size_t hashFunctionsCnt;
+
+  size_t expectedKeysCnt;
+  size_t keysCnt;
+};
+
+/**
+ * @brief Counters of filter checks made on the read path, used to measure the real false positive rate.
+ *
+ * Every read checks a filter and shards of one batch are processed concurrently, so the counters are striped per thread.
+ *
+ */
+struct BloomFilterStats final {
+  BloomFilterStats() noexcept = default;
+  BloomFilterStats(const BloomFilterStats& other) noexcept;
+  BloomFilterStats& operator=(const BloomFilterStats& other) noexcept;
+
+  /**
+   * @brief Number of keys the filter rejected.
+   *
+   */
+  metrics::Counter negativesCnt;
+
+  /**
+   * @brief Number of keys the filter accepted, but which were not found in the index.
+   *
+   */
+  metrics::Counter falsePositivesCnt;
+
+  /**
+   * @brief Number of keys the filter accepted and which were found in the index.
+   *
+   */
+  metrics::Counter truePositivesCnt;
+
+  /**
+   * @brief Get the measured false positive rate, i.e. the share of absent keys that were accepted by the filter.
+   *
+   */
+  double getFalsePositiveRate() const noexcept;
 };
 
 } // namespace kvs::bloom_filter
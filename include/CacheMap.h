@@ -1,7 +1,12 @@
 #pragma once
 
 #include "KeyValueTypes.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <random>
 #include <vector>
 
 namespace kvs::cache_map {
@@ -11,27 +16,113 @@ using namespace kvs::utils;
 /**
  * @brief Cache map based on a hash table. Stored in RAM.
  *
+ * The map is split into stripes, a Key always falls into the same one. Every stripe is an independent linear probing
+ * table with its own mutex, entry count and displacement, so writers of different stripes never contend.
+ *
+ * Readers take no lock: a stripe is guarded by a seqlock, get() reads the slots optimistically and retries if a writer
+ * got in the way. A read only loads shared cache lines, so a hot Key can be read by many cores at once without bouncing
+ * a line between them.
+ *
+ * All methods are thread-safe except resize() and clear(), which must not run concurrently with any other method.
+ *
  */
 class CacheMap final {
 
+private:
+  /**
+   * @brief A slot of a stripe. The Key is stored inline as two words, so that a reader racing with a writer only ever
+   * sees a torn slot, never freed memory. Torn reads are discarded by the seqlock.
+   *
+   */
+  struct Slot final {
+    std::atomic<uint64_t> keyWords[KEY_SIZE / sizeof(uint64_t)];
+    std::atomic<ptr_t> ptr;
+  };
+
 public:
+  /**
+   * @brief Approximate amount of RAM taken by one slot of the map.
+   *
+   */
+  static constexpr size_t SLOT_MEMORY_SIZE = sizeof(Slot);
+
+  /**
+   * @brief The smallest allowed number of slots. Smaller maps could be filled up entirely, which breaks probing.
+   *
+   */
+  static constexpr size_t MIN_SIZE = 4;
+
+  /**
+   * @brief The smallest number of slots in a stripe. Smaller maps consist of a single stripe.
+   *
+   */
+  static constexpr size_t MIN_STRIPE_SIZE = 64;
+
+  /**
+   * @brief The largest number of stripes. Must be a power of two.
+   *
+   */
+  static constexpr size_t MAX_STRIPES_CNT = 64;
+
+  /**
+   * @brief Called for a displaced Entry while its stripe is still locked, i.e. before the Key can be looked up again.
+   *
+   */
+  using DisplacedHandler = std::function<void(const Entry&)>;
+
   CacheMap(size_t size) noexcept;
 
   /**
-     * @brief Put the Entry into the map. If there isn't enough space, displace a random Entry and return it. If an
-     * Entry with the same Key already exists, overwrite it.
+   * @brief Get the number of slots that fit into the given amount of bytes.
+   *
+   */
+  static size_t getSizeForMemoryBudget(size_t memoryBudget) noexcept;
+
+  /**
+     * @brief Put the Entry into the map. If an Entry with the same Key already exists, overwrite it. Otherwise, if its
+     * stripe is at capacity, displace a random Entry of the stripe first and return it.
      *
+     * @param onDisplaced Called for the displaced Entry before the stripe is unlocked, if set.
      * @return Displaced Entry, if any.
      */
-  std::optional<Entry> putOrDisplace(Entry entry) noexcept;
+  std::optional<Entry>
+  putOrDisplace(const HashedKey& key, Ptr ptr,
+                const DisplacedHandler& onDisplaced = nullptr) noexcept;
+  std::optional<Entry> putOrDisplace(const Entry& entry) noexcept;
+
+  /**
+   * @brief Overwrite the Ptr of the Key, if it is present in the map. Unlike putOrDisplace(), never inserts the Key.
+   *
+   * @return Whether the Key was present.
+   */
+  bool update(const HashedKey& key, Ptr ptr) noexcept;
 
   /**
      * @brief Find a Ptr by Key.
      *
      * @return The requested Ptr or EMPTY_PTR, if no Entry with given Key is present.
      */
-  Ptr& get(const Key& key) noexcept;
-  const Ptr& get(const Key& key) const noexcept;
+  Ptr get(const HashedKey& key) const noexcept;
+
+  /**
+   * @brief Change the number of slots and rehash all entries.
+   *
+   * When shrinking, random entries are displaced until the rest fit into the new size.
+   *
+   * @param onDisplaced Called for every displaced Entry, if set.
+   * @return Displaced entries. They have to be pushed to shards just like the ones returned from putOrDisplace().
+   */
+  std::vector<Entry>
+  resize(size_t newSize,
+         const DisplacedHandler& onDisplaced = nullptr) noexcept;
+
+  /**
+   * @brief Get all entries \b present (i.e. those which Ptr is not EMPTY_PTR) in the map.
+   *
+   * Stripes are copied one at a time, so concurrent writes may be seen in some stripes only.
+   *
+   */
+  std::vector<Entry> getEntries() const noexcept;
 
   /**
      * @brief Clear the entire map.
@@ -39,18 +130,108 @@ public:
      */
   void clear() noexcept;
 
-private:
   /**
-    * @brief The internal storage of the map.
-    * 
-    */
-  std::vector<Entry> data;
+   * @brief Get the number of slots in the map.
+   *
+   */
+  size_t getSize() const noexcept;
 
   /**
-     * @brief The number of elements present in the map.
+   * @brief Get the maximum number of entries the map holds before it starts displacing.
+   *
+   */
+  size_t getCapacity() const noexcept;
+
+  /**
+   * @brief Get the number of entries currently present in the map.
+   *
+   */
+  size_t getUsedSize() const noexcept;
+
+  /**
+   * @brief Get the approximate amount of RAM taken by the map in bytes.
+   *
+   */
+  size_t getMemoryFootprint() const noexcept;
+
+private:
+  /**
+   * @brief An independent part of the map. Aligned, so that writers of neighbouring stripes don't share cache lines.
+   *
+   */
+  struct alignas(64) Stripe final {
+    std::mutex mutex;
+
+    /**
+     * @brief The seqlock counter, odd while a writer modifies the slots.
+     *
+     */
+    std::atomic<uint64_t> sequence{0};
+
+    std::unique_ptr<Slot[]> slots;
+    size_t size = 0;
+    size_t capacity = 0;
+
+    /**
+     * @brief The number of entries present in the stripe. Guarded by the mutex.
      *
      */
-  size_t usedSize;
+    size_t usedSize = 0;
+
+    /**
+     * @brief Chooses the entries to displace. Guarded by the mutex.
+     *
+     */
+    std::minstd_rand gen;
+  };
+
+  /**
+   * @brief Allocate empty stripes for the given number of slots.
+   *
+   */
+  void allocateStripes(size_t newSize) noexcept;
+
+  Stripe& getStripe(const HashedKey& key) const noexcept;
+
+  /**
+   * @brief Find the slot of the Key or the empty slot it would be put into. There must be at least one empty slot.
+   *
+   * Safe to call without the stripe mutex, but then the result is only valid if the seqlock confirms it.
+   *
+   */
+  static size_t findSlot(const Stripe& stripe, const HashedKey& key) noexcept;
+
+  /**
+   * @brief Remove a random Entry of a stripe. Requires the stripe mutex and an open write section.
+   *
+   */
+  static Entry displaceRandom(Stripe& stripe) noexcept;
+
+  /**
+   * @brief Put the Entry into a free or matching slot. Requires the stripe mutex and an open write section.
+   *
+   */
+  static void put(Stripe& stripe, const HashedKey& key, Ptr ptr) noexcept;
+
+  /**
+   * @brief Open and close a seqlock write section of a stripe. Require the stripe mutex.
+   *
+   */
+  static void beginWrite(Stripe& stripe) noexcept;
+  static void endWrite(Stripe& stripe) noexcept;
+
+  /**
+   * @brief The stripes of the map. A Key is put into the stripe selected by the lower bits of its hash.
+   *
+   */
+  std::unique_ptr<Stripe[]> stripes;
+  size_t stripesCnt;
+
+  /**
+   * @brief The total number of slots.
+   *
+   */
+  size_t size;
 };
 
 } // namespace kvs::cache_map
@@ -2,8 +2,27 @@
 
 #include "CacheMap.h"
 #include "KeyValueTypes.h"
+#include "Metrics.h"
 #include "Shard.h"
+#include "ShardBuilder.h"
+#include "ShardDirectory.h"
+#include "Storage.h"
+#include "Trace.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <ostream>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
 #include <vector>
 
 namespace kvs {
@@ -11,15 +30,225 @@ namespace kvs {
 using namespace utils;
 using kvs::cache_map::CacheMap;
 using kvs::shard::Shard;
+using kvs::shard::ShardBuilder;
+using kvs::shard::ShardDirectory;
+
+/**
+ * @brief Limits of the background compaction, so that it doesn't take the disk away from foreground operations.
+ *
+ */
+struct CompactionConfig final {
+  /**
+   * @brief The number of shards compacted at the same time, i.e. the number of compaction threads.
+   *
+   */
+  size_t threadsCnt = 1;
+
+  /**
+   * @brief The disk traffic all compactions together may cause, in bytes per second. 0 means unlimited.
+   *
+   */
+  double bytesPerSecond = 0;
+
+  /**
+   * @brief The rate of foreground operations per second above which the KVS is busy. A compaction doesn't start while
+   * the KVS is busy, but waits no longer than maxBusyDelay. 0 means the KVS is never busy.
+   *
+   */
+  double busyOperationsPerSecond = 0;
+
+  std::chrono::milliseconds maxBusyDelay{1000};
+};
+
+/**
+ * @brief A snapshot of the state of the background compaction.
+ *
+ */
+struct CompactionStats final {
+  /**
+   * @brief The number of shards waiting for a compaction.
+   *
+   */
+  size_t queuedShardsCnt = 0;
+
+  /**
+   * @brief The disk space taken by dead values in the queued shards, as of their queueing.
+   *
+   */
+  uint64_t queuedGarbageBytesCnt = 0;
+
+  uint64_t compactionsCnt = 0;
+
+  /**
+   * @brief The disk space taken by dead values in the shards before they were compacted.
+   *
+   */
+  uint64_t reclaimedBytesCnt = 0;
+
+  /**
+   * @brief The bytes written by compactions, which is what CompactionConfig::bytesPerSecond limits.
+   *
+   */
+  uint64_t writtenBytesCnt = 0;
+
+  /**
+   * @brief The total time the compactions ran, summed over the threads.
+   *
+   */
+  std::chrono::duration<double> compactingTime{0};
+
+  /**
+   * @brief The total time the compactions were held back by the I/O budget or a busy KVS.
+   *
+   */
+  std::chrono::duration<double> throttledTime{0};
+};
+
+/**
+ * @brief What the CacheMap lookups of get() and multiGet() found, and which entries were displaced from it.
+ *
+ */
+struct CacheMapStats final {
+  /**
+   * @brief Lookups that found a present value, so the index wasn't read.
+   *
+   */
+  metrics::Counter hitsCnt;
+
+  /**
+   * @brief Lookups that found the Key removed or nonexistent, so nothing was read at all.
+   *
+   */
+  metrics::Counter negativeHitsCnt;
+
+  /**
+   * @brief Lookups that found nothing, so the shard was asked.
+   *
+   */
+  metrics::Counter missesCnt;
+
+  /**
+   * @brief Displaced entries, indexed by their PtrType. Only DELETED ones have to be pushed to their shards.
+   *
+   */
+  std::array<metrics::Counter, 4> displacedCnts;
+};
+
+/**
+ * @brief How full a single shard is.
+ *
+ */
+struct ShardStats final {
+  shard_index_t shardIndex = 0;
+  size_t aliveValuesCnt = 0;
+
+  /**
+   * @brief Alive values plus the dead slots that still take disk space.
+   *
+   */
+  size_t totalValuesCnt = 0;
+};
+
+/**
+ * @brief A snapshot of all counters of a KVS, see KVS::stats().
+ *
+ */
+struct KVSStats final {
+  CacheMapStats cacheMapStats;
+  /**
+   * @brief The number of entries in the CacheMap.
+   *
+   */
+  size_t cacheMapUsedSize = 0;
+  size_t cacheMapCapacity = 0;
+  bloom_filter::BloomFilterStats filterStats;
+  shard::ShardIOStats ioStats;
+  shard::RebuildStats rebuildStats;
+  CompactionStats compactionStats;
+
+  /**
+   * @brief The system calls and the bytes transferred on behalf of every kind of operation.
+   *
+   */
+  storage::SyscallStats syscallStats;
+
+  /**
+   * @brief The used shards in ascending order of their indices.
+   *
+   */
+  std::vector<ShardStats> shardStats;
+
+  /**
+   * @brief Print the counters as "name: value" lines, with the shards summarized by the deciles of alive values per
+   * total ones.
+   *
+   */
+  void printText(std::ostream& out) const;
+
+  /**
+   * @brief Print the counters as a single line JSON object, including every shard.
+   *
+   */
+  void printJSON(std::ostream& out) const;
+};
+
+/**
+ * @brief The reader-writer lock of a shard together with its version, on a cache line of their own.
+ *
+ * Every operation takes the lock of its shard, so packing the locks of neighbouring shards into a line would make their
+ * readers and writers invalidate each other's caches.
+ *
+ */
+struct alignas(64) ShardLock final {
+  std::shared_mutex mutex;
+
+  /**
+   * @brief Incremented whenever the shard is locked exclusively, so that KVS::compactShard() can tell if the shard has
+   * been changed while its lock was released. Guarded by the mutex.
+   *
+   */
+  uint64_t version = 0;
+};
 
 /**
  * @brief The class that provides an access to a key-value storage.
  *
+ * All methods are thread-safe. Every shard has its own reader-writer lock, which also guards the state of its keys in the
+ * CacheMap, so operations on different shards run in parallel. The CacheMap synchronizes itself: lookups are lock-free,
+ * writes lock one stripe of it. While a shard is locked exclusively, the entries of its keys can still be displaced by
+ * other threads, but nothing else changes them.
+ *
+ * Lock order: a shard lock first, then the resharding mutex, then a CacheMap stripe, then the pending removals. A single
+ * operation never holds more than one shard lock, batches take them in ascending order.
+ *
+ * Keys are mapped to shards by a ShardDirectory. A shard whose index is full is split in two by the writer that found it
+ * full, a compacted shard is merged with its buddy if both together are sparse enough. Both happen under the exclusive
+ * locks of the shards involved, so an operation looks up the shard of a Key again after locking it and starts over if
+ * the Key has moved meanwhile.
+ *
+ * Shards that accumulated too many removed values are compacted by background threads, those with the most garbage
+ * first and within the limits of a CompactionConfig. A compaction builds the new files while holding the shard lock
+ * shared, so readers keep using the old files, and swaps them in under the exclusive lock.
+ *
  */
 class KVS final {
 
 public:
-  KVS();
+  /**
+   * @brief Construct a new KVS. Shards already present in the storage directory are reopened.
+   *
+   * @param cacheMapMemoryBudget The amount of RAM in bytes the CacheMap is allowed to take.
+   * @param compactionConfig The limits of the background compaction.
+   */
+  explicit KVS(
+      size_t cacheMapMemoryBudget = CACHE_MAP_SIZE * CacheMap::SLOT_MEMORY_SIZE,
+      const CompactionConfig& compactionConfig = CompactionConfig{});
+
+  /**
+   * @brief Stop the compaction threads. Compactions that haven't started yet are dropped, their shards stay valid.
+   *
+   */
+  ~KVS();
 
   /**
      * @brief Add a new record to the storage.
@@ -42,25 +271,357 @@ public:
      */
   std::optional<Value> get(const Key& key);
 
+  /**
+   * @brief Batched get().
+   *
+   * All keys are hashed and looked up in the CacheMap first, then the rest of the work is grouped by shard, so every
+   * touched shard opens its files once per batch. Different shards are processed in parallel.
+   *
+   * @return The values in the order of keys.
+   */
+  std::vector<std::optional<Value>> multiGet(const std::vector<Key>& keys);
+
+  /**
+   * @brief Batched add(), grouped by shard like multiGet(). If a Key repeats, the last Value wins.
+   *
+   */
+  void multiPut(const std::vector<KeyValue>& keyValues);
+
+  /**
+   * @brief Batched remove(), grouped by shard like multiGet().
+   *
+   */
+  void multiRemove(const std::vector<Key>& keys);
+
   /**
      * @brief Clear the storage entirely.
      *
      */
   void clear();
 
+  /**
+   * @brief Push all delayed removals to disk and save the metadata of every shard.
+   *
+   * After a checkpoint the storage can be reopened by a new KVS without scanning shard indices.
+   *
+   */
+  void checkpoint();
+
+  /**
+   * @brief Block until all scheduled shard compactions are done.
+   *
+   * @throws KVSException if a compaction failed in the background since the last call.
+   */
+  void waitForCompactions();
+
+  /**
+   * @brief Resize the CacheMap to fit into the new memory budget. Displaced entries are pushed to their shards.
+   *
+   */
+  void resizeCacheMap(size_t cacheMapMemoryBudget);
+
+  /**
+   * @brief Get the maximum number of entries the CacheMap holds.
+   *
+   */
+  size_t getCacheMapCapacity() const noexcept;
+
+  /**
+   * @brief Get the approximate amount of RAM taken by the CacheMap in bytes.
+   *
+   */
+  size_t getCacheMapMemoryFootprint() const noexcept;
+
+  /**
+   * @brief Get the filter check counters of the shards, including the measured false positive rate.
+   *
+   */
+  const bloom_filter::BloomFilterStats& getBloomFilterStats() const noexcept;
+
+  /**
+   * @brief Get the rebuild counters of the shards.
+   *
+   */
+  const shard::RebuildStats& getRebuildStats() const noexcept;
+
+  /**
+   * @brief Get the system calls made on behalf of every kind of operation of this KVS.
+   *
+   */
+  const storage::SyscallStats& getSyscallStats() const noexcept;
+
+  /**
+   * @brief Get the compaction backlog and what the compactions have done so far.
+   *
+   */
+  CompactionStats getCompactionStats();
+
+  /**
+   * @brief Take a snapshot of all counters. Every used shard is locked shared in turn, so it waits for writers.
+   *
+   */
+  KVSStats stats();
+
+  /**
+   * @brief Print stats() to the stream every period from a background thread, until stopStatsDump() or the destruction
+   * of the KVS. Replaces a dump that is already running.
+   *
+   * @param json Whether to print KVSStats::printJSON() lines instead of the text.
+   */
+  void startStatsDump(std::ostream& out, std::chrono::milliseconds period,
+                      bool json = false);
+
+  void stopStatsDump();
+
+  /**
+   * @brief Record every add(), get() and remove() to a trace file until stopTrace(), see trace::TraceWriter. Batched
+   * operations aren't recorded. Replaces a trace that is already running.
+   *
+   * @param fullKeys Whether to record the keys themselves rather than their hashes.
+   * @throws KVSException if the file can't be created.
+   */
+  void startTrace(const std::string& filePath, bool fullKeys = false);
+
+  /**
+   * @brief Stop recording and write the rest of the trace. Operations still running may add their records before it is
+   * closed.
+   *
+   * @throws KVSException if writing the trace fails.
+   */
+  void stopTrace();
+
+  /**
+   * @brief Get the index of the shard that currently holds the Key. It changes when the shard is split or merged.
+   *
+   */
+  shard_index_t getShardIndex(const Key& key) const noexcept;
+
 private:
   /**
-    * @brief Rebuilds the shard with the given index.
-    * 
+   * @brief What a compaction of one shard did, see CompactionStats.
+   *
+   */
+  struct CompactionResult final {
+    uint64_t reclaimedBytesCnt = 0;
+    uint64_t writtenBytesCnt = 0;
+  };
+
+  /**
+    * @brief Rebuilds the shard with the given index. Requires the exclusive lock of the shard.
+    *
+    * Pending removals of the shard are pushed by the rebuild.
     */
-  void rebuildShard(shard_index_t shardIndex);
+  CompactionResult rebuildShard(shard_index_t shardIndex);
+
+  /**
+   * @brief Look up the CacheMap Ptr of a Key for a rebuild. Requires the lock of the shard.
+   *
+   * A pending removal is reported as a delayed one and appended to pendingKeys, see applyRebuiltShard().
+   *
+   */
+  Ptr getCacheMapPtrForRebuild(const HashedKey& key,
+                               std::vector<Key>& pendingKeys) const noexcept;
+
+  /**
+   * @brief Replace the shard with the rebuilt one and update the CacheMap. Requires the exclusive lock of the shard.
+   *
+   * @param pendingKeys Pending removals the rebuild has pushed.
+   */
+  CompactionResult applyRebuiltShard(shard_index_t shardIndex,
+                                     ShardBuilder::RebuiltShard& rebuilt,
+                                     const std::vector<Key>& pendingKeys);
+
+  /**
+   * @brief Queue the shard for the compaction threads, or update its priority if it is queued already. Requires the
+   * lock of the shard.
+   *
+   */
+  void scheduleCompaction(shard_index_t shardIndex);
+
+  /**
+   * @brief The loop of a compaction thread.
+   *
+   */
+  void runCompactions() noexcept;
+
+  /**
+   * @brief Wait until the I/O budget allows the next compaction and the KVS isn't busy, or until compactions are
+   * stopped. Requires compactionMutex held by compactionLock.
+   *
+   */
+  void throttleCompaction(std::unique_lock<std::mutex>& compactionLock);
+
+  /**
+   * @brief Count foreground operations, so that compactions can tell if the KVS is busy.
+   *
+   */
+  void countForegroundOperations(size_t operationsCnt) noexcept;
+
+  /**
+   * @brief Rebuild the shard, if it is still required, without blocking its readers.
+   *
+   * The new files are built under the shared lock. If a writer gets in before the exclusive lock is taken for the swap,
+   * they are discarded and built again. After a few lost races the shard is rebuilt under the exclusive lock.
+   *
+   */
+  CompactionResult compactShard(shard_index_t shardIndex);
+
+  /**
+   * @brief Lock the shard for an operation that changes it, see ShardLock::version.
+   *
+   */
+  std::unique_lock<std::shared_mutex>
+  lockShardExclusively(shard_index_t shardIndex);
+
+  /**
+   * @brief Lock the shard of the Key shared. The lookup is repeated until the Key doesn't move to another shard before
+   * the lock is taken.
+   *
+   * @return The index of the shard and its lock.
+   */
+  std::pair<shard_index_t, std::shared_lock<std::shared_mutex>>
+  lockShardOf(const HashedKey& key) const;
+
+  /**
+   * @brief Same as lockShardOf(), but the lock is exclusive, see lockShardExclusively().
+   *
+   */
+  std::pair<shard_index_t, std::unique_lock<std::shared_mutex>>
+  lockShardOfExclusively(const HashedKey& key);
+
+  /**
+   * @brief Write the Value of a Key missing from the CacheMap to its shard. Requires the exclusive lock of the shard.
+   *
+   * @return The new Entry, or nothing if the shard was full and has been split instead. The Key may have moved to the
+   * new shard then, so the write has to be repeated.
+   */
+  std::optional<Entry> writeValueOrSplit(shard_index_t shardIndex,
+                                         const HashedKey& key,
+                                         const Value& value);
+
+  /**
+   * @brief Split the shard in two, moving half of its slots in the directory to a new shard. Requires the exclusive
+   * lock of the shard.
+   *
+   * The new shard is written first, then the directory is saved, then the old shard is rewritten. A crash between the
+   * last two steps only leaves copies of the moved keys in the old shard, which are ignored.
+   *
+   * @throws KVSException SHARD_OVERFLOW if the directory can't grow any further.
+   */
+  void splitShard(shard_index_t shardIndex);
+
+  /**
+   * @brief Merge the shard with its buddy if both together hold few enough keys, see SHARD_MERGE_LOAD_FACTOR. Takes
+   * the locks of both shards.
+   *
+   * The merged shard is written first, then the directory is saved, then the files of the other shard are removed.
+   *
+   * @return The index of the merged shard, or nothing if the shard wasn't merged.
+   */
+  std::optional<shard_index_t> mergeShard(shard_index_t shardIndex);
+
+  /**
+   * @brief Overwrite the CacheMap ptrs of keys whose shard was rebuilt, see ShardBuilder::RebuiltShard. Requires the
+   * exclusive lock of the shard.
+   *
+   */
+  void applyCacheMapUpdates(const std::vector<Entry>& cacheMapUpdatedEntries);
+
+  /**
+   * @brief Put the Ptr into the CacheMap.
+   *
+   * When a delayed removal is displaced, it is registered as a pending removal and appended to displaced. It has to be
+   * passed to pushRemovals() after all shard locks are released.
+   *
+   */
+  void putIntoCacheMap(const HashedKey& key, Ptr ptr,
+                       std::vector<Entry>& displaced);
+
+  /**
+   * @brief Handle an Entry displaced from the CacheMap, see putIntoCacheMap().
+   *
+   */
+  void registerDisplaced(const Entry& entry, std::vector<Entry>& displaced);
+
+  /**
+   * @brief Count a CacheMap lookup of get() or multiGet() in cacheMapStats. A pending removal counts as NONEXISTENT.
+   *
+   */
+  void countLookup(Ptr ptr) noexcept;
+
+  /**
+   * @brief Get the running trace, if any.
+   *
+   */
+  std::shared_ptr<trace::TraceWriter> getTraceWriter() const noexcept;
+
+  /**
+   * @brief Overwrite the CacheMap Ptr of a Key that has just been looked up. Requires the exclusive lock of the shard.
+   *
+   * @return The old Ptr, or EMPTY_PTR if the Entry has been displaced since the lookup. Then a delayed removal is pending.
+   */
+  Ptr replaceCacheMapPtr(const HashedKey& key, Ptr oldPtr, Ptr newPtr) noexcept;
+
+  /**
+   * @brief Unregister a pending removal of the Key.
+   *
+   * @return Whether the removal was pending. If so, the caller has to push it to the shard before releasing the shard lock.
+   */
+  bool takePendingRemoval(const Key& key) noexcept;
+
+  /**
+   * @brief Requires the lock of the shard. Only a Key missing from the CacheMap can be a pending removal, so a lookup
+   * has to precede the check.
+   *
+   */
+  bool isPendingRemoval(const Key& key) const noexcept;
+
+  /**
+   * @brief When a delayed removal is displaced from the CacheMap, it should be pushed to the shard. Use this method for that.
+   *
+   * Must be called without holding any lock. Rebuilds shards if necessary.
+   *
+   */
+  void pushRemovals(std::vector<Entry> displaced);
 
 private:
   /**
-   * @brief Shard objects representing... shards?
+   * @brief Maps keys to the indices of their shards.
+   *
+   */
+  ShardDirectory directory;
+
+  /**
+   * @brief The counters of the shards and their rebuilds. Declared before the shards, which point to them.
+   *
+   */
+  shard::ShardCounters shardCounters;
+
+  /**
+   * @brief Where the IOOperationScopes of the operations count their system calls.
+   *
+   */
+  storage::SyscallStats syscallStats;
+
+  /**
+   * @brief Shard objects representing... shards? Only the indices in use by the directory hold one.
    * 
    */
-  std::vector<Shard> shards;
+  std::vector<std::optional<Shard>> shards;
+
+  /**
+   * @brief The locks of the shards with the same indices.
+   *
+   * resizeCacheMap() takes all of them, so holding any shard lock keeps the layout of the CacheMap.
+   *
+   */
+  mutable std::vector<ShardLock> shardLocks;
+
+  /**
+   * @brief Taken by splits and merges after the shard locks, so that the changes of the directory don't overlap.
+   *
+   */
+  std::mutex reshardingMutex;
 
   /**
     * @brief Cache map, stored in RAM.
@@ -69,11 +630,125 @@ private:
   CacheMap cacheMap;
 
   /**
-    * @brief When an entry is displaced from the CacheMap, the corresponding operation should be pushed to the shard. Use this method for that.
-    * 
-    * @param displaced 
-    */
-  void pushOperation(Entry displaced);
+   * @brief Delayed removals that were displaced from the CacheMap, but not yet pushed to their shards.
+   *
+   * Their keys are treated as removed. They are registered before the displacement becomes visible, so a Key missing
+   * from the CacheMap is either here or in sync with its shard. There are at most as many of them as there are threads
+   * using the KVS.
+   *
+   */
+  std::vector<Key> pendingRemovals;
+
+  /**
+   * @brief The size of pendingRemovals, so that lookups can skip the mutex while there are none.
+   *
+   */
+  std::atomic<size_t> pendingRemovalsCnt;
+
+  /**
+   * @brief Guards pendingRemovals.
+   *
+   */
+  mutable std::mutex pendingRemovalsMutex;
+
+  const CompactionConfig compactionConfig;
+
+  /**
+   * @brief The priority of a queued shard: its garbage in bytes, then the share of garbage in its values file.
+   *
+   */
+  using CompactionPriority = std::tuple<uint64_t, double, shard_index_t>;
+
+  /**
+   * @brief Shards waiting for the compaction threads, the worst one first.
+   *
+   */
+  std::set<CompactionPriority, std::greater<CompactionPriority>>
+      compactionQueue;
+
+  /**
+   * @brief The entry in compactionQueue of the shard with the same index, if it is queued.
+   *
+   */
+  std::vector<std::optional<CompactionPriority>> queuedCompactions;
+
+  /**
+   * @brief Whether the shard with the same index is being compacted. Such a shard may be queued again, but it isn't
+   * compacted twice at the same time.
+   *
+   */
+  std::vector<bool> activeCompactions;
+
+  /**
+   * @brief The number of compactions currently running.
+   *
+   */
+  size_t activeCompactionsCnt;
+
+  /**
+   * @brief The time at which the I/O budget is paid off. Each compaction moves it forward by its written bytes.
+   *
+   */
+  std::chrono::steady_clock::time_point compactionBudgetTime;
+
+  CompactionStats compactionStats;
+
+  /**
+   * @brief The number of foreground operations so far, counted only if CompactionConfig::busyOperationsPerSecond is set.
+   *
+   */
+  std::atomic<uint64_t> foregroundOperationsCnt;
+
+  /**
+   * @brief The first exception thrown by a compaction, rethrown by waitForCompactions().
+   *
+   */
+  std::exception_ptr compactionException;
+
+  bool compactionsStopped;
+
+  /**
+   * @brief Guards the compaction state above. Taken after shard locks.
+   *
+   */
+  std::mutex compactionMutex;
+
+  /**
+   * @brief Notified when a compaction is queued or finished.
+   *
+   */
+  std::condition_variable compactionCondition;
+
+  std::vector<std::thread> compactionThreads;
+
+  CacheMapStats cacheMapStats;
+
+  /**
+   * @brief Guards statsDumpStopped and wakes the dump thread up when it is set.
+   *
+   */
+  bool statsDumpStopped;
+  std::mutex statsDumpMutex;
+  std::condition_variable statsDumpCondition;
+
+  /**
+   * @brief Serializes startStatsDump() and stopStatsDump(), which replace statsDumpThread.
+   *
+   */
+  std::mutex statsDumpThreadMutex;
+  std::thread statsDumpThread;
+
+  /**
+   * @brief Whether traceWriter is set, so that operations skip the atomic load of the shared_ptr while not tracing.
+   *
+   */
+  std::atomic<bool> tracing;
+
+  /**
+   * @brief Accessed with std::atomic_load() and std::atomic_store(). Operations hold a copy while they run.
+   *
+   */
+  std::shared_ptr<trace::TraceWriter> traceWriter;
 };
 
 } // namespace kvs
@@ -14,13 +14,17 @@ enum class KVSErrorType {
   STORAGE_HASH_TABLE_INVALID_BUILD_DATA,
   FAILED_TO_CREATE_SHARD_DIRECTORY,
   SHARD_REBUILDER_FAILED_TO_REPLACE_OLD_FILES,
-  FAILED_TO_GET_VALUES_FILE_SIZE
+  FAILED_TO_GET_VALUES_FILE_SIZE,
+  SHARD_METADATA_INVALID_BUILD_DATA,
+  SHARD_DIRECTORY_INVALID_BUILD_DATA,
+  TRACE_INVALID_DATA
 };
 
 class KVSException final : public std::exception {
 public:
   explicit KVSException(KVSErrorType errType) noexcept;
   const char* what() const noexcept override;
+  KVSErrorType getType() const noexcept;
 
 private:
   KVSErrorType errType;
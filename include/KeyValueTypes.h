@@ -12,10 +12,9 @@ constexpr size_t VALUE_SIZE = 2048;
 constexpr size_t KEY_SIZE = 16;
 constexpr size_t CACHE_MAP_SIZE = 5000;
 constexpr double MAP_LOAD_FACTOR = 1.5;
-constexpr size_t SHARD_NUMBER = 4981;
 constexpr double MAX_OUTDATED_RECORDS_LOAD_FACTOR = 0.5;
-constexpr size_t BLOOM_FILTER_SIZE = 19;
-constexpr size_t BLOOM_FILTER_HASH_FUNCTIONS_NUMBER = 2;
+constexpr double BLOOM_FILTER_FALSE_POSITIVE_RATE = 0.01;
+constexpr double COMPACTION_REWRITE_FRAGMENTATION = 0.75;
 constexpr size_t SHARD_EXPECTED_SIZE = 23;
 constexpr double STORAGE_HASH_TABLE_EXPANSION_FACTOR = 2;
 constexpr double STORAGE_HASH_TABLE_LOAD_FACTOR = MAP_LOAD_FACTOR;
@@ -23,6 +22,12 @@ constexpr size_t STORAGE_HASH_TABLE_INITIAL_SIZE =
     SHARD_EXPECTED_SIZE * STORAGE_HASH_TABLE_LOAD_FACTOR;
 constexpr size_t STORAGE_HASH_TABLE_MAX_SIZE =
     STORAGE_HASH_TABLE_EXPANSION_FACTOR * STORAGE_HASH_TABLE_INITIAL_SIZE;
+constexpr size_t SHARD_MAX_KEYS_CNT =
+    STORAGE_HASH_TABLE_MAX_SIZE / STORAGE_HASH_TABLE_LOAD_FACTOR;
+constexpr double SHARD_MERGE_LOAD_FACTOR = 0.5;
+constexpr uint8_t INITIAL_SHARD_DEPTH = 6;
+constexpr uint8_t MAX_SHARD_DEPTH = 16;
+constexpr size_t MAX_SHARDS_CNT = size_t{1} << MAX_SHARD_DEPTH;
 
 // #define TEST_STORAGE_HASH_TABLE
 // constexpr size_t STORAGE_HASH_TABLE_INITIAL_SIZE = 25000;
@@ -57,6 +62,50 @@ private:
 
 hash_t hashKey(const Key& key, seed_t seed = 0) noexcept;
 
+/**
+ * @brief Map a 32-bit hash onto [0, range) by multiply-shift, which is cheaper than a modulo.
+ *
+ */
+inline size_t reduceRange(uint32_t hash, size_t range) noexcept {
+  return (static_cast<uint64_t>(hash) * range) >> 32;
+}
+
+/**
+ * @brief A Key together with its 128-bit hash.
+ *
+ * Built once per operation, so that every layer derives its positions from different bits of the same hash:
+ * - upper 32 bits of the high half - the shard, whose directory slot is taken from the lower of these bits;
+ * - lower 32 bits of the high half - the CacheMap slot;
+ * - upper 32 bits of the low half - the StorageHashTable slot and the BloomFilter probes;
+ * - lower 32 bits of the low half - the BloomFilter block.
+ *
+ * The conversion from Key is implicit for convenience, but it hashes the Key, so hot paths should construct a HashedKey once
+ * and pass it along.
+ *
+ */
+class HashedKey final {
+public:
+  HashedKey(const Key& key) noexcept;
+
+  const Key& getKey() const noexcept;
+
+  /**
+   * @brief The half of the hash used inside a shard.
+   *
+   */
+  hash_t getLowHash() const noexcept;
+
+  uint32_t getShardBits() const noexcept;
+
+  uint32_t getCacheMapBits() const noexcept;
+
+  uint32_t getStorageHashTableBits() const noexcept;
+
+private:
+  Key key;
+  XXH128_hash_t hash;
+};
+
 /**
  * @brief The value type KVS operates with.
  * 
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace kvs::metrics {
+
+/**
+ * @brief A counter that is cheap to increment from many threads at once.
+ *
+ * The count is split into stripes on separate cache lines and every thread increments the stripe assigned to it, so
+ * threads don't bounce a shared line on every increment. Reading sums up the stripes, so it is slower and only
+ * eventually consistent with concurrent increments.
+ *
+ * Works as a drop-in for a std::atomic<uint64_t> that is only incremented and read.
+ *
+ */
+class Counter final {
+public:
+  /**
+   * @brief The number of stripes. Threads beyond it share stripes round-robin. Must be a power of two.
+   *
+   */
+  static constexpr size_t STRIPES_CNT = 16;
+
+  Counter() noexcept;
+  Counter(uint64_t value) noexcept;
+
+  /**
+   * @brief Copy the current sum, e.g. to take a snapshot of a stats struct.
+   *
+   */
+  Counter(const Counter& other) noexcept;
+  Counter& operator=(const Counter& other) noexcept;
+  Counter& operator=(uint64_t value) noexcept;
+
+  Counter& operator++() noexcept;
+  Counter& operator+=(uint64_t delta) noexcept;
+
+  uint64_t load() const noexcept;
+  operator uint64_t() const noexcept;
+
+private:
+  struct alignas(64) Stripe final {
+    std::atomic<uint64_t> value{0};
+  };
+
+  static size_t getStripeIndex() noexcept;
+
+  std::unique_ptr<Stripe[]> stripes;
+};
+
+} // namespace kvs::metrics
@@ -2,14 +2,112 @@
 
 #include "BloomFilter.h"
 #include "KeyValueTypes.h"
+#include "Metrics.h"
 
+#include <atomic>
+#include <functional>
 #include <optional>
 #include <string>
+#include <vector>
+
+namespace kvs::storage {
+class Storage;
+} // namespace kvs::storage
+
+namespace kvs::storage_hash_table {
+class StorageHashTable;
+} // namespace kvs::storage_hash_table
 
 namespace kvs::shard {
 
 using namespace kvs::utils;
 
+/**
+ * @brief Counters of the disk accesses made by shard operations, compactions excluded (see RebuildStats).
+ *
+ */
+struct ShardIOStats final {
+  /**
+   * @brief Number of times an index file was read or written as a whole.
+   *
+   */
+  metrics::Counter indexReadsCnt;
+  metrics::Counter indexWritesCnt;
+
+  metrics::Counter valuesReadBytesCnt;
+  metrics::Counter valuesWrittenBytesCnt;
+};
+
+/**
+ * @brief Counters of shard rebuilds, used to measure how much of the disk traffic is spent on compaction.
+ *
+ * The counters are atomic, since shards are rebuilt on a background thread.
+ *
+ */
+struct RebuildStats final {
+  RebuildStats() noexcept = default;
+  RebuildStats(const RebuildStats& other) noexcept;
+  RebuildStats& operator=(const RebuildStats& other) noexcept;
+
+  /**
+   * @brief Number of rebuilt shards that replaced the old ones.
+   *
+   */
+  std::atomic<uint64_t> rebuildsCnt = 0;
+
+  /**
+   * @brief Number of value bytes copied into rebuilt shards, including the builds that were discarded.
+   *
+   */
+  std::atomic<uint64_t> copiedBytesCnt = 0;
+
+  /**
+   * @brief Number of shards compacted by punching holes, a part of rebuildsCnt.
+   *
+   */
+  std::atomic<uint64_t> holePunchesCnt = 0;
+
+  /**
+   * @brief Number of dead value bytes released by punching holes.
+   *
+   */
+  std::atomic<uint64_t> punchedBytesCnt = 0;
+
+  /**
+   * @brief Number of shards split in two because their index was full. The values they copied count in copiedBytesCnt.
+   *
+   */
+  std::atomic<uint64_t> splitsCnt = 0;
+
+  /**
+   * @brief Number of pairs of sparse shards merged into one.
+   *
+   */
+  std::atomic<uint64_t> mergesCnt = 0;
+
+  /**
+   * @brief Time spent building the new files of rebuilds, splits and merges in nanoseconds, including the builds that
+   * were discarded.
+   *
+   */
+  std::atomic<uint64_t> buildNanosCnt = 0;
+};
+
+/**
+ * @brief The counters updated by the shards of a KVS and their rebuilds. Every KVS owns its own, so that its stats
+ * don't mix with those of other instances in the process.
+ *
+ */
+struct ShardCounters final {
+  /**
+   * @brief Filter check results.
+   *
+   */
+  bloom_filter::BloomFilterStats filterStats;
+  ShardIOStats ioStats;
+  RebuildStats rebuildStats;
+};
+
 /**
  * @brief A single part of KVS after sharding. Contains a BloomFilter and loads StorageHashTable into RAM from disk when necessary.
  * 
@@ -18,26 +116,22 @@ using namespace kvs::utils;
  */
 class Shard final {
 public:
-  /**
-     * @brief Get the index of a shard that contains the Key.
-     *
-     */
-  static shard_index_t getShardIndex(const Key& key) noexcept;
-
   /**
      * @brief Read a value from this shard.
      *
      * @return pair.first - the Entry corresponding to the Key. Used to update the CacheMap. \n pair.second - the actual Value or nothing, if none is present.
      */
   std::pair<Entry, std::optional<Value>> readValue(shard_index_t shardIndex,
-                                                   const Key& key) const;
+                                                   const HashedKey& key) const;
 
   /**
      * @brief Write a Value to this shard.
      *
      * @return Either the old or the new Entry that corresponds to given Key.
+     * @throws KVSException SHARD_OVERFLOW if the Key is new and the index is full. Nothing is changed then, the shard
+     * has to be split.
      */
-  Entry writeValue(shard_index_t shardIndex, const Key& key,
+  Entry writeValue(shard_index_t shardIndex, const HashedKey& key,
                    const Value& value);
 
   /**
@@ -47,7 +141,7 @@ public:
      *
      * @return The new Entry that corresponds to given Key.
      */
-  Entry removeEntry(shard_index_t shardIndex, const Key& key);
+  Entry removeEntry(shard_index_t shardIndex, const HashedKey& key);
 
   /**
    * @brief Push the delayed removal operation onto disk.
@@ -55,7 +149,35 @@ public:
    * Basically same as removeEntry() except this one doesn't decrement the aliveValuesCnt.
    * 
    */
-  Entry pushRemoveEntry(shard_index_t shardIndex, const Key& key);
+  Entry pushRemoveEntry(shard_index_t shardIndex, const HashedKey& key);
+
+  /**
+   * @brief Batched readValue(). The index is loaded and the values file is opened at most once.
+   *
+   * @return The results in the order of keys.
+   */
+  std::vector<std::pair<Entry, std::optional<Value>>>
+  readValues(shard_index_t shardIndex, const std::vector<HashedKey>& keys) const;
+
+  /**
+   * @brief Batched writeValue(). The index is loaded and saved once, the values file is opened once.
+   *
+   * Keys may repeat; later values overwrite earlier ones.
+   *
+   * @return The entries in the order of keys.
+   * @throws KVSException SHARD_OVERFLOW if the new keys don't fit into the index. Nothing is changed then.
+   */
+  std::vector<Entry>
+  writeValues(shard_index_t shardIndex, const std::vector<HashedKey>& keys,
+              const std::vector<std::reference_wrapper<const Value>>& values);
+
+  /**
+   * @brief Batched removeEntry(). The index is loaded and saved at most once.
+   *
+   * @return The entries in the order of keys.
+   */
+  std::vector<Entry> removeEntries(shard_index_t shardIndex,
+                                   const std::vector<HashedKey>& keys);
 
   /**
      * @brief Read a Value directly from disk storage. Used when CacheMap entry is hit.
@@ -75,6 +197,21 @@ public:
   void writeValueDirectly(shard_index_t shardIndex, Ptr ptr,
                           const Value& value);
 
+  /**
+   * @brief Batched readValueDirectly(). The values file is opened once.
+   *
+   */
+  std::vector<Value> readValuesDirectly(shard_index_t shardIndex,
+                                        const std::vector<Ptr>& ptrs) const;
+
+  /**
+   * @brief Batched writeValueDirectly(). The values file is opened once.
+   *
+   */
+  void writeValuesDirectly(
+      shard_index_t shardIndex, const std::vector<Ptr>& ptrs,
+      const std::vector<std::reference_wrapper<const Value>>& values);
+
   /**
      * @brief Increase the counter of non-deleted elements in this shard.
      *
@@ -92,11 +229,58 @@ public:
   void decrementAliveValuesCnt() noexcept;
 
   /**
-    * @brief Check if a rebuild needs to be called.
+    * @brief Get the number of keys stored in this shard that aren't removed, lazily removed ones excluded.
+    *
+    */
+  size_t getAliveValuesCnt() const noexcept;
+
+  /**
+    * @brief Check the filter for the Key without counting it in ShardCounters::filterStats, e.g. to tell if readValue()
+    * would read the index.
+    *
+    */
+  bool mayContain(const HashedKey& key) const noexcept;
+
+  /**
+    * @brief Get the number of value slots that are dead and can be taken by new keys.
+    *
+    */
+  size_t getFreeSlotsCnt() const noexcept;
+
+  /**
+    * @brief Get the number of value slots released by hole-punching compaction. New keys take them first.
+    *
+    */
+  size_t getHolesCnt() const noexcept;
+
+  /**
+    * @brief Get the number of slots of the values file that hold dead values and still take disk space, i.e. what a
+    * rebuild would reclaim. Holes don't count, their space is released already.
+    *
+    */
+  size_t getDeadSlotsCnt(shard_index_t shardIndex) const;
+
+  /**
+    * @brief Check if a rebuild needs to be called, i.e. if too many slots of the values file are dead, see
+    * getDeadSlotsCnt().
     * 
     */
   bool isRebuildRequired(shard_index_t shardIndex) const;
 
+  /**
+    * @brief Write the metadata file, so the shard can be reopened without scanning its index.
+    *
+    * The file is removed again by the first operation that changes the index file.
+    *
+    */
+  void saveMetadata(shard_index_t shardIndex);
+
+  /**
+    * @brief Check if the metadata file on disk is up to date.
+    *
+    */
+  bool isMetadataSaved() const noexcept;
+
   /**
     * @brief The path to the directory that contains the internal files.
     * 
@@ -110,13 +294,112 @@ public:
   static std::string
   getStorageHashTableFilePath(shard_index_t shardIndex) noexcept;
 
+  static std::string getMetadataFilePath(shard_index_t shardIndex) noexcept;
+
+  /**
+    * @brief The target false positive rate of the filters of newly created or rebuilt shards.
+    *
+    */
+  static double filterFalsePositiveRate;
+
 private:
   /**
    * @brief Disallow to create Shard objects with constructors. Use ShardBuilder::createShard instead.
    * 
    */
-  explicit Shard() noexcept;
-  explicit Shard(const std::vector<Entry>& storageHashTableEntries) noexcept;
+  explicit Shard(ShardCounters& counters) noexcept;
+
+  /**
+   * @brief Create a Shard from the entries of its index. Value slots no entry points to are taken for holes.
+   *
+   */
+  explicit Shard(const std::vector<Entry>& storageHashTableEntries,
+                 size_t valuesFileSize, ShardCounters& counters) noexcept;
+
+  /**
+   * @brief Load a Shard from the contents of its metadata file.
+   *
+   * @throws KVSException if the data is corrupted or doesn't match the shard files.
+   */
+  explicit Shard(shard_index_t shardIndex, const ByteArray& serializedMetadata,
+                 ShardCounters& counters);
+
+  /**
+   * @brief The fixed-size part of the metadata file. It is followed by holesCnt offsets of holes and the filter.
+   *
+   */
+  struct MetadataHeader final {
+    uint32_t version;
+    uint32_t aliveValuesCnt;
+    uint64_t valuesFileSize;
+    uint64_t storageHashTableFileSize;
+    uint64_t freeSlotsCnt;
+    uint64_t holesCnt;
+  };
+
+  static constexpr uint32_t METADATA_VERSION = 5;
+
+  /**
+   * @brief Remove the metadata file before the index file is changed.
+   *
+   */
+  void invalidateMetadata(shard_index_t shardIndex);
+
+  /**
+   * @brief Replace the filter with a new one sized for the present entries, but no less than minExpectedKeysCnt, and fill it.
+   *
+   */
+  void rebuildFilter(const std::vector<Entry>& storageHashTableEntries,
+                     size_t minExpectedKeysCnt) noexcept;
+
+  /**
+   * @brief Add the Key to the filter and rebuild the filter twice as large if it overflows.
+   *
+   * @param storageHashTable The index, already containing the Key.
+   */
+  void addToFilter(
+      const HashedKey& key,
+      const storage_hash_table::StorageHashTable& storageHashTable) noexcept;
+
+  /**
+   * @brief Throw SHARD_OVERFLOW unless the index has room for the given number of keys it doesn't contain yet. New
+   * keys take the DELETED entries first, so those count as room.
+   *
+   */
+  void checkRoomFor(
+      const storage_hash_table::StorageHashTable& storageHashTable,
+      size_t newKeysCnt) const;
+
+  /**
+   * @brief Store the Value of a Key that is new to the index in the slot of a DELETED entry or a hole, or append it
+   * if there are none. DELETED entries go first, since taking one also frees an entry of the index.
+   *
+   * @return The Ptr to the Value, which has to be put into the index.
+   */
+  Ptr storeNewValue(storage_hash_table::StorageHashTable& storageHashTable,
+                    storage::Storage& valuesStorage, const Value& value);
+
+  /**
+   * @brief Read and write the index file, counting it in ShardCounters::ioStats.
+   *
+   */
+  storage_hash_table::StorageHashTable
+  readStorageHashTable(shard_index_t shardIndex) const;
+  void writeStorageHashTable(
+      shard_index_t shardIndex,
+      const storage_hash_table::StorageHashTable& storageHashTable) const;
+
+  /**
+   * @brief Update ShardCounters::filterStats after the index was looked up for a Key accepted by the filter.
+   *
+   */
+  void recordFilterPositive(const Ptr& storageHashTablePtr) const noexcept;
+
+  /**
+   * @brief The counters of the KVS the shard belongs to. Shared with the shards rebuilt from it.
+   *
+   */
+  ShardCounters* counters;
 
   /**
      * @brief Number of values that are stored on disk, but not deleted yet.
@@ -125,11 +408,31 @@ private:
   values_cnt_t aliveValuesCnt;
 
   /**
-     * @brief A filter.
+     * @brief Number of DELETED entries in the index. The slots they point to are reused by new keys before the values
+     * file grows, and the index itself serves as the list of them.
+     *
+     */
+  values_cnt_t freeSlotsCnt;
+
+  /**
+     * @brief Offsets of the value slots no index entry points to. Their space was released by punching holes, so unlike
+     * the slots of DELETED entries they don't make a rebuild necessary.
+     *
+     */
+  std::vector<size_t> holes;
+
+  /**
+     * @brief A filter holding exactly the keys that are present in the index.
      *
      */
   bloom_filter::BloomFilter filter;
 
+  /**
+     * @brief Whether the metadata file describes the current state of the shard.
+     *
+     */
+  bool metadataSaved;
+
   friend class ShardBuilder;
 };
 
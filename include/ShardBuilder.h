@@ -3,6 +3,9 @@
 #include "CacheMap.h"
 #include "KeyValueTypes.h"
 #include "Shard.h"
+#include <functional>
+#include <optional>
+#include <string>
 #include <utility>
 #include <vector>
 
@@ -10,6 +13,25 @@ namespace kvs::shard {
 
 using namespace kvs::utils;
 
+/**
+ * @brief The way a shard gets rid of its dead values.
+ *
+ */
+enum class CompactionMode {
+  /**
+   * @brief Copy the live values into a new values file. Shrinks the file, but moves every value.
+   *
+   */
+  REWRITE,
+
+  /**
+   * @brief Release the dead value slots in place and rewrite only the index. Live values keep their Ptrs, the freed
+   * slots are taken by new keys.
+   *
+   */
+  PUNCH_HOLES
+};
+
 class ShardBuilder final {
 
 public:
@@ -18,8 +40,37 @@ public:
    * 
    * A factory method for consistency.
    * 
+   * @param counters Updated by the Shard and the shards rebuilt from it, must outlive them.
+   */
+  static Shard createShard(shard_index_t shardIndex, ShardCounters& counters);
+
+  /**
+   * @brief Open an existing Shard or create a new one if its files don't exist.
+   *
+   * The Shard is loaded from its metadata file. If the file is missing or outdated, the index file is scanned instead and
+   * the metadata file is written anew.
+   *
+   * @param counters See createShard().
+   */
+  static Shard openShard(shard_index_t shardIndex, ShardCounters& counters);
+
+  /**
+   * @brief A Shard built by buildShard(). Its files are written next to the files of the old Shard and don't replace
+   * them until replaceShard() is called.
+   *
    */
-  static Shard createShard(shard_index_t shardIndex);
+  struct RebuiltShard final {
+    Shard shard;
+    CompactionMode mode;
+
+    /**
+     * @brief Entries in CacheMap that have to be overwritten: new ptrs of all surviving keys and NONEXISTENT for delayed
+     * removals. New ptrs are only needed for keys still present in the CacheMap. Surviving keys don't move when holes
+     * are punched, so there are no new ptrs then.
+     *
+     */
+    std::vector<Entry> cacheMapUpdatedEntries;
+  };
 
   /**
    * @brief Rebuild the Shard according to delayed removals stored in CacheMap.
@@ -29,11 +80,120 @@ public:
    * @param shard The Shard to rebuild.
    * @param cacheMap The CacheMap to read information about delayed removals from.
    * @return pair.first - The newly created Shard to replace the old one.
-   * @return pair.second - Entries in CacheMap that have to be overwritten, including both entries with new ptrs and old removed entries with EMPTY_PTR.
+   * @return pair.second - Entries in CacheMap that have to be overwritten, see RebuiltShard::cacheMapUpdatedEntries.
    */
   static std::pair<Shard, std::vector<Entry>>
   rebuildShard(const Shard& shard, shard_index_t shardIndex,
                const kvs::cache_map::CacheMap& cacheMap);
+
+  /**
+   * @brief Same as above, but the CacheMap is accessed only via getCacheMapPtr, which returns the CacheMap Ptr of a Key.
+   *
+   */
+  static std::pair<Shard, std::vector<Entry>> rebuildShard(
+      const Shard& shard, shard_index_t shardIndex,
+      const std::function<Ptr(const HashedKey&)>& getCacheMapPtr);
+
+  /**
+   * @brief The first half of rebuildShard(): write the files of the new Shard without touching the old ones.
+   *
+   * Only reads the old Shard, so it can run concurrently with other readers of the old Shard. The CompactionMode is
+   * chosen by chooseCompactionMode(); when punching holes, only the index is written. The new Shard updates the
+   * counters of the old one.
+   *
+   */
+  static RebuiltShard
+  buildShard(const Shard& shard, shard_index_t shardIndex,
+             const std::function<Ptr(const HashedKey&)>& getCacheMapPtr);
+
+  /**
+   * @brief The second half of rebuildShard(): replace the files of the old Shard with the rebuilt ones.
+   *
+   * Each file is renamed atomically, the metadata file is removed first and saved again last. When punching holes, the
+   * dead slots are released after the new index is in place, so no index ever points to a punched slot.
+   *
+   */
+  static void replaceShard(shard_index_t shardIndex, RebuiltShard& rebuilt);
+
+  /**
+   * @brief Build new shards from the keys of old ones, used to split a shard in two or to merge two shards into one.
+   *
+   * Like buildShard() with CompactionMode::REWRITE, except that the surviving keys of all old shards are distributed
+   * among the new ones. The files of each new shard are written next to its files, creating its directory if needed,
+   * and replace them when replaceShard() is called. A new shard may have the index of an old one.
+   *
+   * @param getNewShard Returns the position in newShardIndices of the new shard for a Key of the given old shard, or
+   * nothing if the Key doesn't belong to the old shard, e.g. a copy left behind by an interrupted split. Such entries
+   * are dropped.
+   * @param counters The counters of the old shards, updated by the new ones.
+   * @return The new shards in the order of newShardIndices.
+   */
+  static std::vector<RebuiltShard> buildReshardedShards(
+      const std::vector<shard_index_t>& shardIndices,
+      const std::vector<shard_index_t>& newShardIndices,
+      const std::function<std::optional<size_t>(const HashedKey&,
+                                                shard_index_t)>& getNewShard,
+      const std::function<Ptr(const HashedKey&)>& getCacheMapPtr,
+      ShardCounters& counters);
+
+  /**
+   * @brief Remove all files of a shard that is no longer used, e.g. after it was merged into another one.
+   *
+   */
+  static void removeShard(shard_index_t shardIndex) noexcept;
+
+  /**
+   * @brief Choose how to compact the Shard: rewrite it if the share of its values file not taken by live values
+   * exceeds rewriteFragmentation, otherwise punch holes.
+   *
+   */
+  static CompactionMode chooseCompactionMode(const Shard& shard,
+                                             shard_index_t shardIndex);
+
+  /**
+   * @brief The policy knob of chooseCompactionMode(). 0 always rewrites, 1 always punches holes.
+   *
+   * Rewriting is cheap when few values survive and shrinks the files, punching holes avoids moving many live values.
+   *
+   */
+  static double rewriteFragmentation;
+
+  /**
+   * @brief Remove the files written by buildShard(), leaving the old Shard intact.
+   *
+   */
+  static void discardRebuiltShard(shard_index_t shardIndex) noexcept;
+
+private:
+  /**
+   * @brief Surviving keys of a shard with their old ptrs.
+   *
+   */
+  using Survivors = std::vector<std::pair<HashedKey, Ptr>>;
+
+  static std::string getRebuiltFilePath(const std::string& filePath);
+
+  /**
+   * @brief Sort the entries of an index into the survivors of a rebuild and the delayed removals, for which NONEXISTENT
+   * is appended to cacheMapUpdatedEntries.
+   *
+   */
+  static void
+  collectSurvivors(const std::vector<Entry>& shardEntries,
+                   const std::function<Ptr(const HashedKey&)>& getCacheMapPtr,
+                   Survivors& survivors,
+                   std::vector<Entry>& cacheMapUpdatedEntries);
+
+  /**
+   * @brief Copy the values of the survivors into the rebuilt values file of the shard and write its rebuilt index.
+   *
+   * @param survivors Survivors by the index of the shard they come from. Their values are appended shard by shard.
+   */
+  static RebuiltShard
+  rewriteSurvivors(shard_index_t shardIndex,
+                   std::vector<std::pair<shard_index_t, Survivors>>& survivors,
+                   std::vector<Entry> cacheMapUpdatedEntries,
+                   ShardCounters& counters);
 };
 
 } // namespace kvs::shard
@@ -0,0 +1,169 @@
+#pragma once
+
+#include "ByteArray.h"
+#include "KeyValueTypes.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace kvs::shard {
+
+using namespace kvs::utils;
+
+/**
+ * @brief Maps keys to shards by extendible hashing, so that the number of shards follows the amount of data.
+ *
+ * The directory has 2^globalDepth slots, a Key falls into the slot selected by the lower globalDepth bits of
+ * HashedKey::getShardBits(). A shard of the local depth d owns all slots that agree with its pattern on the lower d
+ * bits. Splitting it moves the keys with the bit d set to a new shard, merging two buddies reverses a split. The
+ * directory doubles when a shard that owns a single slot is split and never shrinks.
+ *
+ * getShardIndex() takes no lock and may run concurrently with anything. A change is made in two steps: split() or
+ * merge() saves the new layout to disk, publish() makes it visible to getShardIndex(). Changes must not overlap, i.e.
+ * the next one may start only after publish().
+ *
+ */
+class ShardDirectory final {
+public:
+  /**
+   * @brief Load the directory from its file in Shard::storageDirectoryPath. If there is none, create the initial
+   * directory of 2^INITIAL_SHARD_DEPTH shards and save it.
+   *
+   * @throws KVSException if the file is corrupted.
+   */
+  ShardDirectory();
+
+  /**
+   * @brief Get the index of the shard that contains the Key, as of the last publish().
+   *
+   */
+  shard_index_t getShardIndex(const HashedKey& key) const noexcept;
+
+  /**
+   * @brief Get the indices of all shards in use, in ascending order.
+   *
+   */
+  std::vector<shard_index_t> getShardIndices() const;
+
+  bool isUsed(shard_index_t shardIndex) const;
+
+  uint8_t getGlobalDepth() const noexcept;
+
+  uint8_t getLocalDepth(shard_index_t shardIndex) const;
+
+  /**
+   * @brief Check if the shard can be split, i.e. if its local depth is below MAX_SHARD_DEPTH.
+   *
+   */
+  bool canSplit(shard_index_t shardIndex) const;
+
+  /**
+   * @brief Check if a Key of the shard goes to the new shard when the shard is split.
+   *
+   */
+  bool isMovedBySplit(const HashedKey& key, shard_index_t shardIndex) const;
+
+  /**
+   * @brief Reserve an unused index for the new shard of split().
+   *
+   * @throws KVSException SHARD_OVERFLOW if all indices are used.
+   */
+  shard_index_t allocateShardIndex();
+
+  /**
+   * @brief Return an index reserved by allocateShardIndex() that won't be passed to split().
+   *
+   */
+  void releaseShardIndex(shard_index_t shardIndex) noexcept;
+
+  /**
+   * @brief Give the upper half of the slots of the shard to newShardIndex, which has to be reserved by
+   * allocateShardIndex(), and save the directory.
+   *
+   * @throws KVSException SHARD_OVERFLOW if the shard can't be split, or a storage error. Nothing is changed then.
+   */
+  void split(shard_index_t shardIndex, shard_index_t newShardIndex);
+
+  /**
+   * @brief Get the shard the given one can be merged with: the other half of the split that created both.
+   *
+   * @return Nothing if the local depths of the two differ or the shard has the initial depth.
+   */
+  std::optional<shard_index_t> getBuddy(shard_index_t shardIndex) const;
+
+  /**
+   * @brief Merge the shard with its buddy and save the directory. The lower of the two indices stays in use.
+   *
+   * @return The index of the merged shard.
+   * @throws KVSException on a storage error. Nothing is changed then.
+   */
+  shard_index_t merge(shard_index_t shardIndex);
+
+  /**
+   * @brief Make the last change visible to getShardIndex().
+   *
+   */
+  void publish() noexcept;
+
+  static std::string getFilePath() noexcept;
+
+private:
+  /**
+   * @brief The fixed-size part of the directory file. It is followed by 2^globalDepth shard indices.
+   *
+   */
+  struct Header final {
+    uint32_t version;
+    uint32_t globalDepth;
+  };
+
+  static constexpr uint32_t VERSION = 1;
+
+  /**
+   * @brief Local depths of unused and reserved indices.
+   *
+   */
+  static constexpr uint8_t UNUSED_DEPTH = 0xFF;
+  static constexpr uint8_t RESERVED_DEPTH = 0xFE;
+
+  /**
+   * @brief Parse the directory file and derive the local depths and patterns of the shards from it.
+   *
+   */
+  void load(const ByteArray& bytes);
+
+  /**
+   * @brief Write the layout to the directory file atomically. Requires the mutex.
+   *
+   */
+  static void save(const std::vector<shard_index_t>& newLayout);
+
+  /**
+   * @brief The shard of every slot, as saved on disk. Guarded by the mutex.
+   *
+   */
+  std::vector<shard_index_t> layout;
+
+  /**
+   * @brief The local depth and the lower bits shared by the slots of every shard index. Guarded by the mutex.
+   *
+   */
+  std::vector<uint8_t> localDepths;
+  std::vector<uint32_t> patterns;
+
+  /**
+   * @brief The layout as of the last publish(), read by getShardIndex(). Allocated for the largest directory, so that
+   * the directory can grow under readers: the new half of the slots is filled before globalDepth is increased.
+   *
+   */
+  std::unique_ptr<std::atomic<shard_index_t>[]> slots;
+  std::atomic<uint8_t> globalDepth;
+
+  mutable std::mutex mutex;
+};
+
+} // namespace kvs::shard
@@ -1,14 +1,165 @@
 #pragma once
 
 #include "ByteArray.h"
+#include "Metrics.h"
 
-#include <fstream>
+#include <array>
+#include <cstddef>
+#include <ostream>
 #include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
 
 namespace kvs::storage {
 
 using kvs::utils::ByteArray;
 
+/**
+ * @brief The system calls made by the functions of this namespace. OTHER stands for seeks, unlinks, hole punches and
+ * in-kernel copies.
+ *
+ */
+enum class Syscall { OPEN, READ, WRITE, STAT, RENAME, CLOSE, OTHER };
+constexpr size_t SYSCALLS_CNT = 7;
+// indexed by Syscall
+constexpr const char* SYSCALL_NAMES[SYSCALLS_CNT] = {
+    "open", "read", "write", "stat", "rename", "close", "other"};
+
+/**
+ * @brief The logical operations system calls are made for. OTHER stands for the maintenance of a KVS outside of its
+ * operations, e.g. opening or flushing it.
+ *
+ */
+enum class IOOperation {
+  ADD,
+  GET,
+  REMOVE,
+  MULTI_GET,
+  MULTI_PUT,
+  MULTI_REMOVE,
+  COMPACTION,
+  OTHER
+};
+constexpr size_t IO_OPERATIONS_CNT = 8;
+// indexed by IOOperation
+constexpr const char* IO_OPERATION_NAMES[IO_OPERATIONS_CNT] = {
+    "add",          "get",        "remove", "multi_get", "multi_put",
+    "multi_remove", "compaction", "other"};
+
+/**
+ * @brief The system calls and disk bytes of one kind of logical operation.
+ *
+ */
+struct IOOperationStats final {
+  /**
+   * @brief The number of operations, i.e. of outermost IOOperationScopes of this kind.
+   *
+   */
+  metrics::Counter operationsCnt;
+
+  /**
+   * @brief Indexed by Syscall.
+   *
+   */
+  std::array<metrics::Counter, SYSCALLS_CNT> syscallsCnts;
+
+  /**
+   * @brief Bytes read and written. In-kernel copies count as both.
+   *
+   */
+  metrics::Counter readBytesCnt;
+  metrics::Counter writtenBytesCnt;
+};
+
+/**
+ * @brief The system calls of the file operations of a KVS, by the logical operation they were made for. Calls outside
+ * of any IOOperationScope aren't counted.
+ *
+ * Directories aren't accounted for: they are only created and removed along with shards.
+ *
+ */
+struct SyscallStats final {
+  /**
+   * @brief Indexed by IOOperation.
+   *
+   */
+  std::array<IOOperationStats, IO_OPERATIONS_CNT> operationStats;
+
+  /**
+   * @brief Print an "operation,operations,<syscalls>,read bytes,written bytes" table of the system calls and bytes per
+   * operation, leaving out the operations that didn't happen.
+   *
+   */
+  void printPerOperation(std::ostream& out) const;
+};
+
+/**
+ * @brief Where the system calls of a thread are counted. No stats means nowhere.
+ *
+ */
+struct IOOperationContext final {
+  SyscallStats* stats = nullptr;
+  IOOperation operation = IOOperation::OTHER;
+};
+
+/**
+ * @brief Attributes the system calls the thread makes while it lives to the given operation in the given stats, and
+ * counts the operation. An inner scope takes over until it ends, but the outermost operation is the one counted.
+ *
+ */
+class IOOperationScope final {
+public:
+  IOOperationScope(SyscallStats& stats, IOOperation operation) noexcept;
+
+  /**
+   * @brief Continue the scope another thread is in, e.g. the one that hands out work to this thread, without counting
+   * the operation again.
+   *
+   */
+  explicit IOOperationScope(const IOOperationContext& context) noexcept;
+
+  ~IOOperationScope();
+
+  IOOperationScope(const IOOperationScope&) = delete;
+  IOOperationScope& operator=(const IOOperationScope&) = delete;
+
+  /**
+   * @brief Get the context of the innermost scope of the thread, to be continued by another thread.
+   *
+   */
+  static IOOperationContext getCurrentContext() noexcept;
+
+private:
+  IOOperationContext previousContext;
+};
+
+/**
+ * @brief Accounted std::filesystem::file_size().
+ *
+ * @throws std::filesystem::filesystem_error if the file doesn't exist.
+ */
+size_t getFileSize(const std::string& filename);
+
+/**
+ * @brief Accounted std::filesystem::exists().
+ *
+ */
+bool fileExists(const std::string& filename);
+
+/**
+ * @brief Accounted std::filesystem::rename().
+ *
+ * @throws std::filesystem::filesystem_error on failure.
+ */
+void renameFile(const std::string& oldFilename, const std::string& newFilename);
+
+/**
+ * @brief Accounted std::filesystem::remove(). A missing file isn't an error.
+ *
+ */
+bool removeFile(const std::string& filename, std::error_code& errorCode) noexcept;
+
 /**
  * @brief Read the entire file. 
  * 
@@ -25,10 +176,40 @@ ByteArray readFile(std::string filename);
  */
 void writeFile(std::string filename, ByteArray bytes);
 
+/**
+ * @brief Overwrite the destination file with the given ranges of the source file, one after another. Create the
+ * destination file if it doesn't exist.
+ *
+ * The ranges are copied in the kernel with copy_file_range() where available, otherwise through a large buffer, so the
+ * number of syscalls depends on the amount of data rather than the number of ranges.
+ *
+ * @param ranges Pairs of an offset in the source file and a length.
+ * @param append Append the ranges to the destination file instead of overwriting it.
+ * @throws KVSException if a range exceeds the end of the source file.
+ */
+void copyFileRanges(const std::string& sourceFilename,
+                    const std::string& destinationFilename,
+                    const std::vector<std::pair<size_t, size_t>>& ranges,
+                    bool append = false);
+
+/**
+ * @brief Release the disk space of the given ranges of the file, which read as zeros afterwards. The file size doesn't
+ * change.
+ *
+ * Uses fallocate(FALLOC_FL_PUNCH_HOLE). Only whole filesystem blocks are released, the parts of a range that share a
+ * block with live data are just zeroed, so neighbouring ranges should be merged before the call.
+ *
+ * @param ranges Pairs of an offset and a length.
+ * @return false if the filesystem doesn't support punching holes. The file is left unchanged then.
+ */
+bool punchHoles(const std::string& filename,
+                const std::vector<std::pair<size_t, size_t>>& ranges);
+
 /**
  * @brief An abstraction for safely opening, reading, writing and closing files on disk.
  * 
- * If any operation fails, throws a new KVSException.
+ * Every read and write is a single positioned system call, nothing is buffered. If any operation fails, throws a new
+ * KVSException.
  *
  */
 class Storage final {
@@ -40,6 +221,16 @@ public:
    */
   explicit Storage(std::string filename);
 
+  Storage(Storage&& other) noexcept;
+  Storage(const Storage&) = delete;
+  Storage& operator=(const Storage&) = delete;
+
+  /**
+   * @brief Close the file if close() wasn't called, ignoring errors.
+   *
+   */
+  ~Storage();
+
   /**
     * @brief Apply all changes to the file contents (if any) and close the file. All further operations with this Storage object are disallowed.
     * 
@@ -74,7 +265,7 @@ public:
   size_t append(ByteArray bytes);
 
 private:
-  std::fstream file;
+  int fd;
   size_t fileSize;
 };
 
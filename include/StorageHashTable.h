@@ -42,15 +42,23 @@ public:
      *
      * @return The requested Ptr or EMPTY_PTR, if no Entry with given Key is present.
      */
-  Ptr& get(const Key& key) noexcept;
-  const Ptr& get(const Key& key) const noexcept;
+  Ptr& get(const HashedKey& key) noexcept;
+  const Ptr& get(const HashedKey& key) const noexcept;
 
   /**
      * @brief Put an Entry into the table.
      *
      */
+  void put(const HashedKey& key, Ptr ptr) noexcept;
   void put(const Entry& entry) noexcept;
 
+  /**
+   * @brief Remove any DELETED entry from the table, so that the value slot it points to can be taken by another Key.
+   *
+   * @return The Ptr of the removed entry, or nothing if there are no DELETED entries.
+   */
+  std::optional<Ptr> takeDeletedEntry() noexcept;
+
   /**
    * @brief Get all entries \b present (i.e. those which Ptr is not EMPTY_PTR) in the map.
    * 
@@ -59,6 +67,12 @@ public:
    */
   std::vector<Entry> getEntries() const noexcept;
 
+  /**
+   * @brief Get the number of entries in the table, DELETED ones included.
+   *
+   */
+  size_t getUsedSize() const noexcept;
+
 private:
   /**
    * @brief Expand the map to twice its current capacity.
@@ -69,6 +83,13 @@ private:
    */
   void expand();
 
+  /**
+   * @brief Empty the slot and shift the rest of its cluster back, so that no Key is separated from its home slot by an
+   * empty one.
+   *
+   */
+  void removeAt(size_t index) noexcept;
+
 private:
   std::vector<Entry> data;
   std::size_t usedSize;
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "KeyValueTypes.h"
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace kvs::trace {
+
+using namespace kvs::utils;
+
+enum class TraceOperation : uint8_t { ADD, GET, REMOVE };
+
+/**
+ * @brief What an operation had to do, as bit flags of a TraceRecord.
+ *
+ */
+enum TraceOutcome : uint8_t {
+  /**
+   * @brief The CacheMap knew the Key, as present, removed or nonexistent.
+   *
+   */
+  CACHE_HIT = 1,
+
+  /**
+   * @brief The Key was missing from the CacheMap and the filter of its shard rejected it, so no index was read.
+   *
+   */
+  BLOOM_REJECT = 2,
+
+  /**
+   * @brief The index of the shard was read.
+   *
+   */
+  DISK_READ = 4,
+
+  /**
+   * @brief The operation split its shard or scheduled a compaction of it.
+   *
+   */
+  REBUILD_TRIGGERED = 8
+};
+
+/**
+ * @brief A single traced operation.
+ *
+ */
+struct TraceRecord final {
+  /**
+   * @brief The time the operation started, relative to the start of the trace.
+   *
+   */
+  std::chrono::nanoseconds timestamp{0};
+
+  TraceOperation operation = TraceOperation::GET;
+
+  /**
+   * @brief A combination of TraceOutcome flags.
+   *
+   */
+  uint8_t outcome = 0;
+
+  /**
+   * @brief The low half of the hash of the Key, see HashedKey::getLowHash().
+   *
+   */
+  hash_t keyHash = 0;
+
+  /**
+   * @brief The Key itself, present only in traces with full keys.
+   *
+   */
+  std::optional<Key> key;
+
+  /**
+   * @brief The Key to replay the record with: the traced Key or, in traces without full keys, a Key made of the hash.
+   * Different keys of the trace stay different as long as their hashes don't collide.
+   *
+   */
+  Key getReplayKey() const;
+};
+
+/**
+ * @brief Appends records to a trace file. Thread-safe.
+ *
+ * The file starts with a header, then every record takes 18 bytes with the hash of the Key or 10 + KEY_SIZE bytes with
+ * the full Key. Records are buffered and written in chunks, so they are ordered by the time they were added rather than
+ * by their timestamps.
+ *
+ */
+class TraceWriter final {
+public:
+  /**
+   * @brief Create or truncate the trace file.
+   *
+   * @param fullKeys Whether to record the keys themselves rather than their hashes.
+   * @throws KVSException if the file can't be opened.
+   */
+  TraceWriter(const std::string& filePath, bool fullKeys);
+
+  /**
+   * @brief Flush the buffered records. Errors are ignored, call flush() first to see them.
+   *
+   */
+  ~TraceWriter();
+
+  /**
+   * @brief Get the time since the start of the trace, to be used as a timestamp.
+   *
+   */
+  std::chrono::nanoseconds getTimestamp() const noexcept;
+
+  void write(std::chrono::nanoseconds timestamp, TraceOperation operation,
+             uint8_t outcome, const HashedKey& key);
+
+  /**
+   * @brief Write the buffered records to the file.
+   *
+   * @throws KVSException if writing fails.
+   */
+  void flush();
+
+private:
+  void flushLocked();
+
+  const bool fullKeys;
+  const std::chrono::steady_clock::time_point start;
+  std::vector<char> buffer;
+  std::ofstream file;
+  std::mutex mutex;
+};
+
+/**
+ * @brief Reads the records of a trace file one by one.
+ *
+ */
+class TraceReader final {
+public:
+  /**
+   * @brief Open the trace file and read its header.
+   *
+   * @throws KVSException if the file can't be opened or isn't a trace.
+   */
+  explicit TraceReader(const std::string& filePath);
+
+  bool hasFullKeys() const noexcept;
+
+  /**
+   * @brief Read the next record.
+   *
+   * @return The record or nothing at the end of the trace.
+   * @throws KVSException if the trace is truncated in the middle of a record.
+   */
+  std::optional<TraceRecord> next();
+
+private:
+  bool fullKeys;
+  std::ifstream file;
+};
+
+} // namespace kvs::trace
@@ -1,28 +1,210 @@
 #include "BloomFilter.h"
-#include <random>
+#include "KVSException.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 namespace kvs::bloom_filter {
 
-BloomFilter::BloomFilter() noexcept : seeds() {
-  std::random_device rd;
-  std::mt19937_64 gen(rd());
-  std::uniform_int_distribution<seed_t> distr; // from 0 to type::max by default
+constexpr size_t MAX_HASH_FUNCTIONS_CNT = 16;
+
+/**
+ * @brief Keys are spread over small blocks unevenly, so a blocked filter needs more counters than a classic one.
+ *
+ */
+constexpr double BLOCKING_OVERHEAD = 1.3;
+
+/**
+ * @brief An odd multiplier deriving the second double hashing function from the first one.
+ *
+ */
+constexpr uint32_t PROBE_STEP_MULTIPLIER = 0x9e3779b9;
+
+BloomFilter::BloomFilter(size_t expectedKeysCnt_,
+                         double falsePositiveRate) noexcept
+    : expectedKeysCnt{std::max<size_t>(expectedKeysCnt_, 1)},
+      keysCnt{0} {
+  // every bit of a classic Bloom filter becomes a counter
+  size_t countersCnt = std::ceil(expectedKeysCnt *
+                                 getBitsPerKey(falsePositiveRate) *
+                                 BLOCKING_OVERHEAD);
+  blocks.resize((countersCnt + BLOCK_COUNTERS - 1) / BLOCK_COUNTERS);
+
+  // counters are rounded up to whole blocks, so use the actual ones per key
+  double countersPerKey =
+      static_cast<double>(getCountersCnt()) / expectedKeysCnt;
+  hashFunctionsCnt = std::clamp<size_t>(
+      std::round(countersPerKey * std::log(2)), 1, MAX_HASH_FUNCTIONS_CNT);
+}
+
+BloomFilter::BloomFilter(const ByteArray& array) {
+  Header header;
+  if (array.length() < sizeof(Header))
+    throw KVSException(KVSErrorType::SHARD_METADATA_INVALID_BUILD_DATA);
+  memcpy(reinterpret_cast<char*>(&header), array.get(), sizeof(Header));
+  if (array.length() != sizeof(Header) + header.blocksCnt * sizeof(Block) ||
+      header.blocksCnt == 0 || header.hashFunctionsCnt == 0)
+    throw KVSException(KVSErrorType::SHARD_METADATA_INVALID_BUILD_DATA);
+
+  blocks.resize(header.blocksCnt);
+  memcpy(reinterpret_cast<char*>(blocks.data()), array.get() + sizeof(Header),
+         header.blocksCnt * sizeof(Block));
+  hashFunctionsCnt = header.hashFunctionsCnt;
+  expectedKeysCnt = header.expectedKeysCnt;
+  keysCnt = header.keysCnt;
+}
+
+ByteArray BloomFilter::serializeToByteArray() const noexcept {
+  Header header{blocks.size(), hashFunctionsCnt, expectedKeysCnt,
+                keysCnt};
+  ByteArray result(sizeof(Header) + blocks.size() * sizeof(Block));
+  memcpy(result.get(), reinterpret_cast<const char*>(&header), sizeof(Header));
+  memcpy(result.get() + sizeof(Header),
+         reinterpret_cast<const char*>(blocks.data()),
+         blocks.size() * sizeof(Block));
+  return result;
+}
 
-  for (size_t i = 0; i < BLOOM_FILTER_HASH_FUNCTIONS_NUMBER; i++)
-    seeds.push_back(distr(gen));
+double BloomFilter::getBitsPerKey(double falsePositiveRate) noexcept {
+  // optimal m / n = -ln(p) / ln(2)^2
+  return -std::log(falsePositiveRate) / (std::log(2) * std::log(2));
 }
 
-size_t mapToBitset(hash_t hash) { return hash % BLOOM_FILTER_SIZE; }
+size_t BloomFilter::getBlockIndex(hash_t hash) const noexcept {
+  // multiply-shift range reduction of the lower half
+  return ((hash & 0xffffffff) * blocks.size()) >> 32;
+}
+
+template <typename F>
+void BloomFilter::forEachCounter(hash_t hash, F f) const noexcept {
+  uint32_t h1 = static_cast<uint32_t>(hash >> 32);
+  uint32_t h2 = h1 * PROBE_STEP_MULTIPLIER;
+  constexpr size_t wordCounters = 64 / COUNTER_BITS;
+  for (size_t i = 0; i < hashFunctionsCnt; i++) {
+    uint32_t counter = h1 >> 25; // top 7 bits select one of 128
+    f(counter / wordCounters, (counter % wordCounters) * COUNTER_BITS);
+    h1 += h2;
+  }
+}
+
+void BloomFilter::add(const HashedKey& key) noexcept {
+  hash_t hash = key.getLowHash();
+  Block& block = blocks[getBlockIndex(hash)];
+  forEachCounter(hash, [&block](size_t wordIndex, size_t shift) {
+    uint64_t& word = block.words[wordIndex];
+    if (((word >> shift) & COUNTER_MAX) != COUNTER_MAX)
+      word += uint64_t{1} << shift;
+  });
+  ++keysCnt;
+}
+
+void BloomFilter::remove(const HashedKey& key) noexcept {
+  hash_t hash = key.getLowHash();
+  Block& block = blocks[getBlockIndex(hash)];
+  forEachCounter(hash, [&block](size_t wordIndex, size_t shift) {
+    uint64_t& word = block.words[wordIndex];
+    uint64_t counter = (word >> shift) & COUNTER_MAX;
+    // a saturated counter may hide more keys than it can count
+    if (counter != 0 && counter != COUNTER_MAX)
+      word -= uint64_t{1} << shift;
+  });
+  --keysCnt;
+}
+
+bool BloomFilter::checkHash(hash_t hash) const noexcept {
+  const Block& block = blocks[getBlockIndex(hash)];
+  bool exists = true;
+  forEachCounter(hash, [&block, &exists](size_t wordIndex, size_t shift) {
+    exists &= ((block.words[wordIndex] >> shift) & COUNTER_MAX) != 0;
+  });
+  return exists;
+}
+
+bool BloomFilter::checkExist(const HashedKey& key) const noexcept {
+  return checkHash(key.getLowHash());
+}
+
+std::vector<bool>
+BloomFilter::checkExist(const std::vector<HashedKey>& keys) const noexcept {
+  std::vector<bool> result(keys.size());
+  size_t i = 0;
+#ifdef __AVX2__
+  constexpr size_t LANES = 8;
+  // a block is 16 32-bit words; counter j of a block is in word j / 8
+  const int* words = reinterpret_cast<const int*>(blocks.data());
+  for (; i + LANES <= keys.size(); i += LANES) {
+    alignas(32) uint32_t h1[LANES], h2[LANES], base[LANES];
+    for (size_t lane = 0; lane < LANES; lane++) {
+      hash_t hash = keys[i + lane].getLowHash();
+      h1[lane] = static_cast<uint32_t>(hash >> 32);
+      h2[lane] = h1[lane] * PROBE_STEP_MULTIPLIER;
+      base[lane] = getBlockIndex(hash) * (BLOCK_BITS / 32);
+    }
+    __m256i vh1 = _mm256_load_si256(reinterpret_cast<const __m256i*>(h1));
+    __m256i vh2 = _mm256_load_si256(reinterpret_cast<const __m256i*>(h2));
+    __m256i vbase = _mm256_load_si256(reinterpret_cast<const __m256i*>(base));
+    __m256i counterMax = _mm256_set1_epi32(COUNTER_MAX);
+    __m256i zero = _mm256_setzero_si256();
+    __m256i missing = zero;
+    for (size_t probe = 0; probe < hashFunctionsCnt; probe++) {
+      __m256i counter = _mm256_srli_epi32(vh1, 25);
+      __m256i index = _mm256_add_epi32(vbase, _mm256_srli_epi32(counter, 3));
+      __m256i word = _mm256_i32gather_epi32(words, index, 4);
+      __m256i shift = _mm256_slli_epi32(
+          _mm256_and_si256(counter, _mm256_set1_epi32(7)), 2);
+      __m256i value =
+          _mm256_and_si256(_mm256_srlv_epi32(word, shift), counterMax);
+      missing = _mm256_or_si256(missing, _mm256_cmpeq_epi32(value, zero));
+      vh1 = _mm256_add_epi32(vh1, vh2);
+    }
+    int found = ~_mm256_movemask_ps(_mm256_castsi256_ps(missing));
+    for (size_t lane = 0; lane < LANES; lane++)
+      result[i + lane] = found & (1 << lane);
+  }
+#endif
+  for (; i < keys.size(); i++) result[i] = checkHash(keys[i].getLowHash());
+  return result;
+}
+
+bool BloomFilter::isOverflowed() const noexcept {
+  return keysCnt > expectedKeysCnt;
+}
+
+size_t BloomFilter::getExpectedKeysCnt() const noexcept {
+  return expectedKeysCnt;
+}
+
+size_t BloomFilter::getKeysCnt() const noexcept { return keysCnt; }
+
+size_t BloomFilter::getCountersCnt() const noexcept {
+  return blocks.size() * BLOCK_COUNTERS;
+}
+
+size_t BloomFilter::getHashFunctionsCnt() const noexcept {
+  return hashFunctionsCnt;
+}
+
+BloomFilterStats::BloomFilterStats(const BloomFilterStats& other) noexcept {
+  *this = other;
+}
 
-void BloomFilter::add(const Key& key) noexcept {
-  for (seed_t seed : seeds) bitset.set(mapToBitset(hashKey(key, seed)));
+BloomFilterStats&
+BloomFilterStats::operator=(const BloomFilterStats& other) noexcept {
+  negativesCnt = other.negativesCnt.load();
+  falsePositivesCnt = other.falsePositivesCnt.load();
+  truePositivesCnt = other.truePositivesCnt.load();
+  return *this;
 }
 
-bool BloomFilter::checkExist(const Key& key) const noexcept {
-  for (seed_t seed : seeds)
-    if (!bitset[mapToBitset(hashKey(key, seed))])
-      return false;
-  return true;
+double BloomFilterStats::getFalsePositiveRate() const noexcept {
+  uint64_t absentKeysCnt = negativesCnt + falsePositivesCnt;
+  if (absentKeysCnt == 0)
+    return 0;
+  return static_cast<double>(falsePositivesCnt) / absentKeysCnt;
 }
 
 } // namespace kvs::bloom_filter
@@ -1,120 +1,249 @@
 #include "CacheMap.h"
+#include <algorithm>
 #include <cassert>
-#include <functional>
-#include <random>
+#include <cstring>
+#include <thread>
 
 namespace kvs::cache_map {
 
-CacheMap::CacheMap(size_t size) noexcept {
-  data.resize(size);
-  usedSize = 0;
-}
-
-/**
- * @brief Find the next entry by predicate \b exclusively after fromIndex.
- * 
- * @return size_t The found index \b or fromIndex, if no entry was found.
- */
-size_t findNextByPredicate(const std::vector<Entry>& data, size_t fromIndex,
-                           std::function<bool(const Entry&)> predicate) {
-  for (size_t i = (fromIndex != data.size() - 1 ? fromIndex + 1 : 0);
-       i != fromIndex; i = (i + 1) % data.size()) {
-    if (predicate(data[i]))
-      return i;
-  }
-  return fromIndex;
+namespace {
+
+constexpr size_t KEY_WORDS_CNT = KEY_SIZE / sizeof(uint64_t);
+
+void toKeyWords(const Key& key, uint64_t (&words)[KEY_WORDS_CNT]) noexcept {
+  std::memcpy(words, key.getBytes().get(), KEY_SIZE);
 }
 
-std::optional<Entry> CacheMap::putOrDisplace(Entry entry) noexcept {
-  auto [key, ptr] = entry;
-  size_t keyIndex = hashKey(key) % data.size();
+Key fromKeyWords(const uint64_t (&words)[KEY_WORDS_CNT]) noexcept {
+  ByteArray bytes(KEY_SIZE);
+  std::memcpy(bytes.get(), words, KEY_SIZE);
+  return Key{bytes};
+}
 
+} // namespace
+
+CacheMap::CacheMap(size_t size) noexcept { allocateStripes(size); }
+
+size_t CacheMap::getSizeForMemoryBudget(size_t memoryBudget) noexcept {
+  return std::max(MIN_SIZE, memoryBudget / SLOT_MEMORY_SIZE);
+}
+
+void CacheMap::allocateStripes(size_t newSize) noexcept {
+  assert(newSize >= MIN_SIZE);
+  stripesCnt = 1;
+  while (stripesCnt * 2 <= MAX_STRIPES_CNT &&
+         newSize / (stripesCnt * 2) >= MIN_STRIPE_SIZE)
+    stripesCnt *= 2;
+  stripes = std::make_unique<Stripe[]>(stripesCnt);
+  size = newSize;
+
+  // slots and capacity are spread evenly, so that the stripes add up to the whole map exactly
+  size_t capacity = getCapacity();
   std::random_device rd;
-  std::mt19937 gen(rd());
-  std::uniform_int_distribution<size_t> distr;
+  for (size_t i = 0; i < stripesCnt; i++) {
+    Stripe& stripe = stripes[i];
+    stripe.size = newSize * (i + 1) / stripesCnt - newSize * i / stripesCnt;
+    stripe.capacity =
+        capacity * (i + 1) / stripesCnt - capacity * i / stripesCnt;
+    stripe.slots = std::make_unique<Slot[]>(stripe.size);
+    for (size_t j = 0; j < stripe.size; j++)
+      stripe.slots[j].ptr.store(Ptr::EMPTY_PTR_V, std::memory_order_relaxed);
+    stripe.gen.seed(rd());
+  }
+}
 
-  std::optional<Entry> displaced;
-  if (usedSize * MAP_LOAD_FACTOR > data.size()) {
-    // randomly delete one of the entries
-    size_t randomIndex = distr(gen) % data.size();
-    size_t foundIndex;
-    auto emptyCheck = [](const Entry& e) { return e.ptr == EMPTY_PTR; };
-    if (data[randomIndex].ptr != EMPTY_PTR) {
-      foundIndex = findNextByPredicate(data, randomIndex, emptyCheck);
-      assert(foundIndex != randomIndex);
-      if (foundIndex == 0)
-        foundIndex = data.size() - 1;
-      else
-        foundIndex -= 1;
-    } else {
-      foundIndex = randomIndex;
-      for (size_t i = (randomIndex == 0 ? data.size() - 1 : randomIndex - 1);
-           i != randomIndex; i--) {
-        if (!emptyCheck(data[i])) {
-          foundIndex = i;
-          break;
-        }
-        if (i == 0)
-          i = data.size();
-      }
-      assert(foundIndex != randomIndex);
-    }
-    assert(data[foundIndex].ptr != EMPTY_PTR);
-    displaced = std::optional(data[foundIndex]);
-    data[foundIndex] = Entry(Key(), Ptr());
-    usedSize--;
+CacheMap::Stripe& CacheMap::getStripe(const HashedKey& key) const noexcept {
+  // the slot is chosen by the upper bits, see reduceRange()
+  return stripes[key.getCacheMapBits() & (stripesCnt - 1)];
+}
+
+size_t CacheMap::findSlot(const Stripe& stripe,
+                          const HashedKey& key) noexcept {
+  uint64_t keyWords[KEY_WORDS_CNT];
+  toKeyWords(key.getKey(), keyWords);
+  size_t index = reduceRange(key.getCacheMapBits(), stripe.size);
+  // bounded, because a racing reader may see no empty slot at all
+  for (size_t probes = 0; probes < stripe.size; probes++) {
+    const Slot& slot = stripe.slots[index];
+    if (slot.ptr.load(std::memory_order_relaxed) == Ptr::EMPTY_PTR_V ||
+        (slot.keyWords[0].load(std::memory_order_relaxed) == keyWords[0] &&
+         slot.keyWords[1].load(std::memory_order_relaxed) == keyWords[1]))
+      return index;
+    if (++index == stripe.size)
+      index = 0;
   }
+  return index;
+}
+
+void CacheMap::beginWrite(Stripe& stripe) noexcept {
+  stripe.sequence.store(stripe.sequence.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
 
-  // now actually put the Entry into the map
-  auto entryCheck = [&entry](const Entry& e) {
-    return e.key == entry.key || // or there is such key
-           e.ptr == EMPTY_PTR; // either no such key before and new empty spot
+void CacheMap::endWrite(Stripe& stripe) noexcept {
+  stripe.sequence.store(stripe.sequence.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_release);
+}
+
+Entry CacheMap::displaceRandom(Stripe& stripe) noexcept {
+  assert(stripe.usedSize > 0 && stripe.usedSize < stripe.size);
+  auto isEmpty = [&stripe](size_t i) {
+    return stripe.slots[i].ptr.load(std::memory_order_relaxed) ==
+           Ptr::EMPTY_PTR_V;
   };
+  auto next = [&stripe](size_t i) { return i + 1 == stripe.size ? 0 : i + 1; };
 
-  if (!entryCheck(data[keyIndex])) {
-    size_t newIndex = findNextByPredicate(data, keyIndex, entryCheck);
-    assert(keyIndex != newIndex);
-    keyIndex = newIndex;
+  size_t index = std::uniform_int_distribution<size_t>(
+      0, stripe.size - 1)(stripe.gen);
+  // take the last entry of a cluster, removing it doesn't break probing of the others
+  if (isEmpty(index)) {
+    do {
+      index = (index == 0 ? stripe.size : index) - 1;
+    } while (isEmpty(index));
+  } else {
+    while (!isEmpty(next(index))) index = next(index);
   }
-  if (data[keyIndex].ptr == EMPTY_PTR)
-    usedSize++;
-  data[keyIndex] = entry;
 
+  Slot& slot = stripe.slots[index];
+  uint64_t keyWords[KEY_WORDS_CNT];
+  for (size_t i = 0; i < KEY_WORDS_CNT; i++)
+    keyWords[i] = slot.keyWords[i].load(std::memory_order_relaxed);
+  Entry displaced{fromKeyWords(keyWords),
+                  Ptr(slot.ptr.load(std::memory_order_relaxed))};
+  slot.ptr.store(Ptr::EMPTY_PTR_V, std::memory_order_relaxed);
+  stripe.usedSize--;
   return displaced;
 }
 
-Ptr& CacheMap::get(const Key& key) noexcept {
-  size_t keyIndex = hashKey(key) % data.size();
-  if (data[keyIndex].key == key)
-    return data[keyIndex].ptr;
+void CacheMap::put(Stripe& stripe, const HashedKey& key, Ptr ptr) noexcept {
+  Slot& slot = stripe.slots[findSlot(stripe, key)];
+  if (slot.ptr.load(std::memory_order_relaxed) == Ptr::EMPTY_PTR_V) {
+    uint64_t keyWords[KEY_WORDS_CNT];
+    toKeyWords(key.getKey(), keyWords);
+    for (size_t i = 0; i < KEY_WORDS_CNT; i++)
+      slot.keyWords[i].store(keyWords[i], std::memory_order_relaxed);
+    stripe.usedSize++;
+  }
+  slot.ptr.store(ptr.getRaw(), std::memory_order_relaxed);
+}
 
-  size_t foundIndex =
-      findNextByPredicate(data, keyIndex, [&key](const Entry& e) {
-        return e.key == key || e.ptr == EMPTY_PTR;
-      });
-  assert(foundIndex != keyIndex);
-  return data[foundIndex].ptr;
+std::optional<Entry>
+CacheMap::putOrDisplace(const HashedKey& key, Ptr ptr,
+                        const DisplacedHandler& onDisplaced) noexcept {
+  Stripe& stripe = getStripe(key);
+  std::lock_guard stripeLock{stripe.mutex};
+  beginWrite(stripe);
+  std::optional<Entry> displaced;
+  // overwriting a cached Key takes no room, so it never displaces, least of all the Key itself
+  bool isNewKey = stripe.slots[findSlot(stripe, key)].ptr.load(
+                      std::memory_order_relaxed) == Ptr::EMPTY_PTR_V;
+  if (isNewKey && stripe.usedSize >= stripe.capacity)
+    displaced = displaceRandom(stripe);
+  put(stripe, key, ptr);
+  // readers can't see the displacement before the handler returns
+  if (displaced.has_value() && onDisplaced)
+    onDisplaced(displaced.value());
+  endWrite(stripe);
+  return displaced;
 }
 
-// TODO fix copypaste
-const Ptr& CacheMap::get(const Key& key) const noexcept {
-  size_t keyIndex = hashKey(key) % data.size();
-  if (data[keyIndex].key == key)
-    return data[keyIndex].ptr;
+std::optional<Entry> CacheMap::putOrDisplace(const Entry& entry) noexcept {
+  return putOrDisplace(HashedKey(entry.key), entry.ptr);
+}
+
+bool CacheMap::update(const HashedKey& key, Ptr ptr) noexcept {
+  Stripe& stripe = getStripe(key);
+  std::lock_guard stripeLock{stripe.mutex};
+  Slot& slot = stripe.slots[findSlot(stripe, key)];
+  if (slot.ptr.load(std::memory_order_relaxed) == Ptr::EMPTY_PTR_V)
+    return false;
+  beginWrite(stripe);
+  slot.ptr.store(ptr.getRaw(), std::memory_order_relaxed);
+  endWrite(stripe);
+  return true;
+}
+
+Ptr CacheMap::get(const HashedKey& key) const noexcept {
+  const Stripe& stripe = getStripe(key);
+  while (true) {
+    uint64_t sequence = stripe.sequence.load(std::memory_order_acquire);
+    if (sequence & 1) {
+      std::this_thread::yield();
+      continue;
+    }
+    ptr_t ptr = stripe.slots[findSlot(stripe, key)].ptr.load(
+        std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (stripe.sequence.load(std::memory_order_relaxed) == sequence)
+      return Ptr(ptr);
+  }
+}
+
+std::vector<Entry>
+CacheMap::resize(size_t newSize,
+                 const DisplacedHandler& onDisplaced) noexcept {
+  std::vector<Entry> entries = getEntries();
+  // randomly choose the entries to displace
+  std::random_device rd;
+  std::minstd_rand gen(rd());
+  std::shuffle(entries.begin(), entries.end(), gen);
+
+  allocateStripes(newSize);
+  std::vector<Entry> displaced;
+  for (const Entry& e : entries) {
+    HashedKey key{e.key};
+    Stripe& stripe = getStripe(key);
+    if (stripe.usedSize < stripe.capacity) {
+      put(stripe, key, e.ptr);
+    } else {
+      displaced.push_back(e);
+      if (onDisplaced)
+        onDisplaced(e);
+    }
+  }
+  return displaced;
+}
+
+std::vector<Entry> CacheMap::getEntries() const noexcept {
+  std::vector<Entry> result;
+  for (size_t i = 0; i < stripesCnt; i++) {
+    Stripe& stripe = stripes[i];
+    std::lock_guard stripeLock{stripe.mutex};
+    for (size_t j = 0; j < stripe.size; j++) {
+      const Slot& slot = stripe.slots[j];
+      ptr_t ptr = slot.ptr.load(std::memory_order_relaxed);
+      if (ptr == Ptr::EMPTY_PTR_V)
+        continue;
+      uint64_t keyWords[KEY_WORDS_CNT];
+      for (size_t k = 0; k < KEY_WORDS_CNT; k++)
+        keyWords[k] = slot.keyWords[k].load(std::memory_order_relaxed);
+      result.emplace_back(fromKeyWords(keyWords), Ptr(ptr));
+    }
+  }
+  return result;
+}
+
+void CacheMap::clear() noexcept { allocateStripes(size); }
+
+size_t CacheMap::getSize() const noexcept { return size; }
 
-  size_t foundIndex =
-      findNextByPredicate(data, keyIndex, [&key](const Entry& e) {
-        return e.key == key || e.ptr == EMPTY_PTR;
-      });
-  assert(foundIndex != keyIndex);
-  return data[foundIndex].ptr;
+size_t CacheMap::getCapacity() const noexcept {
+  return size / MAP_LOAD_FACTOR;
+}
+
+size_t CacheMap::getUsedSize() const noexcept {
+  size_t usedSize = 0;
+  for (size_t i = 0; i < stripesCnt; i++) {
+    std::lock_guard stripeLock{stripes[i].mutex};
+    usedSize += stripes[i].usedSize;
+  }
+  return usedSize;
 }
 
-void CacheMap::clear() noexcept {
-  size_t size = data.size();
-  data.clear();
-  data.resize(size);
-  usedSize = 0;
+size_t CacheMap::getMemoryFootprint() const noexcept {
+  return sizeof(CacheMap) + stripesCnt * sizeof(Stripe) +
+         size * sizeof(Slot);
 }
 
 } // namespace kvs::cache_map
@@ -1,182 +1,1374 @@
 #include "KVS.h"
-#include "ShardBuilder.h"
+#include "KVSException.h"
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <future>
+#include <iomanip>
+#include <map>
+#include <stdexcept>
+#include <thread>
+#include <utility>
 
 namespace kvs {
 
 using namespace utils;
-using kvs::shard::ShardBuilder;
+namespace {
 
-KVS::KVS() : shards(), cacheMap(CACHE_MAP_SIZE) {
-  shards.reserve(SHARD_NUMBER);
-  for (shard_index_t i = 0; i < SHARD_NUMBER; i++)
-    shards.push_back(ShardBuilder::createShard(i));
+/**
+ * @brief How many times compactShard() builds the new files without blocking writers before it gives up on that.
+ *
+ */
+constexpr size_t OPTIMISTIC_COMPACTION_ATTEMPTS = 3;
+
+/**
+ * @brief The period over which the rate of foreground operations is measured to tell if the KVS is busy.
+ *
+ */
+constexpr std::chrono::milliseconds BUSY_CHECK_INTERVAL{10};
+
+/**
+ * @brief The part of a batch that falls into one shard.
+ *
+ * Hits are keys with a usable CacheMap Ptr, misses have to be looked up in the shard. Pending keys are pending removals
+ * that have to be pushed before the misses are handled. Indices refer to the batch.
+ *
+ */
+struct ShardBatch final {
+  std::vector<size_t> hitIndices;
+  std::vector<Ptr> hitPtrs;
+  std::vector<size_t> missIndices;
+  std::vector<HashedKey> missKeys;
+  std::vector<Entry> missEntries;
+  std::vector<HashedKey> pendingKeys;
+
+  /**
+   * @brief Set if the misses didn't fit into the shard. They are written again after the shard is split.
+   *
+   */
+  bool overflowed = false;
+};
+
+using ShardBatches = std::map<shard_index_t, ShardBatch>;
+
+/**
+ * @brief Create an empty batch for the shard of every key.
+ *
+ */
+ShardBatches groupByShard(const ShardDirectory& directory,
+                          const std::vector<HashedKey>& keys) {
+  ShardBatches batches;
+  for (const HashedKey& key : keys) batches[directory.getShardIndex(key)];
+  return batches;
 }
 
-void KVS::pushOperation(Entry displaced) {
-  auto [key, ptr] = displaced;
-  shard_index_t shardIndex = Shard::getShardIndex(key);
-  switch (ptr.getType()) {
+/**
+ * @brief Lock the shards of all batches in ascending order, so that two batches can't deadlock.
+ *
+ */
+template <typename Lock>
+std::vector<Lock> lockShards(std::vector<ShardLock>& shardLocks,
+                             const ShardBatches& batches) {
+  std::vector<Lock> locks;
+  locks.reserve(batches.size());
+  for (const auto& [shardIndex, batch] : batches)
+    locks.emplace_back(shardLocks[shardIndex].mutex);
+  return locks;
+}
 
-  case PtrType::DELETED: {
-    shards[shardIndex].pushRemoveEntry(shardIndex, key);
-    break;
+/**
+ * @brief Group the keys by shard and lock the shards, see lockShards(). Starts over if a Key moves to another shard
+ * before its shard is locked.
+ *
+ */
+template <typename Lock>
+std::vector<Lock> lockShardsOf(const ShardDirectory& directory,
+                               std::vector<ShardLock>& shardLocks,
+                               const std::vector<HashedKey>& keys,
+                               ShardBatches& batches) {
+  while (true) {
+    batches = groupByShard(directory, keys);
+    std::vector<Lock> locks = lockShards<Lock>(shardLocks, batches);
+    // a Key only leaves a shard under its exclusive lock
+    if (std::all_of(keys.begin(), keys.end(),
+                    [&directory, &batches](const HashedKey& key) {
+                      return batches.count(directory.getShardIndex(key)) > 0;
+                    }))
+      return locks;
   }
+}
 
-  case PtrType::PRESENT:
-    [[fallthrough]];
+/**
+ * @brief Lock all shards in ascending order.
+ *
+ */
+template <typename Lock>
+std::vector<Lock> lockAllShards(std::vector<ShardLock>& shardLocks) {
+  std::vector<Lock> locks;
+  locks.reserve(shardLocks.size());
+  for (ShardLock& shardLock : shardLocks)
+    locks.emplace_back(shardLock.mutex);
+  return locks;
+}
 
-  case PtrType::NONEXISTENT:
-    break;
+/**
+ * @brief Call f(shardIndex, batch) for every batch, running different shards on different threads.
+ *
+ * Exceptions are rethrown after all threads finish.
+ *
+ */
+template <typename F>
+void forEachShardBatch(ShardBatches& batches, F f) {
+  std::vector<std::pair<const shard_index_t, ShardBatch>*> tasks;
+  tasks.reserve(batches.size());
+  for (auto& task : batches) tasks.push_back(&task);
 
-  case PtrType::EMPTY_PTR: {
-    assert(false && "pushing EMPTY_PTR makes no sense");
+  size_t threadsCnt = std::min<size_t>(
+      tasks.size(), std::max(1u, std::thread::hardware_concurrency()));
+  std::atomic<size_t> nextTask = 0;
+  // the system calls of the workers belong to the operation of the calling thread
+  storage::IOOperationContext ioContext =
+      storage::IOOperationScope::getCurrentContext();
+  auto worker = [&tasks, &nextTask, &f, &ioContext]() {
+    storage::IOOperationScope ioScope{ioContext};
+    for (size_t i = nextTask++; i < tasks.size(); i = nextTask++)
+      f(tasks[i]->first, tasks[i]->second);
+  };
+  if (threadsCnt <= 1) {
+    worker();
+    return;
   }
+
+  std::vector<std::future<void>> workers;
+  workers.reserve(threadsCnt - 1);
+  for (size_t i = 1; i < threadsCnt; i++)
+    workers.push_back(std::async(std::launch::async, worker));
+  std::exception_ptr exception;
+  try {
+    worker();
+  } catch (...) {
+    exception = std::current_exception();
   }
+  for (std::future<void>& w : workers) {
+    try {
+      w.get();
+    } catch (...) {
+      if (!exception)
+        exception = std::current_exception();
+    }
+  }
+  if (exception)
+    std::rethrow_exception(exception);
+}
+
+constexpr const char* PTR_TYPE_NAMES[] = {"present", "deleted", "empty",
+                                          "nonexistent"};
+
+constexpr size_t FILL_RATIO_BUCKETS_CNT = 10;
+
+/**
+ * @brief Call visit(name, value) for every counter of the stats except the shards, so that all formats print the same.
+ *
+ */
+template <typename Visitor>
+void forEachCounter(const KVSStats& stats, Visitor&& visit) {
+  const CacheMapStats& cacheMapStats = stats.cacheMapStats;
+  visit("cache_map.hits", cacheMapStats.hitsCnt.load());
+  visit("cache_map.negative_hits", cacheMapStats.negativeHitsCnt.load());
+  visit("cache_map.misses", cacheMapStats.missesCnt.load());
+  for (size_t i = 0; i < cacheMapStats.displacedCnts.size(); i++)
+    visit(std::string("cache_map.displaced_") + PTR_TYPE_NAMES[i],
+          cacheMapStats.displacedCnts[i].load());
+  visit("cache_map.used_size", static_cast<uint64_t>(stats.cacheMapUsedSize));
+  visit("cache_map.capacity", static_cast<uint64_t>(stats.cacheMapCapacity));
+
+  visit("filter.negatives", stats.filterStats.negativesCnt.load());
+  visit("filter.false_positives", stats.filterStats.falsePositivesCnt.load());
+  visit("filter.true_positives", stats.filterStats.truePositivesCnt.load());
+  visit("filter.false_positive_rate",
+        stats.filterStats.getFalsePositiveRate());
 
-  if (shards[shardIndex].isRebuildRequired(shardIndex))
-    rebuildShard(shardIndex);
+  visit("io.index_reads", stats.ioStats.indexReadsCnt.load());
+  visit("io.index_writes", stats.ioStats.indexWritesCnt.load());
+  visit("io.values_read_bytes", stats.ioStats.valuesReadBytesCnt.load());
+  visit("io.values_written_bytes", stats.ioStats.valuesWrittenBytesCnt.load());
+
+  const shard::RebuildStats& rebuildStats = stats.rebuildStats;
+  visit("rebuild.rebuilds", rebuildStats.rebuildsCnt.load());
+  visit("rebuild.copied_bytes", rebuildStats.copiedBytesCnt.load());
+  visit("rebuild.hole_punches", rebuildStats.holePunchesCnt.load());
+  visit("rebuild.punched_bytes", rebuildStats.punchedBytesCnt.load());
+  visit("rebuild.splits", rebuildStats.splitsCnt.load());
+  visit("rebuild.merges", rebuildStats.mergesCnt.load());
+  visit("rebuild.build_seconds", rebuildStats.buildNanosCnt.load() / 1e9);
+
+  const CompactionStats& compactionStats = stats.compactionStats;
+  visit("compaction.queued_shards",
+        static_cast<uint64_t>(compactionStats.queuedShardsCnt));
+  visit("compaction.queued_garbage_bytes",
+        compactionStats.queuedGarbageBytesCnt);
+  visit("compaction.compactions", compactionStats.compactionsCnt);
+  visit("compaction.reclaimed_bytes", compactionStats.reclaimedBytesCnt);
+  visit("compaction.written_bytes", compactionStats.writtenBytesCnt);
+  visit("compaction.compacting_seconds",
+        compactionStats.compactingTime.count());
+  visit("compaction.throttled_seconds", compactionStats.throttledTime.count());
+
+  for (size_t i = 0; i < storage::IO_OPERATIONS_CNT; i++) {
+    const storage::IOOperationStats& operationStats =
+        stats.syscallStats.operationStats[i];
+    uint64_t syscallsCnt = 0;
+    for (const metrics::Counter& counter : operationStats.syscallsCnts)
+      syscallsCnt += counter.load();
+    if (operationStats.operationsCnt.load() == 0 && syscallsCnt == 0)
+      continue;
+    std::string prefix =
+        std::string("syscalls.") + storage::IO_OPERATION_NAMES[i] + '.';
+    visit(prefix + "operations", operationStats.operationsCnt.load());
+    for (size_t j = 0; j < storage::SYSCALLS_CNT; j++)
+      visit(prefix + storage::SYSCALL_NAMES[j],
+            operationStats.syscallsCnts[j].load());
+    visit(prefix + "read_bytes", operationStats.readBytesCnt.load());
+    visit(prefix + "written_bytes", operationStats.writtenBytesCnt.load());
+  }
 }
 
-void KVS::add(const Key& key, const Value& value) {
-  shard_index_t shardIndex = Shard::getShardIndex(key);
-  Ptr& ptr = cacheMap.get(key);
-  switch (ptr.getType()) {
+/**
+ * @brief Collects the outcome of a single operation for the trace, if one is running.
+ *
+ */
+class OperationTrace final {
+public:
+  explicit OperationTrace(std::shared_ptr<trace::TraceWriter> writer) noexcept
+      : writer(std::move(writer)),
+        timestamp(this->writer ? this->writer->getTimestamp()
+                               : std::chrono::nanoseconds(0)) {}
 
-  case PtrType::PRESENT: {
-    shards[shardIndex].writeValueDirectly(shardIndex, ptr, value);
-    break;
+  bool isEnabled() const noexcept { return writer != nullptr; }
+
+  void addOutcome(uint8_t outcomeFlags) noexcept { outcome |= outcomeFlags; }
+
+  void write(trace::TraceOperation operation, const HashedKey& key) {
+    if (writer)
+      writer->write(timestamp, operation, outcome, key);
   }
 
-  case PtrType::DELETED: {
-    shards[shardIndex].writeValueDirectly(shardIndex, ptr, value);
-    ptr.setValuePresent(true);
-    shards[shardIndex].incrementAliveValuesCnt();
-    break;
+private:
+  std::shared_ptr<trace::TraceWriter> writer;
+  std::chrono::nanoseconds timestamp;
+  uint8_t outcome = 0;
+};
+
+double getFillRatio(const ShardStats& shardStats) noexcept {
+  // an empty shard has no garbage either
+  return shardStats.totalValuesCnt == 0
+             ? 1
+             : static_cast<double>(shardStats.aliveValuesCnt) /
+                   shardStats.totalValuesCnt;
+}
+
+} // namespace
+
+void KVSStats::printText(std::ostream& out) const {
+  forEachCounter(*this, [&out](const std::string& name, auto value) {
+    out << name << ": " << value << '\n';
+  });
+  std::array<size_t, FILL_RATIO_BUCKETS_CNT> fillRatioBuckets{};
+  for (const ShardStats& stats : shardStats)
+    fillRatioBuckets[std::min<size_t>(
+        getFillRatio(stats) * FILL_RATIO_BUCKETS_CNT,
+        FILL_RATIO_BUCKETS_CNT - 1)]++;
+  out << "shards: " << shardStats.size() << '\n';
+  for (size_t i = 0; i < FILL_RATIO_BUCKETS_CNT; i++) {
+    out << "shards.alive_" << i * 100 / FILL_RATIO_BUCKETS_CNT << '-'
+        << (i + 1) * 100 / FILL_RATIO_BUCKETS_CNT
+        << "%: " << fillRatioBuckets[i] << '\n';
   }
+}
 
-  case PtrType::NONEXISTENT:
-    [[fallthrough]];
+void KVSStats::printJSON(std::ostream& out) const {
+  out << '{';
+  forEachCounter(*this, [&out](const std::string& name, auto value) {
+    out << '"' << name << "\":" << value << ',';
+  });
+  out << "\"shards\":[";
+  for (size_t i = 0; i < shardStats.size(); i++) {
+    out << (i == 0 ? "" : ",") << "{\"index\":" << shardStats[i].shardIndex
+        << ",\"alive\":" << shardStats[i].aliveValuesCnt
+        << ",\"total\":" << shardStats[i].totalValuesCnt << '}';
+  }
+  out << "]}\n";
+}
 
-  case PtrType::EMPTY_PTR: {
-    std::optional<Entry> displaced = cacheMap.putOrDisplace(
-        shards[shardIndex].writeValue(shardIndex, key, value));
-    if (displaced.has_value())
-      pushOperation(displaced.value());
+KVS::KVS(size_t cacheMapMemoryBudget,
+         const CompactionConfig& compactionConfig)
+    : directory(),
+      shards(MAX_SHARDS_CNT),
+      shardLocks(MAX_SHARDS_CNT),
+      cacheMap(CacheMap::getSizeForMemoryBudget(cacheMapMemoryBudget)),
+      pendingRemovalsCnt(0),
+      compactionConfig(compactionConfig),
+      queuedCompactions(MAX_SHARDS_CNT),
+      activeCompactions(MAX_SHARDS_CNT, false),
+      activeCompactionsCnt(0),
+      foregroundOperationsCnt(0),
+      compactionsStopped(false),
+      statsDumpStopped(false),
+      tracing(false) {
+  storage::IOOperationScope ioScope{syscallStats, storage::IOOperation::OTHER};
+  for (shard_index_t i : directory.getShardIndices())
+    shards[i] = ShardBuilder::openShard(i, shardCounters);
+  for (size_t i = 0; i < std::max<size_t>(compactionConfig.threadsCnt, 1); i++)
+    compactionThreads.emplace_back(&KVS::runCompactions, this);
+}
 
-    break;
+KVS::~KVS() {
+  stopStatsDump();
+  {
+    std::lock_guard compactionLock{compactionMutex};
+    compactionsStopped = true;
   }
+  compactionCondition.notify_all();
+  for (std::thread& compactionThread : compactionThreads)
+    compactionThread.join();
+}
+
+void KVS::countForegroundOperations(size_t operationsCnt) noexcept {
+  if (compactionConfig.busyOperationsPerSecond > 0)
+    foregroundOperationsCnt.fetch_add(operationsCnt,
+                                      std::memory_order_relaxed);
+}
+
+std::unique_lock<std::shared_mutex>
+KVS::lockShardExclusively(shard_index_t shardIndex) {
+  std::unique_lock shardLock{shardLocks[shardIndex].mutex};
+  ++shardLocks[shardIndex].version;
+  return shardLock;
+}
+
+std::pair<shard_index_t, std::shared_lock<std::shared_mutex>>
+KVS::lockShardOf(const HashedKey& key) const {
+  while (true) {
+    shard_index_t shardIndex = directory.getShardIndex(key);
+    std::shared_lock shardLock{shardLocks[shardIndex].mutex};
+    // the shard could have been split or merged before it was locked
+    if (directory.getShardIndex(key) == shardIndex)
+      return {shardIndex, std::move(shardLock)};
   }
 }
 
-std::optional<Value> KVS::get(const Key& key) {
-  shard_index_t shardIndex = Shard::getShardIndex(key);
-  Ptr& ptr = cacheMap.get(key);
-  switch (ptr.getType()) {
+std::pair<shard_index_t, std::unique_lock<std::shared_mutex>>
+KVS::lockShardOfExclusively(const HashedKey& key) {
+  while (true) {
+    shard_index_t shardIndex = directory.getShardIndex(key);
+    auto shardLock = lockShardExclusively(shardIndex);
+    if (directory.getShardIndex(key) == shardIndex)
+      return {shardIndex, std::move(shardLock)};
+  }
+}
+
+void KVS::putIntoCacheMap(const HashedKey& key, Ptr ptr,
+                          std::vector<Entry>& displaced) {
+  cacheMap.putOrDisplace(key, ptr, [this, &displaced](const Entry& entry) {
+    registerDisplaced(entry, displaced);
+  });
+}
 
-  case PtrType::PRESENT: {
-    return std::optional<Value>(
-        shards[shardIndex].readValueDirectly(shardIndex, ptr));
+void KVS::registerDisplaced(const Entry& entry,
+                            std::vector<Entry>& displaced) {
+  ++cacheMapStats.displacedCnts[static_cast<size_t>(entry.ptr.getType())];
+  // other entries are in sync with their shards already
+  if (entry.ptr.getType() != PtrType::DELETED)
+    return;
+  {
+    std::lock_guard pendingRemovalsLock{pendingRemovalsMutex};
+    pendingRemovals.push_back(entry.key);
+    pendingRemovalsCnt++;
   }
+  displaced.push_back(entry);
+}
 
+void KVS::countLookup(Ptr ptr) noexcept {
+  switch (ptr.getType()) {
+  case PtrType::PRESENT:
+    ++cacheMapStats.hitsCnt;
+    break;
   case PtrType::NONEXISTENT:
     [[fallthrough]];
+  case PtrType::DELETED:
+    ++cacheMapStats.negativeHitsCnt;
+    break;
+  case PtrType::EMPTY_PTR:
+    ++cacheMapStats.missesCnt;
+    break;
+  }
+}
+
+Ptr KVS::replaceCacheMapPtr(const HashedKey& key, Ptr oldPtr,
+                            Ptr newPtr) noexcept {
+  return cacheMap.update(key, newPtr) ? oldPtr : EMPTY_PTR;
+}
 
-  case PtrType::DELETED: {
-    return std::optional<Value>();
+bool KVS::takePendingRemoval(const Key& key) noexcept {
+  if (pendingRemovalsCnt == 0)
+    return false;
+  std::lock_guard pendingRemovalsLock{pendingRemovalsMutex};
+  auto it = std::find(pendingRemovals.begin(), pendingRemovals.end(), key);
+  if (it == pendingRemovals.end())
+    return false;
+  *it = pendingRemovals.back();
+  pendingRemovals.pop_back();
+  pendingRemovalsCnt--;
+  return true;
+}
+
+bool KVS::isPendingRemoval(const Key& key) const noexcept {
+  if (pendingRemovalsCnt == 0)
+    return false;
+  std::lock_guard pendingRemovalsLock{pendingRemovalsMutex};
+  return std::find(pendingRemovals.begin(), pendingRemovals.end(), key) !=
+         pendingRemovals.end();
+}
+
+void KVS::pushRemovals(std::vector<Entry> displaced) {
+  for (const Entry& entry : displaced) {
+    HashedKey hashedKey{entry.key};
+    auto [shardIndex, shardLock] = lockShardOfExclusively(hashedKey);
+    // an operation on the same key could have pushed it already
+    if (takePendingRemoval(hashedKey.getKey()))
+      shards[shardIndex]->pushRemoveEntry(shardIndex, hashedKey);
+
+    if (shards[shardIndex]->isRebuildRequired(shardIndex))
+      scheduleCompaction(shardIndex);
   }
+}
 
-  case PtrType::EMPTY_PTR: {
-    auto [newEntry, optValue] = shards[shardIndex].readValue(shardIndex, key);
-    switch (newEntry.ptr.getType()) {
+std::optional<Entry> KVS::writeValueOrSplit(shard_index_t shardIndex,
+                                            const HashedKey& key,
+                                            const Value& value) {
+  try {
+    return shards[shardIndex]->writeValue(shardIndex, key, value);
+  } catch (const KVSException& exc) {
+    if (exc.getType() != KVSErrorType::SHARD_OVERFLOW)
+      throw;
+  }
+  splitShard(shardIndex);
+  return std::nullopt;
+}
+
+void KVS::add(const Key& key, const Value& value) {
+  storage::IOOperationScope ioScope{syscallStats, storage::IOOperation::ADD};
+  countForegroundOperations(1);
+  HashedKey hashedKey{key};
+  OperationTrace operationTrace{getTraceWriter()};
+  std::vector<Entry> displaced;
+  bool written = false;
+  while (!written) {
+    auto [shardIndex, shardLock] = lockShardOfExclusively(hashedKey);
+    Shard& shard = *shards[shardIndex];
+    Ptr ptr = cacheMap.get(hashedKey);
+    if (ptr.getType() == PtrType::DELETED) {
+      Ptr presentPtr = ptr;
+      presentPtr.setValuePresent(true);
+      ptr = replaceCacheMapPtr(hashedKey, ptr, presentPtr);
+    }
+    if (ptr == EMPTY_PTR && takePendingRemoval(key))
+      shard.pushRemoveEntry(shardIndex, hashedKey);
+
+    switch (ptr.getType()) {
 
     case PtrType::PRESENT: {
-      std::optional<Entry> displaced = cacheMap.putOrDisplace(newEntry);
-      if (displaced.has_value())
-        pushOperation(displaced.value());
+      shard.writeValueDirectly(shardIndex, ptr, value);
+      operationTrace.addOutcome(trace::CACHE_HIT);
+      written = true;
       break;
     }
 
-    case PtrType::EMPTY_PTR:
-      [[fallthrough]];
-
     case PtrType::DELETED: {
-      std::optional<Entry> displaced = cacheMap.putOrDisplace(
-          Entry(newEntry.key, Ptr(PtrType::NONEXISTENT)));
-      if (displaced.has_value())
-        pushOperation(displaced.value());
+      shard.writeValueDirectly(shardIndex, ptr, value);
+      shard.incrementAliveValuesCnt();
+      operationTrace.addOutcome(trace::CACHE_HIT);
+      written = true;
       break;
     }
 
-    case PtrType::NONEXISTENT: {
-      assert(false && "returning NONEXISTENT Ptr from readValue() is illegal");
+    case PtrType::NONEXISTENT:
+      operationTrace.addOutcome(trace::CACHE_HIT);
+      [[fallthrough]];
+
+    case PtrType::EMPTY_PTR: {
+      std::optional<Entry> newEntry =
+          writeValueOrSplit(shardIndex, hashedKey, value);
+      operationTrace.addOutcome(trace::DISK_READ);
+      if (newEntry.has_value()) {
+        putIntoCacheMap(hashedKey, newEntry->ptr, displaced);
+        written = true;
+      } else {
+        operationTrace.addOutcome(trace::REBUILD_TRIGGERED);
+      }
+      break;
     }
     }
-
-    return optValue;
   }
+  pushRemovals(std::move(displaced));
+  operationTrace.write(trace::TraceOperation::ADD, hashedKey);
+}
+
+std::optional<Value> KVS::get(const Key& key) {
+  storage::IOOperationScope ioScope{syscallStats, storage::IOOperation::GET};
+  countForegroundOperations(1);
+  HashedKey hashedKey{key};
+  OperationTrace operationTrace{getTraceWriter()};
+  std::vector<Entry> displaced;
+  std::optional<Value> result;
+  {
+    auto [shardIndex, shardLock] = lockShardOf(hashedKey);
+    Ptr ptr = cacheMap.get(hashedKey);
+    if (ptr == EMPTY_PTR && isPendingRemoval(key))
+      ptr = Ptr{PtrType::NONEXISTENT};
+    countLookup(ptr);
+    if (ptr != EMPTY_PTR)
+      operationTrace.addOutcome(trace::CACHE_HIT);
+
+    switch (ptr.getType()) {
+
+    case PtrType::PRESENT: {
+      result = shards[shardIndex]->readValueDirectly(shardIndex, ptr);
+      break;
+    }
+
+    case PtrType::NONEXISTENT:
+      [[fallthrough]];
+
+    case PtrType::DELETED:
+      break;
+
+    case PtrType::EMPTY_PTR: {
+      if (operationTrace.isEnabled())
+        operationTrace.addOutcome(shards[shardIndex]->mayContain(hashedKey)
+                                      ? trace::DISK_READ
+                                      : trace::BLOOM_REJECT);
+      auto [newEntry, optValue] =
+          shards[shardIndex]->readValue(shardIndex, hashedKey);
+      switch (newEntry.ptr.getType()) {
+
+      case PtrType::PRESENT:
+        break;
+
+      case PtrType::EMPTY_PTR:
+        [[fallthrough]];
+
+      case PtrType::DELETED: {
+        newEntry.ptr = Ptr{PtrType::NONEXISTENT};
+        break;
+      }
+
+      case PtrType::NONEXISTENT: {
+        assert(false &&
+               "returning NONEXISTENT Ptr from readValue() is illegal");
+      }
+      }
+      // readers of the same shard can only put the same Ptr concurrently
+      putIntoCacheMap(hashedKey, newEntry.ptr, displaced);
+      result = std::move(optValue);
+      break;
+    }
+    }
   }
-  throw std::logic_error("unreachable");
+  pushRemovals(std::move(displaced));
+  operationTrace.write(trace::TraceOperation::GET, hashedKey);
+  return result;
 }
 
 void KVS::remove(const Key& key) {
-  shard_index_t shardIndex = Shard::getShardIndex(key);
-  Ptr& ptr = cacheMap.get(key);
-  switch (ptr.getType()) {
-  case PtrType::PRESENT: {
+  storage::IOOperationScope ioScope{syscallStats, storage::IOOperation::REMOVE};
+  countForegroundOperations(1);
+  HashedKey hashedKey{key};
+  OperationTrace operationTrace{getTraceWriter()};
+  std::vector<Entry> displaced;
+  {
+    auto [shardIndex, shardLock] = lockShardOfExclusively(hashedKey);
+    Ptr ptr = cacheMap.get(hashedKey);
     // lazy deletion
-    ptr.setValuePresent(false);
-    shards[shardIndex].decrementAliveValuesCnt();
-    if (shards[shardIndex].isRebuildRequired(shardIndex)) {
-      rebuildShard(shardIndex);
+    if (ptr.getType() == PtrType::PRESENT) {
+      Ptr deletedPtr = ptr;
+      deletedPtr.setValuePresent(false);
+      ptr = replaceCacheMapPtr(hashedKey, ptr, deletedPtr);
+    }
+    if (ptr == EMPTY_PTR && takePendingRemoval(key))
+      shards[shardIndex]->pushRemoveEntry(shardIndex, hashedKey);
+    if (ptr != EMPTY_PTR)
+      operationTrace.addOutcome(trace::CACHE_HIT);
+
+    switch (ptr.getType()) {
+    case PtrType::PRESENT: {
+      shards[shardIndex]->decrementAliveValuesCnt();
+      if (shards[shardIndex]->isRebuildRequired(shardIndex)) {
+        scheduleCompaction(shardIndex);
+        operationTrace.addOutcome(trace::REBUILD_TRIGGERED);
+      }
+      break;
+    }
+
+    case PtrType::NONEXISTENT:
+      [[fallthrough]];
+
+    case PtrType::DELETED:
+      break;
+
+    case PtrType::EMPTY_PTR: {
+      if (operationTrace.isEnabled())
+        operationTrace.addOutcome(shards[shardIndex]->mayContain(hashedKey)
+                                      ? trace::DISK_READ
+                                      : trace::BLOOM_REJECT);
+      Entry newEntry = shards[shardIndex]->removeEntry(shardIndex, hashedKey);
+      switch (newEntry.ptr.getType()) {
+
+      case PtrType::PRESENT: {
+        assert(false &&
+               "returning PRESENT Ptr from removeEntry() makes no sense");
+      }
+
+      case PtrType::NONEXISTENT: {
+        assert(false &&
+               "returning NONEXISTENT Ptr from removeEntry() is illegal");
+      }
+
+      case PtrType::DELETED:
+        [[fallthrough]];
+
+      case PtrType::EMPTY_PTR: {
+        putIntoCacheMap(hashedKey, Ptr(PtrType::NONEXISTENT), displaced);
+        break;
+      }
+      }
+      break;
+    }
     }
-    break;
   }
+  pushRemovals(std::move(displaced));
+  operationTrace.write(trace::TraceOperation::REMOVE, hashedKey);
+}
 
-  case PtrType::NONEXISTENT:
-    [[fallthrough]];
+std::vector<std::optional<Value>> KVS::multiGet(const std::vector<Key>& keys) {
+  storage::IOOperationScope ioScope{syscallStats,
+                                    storage::IOOperation::MULTI_GET};
+  countForegroundOperations(keys.size());
+  std::vector<HashedKey> hashedKeys(keys.begin(), keys.end());
+  std::vector<std::optional<Value>> result(keys.size());
+  ShardBatches batches;
+  std::vector<Entry> displaced;
+  {
+    auto locks = lockShardsOf<std::shared_lock<std::shared_mutex>>(
+        directory, shardLocks, hashedKeys, batches);
+    for (size_t i = 0; i < keys.size(); i++) {
+      Ptr ptr = cacheMap.get(hashedKeys[i]);
+      if (ptr == EMPTY_PTR && isPendingRemoval(keys[i])) {
+        countLookup(Ptr{PtrType::NONEXISTENT});
+        continue;
+      }
+      countLookup(ptr);
+      ShardBatch& batch = batches[directory.getShardIndex(hashedKeys[i])];
+      switch (ptr.getType()) {
+      case PtrType::PRESENT: {
+        batch.hitIndices.push_back(i);
+        batch.hitPtrs.push_back(ptr);
+        break;
+      }
+      case PtrType::NONEXISTENT:
+        [[fallthrough]];
+      case PtrType::DELETED:
+        break;
+      case PtrType::EMPTY_PTR: {
+        batch.missIndices.push_back(i);
+        batch.missKeys.push_back(hashedKeys[i]);
+        break;
+      }
+      }
+    }
 
-  case PtrType::DELETED:
-    break;
+    forEachShardBatch(batches, [this, &result](shard_index_t shardIndex,
+                                               ShardBatch& batch) {
+      const Shard& shard = *shards[shardIndex];
+      if (!batch.hitPtrs.empty()) {
+        std::vector<Value> values =
+            shard.readValuesDirectly(shardIndex, batch.hitPtrs);
+        for (size_t j = 0; j < values.size(); j++)
+          result[batch.hitIndices[j]] = std::move(values[j]);
+      }
+      if (!batch.missKeys.empty()) {
+        auto read = shard.readValues(shardIndex, batch.missKeys);
+        for (size_t j = 0; j < read.size(); j++) {
+          auto& [newEntry, optValue] = read[j];
+          result[batch.missIndices[j]] = std::move(optValue);
+          batch.missEntries.push_back(newEntry);
+        }
+      }
+    });
 
-  case PtrType::EMPTY_PTR: {
-    Entry newEntry = shards[shardIndex].removeEntry(shardIndex, key);
-    switch (newEntry.ptr.getType()) {
+    for (auto& [shardIndex, batch] : batches) {
+      for (size_t j = 0; j < batch.missKeys.size(); j++) {
+        Ptr ptr = batch.missEntries[j].ptr;
+        if (ptr.getType() != PtrType::PRESENT)
+          ptr = Ptr{PtrType::NONEXISTENT};
+        putIntoCacheMap(batch.missKeys[j], ptr, displaced);
+      }
+    }
+  }
+  pushRemovals(std::move(displaced));
+  return result;
+}
 
-    case PtrType::PRESENT: {
-      assert(false &&
-             "returning PRESENT Ptr from removeEntry() makes no sense");
+void KVS::multiPut(const std::vector<KeyValue>& keyValues) {
+  storage::IOOperationScope ioScope{syscallStats,
+                                    storage::IOOperation::MULTI_PUT};
+  countForegroundOperations(keyValues.size());
+  std::vector<HashedKey> hashedKeys;
+  hashedKeys.reserve(keyValues.size());
+  for (const KeyValue& keyValue : keyValues)
+    hashedKeys.emplace_back(keyValue.key);
+  ShardBatches batches;
+  std::vector<Entry> displaced;
+  std::vector<KeyValue> overflowedKeyValues;
+  {
+    auto locks = lockShardsOf<std::unique_lock<std::shared_mutex>>(
+        directory, shardLocks, hashedKeys, batches);
+    for (const auto& [shardIndex, batch] : batches)
+      ++shardLocks[shardIndex].version;
+    for (size_t i = 0; i < keyValues.size(); i++) {
+      shard_index_t shardIndex = directory.getShardIndex(hashedKeys[i]);
+      ShardBatch& batch = batches[shardIndex];
+      Ptr ptr = cacheMap.get(hashedKeys[i]);
+      if (ptr.getType() == PtrType::DELETED) {
+        Ptr presentPtr = ptr;
+        presentPtr.setValuePresent(true);
+        ptr = replaceCacheMapPtr(hashedKeys[i], ptr, presentPtr);
+      }
+      if (ptr == EMPTY_PTR && takePendingRemoval(keyValues[i].key))
+        batch.pendingKeys.push_back(hashedKeys[i]);
+      switch (ptr.getType()) {
+      case PtrType::DELETED:
+        ptr.setValuePresent(true);
+        shards[shardIndex]->incrementAliveValuesCnt();
+        [[fallthrough]];
+      case PtrType::PRESENT: {
+        batch.hitIndices.push_back(i);
+        batch.hitPtrs.push_back(ptr);
+        break;
+      }
+      case PtrType::NONEXISTENT:
+        [[fallthrough]];
+      case PtrType::EMPTY_PTR: {
+        batch.missIndices.push_back(i);
+        batch.missKeys.push_back(hashedKeys[i]);
+        break;
+      }
+      }
     }
 
-    case PtrType::NONEXISTENT: {
-      assert(false &&
-             "returning NONEXISTENT Ptr from removeEntry() is illegal");
+    forEachShardBatch(batches, [this, &keyValues](shard_index_t shardIndex,
+                                                  ShardBatch& batch) {
+      Shard& shard = *shards[shardIndex];
+      for (const HashedKey& key : batch.pendingKeys)
+        shard.pushRemoveEntry(shardIndex, key);
+      auto valuesOf = [&keyValues](const std::vector<size_t>& indices) {
+        std::vector<std::reference_wrapper<const Value>> values;
+        values.reserve(indices.size());
+        for (size_t i : indices) values.emplace_back(keyValues[i].value);
+        return values;
+      };
+      if (!batch.hitPtrs.empty())
+        shard.writeValuesDirectly(shardIndex, batch.hitPtrs,
+                                  valuesOf(batch.hitIndices));
+      if (batch.missKeys.empty())
+        return;
+      try {
+        batch.missEntries = shard.writeValues(shardIndex, batch.missKeys,
+                                              valuesOf(batch.missIndices));
+      } catch (const KVSException& exc) {
+        if (exc.getType() != KVSErrorType::SHARD_OVERFLOW)
+          throw;
+        batch.overflowed = true;
+      }
+    });
+
+    for (auto& [shardIndex, batch] : batches) {
+      if (batch.overflowed) {
+        splitShard(shardIndex);
+        for (size_t i : batch.missIndices)
+          overflowedKeyValues.push_back(keyValues[i]);
+        continue;
+      }
+      for (size_t j = 0; j < batch.missKeys.size(); j++)
+        putIntoCacheMap(batch.missKeys[j], batch.missEntries[j].ptr,
+                        displaced);
     }
+  }
+  pushRemovals(std::move(displaced));
+  // the misses of full shards may belong to the new halves now
+  if (!overflowedKeyValues.empty())
+    multiPut(overflowedKeyValues);
+}
 
-    case PtrType::DELETED:
-      [[fallthrough]];
+void KVS::multiRemove(const std::vector<Key>& keys) {
+  storage::IOOperationScope ioScope{syscallStats,
+                                    storage::IOOperation::MULTI_REMOVE};
+  countForegroundOperations(keys.size());
+  std::vector<HashedKey> hashedKeys(keys.begin(), keys.end());
+  ShardBatches batches;
+  std::vector<Entry> displaced;
+  {
+    auto locks = lockShardsOf<std::unique_lock<std::shared_mutex>>(
+        directory, shardLocks, hashedKeys, batches);
+    for (const auto& [shardIndex, batch] : batches)
+      ++shardLocks[shardIndex].version;
+    std::vector<shard_index_t> lazilyRemovedShards;
+    for (size_t i = 0; i < keys.size(); i++) {
+      shard_index_t shardIndex = directory.getShardIndex(hashedKeys[i]);
+      ShardBatch& batch = batches[shardIndex];
+      Ptr ptr = cacheMap.get(hashedKeys[i]);
+      if (ptr.getType() == PtrType::PRESENT) {
+        Ptr deletedPtr = ptr;
+        deletedPtr.setValuePresent(false);
+        ptr = replaceCacheMapPtr(hashedKeys[i], ptr, deletedPtr);
+      }
+      if (ptr == EMPTY_PTR && takePendingRemoval(keys[i]))
+        batch.pendingKeys.push_back(hashedKeys[i]);
+      switch (ptr.getType()) {
+      case PtrType::PRESENT: {
+        // lazy deletion, shards are rebuilt after the whole batch
+        shards[shardIndex]->decrementAliveValuesCnt();
+        lazilyRemovedShards.push_back(shardIndex);
+        break;
+      }
+      case PtrType::NONEXISTENT:
+        [[fallthrough]];
+      case PtrType::DELETED:
+        break;
+      case PtrType::EMPTY_PTR: {
+        batch.missIndices.push_back(i);
+        batch.missKeys.push_back(hashedKeys[i]);
+        break;
+      }
+      }
+    }
 
-    case PtrType::EMPTY_PTR: {
-      std::optional<Entry> displaced = cacheMap.putOrDisplace(
-          Entry(newEntry.key, Ptr(PtrType::NONEXISTENT)));
-      if (displaced.has_value())
-        pushOperation(displaced.value());
-      break;
+    forEachShardBatch(batches, [this](shard_index_t shardIndex,
+                                      ShardBatch& batch) {
+      Shard& shard = *shards[shardIndex];
+      for (const HashedKey& key : batch.pendingKeys)
+        shard.pushRemoveEntry(shardIndex, key);
+      batch.missEntries = shard.removeEntries(shardIndex, batch.missKeys);
+    });
+
+    for (auto& [shardIndex, batch] : batches) {
+      for (size_t j = 0; j < batch.missKeys.size(); j++) {
+        assert(batch.missEntries[j].ptr.getType() == PtrType::DELETED ||
+               batch.missEntries[j].ptr == EMPTY_PTR);
+        putIntoCacheMap(batch.missKeys[j], Ptr(PtrType::NONEXISTENT),
+                        displaced);
+      }
     }
+    for (shard_index_t shardIndex : lazilyRemovedShards) {
+      if (shards[shardIndex]->isRebuildRequired(shardIndex))
+        scheduleCompaction(shardIndex);
     }
-    break;
   }
+  pushRemovals(std::move(displaced));
+}
+
+Ptr KVS::getCacheMapPtrForRebuild(const HashedKey& key,
+                                  std::vector<Key>& pendingKeys) const
+    noexcept {
+  Ptr ptr = cacheMap.get(key);
+  // a pending removal is a delayed removal that has just left the CacheMap, the rebuild pushes it
+  if (ptr == EMPTY_PTR && isPendingRemoval(key.getKey())) {
+    pendingKeys.push_back(key.getKey());
+    return Ptr{0, false};
   }
+  return ptr;
+}
+
+KVS::CompactionResult KVS::rebuildShard(shard_index_t shardIndex) {
+  std::vector<Key> pendingKeys;
+  ShardBuilder::RebuiltShard rebuilt = ShardBuilder::buildShard(
+      *shards[shardIndex], shardIndex,
+      [this, &pendingKeys](const HashedKey& key) {
+        return getCacheMapPtrForRebuild(key, pendingKeys);
+      });
+  return applyRebuiltShard(shardIndex, rebuilt, pendingKeys);
 }
 
-void KVS::rebuildShard(shard_index_t shardIndex) {
-  auto [newShard, newEntries] =
-      ShardBuilder::rebuildShard(shards[shardIndex], shardIndex, cacheMap);
-  shards[shardIndex] = newShard;
-  for (const Entry& newEntry : newEntries) {
-    std::optional<Entry> displaced = cacheMap.putOrDisplace(newEntry);
-    assert(!displaced.has_value());
+KVS::CompactionResult
+KVS::applyRebuiltShard(shard_index_t shardIndex,
+                       ShardBuilder::RebuiltShard& rebuilt,
+                       const std::vector<Key>& pendingKeys) {
+  CompactionResult result;
+  result.reclaimedBytesCnt =
+      shards[shardIndex]->getDeadSlotsCnt(shardIndex) * VALUE_SIZE;
+  ShardBuilder::replaceShard(shardIndex, rebuilt);
+  shards[shardIndex] = rebuilt.shard;
+  result.writtenBytesCnt = storage::getFileSize(
+      Shard::getStorageHashTableFilePath(shardIndex));
+  if (rebuilt.mode == shard::CompactionMode::REWRITE)
+    result.writtenBytesCnt +=
+        storage::getFileSize(Shard::getValuesFilePath(shardIndex));
+
+  for (const Key& key : pendingKeys) takePendingRemoval(key);
+  applyCacheMapUpdates(rebuilt.cacheMapUpdatedEntries);
+  return result;
+}
+
+void KVS::applyCacheMapUpdates(
+    const std::vector<Entry>& cacheMapUpdatedEntries) {
+  for (const Entry& newEntry : cacheMapUpdatedEntries) {
+    // an entry displaced meanwhile is in sync with the new shard, as a delayed removal it has been pushed by the rebuild
+    if (!cacheMap.update(HashedKey{newEntry.key}, newEntry.ptr) &&
+        newEntry.ptr.getType() == PtrType::NONEXISTENT)
+      takePendingRemoval(newEntry.key);
+  }
+}
+
+void KVS::splitShard(shard_index_t shardIndex) {
+  std::lock_guard reshardingLock{reshardingMutex};
+  if (!directory.canSplit(shardIndex))
+    throw KVSException(KVSErrorType::SHARD_OVERFLOW);
+  shard_index_t newShardIndex = directory.allocateShardIndex();
+  std::vector<Key> pendingKeys;
+  std::vector<ShardBuilder::RebuiltShard> rebuilt;
+  try {
+    rebuilt = ShardBuilder::buildReshardedShards(
+        {shardIndex}, {shardIndex, newShardIndex},
+        [this](const HashedKey& key,
+               shard_index_t oldShardIndex) -> std::optional<size_t> {
+          if (directory.getShardIndex(key) != oldShardIndex)
+            return std::nullopt;
+          return directory.isMovedBySplit(key, oldShardIndex) ? 1 : 0;
+        },
+        [this, &pendingKeys](const HashedKey& key) {
+          return getCacheMapPtrForRebuild(key, pendingKeys);
+        },
+        shardCounters);
+    // nothing can reach the new shard before the directory is published
+    ShardBuilder::replaceShard(newShardIndex, rebuilt[1]);
+    shards[newShardIndex] = rebuilt[1].shard;
+    directory.split(shardIndex, newShardIndex);
+    for (const Key& key : pendingKeys) takePendingRemoval(key);
+  } catch (...) {
+    ShardBuilder::discardRebuiltShard(shardIndex);
+    ShardBuilder::removeShard(newShardIndex);
+    shards[newShardIndex].reset();
+    directory.releaseShardIndex(newShardIndex);
+    throw;
+  }
+
+  try {
+    ShardBuilder::replaceShard(shardIndex, rebuilt[0]);
+    shards[shardIndex] = rebuilt[0].shard;
+    applyCacheMapUpdates(rebuilt[0].cacheMapUpdatedEntries);
+  } catch (...) {
+    // the split is saved already, the old files just keep copies of the moved keys
+    applyCacheMapUpdates(rebuilt[1].cacheMapUpdatedEntries);
+    directory.publish();
+    throw;
   }
+  applyCacheMapUpdates(rebuilt[1].cacheMapUpdatedEntries);
+  directory.publish();
+  ++shardCounters.rebuildStats.splitsCnt;
+}
+
+std::optional<shard_index_t> KVS::mergeShard(shard_index_t shardIndex) {
+  std::optional<shard_index_t> buddyIndex = directory.getBuddy(shardIndex);
+  if (!buddyIndex.has_value())
+    return std::nullopt;
+  shard_index_t mergedIndex = std::min(shardIndex, buddyIndex.value());
+  shard_index_t removedIndex = std::max(shardIndex, buddyIndex.value());
+  auto mergedLock = lockShardExclusively(mergedIndex);
+  auto removedLock = lockShardExclusively(removedIndex);
+  std::lock_guard reshardingLock{reshardingMutex};
+  // either shard could have been split or merged before it was locked
+  if (!directory.isUsed(shardIndex) ||
+      directory.getBuddy(shardIndex) != buddyIndex ||
+      shards[mergedIndex]->getAliveValuesCnt() +
+              shards[removedIndex]->getAliveValuesCnt() >
+          SHARD_MAX_KEYS_CNT * SHARD_MERGE_LOAD_FACTOR)
+    return std::nullopt;
+
+  std::vector<Key> pendingKeys;
+  std::vector<ShardBuilder::RebuiltShard> rebuilt;
+  try {
+    rebuilt = ShardBuilder::buildReshardedShards(
+        {mergedIndex, removedIndex}, {mergedIndex},
+        [this](const HashedKey& key,
+               shard_index_t oldShardIndex) -> std::optional<size_t> {
+          if (directory.getShardIndex(key) != oldShardIndex)
+            return std::nullopt;
+          return 0;
+        },
+        [this, &pendingKeys](const HashedKey& key) {
+          return getCacheMapPtrForRebuild(key, pendingKeys);
+        },
+        shardCounters);
+  } catch (...) {
+    ShardBuilder::discardRebuiltShard(mergedIndex);
+    throw;
+  }
+  ShardBuilder::replaceShard(mergedIndex, rebuilt[0]);
+  shards[mergedIndex] = rebuilt[0].shard;
+  try {
+    directory.merge(mergedIndex);
+    for (const Key& key : pendingKeys) takePendingRemoval(key);
+  } catch (...) {
+    // the other shard keeps its keys, the merged files just hold copies of them
+    std::vector<Entry> ownEntries;
+    for (const Entry& entry : rebuilt[0].cacheMapUpdatedEntries) {
+      if (directory.getShardIndex(HashedKey{entry.key}) == mergedIndex)
+        ownEntries.push_back(entry);
+    }
+    applyCacheMapUpdates(ownEntries);
+    throw;
+  }
+  applyCacheMapUpdates(rebuilt[0].cacheMapUpdatedEntries);
+  directory.publish();
+
+  ShardBuilder::removeShard(removedIndex);
+  shards[removedIndex].reset();
+  {
+    std::lock_guard compactionLock{compactionMutex};
+    std::optional<CompactionPriority>& queued =
+        queuedCompactions[removedIndex];
+    if (queued.has_value())
+      compactionQueue.erase(queued.value());
+    queued.reset();
+  }
+  ++shardCounters.rebuildStats.mergesCnt;
+  return mergedIndex;
+}
+
+void KVS::scheduleCompaction(shard_index_t shardIndex) {
+  uint64_t garbageBytesCnt =
+      shards[shardIndex]->getDeadSlotsCnt(shardIndex) * VALUE_SIZE;
+  uint64_t valuesFileSize = std::max<uint64_t>(
+      storage::getFileSize(Shard::getValuesFilePath(shardIndex)), 1);
+  CompactionPriority priority{
+      garbageBytesCnt, static_cast<double>(garbageBytesCnt) / valuesFileSize,
+      shardIndex};
+  {
+    std::lock_guard compactionLock{compactionMutex};
+    std::optional<CompactionPriority>& queued = queuedCompactions[shardIndex];
+    if (queued.has_value())
+      compactionQueue.erase(queued.value());
+    queued = priority;
+    compactionQueue.insert(priority);
+  }
+  compactionCondition.notify_all();
+}
+
+void KVS::runCompactions() noexcept {
+  std::unique_lock compactionLock{compactionMutex};
+  // the worst shard that isn't being compacted by another thread
+  auto findNext = [this]() {
+    return std::find_if(compactionQueue.begin(), compactionQueue.end(),
+                        [this](const CompactionPriority& priority) {
+                          return !activeCompactions[std::get<2>(priority)];
+                        });
+  };
+  while (true) {
+    compactionCondition.wait(compactionLock, [this, &findNext]() {
+      return compactionsStopped || findNext() != compactionQueue.end();
+    });
+    if (compactionsStopped)
+      return;
+    // the shard is chosen after the wait, so that the worst one at that time goes first
+    throttleCompaction(compactionLock);
+    auto next = findNext();
+    if (compactionsStopped)
+      return;
+    if (next == compactionQueue.end())
+      continue;
+    shard_index_t shardIndex = std::get<2>(*next);
+    compactionQueue.erase(next);
+    // the shard may gain garbage while it is compacted, so let it be queued again
+    queuedCompactions[shardIndex].reset();
+    activeCompactions[shardIndex] = true;
+    ++activeCompactionsCnt;
+    compactionLock.unlock();
+
+    std::exception_ptr exception;
+    CompactionResult result;
+    auto begin = std::chrono::steady_clock::now();
+    try {
+      result = compactShard(shardIndex);
+      // the compacted shard may be sparse enough to be merged, and so may be the merged one
+      for (std::optional<shard_index_t> mergedIndex = mergeShard(shardIndex);
+           mergedIndex.has_value(); mergedIndex = mergeShard(*mergedIndex))
+        ;
+    } catch (...) {
+      exception = std::current_exception();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    compactionLock.lock();
+    if (exception && !compactionException)
+      compactionException = exception;
+    if (result.reclaimedBytesCnt > 0 || result.writtenBytesCnt > 0)
+      ++compactionStats.compactionsCnt;
+    compactionStats.reclaimedBytesCnt += result.reclaimedBytesCnt;
+    compactionStats.writtenBytesCnt += result.writtenBytesCnt;
+    compactionStats.compactingTime += end - begin;
+    if (compactionConfig.bytesPerSecond > 0)
+      compactionBudgetTime =
+          std::max(compactionBudgetTime, end) +
+          std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+              std::chrono::duration<double>(result.writtenBytesCnt /
+                                            compactionConfig.bytesPerSecond));
+    activeCompactions[shardIndex] = false;
+    --activeCompactionsCnt;
+    compactionCondition.notify_all();
+  }
+}
+
+void KVS::throttleCompaction(std::unique_lock<std::mutex>& compactionLock) {
+  auto begin = std::chrono::steady_clock::now();
+  compactionCondition.wait_until(compactionLock, compactionBudgetTime,
+                                 [this]() { return compactionsStopped; });
+
+  if (compactionConfig.busyOperationsPerSecond > 0) {
+    auto deadline = std::chrono::steady_clock::now() +
+                    compactionConfig.maxBusyDelay;
+    while (!compactionsStopped && std::chrono::steady_clock::now() < deadline) {
+      uint64_t operationsCnt = foregroundOperationsCnt;
+      auto checkBegin = std::chrono::steady_clock::now();
+      compactionCondition.wait_for(compactionLock, BUSY_CHECK_INTERVAL,
+                                   [this]() { return compactionsStopped; });
+      std::chrono::duration<double> checkTime =
+          std::chrono::steady_clock::now() - checkBegin;
+      if ((foregroundOperationsCnt - operationsCnt) / checkTime.count() <
+          compactionConfig.busyOperationsPerSecond)
+        break;
+    }
+  }
+  compactionStats.throttledTime += std::chrono::steady_clock::now() - begin;
+}
+
+KVS::CompactionResult KVS::compactShard(shard_index_t shardIndex) {
+  storage::IOOperationScope ioScope{syscallStats,
+                                    storage::IOOperation::COMPACTION};
+  for (size_t attempt = 0; attempt < OPTIMISTIC_COMPACTION_ATTEMPTS;
+       attempt++) {
+    std::vector<Key> pendingKeys;
+    std::optional<ShardBuilder::RebuiltShard> rebuilt;
+    uint64_t version;
+    {
+      std::shared_lock shardLock{shardLocks[shardIndex].mutex};
+      // the shard could have been merged into its buddy since it was queued
+      if (!directory.isUsed(shardIndex) ||
+          !shards[shardIndex]->isRebuildRequired(shardIndex))
+        return CompactionResult{};
+      version = shardLocks[shardIndex].version;
+      try {
+        rebuilt = ShardBuilder::buildShard(
+            *shards[shardIndex], shardIndex,
+            [this, &pendingKeys](const HashedKey& key) {
+              return getCacheMapPtrForRebuild(key, pendingKeys);
+            });
+      } catch (...) {
+        ShardBuilder::discardRebuiltShard(shardIndex);
+        throw;
+      }
+    }
+
+    auto shardLock = lockShardExclusively(shardIndex);
+    // readers could only have cached old Ptrs and displaced entries meanwhile, applyRebuiltShard() handles both
+    if (shardLocks[shardIndex].version == version + 1)
+      return applyRebuiltShard(shardIndex, rebuilt.value(), pendingKeys);
+    ShardBuilder::discardRebuiltShard(shardIndex);
+  }
+
+  // writers keep winning the race, so keep them out for the whole rebuild
+  auto shardLock = lockShardExclusively(shardIndex);
+  if (directory.isUsed(shardIndex) &&
+      shards[shardIndex]->isRebuildRequired(shardIndex))
+    return rebuildShard(shardIndex);
+  return CompactionResult{};
+}
+
+void KVS::waitForCompactions() {
+  std::unique_lock compactionLock{compactionMutex};
+  compactionCondition.wait(compactionLock, [this]() {
+    return compactionQueue.empty() && activeCompactionsCnt == 0;
+  });
+  if (compactionException)
+    std::rethrow_exception(std::exchange(compactionException, nullptr));
+}
+
+void KVS::checkpoint() {
+  storage::IOOperationScope ioScope{syscallStats, storage::IOOperation::OTHER};
+  std::vector<Key> delayedRemovals;
+  {
+    // keeps resizeCacheMap() out, other operations only change the entries concurrently
+    auto locks = lockAllShards<std::shared_lock<std::shared_mutex>>(shardLocks);
+    for (const Entry& entry : cacheMap.getEntries()) {
+      if (entry.ptr.getType() == PtrType::DELETED)
+        delayedRemovals.push_back(entry.key);
+    }
+    std::lock_guard pendingRemovalsLock{pendingRemovalsMutex};
+    delayedRemovals.insert(delayedRemovals.end(), pendingRemovals.begin(),
+                           pendingRemovals.end());
+  }
+  for (const Key& key : delayedRemovals) {
+    HashedKey hashedKey{key};
+    auto [shardIndex, shardLock] = lockShardOfExclusively(hashedKey);
+    Ptr ptr = cacheMap.get(hashedKey);
+    if (ptr.getType() == PtrType::DELETED)
+      ptr = replaceCacheMapPtr(hashedKey, ptr, Ptr{PtrType::NONEXISTENT});
+    if (ptr.getType() == PtrType::DELETED ||
+        (ptr == EMPTY_PTR && takePendingRemoval(key)))
+      shards[shardIndex]->pushRemoveEntry(shardIndex, hashedKey);
+  }
+  for (shard_index_t i : directory.getShardIndices()) {
+    std::unique_lock shardLock{shardLocks[i].mutex};
+    if (directory.isUsed(i) && !shards[i]->isMetadataSaved())
+      shards[i]->saveMetadata(i);
+  }
+}
+
+void KVS::resizeCacheMap(size_t cacheMapMemoryBudget) {
+  storage::IOOperationScope ioScope{syscallStats, storage::IOOperation::OTHER};
+  std::vector<Entry> displaced;
+  {
+    // CacheMap::resize() can't run concurrently with anything else
+    auto locks = lockAllShards<std::unique_lock<std::shared_mutex>>(shardLocks);
+    cacheMap.resize(CacheMap::getSizeForMemoryBudget(cacheMapMemoryBudget),
+                    [this, &displaced](const Entry& entry) {
+                      registerDisplaced(entry, displaced);
+                    });
+  }
+  pushRemovals(std::move(displaced));
+}
+
+size_t KVS::getCacheMapCapacity() const noexcept {
+  // any shard lock keeps resizeCacheMap() out
+  std::shared_lock shardLock{shardLocks[0].mutex};
+  return cacheMap.getCapacity();
+}
+
+size_t KVS::getCacheMapMemoryFootprint() const noexcept {
+  std::shared_lock shardLock{shardLocks[0].mutex};
+  return cacheMap.getMemoryFootprint();
+}
+
+const bloom_filter::BloomFilterStats&
+KVS::getBloomFilterStats() const noexcept {
+  return shardCounters.filterStats;
+}
+
+const shard::RebuildStats& KVS::getRebuildStats() const noexcept {
+  return shardCounters.rebuildStats;
+}
+
+const storage::SyscallStats& KVS::getSyscallStats() const noexcept {
+  return syscallStats;
+}
+
+shard_index_t KVS::getShardIndex(const Key& key) const noexcept {
+  return directory.getShardIndex(HashedKey{key});
+}
+
+CompactionStats KVS::getCompactionStats() {
+  std::lock_guard compactionLock{compactionMutex};
+  CompactionStats stats = compactionStats;
+  stats.queuedShardsCnt = compactionQueue.size();
+  for (const CompactionPriority& priority : compactionQueue)
+    stats.queuedGarbageBytesCnt += std::get<0>(priority);
+  return stats;
+}
+
+KVSStats KVS::stats() {
+  KVSStats stats;
+  stats.cacheMapStats = cacheMapStats;
+  {
+    std::shared_lock shardLock{shardLocks[0].mutex};
+    stats.cacheMapUsedSize = cacheMap.getUsedSize();
+    stats.cacheMapCapacity = cacheMap.getCapacity();
+  }
+  stats.filterStats = shardCounters.filterStats;
+  stats.ioStats = shardCounters.ioStats;
+  stats.rebuildStats = shardCounters.rebuildStats;
+  stats.compactionStats = getCompactionStats();
+  stats.syscallStats = syscallStats;
+  for (shard_index_t shardIndex : directory.getShardIndices()) {
+    std::shared_lock shardLock{shardLocks[shardIndex].mutex};
+    // merged away since the indices were taken
+    if (!directory.isUsed(shardIndex))
+      continue;
+    const Shard& shard = *shards[shardIndex];
+    size_t aliveValuesCnt = shard.getAliveValuesCnt();
+    stats.shardStats.push_back(
+        ShardStats{shardIndex, aliveValuesCnt,
+                   aliveValuesCnt + shard.getDeadSlotsCnt(shardIndex)});
+  }
+  return stats;
+}
+
+void KVS::startStatsDump(std::ostream& out, std::chrono::milliseconds period,
+                         bool json) {
+  std::lock_guard statsDumpThreadLock{statsDumpThreadMutex};
+  if (statsDumpThread.joinable()) {
+    {
+      std::lock_guard statsDumpLock{statsDumpMutex};
+      statsDumpStopped = true;
+    }
+    statsDumpCondition.notify_all();
+    statsDumpThread.join();
+  }
+  statsDumpStopped = false;
+  statsDumpThread = std::thread([this, &out, period, json]() {
+    std::unique_lock statsDumpLock{statsDumpMutex};
+    while (!statsDumpCondition.wait_for(statsDumpLock, period,
+                                        [this]() { return statsDumpStopped; })) {
+      statsDumpLock.unlock();
+      KVSStats snapshot = stats();
+      if (json)
+        snapshot.printJSON(out);
+      else
+        snapshot.printText(out);
+      out.flush();
+      statsDumpLock.lock();
+    }
+  });
+}
+
+void KVS::stopStatsDump() {
+  std::lock_guard statsDumpThreadLock{statsDumpThreadMutex};
+  if (!statsDumpThread.joinable())
+    return;
+  {
+    std::lock_guard statsDumpLock{statsDumpMutex};
+    statsDumpStopped = true;
+  }
+  statsDumpCondition.notify_all();
+  statsDumpThread.join();
+}
+
+void KVS::startTrace(const std::string& filePath, bool fullKeys) {
+  std::atomic_store(&traceWriter,
+                    std::make_shared<trace::TraceWriter>(filePath, fullKeys));
+  tracing = true;
+}
+
+void KVS::stopTrace() {
+  tracing = false;
+  std::shared_ptr<trace::TraceWriter> writer =
+      std::atomic_exchange(&traceWriter, {});
+  if (writer)
+    writer->flush();
+}
+
+std::shared_ptr<trace::TraceWriter> KVS::getTraceWriter() const noexcept {
+  if (!tracing.load(std::memory_order_relaxed))
+    return nullptr;
+  return std::atomic_load(&traceWriter);
 }
 
 void KVS::clear() {
@@ -27,8 +27,16 @@ const char* KVSException::what() const noexcept {
     return "ShardRebuilder failed to move new shard files to old ones";
   case KVSErrorType::FAILED_TO_GET_VALUES_FILE_SIZE:
     return "Failed to get shard values file size";
+  case KVSErrorType::SHARD_METADATA_INVALID_BUILD_DATA:
+    return "Failed to load shard metadata: invalid data";
+  case KVSErrorType::SHARD_DIRECTORY_INVALID_BUILD_DATA:
+    return "Failed to load shard directory: invalid data";
+  case KVSErrorType::TRACE_INVALID_DATA:
+    return "Failed to read trace: invalid data";
   }
   return "<unsupported exception type>";
 }
 
+KVSErrorType KVSException::getType() const noexcept { return errType; }
+
 } // namespace kvs
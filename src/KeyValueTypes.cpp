@@ -43,6 +43,26 @@ hash_t hashKey(const Key& key, seed_t seed) noexcept {
   return XXH3_64bits_withSeed(key.getBytes().get(), KEY_SIZE, seed);
 }
 
+// ----- HashedKey impl -----
+
+HashedKey::HashedKey(const Key& key_) noexcept
+    : key{key_},
+      hash{XXH3_128bits(key_.getBytes().get(), KEY_SIZE)} {}
+
+const Key& HashedKey::getKey() const noexcept { return key; }
+
+hash_t HashedKey::getLowHash() const noexcept { return hash.low64; }
+
+uint32_t HashedKey::getShardBits() const noexcept { return hash.high64 >> 32; }
+
+uint32_t HashedKey::getCacheMapBits() const noexcept {
+  return static_cast<uint32_t>(hash.high64);
+}
+
+uint32_t HashedKey::getStorageHashTableBits() const noexcept {
+  return hash.low64 >> 32;
+}
+
 // ----- Ptr impl -----
 
 Ptr::Ptr(ptr_t ptr_) noexcept : ptr(ptr_) {
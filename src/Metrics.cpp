@@ -0,0 +1,46 @@
+#include "Metrics.h"
+
+namespace kvs::metrics {
+
+Counter::Counter() noexcept : stripes(std::make_unique<Stripe[]>(STRIPES_CNT)) {}
+
+Counter::Counter(uint64_t value) noexcept : Counter() { *this = value; }
+
+Counter::Counter(const Counter& other) noexcept : Counter(other.load()) {}
+
+Counter& Counter::operator=(const Counter& other) noexcept {
+  return *this = other.load();
+}
+
+Counter& Counter::operator=(uint64_t value) noexcept {
+  for (size_t i = 1; i < STRIPES_CNT; i++)
+    stripes[i].value.store(0, std::memory_order_relaxed);
+  stripes[0].value.store(value, std::memory_order_relaxed);
+  return *this;
+}
+
+size_t Counter::getStripeIndex() noexcept {
+  static std::atomic<size_t> nextStripeIndex{0};
+  thread_local size_t stripeIndex =
+      nextStripeIndex.fetch_add(1, std::memory_order_relaxed) &
+      (STRIPES_CNT - 1);
+  return stripeIndex;
+}
+
+Counter& Counter::operator++() noexcept { return *this += 1; }
+
+Counter& Counter::operator+=(uint64_t delta) noexcept {
+  stripes[getStripeIndex()].value.fetch_add(delta, std::memory_order_relaxed);
+  return *this;
+}
+
+uint64_t Counter::load() const noexcept {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < STRIPES_CNT; i++)
+    sum += stripes[i].value.load(std::memory_order_relaxed);
+  return sum;
+}
+
+Counter::operator uint64_t() const noexcept { return load(); }
+
+} // namespace kvs::metrics
@@ -3,6 +3,9 @@
 #include "Storage.h"
 #include "StorageHashTable.h"
 
+#include <algorithm>
+#include <cassert>
+#include <cstring>
 #include <filesystem>
 
 using kvs::storage::Storage, kvs::storage_hash_table::StorageHashTable;
@@ -10,26 +13,39 @@ using kvs::storage::Storage, kvs::storage_hash_table::StorageHashTable;
 namespace kvs::shard {
 
 std::string Shard::storageDirectoryPath = STORAGE_DIRECTORY_PATH;
+double Shard::filterFalsePositiveRate = BLOOM_FILTER_FALSE_POSITIVE_RATE;
 
-shard_index_t Shard::getShardIndex(const Key& key) noexcept {
-  return hashKey(key) % SHARD_NUMBER;
+RebuildStats::RebuildStats(const RebuildStats& other) noexcept {
+  *this = other;
+}
+
+RebuildStats& RebuildStats::operator=(const RebuildStats& other) noexcept {
+  rebuildsCnt = other.rebuildsCnt.load();
+  copiedBytesCnt = other.copiedBytesCnt.load();
+  holePunchesCnt = other.holePunchesCnt.load();
+  punchedBytesCnt = other.punchedBytesCnt.load();
+  splitsCnt = other.splitsCnt.load();
+  mergesCnt = other.mergesCnt.load();
+  buildNanosCnt = other.buildNanosCnt.load();
+  return *this;
 }
 
 std::pair<Entry, std::optional<Value>>
-Shard::readValue(shard_index_t shardIndex, const Key& key) const {
+Shard::readValue(shard_index_t shardIndex, const HashedKey& key) const {
   if (!filter.checkExist(key)) {
-    return std::make_pair(Entry{key}, std::optional<Value>{});
+    ++counters->filterStats.negativesCnt;
+    return std::make_pair(Entry{key.getKey()}, std::optional<Value>{});
   }
-  StorageHashTable storageHashTable{
-      storage::readFile(getStorageHashTableFilePath(shardIndex))};
+  StorageHashTable storageHashTable = readStorageHashTable(shardIndex);
   Ptr ptr = storageHashTable.get(key);
+  recordFilterPositive(ptr);
   switch (ptr.getType()) {
   case PtrType::EMPTY_PTR:
-    return std::make_pair(Entry{key}, std::optional<Value>{});
+    return std::make_pair(Entry{key.getKey()}, std::optional<Value>{});
   case PtrType::DELETED:
-    return std::make_pair(Entry{key, ptr}, std::optional<Value>{});
+    return std::make_pair(Entry{key.getKey(), ptr}, std::optional<Value>{});
   case PtrType::PRESENT:
-    return std::make_pair(Entry{key, ptr},
+    return std::make_pair(Entry{key.getKey(), ptr},
                           std::optional{readValueDirectly(shardIndex, ptr)});
   case PtrType::NONEXISTENT:
     throw std::logic_error("NONEXISTENT is forbidden in StorageHashTable");
@@ -37,40 +53,40 @@ Shard::readValue(shard_index_t shardIndex, const Key& key) const {
   throw std::logic_error("unreachable");
 }
 
-Entry Shard::writeValue(shard_index_t shardIndex, const Key& key,
+Entry Shard::writeValue(shard_index_t shardIndex, const HashedKey& key,
                         const Value& value) {
-  StorageHashTable storageHashTable{
-      storage::readFile(getStorageHashTableFilePath(shardIndex))};
+  StorageHashTable storageHashTable = readStorageHashTable(shardIndex);
   Ptr& ptr = storageHashTable.get(key);
   switch (ptr.getType()) {
 
   case PtrType::PRESENT: {
     writeValueDirectly(shardIndex, ptr, value);
-    return Entry{key, ptr};
+    return Entry{key.getKey(), ptr};
   }
   case PtrType::DELETED: {
+    invalidateMetadata(shardIndex);
     writeValueDirectly(shardIndex, ptr, value);
     ++aliveValuesCnt;
+    --freeSlotsCnt;
 
     ptr.setValuePresent(true);
-    storage::writeFile(getStorageHashTableFilePath(shardIndex),
-                       storageHashTable.serializeToByteArray());
-    return Entry{key, ptr};
+    addToFilter(key, storageHashTable);
+    writeStorageHashTable(shardIndex, storageHashTable);
+    return Entry{key.getKey(), ptr};
   }
   case PtrType::EMPTY_PTR: {
+    checkRoomFor(storageHashTable, 1);
+    invalidateMetadata(shardIndex);
     Storage storage(getValuesFilePath(shardIndex));
-    size_t offset = storage.append(value.getBytes());
+    Ptr newPtr = storeNewValue(storageHashTable, storage, value);
     storage.close();
     ++aliveValuesCnt;
-    filter.add(key);
 
-    Ptr newPtr{offset, true};
-    Entry newEntry{key, newPtr};
-    storageHashTable.put(newEntry);
-    storage::writeFile(getStorageHashTableFilePath(shardIndex),
-                       storageHashTable.serializeToByteArray());
+    storageHashTable.put(key, newPtr);
+    addToFilter(key, storageHashTable);
+    writeStorageHashTable(shardIndex, storageHashTable);
 
-    return newEntry;
+    return Entry{key.getKey(), newPtr};
   }
   case PtrType::NONEXISTENT: {
     throw std::logic_error("NONEXISTENT is forbidden in StorageHashTable");
@@ -79,24 +95,27 @@ Entry Shard::writeValue(shard_index_t shardIndex, const Key& key,
   throw std::logic_error("unreachable");
 }
 
-Entry Shard::removeEntry(shard_index_t shardIndex, const Key& key) {
+Entry Shard::removeEntry(shard_index_t shardIndex, const HashedKey& key) {
   if (!filter.checkExist(key)) {
-    return Entry{key};
+    ++counters->filterStats.negativesCnt;
+    return Entry{key.getKey()};
   }
-  StorageHashTable storageHashTable{
-      storage::readFile(getStorageHashTableFilePath(shardIndex))};
+  StorageHashTable storageHashTable = readStorageHashTable(shardIndex);
   Ptr& ptr = storageHashTable.get(key);
+  recordFilterPositive(ptr);
   switch (ptr.getType()) {
   case PtrType::DELETED:
-    return Entry{key, ptr};
+    return Entry{key.getKey(), ptr};
   case PtrType::EMPTY_PTR:
-    return Entry{key};
+    return Entry{key.getKey()};
   case PtrType::PRESENT: {
+    invalidateMetadata(shardIndex);
     --aliveValuesCnt;
+    ++freeSlotsCnt;
     ptr.setValuePresent(false);
-    storage::writeFile(getStorageHashTableFilePath(shardIndex),
-                       storageHashTable.serializeToByteArray());
-    return Entry{key, ptr};
+    filter.remove(key);
+    writeStorageHashTable(shardIndex, storageHashTable);
+    return Entry{key.getKey(), ptr};
   }
   case PtrType::NONEXISTENT: {
     throw std::logic_error("NONEXISTENT is forbidden in StorageHashTable");
@@ -105,23 +124,26 @@ Entry Shard::removeEntry(shard_index_t shardIndex, const Key& key) {
   throw std::logic_error("unreachable");
 }
 
-Entry Shard::pushRemoveEntry(shard_index_t shardIndex, const Key& key) {
+Entry Shard::pushRemoveEntry(shard_index_t shardIndex, const HashedKey& key) {
   if (!filter.checkExist(key)) {
-    return Entry{key};
+    ++counters->filterStats.negativesCnt;
+    return Entry{key.getKey()};
   }
-  StorageHashTable storageHashTable{
-      storage::readFile(getStorageHashTableFilePath(shardIndex))};
+  StorageHashTable storageHashTable = readStorageHashTable(shardIndex);
   Ptr& ptr = storageHashTable.get(key);
+  recordFilterPositive(ptr);
   switch (ptr.getType()) {
   case PtrType::DELETED:
-    return Entry{key, ptr};
+    return Entry{key.getKey(), ptr};
   case PtrType::EMPTY_PTR:
-    return Entry{key};
+    return Entry{key.getKey()};
   case PtrType::PRESENT: {
+    invalidateMetadata(shardIndex);
+    ++freeSlotsCnt;
     ptr.setValuePresent(false);
-    storage::writeFile(getStorageHashTableFilePath(shardIndex),
-                       storageHashTable.serializeToByteArray());
-    return Entry{key, ptr};
+    filter.remove(key);
+    writeStorageHashTable(shardIndex, storageHashTable);
+    return Entry{key.getKey(), ptr};
   }
   case PtrType::NONEXISTENT: {
     throw std::logic_error("NONEXISTENT is forbidden in StorageHashTable");
@@ -130,10 +152,160 @@ Entry Shard::pushRemoveEntry(shard_index_t shardIndex, const Key& key) {
   throw std::logic_error("unreachable");
 }
 
+std::vector<std::pair<Entry, std::optional<Value>>>
+Shard::readValues(shard_index_t shardIndex,
+                  const std::vector<HashedKey>& keys) const {
+  std::vector<bool> mayExist = filter.checkExist(keys);
+  std::vector<std::pair<Entry, std::optional<Value>>> result;
+  result.reserve(keys.size());
+  // both files are opened lazily, the filter may reject every key
+  std::optional<StorageHashTable> storageHashTable;
+  std::optional<Storage> valuesStorage;
+  for (size_t i = 0; i < keys.size(); i++) {
+    const Key& key = keys[i].getKey();
+    if (!mayExist[i]) {
+      ++counters->filterStats.negativesCnt;
+      result.emplace_back(Entry{key}, std::nullopt);
+      continue;
+    }
+    if (!storageHashTable.has_value())
+      storageHashTable.emplace(readStorageHashTable(shardIndex));
+    Ptr ptr = storageHashTable->get(keys[i]);
+    recordFilterPositive(ptr);
+    switch (ptr.getType()) {
+    case PtrType::EMPTY_PTR:
+      result.emplace_back(Entry{key}, std::nullopt);
+      break;
+    case PtrType::DELETED:
+      result.emplace_back(Entry{key, ptr}, std::nullopt);
+      break;
+    case PtrType::PRESENT:
+      if (!valuesStorage.has_value())
+        valuesStorage.emplace(getValuesFilePath(shardIndex));
+      result.emplace_back(Entry{key, ptr},
+                          Value{valuesStorage->read(ptr.getOffset(), VALUE_SIZE)});
+      counters->ioStats.valuesReadBytesCnt += VALUE_SIZE;
+      break;
+    case PtrType::NONEXISTENT:
+      throw std::logic_error("NONEXISTENT is forbidden in StorageHashTable");
+    }
+  }
+  if (valuesStorage.has_value())
+    valuesStorage->close();
+  return result;
+}
+
+std::vector<Entry> Shard::writeValues(
+    shard_index_t shardIndex, const std::vector<HashedKey>& keys,
+    const std::vector<std::reference_wrapper<const Value>>& values) {
+  assert(keys.size() == values.size());
+  StorageHashTable storageHashTable = readStorageHashTable(shardIndex);
+  std::vector<const HashedKey*> newKeys;
+  for (const HashedKey& key : keys) {
+    if (storageHashTable.get(key) == EMPTY_PTR &&
+        std::none_of(newKeys.begin(), newKeys.end(),
+                     [&key](const HashedKey* newKey) {
+                       return newKey->getKey() == key.getKey();
+                     }))
+      newKeys.push_back(&key);
+  }
+  checkRoomFor(storageHashTable, newKeys.size());
+
+  Storage valuesStorage{getValuesFilePath(shardIndex)};
+  bool indexChanged = false;
+  std::vector<Entry> result;
+  result.reserve(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    const HashedKey& key = keys[i];
+    const Value& value = values[i];
+    Ptr& ptr = storageHashTable.get(key);
+    switch (ptr.getType()) {
+    case PtrType::PRESENT: {
+      valuesStorage.write(ptr.getOffset(), value.getBytes());
+      counters->ioStats.valuesWrittenBytesCnt += VALUE_SIZE;
+      result.emplace_back(key.getKey(), ptr);
+      break;
+    }
+    case PtrType::DELETED: {
+      invalidateMetadata(shardIndex);
+      indexChanged = true;
+      valuesStorage.write(ptr.getOffset(), value.getBytes());
+      counters->ioStats.valuesWrittenBytesCnt += VALUE_SIZE;
+      ++aliveValuesCnt;
+      --freeSlotsCnt;
+      ptr.setValuePresent(true);
+      result.emplace_back(key.getKey(), ptr);
+      addToFilter(key, storageHashTable);
+      break;
+    }
+    case PtrType::EMPTY_PTR: {
+      invalidateMetadata(shardIndex);
+      indexChanged = true;
+      Ptr newPtr = storeNewValue(storageHashTable, valuesStorage, value);
+      ++aliveValuesCnt;
+      storageHashTable.put(key, newPtr);
+      result.emplace_back(key.getKey(), newPtr);
+      addToFilter(key, storageHashTable);
+      break;
+    }
+    case PtrType::NONEXISTENT:
+      throw std::logic_error("NONEXISTENT is forbidden in StorageHashTable");
+    }
+  }
+  valuesStorage.close();
+  if (indexChanged)
+    writeStorageHashTable(shardIndex, storageHashTable);
+  return result;
+}
+
+std::vector<Entry> Shard::removeEntries(shard_index_t shardIndex,
+                                        const std::vector<HashedKey>& keys) {
+  std::optional<StorageHashTable> storageHashTable;
+  bool indexChanged = false;
+  std::vector<Entry> result;
+  result.reserve(keys.size());
+  for (const HashedKey& key : keys) {
+    // checked one by one, since removals change the filter
+    if (!filter.checkExist(key)) {
+      ++counters->filterStats.negativesCnt;
+      result.emplace_back(key.getKey());
+      continue;
+    }
+    if (!storageHashTable.has_value())
+      storageHashTable.emplace(readStorageHashTable(shardIndex));
+    Ptr& ptr = storageHashTable->get(key);
+    recordFilterPositive(ptr);
+    switch (ptr.getType()) {
+    case PtrType::DELETED:
+      result.emplace_back(key.getKey(), ptr);
+      break;
+    case PtrType::EMPTY_PTR:
+      result.emplace_back(key.getKey());
+      break;
+    case PtrType::PRESENT: {
+      invalidateMetadata(shardIndex);
+      indexChanged = true;
+      --aliveValuesCnt;
+      ++freeSlotsCnt;
+      ptr.setValuePresent(false);
+      filter.remove(key);
+      result.emplace_back(key.getKey(), ptr);
+      break;
+    }
+    case PtrType::NONEXISTENT:
+      throw std::logic_error("NONEXISTENT is forbidden in StorageHashTable");
+    }
+  }
+  if (indexChanged)
+    writeStorageHashTable(shardIndex, *storageHashTable);
+  return result;
+}
+
 Value Shard::readValueDirectly(shard_index_t shardIndex, Ptr ptr) const {
   Storage storage{getValuesFilePath(shardIndex)};
   Value value{storage.read(ptr.getOffset(), VALUE_SIZE)};
   storage.close();
+  counters->ioStats.valuesReadBytesCnt += VALUE_SIZE;
   return value;
 }
 
@@ -142,32 +314,244 @@ void Shard::writeValueDirectly(shard_index_t shardIndex, Ptr ptr,
   Storage storage{getValuesFilePath(shardIndex)};
   storage.write(ptr.getOffset(), value.getBytes());
   storage.close();
+  counters->ioStats.valuesWrittenBytesCnt += VALUE_SIZE;
+}
+
+std::vector<Value>
+Shard::readValuesDirectly(shard_index_t shardIndex,
+                          const std::vector<Ptr>& ptrs) const {
+  std::vector<Value> values;
+  values.reserve(ptrs.size());
+  Storage storage{getValuesFilePath(shardIndex)};
+  for (Ptr ptr : ptrs)
+    values.emplace_back(storage.read(ptr.getOffset(), VALUE_SIZE));
+  storage.close();
+  counters->ioStats.valuesReadBytesCnt += ptrs.size() * VALUE_SIZE;
+  return values;
+}
+
+void Shard::writeValuesDirectly(
+    shard_index_t shardIndex, const std::vector<Ptr>& ptrs,
+    const std::vector<std::reference_wrapper<const Value>>& values) {
+  assert(ptrs.size() == values.size());
+  Storage storage{getValuesFilePath(shardIndex)};
+  for (size_t i = 0; i < ptrs.size(); i++)
+    storage.write(ptrs[i].getOffset(), values[i].get().getBytes());
+  storage.close();
+  counters->ioStats.valuesWrittenBytesCnt += ptrs.size() * VALUE_SIZE;
+}
+
+StorageHashTable Shard::readStorageHashTable(shard_index_t shardIndex) const {
+  ++counters->ioStats.indexReadsCnt;
+  return StorageHashTable{
+      storage::readFile(getStorageHashTableFilePath(shardIndex))};
+}
+
+void Shard::writeStorageHashTable(
+    shard_index_t shardIndex, const StorageHashTable& storageHashTable) const {
+  ++counters->ioStats.indexWritesCnt;
+  storage::writeFile(getStorageHashTableFilePath(shardIndex),
+                     storageHashTable.serializeToByteArray());
+}
+
+void Shard::checkRoomFor(const StorageHashTable& storageHashTable,
+                         size_t newKeysCnt) const {
+  if (storageHashTable.getUsedSize() + newKeysCnt >
+      SHARD_MAX_KEYS_CNT + freeSlotsCnt)
+    throw KVSException(KVSErrorType::SHARD_OVERFLOW);
+}
+
+Ptr Shard::storeNewValue(StorageHashTable& storageHashTable,
+                         Storage& valuesStorage, const Value& value) {
+  counters->ioStats.valuesWrittenBytesCnt += VALUE_SIZE;
+  std::optional<Ptr> freeSlot;
+  if (freeSlotsCnt > 0)
+    freeSlot = storageHashTable.takeDeletedEntry();
+  if (freeSlot.has_value()) {
+    // the DELETED entry is gone, its Key is absent from the shard now
+    --freeSlotsCnt;
+    valuesStorage.write(freeSlot->getOffset(), value.getBytes());
+    return Ptr{freeSlot->getOffset(), true};
+  }
+  if (!holes.empty()) {
+    size_t offset = holes.back();
+    holes.pop_back();
+    valuesStorage.write(offset, value.getBytes());
+    return Ptr{offset, true};
+  }
+  return Ptr{valuesStorage.append(value.getBytes()), true};
 }
 
 void Shard::incrementAliveValuesCnt() noexcept { ++aliveValuesCnt; }
 
 void Shard::decrementAliveValuesCnt() noexcept { --aliveValuesCnt; }
 
+bool Shard::mayContain(const HashedKey& key) const noexcept {
+  return filter.checkExist(key);
+}
+
+size_t Shard::getAliveValuesCnt() const noexcept { return aliveValuesCnt; }
+
+size_t Shard::getFreeSlotsCnt() const noexcept { return freeSlotsCnt; }
+
+size_t Shard::getHolesCnt() const noexcept { return holes.size(); }
+
+size_t Shard::getDeadSlotsCnt(shard_index_t shardIndex) const {
+  size_t valuesCnt;
+  try {
+    valuesCnt =
+        storage::getFileSize(getValuesFilePath(shardIndex)) / VALUE_SIZE;
+  } catch (const std::exception& exc) {
+    throw KVSException(KVSErrorType::FAILED_TO_GET_VALUES_FILE_SIZE);
+  }
+  size_t usedSlotsCnt = valuesCnt - holes.size();
+  return usedSlotsCnt > aliveValuesCnt ? usedSlotsCnt - aliveValuesCnt : 0;
+}
+
 bool Shard::isRebuildRequired(shard_index_t shardIndex) const {
+  return (getDeadSlotsCnt(shardIndex) + aliveValuesCnt) *
+             MAX_OUTDATED_RECORDS_LOAD_FACTOR >
+         aliveValuesCnt;
+}
+
+void Shard::saveMetadata(shard_index_t shardIndex) {
+  MetadataHeader header;
+  header.version = METADATA_VERSION;
+  header.aliveValuesCnt = aliveValuesCnt;
+  header.freeSlotsCnt = freeSlotsCnt;
+  header.holesCnt = holes.size();
   try {
-    values_cnt_t valuesCnt =
-        std::filesystem::file_size(getValuesFilePath(shardIndex)) / VALUE_SIZE;
-    return valuesCnt * MAX_OUTDATED_RECORDS_LOAD_FACTOR > aliveValuesCnt;
+    header.valuesFileSize =
+        storage::getFileSize(getValuesFilePath(shardIndex));
+    header.storageHashTableFileSize =
+        storage::getFileSize(getStorageHashTableFilePath(shardIndex));
   } catch (const std::exception& exc) {
     throw KVSException(KVSErrorType::FAILED_TO_GET_VALUES_FILE_SIZE);
   }
+
+  std::vector<uint64_t> holeOffsets(holes.begin(), holes.end());
+  size_t holesLength = holeOffsets.size() * sizeof(uint64_t);
+  ByteArray serializedFilter = filter.serializeToByteArray();
+  ByteArray bytes(sizeof(MetadataHeader) + holesLength +
+                  serializedFilter.length());
+  memcpy(bytes.get(), reinterpret_cast<const char*>(&header),
+         sizeof(MetadataHeader));
+  memcpy(bytes.get() + sizeof(MetadataHeader),
+         reinterpret_cast<const char*>(holeOffsets.data()), holesLength);
+  memcpy(bytes.get() + sizeof(MetadataHeader) + holesLength,
+         serializedFilter.get(), serializedFilter.length());
+  storage::writeFile(getMetadataFilePath(shardIndex), bytes);
+  metadataSaved = true;
+}
+
+bool Shard::isMetadataSaved() const noexcept { return metadataSaved; }
+
+void Shard::invalidateMetadata(shard_index_t shardIndex) {
+  if (!metadataSaved)
+    return;
+  std::error_code errorCode;
+  storage::removeFile(getMetadataFilePath(shardIndex), errorCode);
+  metadataSaved = false;
+}
+
+Shard::Shard(ShardCounters& counters) noexcept
+    : counters{&counters},
+      aliveValuesCnt{0},
+      freeSlotsCnt{0},
+      filter{SHARD_EXPECTED_SIZE, filterFalsePositiveRate},
+      metadataSaved{false} {}
+
+Shard::Shard(const std::vector<Entry>& storageHashTableEntries,
+             size_t valuesFileSize, ShardCounters& counters) noexcept
+    : counters{&counters}, aliveValuesCnt{0}, metadataSaved{false} {
+  rebuildFilter(storageHashTableEntries, SHARD_EXPECTED_SIZE);
+  aliveValuesCnt = filter.getKeysCnt();
+  freeSlotsCnt = std::count_if(
+      storageHashTableEntries.begin(), storageHashTableEntries.end(),
+      [](const Entry& e) { return e.ptr.getType() == PtrType::DELETED; });
+
+  std::vector<bool> referenced(valuesFileSize / VALUE_SIZE);
+  for (const Entry& entry : storageHashTableEntries) {
+    if (entry.ptr.getOffset() / VALUE_SIZE < referenced.size())
+      referenced[entry.ptr.getOffset() / VALUE_SIZE] = true;
+  }
+  for (size_t i = 0; i < referenced.size(); i++) {
+    if (!referenced[i])
+      holes.push_back(i * VALUE_SIZE);
+  }
 }
 
-Shard::Shard() noexcept : aliveValuesCnt{0}, filter{} {}
+Shard::Shard(shard_index_t shardIndex, const ByteArray& array,
+             ShardCounters& counters)
+    : counters{&counters}, metadataSaved{true} {
+  MetadataHeader header;
+  if (array.length() < sizeof(MetadataHeader))
+    throw KVSException(KVSErrorType::SHARD_METADATA_INVALID_BUILD_DATA);
+  memcpy(reinterpret_cast<char*>(&header), array.get(),
+         sizeof(MetadataHeader));
+  if (header.version != METADATA_VERSION)
+    throw KVSException(KVSErrorType::SHARD_METADATA_INVALID_BUILD_DATA);
+
+  // the files could have been changed after a crash
+  try {
+    if (header.valuesFileSize !=
+            storage::getFileSize(getValuesFilePath(shardIndex)) ||
+        header.storageHashTableFileSize !=
+            storage::getFileSize(getStorageHashTableFilePath(shardIndex)))
+      throw KVSException(KVSErrorType::SHARD_METADATA_INVALID_BUILD_DATA);
+  } catch (const std::filesystem::filesystem_error& exc) {
+    throw KVSException(KVSErrorType::SHARD_METADATA_INVALID_BUILD_DATA);
+  }
+
+  size_t holesLength = header.holesCnt * sizeof(uint64_t);
+  if (header.holesCnt > header.valuesFileSize / VALUE_SIZE ||
+      array.length() < sizeof(MetadataHeader) + holesLength)
+    throw KVSException(KVSErrorType::SHARD_METADATA_INVALID_BUILD_DATA);
+  std::vector<uint64_t> holeOffsets(header.holesCnt);
+  memcpy(reinterpret_cast<char*>(holeOffsets.data()),
+         array.get() + sizeof(MetadataHeader), holesLength);
+  holes.assign(holeOffsets.begin(), holeOffsets.end());
 
-Shard::Shard(const std::vector<Entry>& storageHashTableEntries) noexcept
-    : aliveValuesCnt{static_cast<values_cnt_t>(storageHashTableEntries.size())},
-      filter{} {
+  ByteArray serializedFilter(array.length() - sizeof(MetadataHeader) -
+                             holesLength);
+  memcpy(serializedFilter.get(),
+         array.get() + sizeof(MetadataHeader) + holesLength,
+         serializedFilter.length());
+  filter = bloom_filter::BloomFilter{serializedFilter};
+  aliveValuesCnt = header.aliveValuesCnt;
+  freeSlotsCnt = header.freeSlotsCnt;
+}
+
+void Shard::rebuildFilter(const std::vector<Entry>& storageHashTableEntries,
+                          size_t minExpectedKeysCnt) noexcept {
+  size_t presentCnt = std::count_if(
+      storageHashTableEntries.begin(), storageHashTableEntries.end(),
+      [](const Entry& e) { return e.ptr.getType() == PtrType::PRESENT; });
+  filter = bloom_filter::BloomFilter{std::max(minExpectedKeysCnt, presentCnt),
+                                     filterFalsePositiveRate};
   for (const Entry& entry : storageHashTableEntries) {
-    filter.add(entry.key);
+    if (entry.ptr.getType() == PtrType::PRESENT)
+      filter.add(entry.key);
+  }
+}
+
+void Shard::addToFilter(const HashedKey& key,
+                        const StorageHashTable& storageHashTable) noexcept {
+  filter.add(key);
+  if (filter.isOverflowed()) {
+    rebuildFilter(storageHashTable.getEntries(),
+                  2 * filter.getExpectedKeysCnt());
   }
 }
 
+void Shard::recordFilterPositive(
+    const Ptr& storageHashTablePtr) const noexcept {
+  if (storageHashTablePtr.getType() == PtrType::PRESENT)
+    ++counters->filterStats.truePositivesCnt;
+  else
+    ++counters->filterStats.falsePositivesCnt;
+}
+
 std::string Shard::getShardDirectoryPath(shard_index_t shardIndex) noexcept {
   return Shard::storageDirectoryPath + std::to_string(shardIndex);
 }
@@ -181,4 +565,8 @@ Shard::getStorageHashTableFilePath(shard_index_t shardIndex) noexcept {
   return Shard::storageDirectoryPath + std::to_string(shardIndex) + "/index";
 }
 
+std::string Shard::getMetadataFilePath(shard_index_t shardIndex) noexcept {
+  return Shard::storageDirectoryPath + std::to_string(shardIndex) + "/meta";
+}
+
 } // namespace kvs::shard
@@ -3,15 +3,45 @@
 #include "Storage.h"
 #include "StorageHashTable.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <filesystem>
 #include <iostream>
 
-using kvs::storage::Storage, kvs::storage_hash_table::StorageHashTable;
+using kvs::storage_hash_table::StorageHashTable;
 
 namespace kvs::shard {
 
-Shard ShardBuilder::createShard(shard_index_t shardIndex) {
+double ShardBuilder::rewriteFragmentation = COMPACTION_REWRITE_FRAGMENTATION;
+
+namespace {
+
+/**
+ * @brief Adds the time from its construction to its destruction to RebuildStats::buildNanosCnt.
+ *
+ */
+class BuildTimer final {
+public:
+  explicit BuildTimer(RebuildStats& rebuildStats) noexcept
+      : rebuildStats(rebuildStats), begin(std::chrono::steady_clock::now()) {}
+
+  ~BuildTimer() {
+    rebuildStats.buildNanosCnt +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - begin)
+            .count();
+  }
+
+private:
+  RebuildStats& rebuildStats;
+  std::chrono::steady_clock::time_point begin;
+};
+
+} // namespace
+
+Shard ShardBuilder::createShard(shard_index_t shardIndex,
+                                ShardCounters& counters) {
   try {
     std::filesystem::create_directories(
         Shard::getShardDirectoryPath(shardIndex));
@@ -22,71 +52,284 @@ Shard ShardBuilder::createShard(shard_index_t shardIndex) {
   storage::writeFile(
       Shard::getStorageHashTableFilePath(shardIndex),
       StorageHashTable{STORAGE_HASH_TABLE_INITIAL_SIZE}.serializeToByteArray());
-  return Shard{};
+  Shard shard{counters};
+  shard.saveMetadata(shardIndex);
+  return shard;
 }
 
-std::pair<Shard, std::vector<Entry>>
-ShardBuilder::rebuildShard(const Shard& shard, shard_index_t shardIndex,
-                           const kvs::cache_map::CacheMap& cacheMap) {
-  assert(shard.isRebuildRequired(shardIndex));
+Shard ShardBuilder::openShard(shard_index_t shardIndex,
+                              ShardCounters& counters) {
+  std::string metadataFilePath = Shard::getMetadataFilePath(shardIndex);
+  if (storage::fileExists(metadataFilePath)) {
+    try {
+      return Shard{shardIndex, storage::readFile(metadataFilePath), counters};
+    } catch (const KVSException& exc) {
+      // fall back to scanning the index
+    }
+  }
+
   std::string hashTableFilePath =
       Shard::getStorageHashTableFilePath(shardIndex);
-  std::string valuesFilePath = Shard::getValuesFilePath(shardIndex);
+  if (!storage::fileExists(hashTableFilePath) ||
+      !storage::fileExists(Shard::getValuesFilePath(shardIndex)))
+    return createShard(shardIndex, counters);
 
   std::vector<Entry> shardEntries =
       StorageHashTable{storage::readFile(hashTableFilePath)}.getEntries();
-  std::vector<Entry> cacheMapUpdatedEntries;
-  StorageHashTable newStorageHashTable{STORAGE_HASH_TABLE_INITIAL_SIZE};
+  Shard shard{shardEntries,
+              storage::getFileSize(Shard::getValuesFilePath(shardIndex)),
+              counters};
+  shard.saveMetadata(shardIndex);
+  return shard;
+}
 
-  std::string newHashTableFilePath = hashTableFilePath + ":rebuilt";
-  std::string newValuesFilePath = valuesFilePath + ":rebuilt";
-  storage::writeFile(newValuesFilePath, ByteArray{0});
-  Storage newValuesStorage{newValuesFilePath};
+std::pair<Shard, std::vector<Entry>>
+ShardBuilder::rebuildShard(const Shard& shard, shard_index_t shardIndex,
+                           const kvs::cache_map::CacheMap& cacheMap) {
+  return rebuildShard(shard, shardIndex, [&cacheMap](const HashedKey& key) {
+    return cacheMap.get(key);
+  });
+}
+
+std::pair<Shard, std::vector<Entry>> ShardBuilder::rebuildShard(
+    const Shard& shard, shard_index_t shardIndex,
+    const std::function<Ptr(const HashedKey&)>& getCacheMapPtr) {
+  RebuiltShard rebuilt = buildShard(shard, shardIndex, getCacheMapPtr);
+  replaceShard(shardIndex, rebuilt);
+  return std::make_pair(rebuilt.shard, rebuilt.cacheMapUpdatedEntries);
+}
 
+std::string ShardBuilder::getRebuiltFilePath(const std::string& filePath) {
+  return filePath + ":rebuilt";
+}
+
+void ShardBuilder::collectSurvivors(
+    const std::vector<Entry>& shardEntries,
+    const std::function<Ptr(const HashedKey&)>& getCacheMapPtr,
+    Survivors& survivors, std::vector<Entry>& cacheMapUpdatedEntries) {
   for (const auto& shardEntry : shardEntries) {
     const Key& key = shardEntry.key;
-    Ptr cacheMapPtr = cacheMap.get(key);
+    HashedKey hashedKey{key};
+    Ptr cacheMapPtr = getCacheMapPtr(hashedKey);
     switch (cacheMapPtr.getType()) {
     case PtrType::DELETED: { // == not sync deleted
       cacheMapUpdatedEntries.emplace_back(key, Ptr{PtrType::NONEXISTENT});
       break;
     }
     case PtrType::NONEXISTENT: { // == sync deleted
-      assert(shardEntry.ptr.getType() == PtrType::NONEXISTENT);
+      assert(shardEntry.ptr.getType() == PtrType::DELETED);
       break;
     }
     case PtrType::EMPTY_PTR: {
-      if (shardEntry.ptr.getType() == PtrType::PRESENT) {
-        size_t newOffset = newValuesStorage.append(
-            shard.readValueDirectly(shardIndex, shardEntry.ptr).getBytes());
-        newStorageHashTable.put(Entry{key, Ptr{newOffset, true}});
-      }
+      if (shardEntry.ptr.getType() == PtrType::PRESENT)
+        survivors.emplace_back(hashedKey, shardEntry.ptr);
       break;
     }
     case PtrType::PRESENT: {
       assert(shardEntry.ptr.getType() == PtrType::PRESENT);
-      size_t newOffset = newValuesStorage.append(
-          shard.readValueDirectly(shardIndex, shardEntry.ptr).getBytes());
-      newStorageHashTable.put(Entry{key, Ptr{newOffset, true}});
-      cacheMapUpdatedEntries.emplace_back(key, Ptr{newOffset, true});
+      survivors.emplace_back(hashedKey, shardEntry.ptr);
       break;
     }
     }
   }
-  newValuesStorage.close();
-  storage::writeFile(newHashTableFilePath,
-                     newStorageHashTable.serializeToByteArray());
+}
+
+ShardBuilder::RebuiltShard ShardBuilder::rewriteSurvivors(
+    shard_index_t shardIndex,
+    std::vector<std::pair<shard_index_t, Survivors>>& survivors,
+    std::vector<Entry> cacheMapUpdatedEntries, ShardCounters& counters) {
+  std::string rebuiltValuesFilePath =
+      getRebuiltFilePath(Shard::getValuesFilePath(shardIndex));
+  StorageHashTable newStorageHashTable{STORAGE_HASH_TABLE_INITIAL_SIZE};
+  size_t valuesCnt = 0;
+  for (auto& [sourceShardIndex, sourceSurvivors] : survivors) {
+    // keep the order of the old file, so that it is read in one pass and neighbouring values are copied as one range
+    std::sort(sourceSurvivors.begin(), sourceSurvivors.end(),
+              [](const auto& lhs, const auto& rhs) {
+                return lhs.second.getOffset() < rhs.second.getOffset();
+              });
+    std::vector<std::pair<size_t, size_t>> ranges;
+    for (const auto& [hashedKey, oldPtr] : sourceSurvivors) {
+      size_t oldOffset = oldPtr.getOffset();
+      if (!ranges.empty() &&
+          ranges.back().first + ranges.back().second == oldOffset)
+        ranges.back().second += VALUE_SIZE;
+      else
+        ranges.emplace_back(oldOffset, VALUE_SIZE);
+
+      Ptr newPtr{valuesCnt++ * VALUE_SIZE, true};
+      newStorageHashTable.put(hashedKey, newPtr);
+      // the Key may be cached with the old Ptr before the new files replace the old ones
+      cacheMapUpdatedEntries.emplace_back(hashedKey.getKey(), newPtr);
+    }
+    storage::copyFileRanges(Shard::getValuesFilePath(sourceShardIndex),
+                            rebuiltValuesFilePath, ranges,
+                            &sourceSurvivors != &survivors.front().second);
+  }
+  counters.rebuildStats.copiedBytesCnt += valuesCnt * VALUE_SIZE;
+  storage::writeFile(
+      getRebuiltFilePath(Shard::getStorageHashTableFilePath(shardIndex)),
+      newStorageHashTable.serializeToByteArray());
+
+  return RebuiltShard{
+      Shard{newStorageHashTable.getEntries(), valuesCnt * VALUE_SIZE,
+            counters},
+      CompactionMode::REWRITE, std::move(cacheMapUpdatedEntries)};
+}
+
+ShardBuilder::RebuiltShard ShardBuilder::buildShard(
+    const Shard& shard, shard_index_t shardIndex,
+    const std::function<Ptr(const HashedKey&)>& getCacheMapPtr) {
+  assert(shard.isRebuildRequired(shardIndex));
+  BuildTimer buildTimer{shard.counters->rebuildStats};
+  CompactionMode mode = chooseCompactionMode(shard, shardIndex);
+  std::string valuesFilePath = Shard::getValuesFilePath(shardIndex);
+  std::string hashTableFilePath =
+      Shard::getStorageHashTableFilePath(shardIndex);
+
+  std::vector<Entry> shardEntries =
+      StorageHashTable{storage::readFile(hashTableFilePath)}.getEntries();
+  std::vector<Entry> cacheMapUpdatedEntries;
+  Survivors survivors;
+  collectSurvivors(shardEntries, getCacheMapPtr, survivors,
+                   cacheMapUpdatedEntries);
+
+  if (mode == CompactionMode::PUNCH_HOLES) {
+    StorageHashTable newStorageHashTable{STORAGE_HASH_TABLE_INITIAL_SIZE};
+    for (const auto& [hashedKey, ptr] : survivors)
+      newStorageHashTable.put(hashedKey, ptr);
+    storage::writeFile(getRebuiltFilePath(hashTableFilePath),
+                       newStorageHashTable.serializeToByteArray());
+    return RebuiltShard{Shard{newStorageHashTable.getEntries(),
+                              storage::getFileSize(valuesFilePath),
+                              *shard.counters},
+                        mode, std::move(cacheMapUpdatedEntries)};
+  }
+
+  std::vector<std::pair<shard_index_t, Survivors>> sources;
+  sources.emplace_back(shardIndex, std::move(survivors));
+  return rewriteSurvivors(shardIndex, sources,
+                          std::move(cacheMapUpdatedEntries), *shard.counters);
+}
+
+std::vector<ShardBuilder::RebuiltShard> ShardBuilder::buildReshardedShards(
+    const std::vector<shard_index_t>& shardIndices,
+    const std::vector<shard_index_t>& newShardIndices,
+    const std::function<std::optional<size_t>(const HashedKey&,
+                                              shard_index_t)>& getNewShard,
+    const std::function<Ptr(const HashedKey&)>& getCacheMapPtr,
+    ShardCounters& counters) {
+  BuildTimer buildTimer{counters.rebuildStats};
+  std::vector<std::vector<std::pair<shard_index_t, Survivors>>> survivors(
+      newShardIndices.size());
+  std::vector<std::vector<Entry>> cacheMapUpdatedEntries(
+      newShardIndices.size());
+  for (shard_index_t shardIndex : shardIndices) {
+    std::vector<std::vector<Entry>> shardEntries(newShardIndices.size());
+    for (const Entry& entry :
+         StorageHashTable{storage::readFile(
+                              Shard::getStorageHashTableFilePath(shardIndex))}
+             .getEntries()) {
+      std::optional<size_t> newShard =
+          getNewShard(HashedKey{entry.key}, shardIndex);
+      if (newShard.has_value())
+        shardEntries[newShard.value()].push_back(entry);
+    }
+    for (size_t i = 0; i < newShardIndices.size(); i++) {
+      survivors[i].emplace_back(shardIndex, Survivors{});
+      collectSurvivors(shardEntries[i], getCacheMapPtr,
+                       survivors[i].back().second, cacheMapUpdatedEntries[i]);
+    }
+  }
+
+  std::vector<RebuiltShard> result;
+  result.reserve(newShardIndices.size());
+  for (size_t i = 0; i < newShardIndices.size(); i++) {
+    try {
+      std::filesystem::create_directories(
+          Shard::getShardDirectoryPath(newShardIndices[i]));
+    } catch (const std::exception& exc) {
+      throw KVSException{KVSErrorType::FAILED_TO_CREATE_SHARD_DIRECTORY};
+    }
+    result.push_back(rewriteSurvivors(newShardIndices[i], survivors[i],
+                                      std::move(cacheMapUpdatedEntries[i]),
+                                      counters));
+  }
+  return result;
+}
+
+void ShardBuilder::replaceShard(shard_index_t shardIndex,
+                                RebuiltShard& rebuilt) {
+  std::string valuesFilePath = Shard::getValuesFilePath(shardIndex);
+  std::string hashTableFilePath =
+      Shard::getStorageHashTableFilePath(shardIndex);
+  std::error_code errorCode;
+  storage::removeFile(Shard::getMetadataFilePath(shardIndex), errorCode);
 
   try {
-    std::filesystem::rename(newValuesFilePath, valuesFilePath);
-    std::filesystem::rename(newHashTableFilePath, hashTableFilePath);
+    if (rebuilt.mode == CompactionMode::REWRITE)
+      storage::renameFile(getRebuiltFilePath(valuesFilePath), valuesFilePath);
+    storage::renameFile(getRebuiltFilePath(hashTableFilePath),
+                        hashTableFilePath);
   } catch (const std::exception& exc) {
     throw KVSException{
         KVSErrorType::SHARD_REBUILDER_FAILED_TO_REPLACE_OLD_FILES};
   }
 
-  Shard newShard{newStorageHashTable.getEntries()};
-  assert(!newShard.isRebuildRequired(shardIndex));
-  return std::make_pair(newShard, cacheMapUpdatedEntries);
+  if (rebuilt.mode == CompactionMode::PUNCH_HOLES) {
+    // neighbouring slots are punched together, so that whole blocks are released
+    std::vector<size_t> holes = rebuilt.shard.holes;
+    std::sort(holes.begin(), holes.end());
+    std::vector<std::pair<size_t, size_t>> ranges;
+    for (size_t offset : holes) {
+      if (!ranges.empty() &&
+          ranges.back().first + ranges.back().second == offset)
+        ranges.back().second += VALUE_SIZE;
+      else
+        ranges.emplace_back(offset, VALUE_SIZE);
+    }
+    if (storage::punchHoles(valuesFilePath, ranges))
+      rebuilt.shard.counters->rebuildStats.punchedBytesCnt +=
+          holes.size() * VALUE_SIZE;
+    ++rebuilt.shard.counters->rebuildStats.holePunchesCnt;
+  }
+
+  assert(!rebuilt.shard.isRebuildRequired(shardIndex));
+  rebuilt.shard.saveMetadata(shardIndex);
+  ++rebuilt.shard.counters->rebuildStats.rebuildsCnt;
+}
+
+CompactionMode ShardBuilder::chooseCompactionMode(const Shard& shard,
+                                                  shard_index_t shardIndex) {
+  size_t valuesCnt;
+  try {
+    valuesCnt =
+        storage::getFileSize(Shard::getValuesFilePath(shardIndex)) /
+        VALUE_SIZE;
+  } catch (const std::exception& exc) {
+    throw KVSException(KVSErrorType::FAILED_TO_GET_VALUES_FILE_SIZE);
+  }
+  if (valuesCnt == 0)
+    return CompactionMode::REWRITE;
+  double fragmentation =
+      static_cast<double>(valuesCnt - shard.aliveValuesCnt) / valuesCnt;
+  return fragmentation > rewriteFragmentation ? CompactionMode::REWRITE
+                                              : CompactionMode::PUNCH_HOLES;
+}
+
+void ShardBuilder::removeShard(shard_index_t shardIndex) noexcept {
+  std::error_code errorCode;
+  std::filesystem::remove_all(Shard::getShardDirectoryPath(shardIndex),
+                              errorCode);
+}
+
+void ShardBuilder::discardRebuiltShard(shard_index_t shardIndex) noexcept {
+  std::error_code errorCode;
+  storage::removeFile(
+      getRebuiltFilePath(Shard::getValuesFilePath(shardIndex)), errorCode);
+  storage::removeFile(
+      getRebuiltFilePath(Shard::getStorageHashTableFilePath(shardIndex)),
+      errorCode);
 }
+
 } // namespace kvs::shard
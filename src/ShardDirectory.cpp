@@ -0,0 +1,234 @@
+#include "ShardDirectory.h"
+#include "KVSException.h"
+#include "Shard.h"
+#include "Storage.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+namespace kvs::shard {
+
+namespace {
+
+uint32_t getMask(uint8_t depth) noexcept {
+  return (uint32_t{1} << depth) - 1;
+}
+
+uint8_t getDepth(size_t slotsCnt) noexcept {
+  uint8_t depth = 0;
+  while ((size_t{1} << depth) < slotsCnt) depth++;
+  return depth;
+}
+
+} // namespace
+
+ShardDirectory::ShardDirectory()
+    : localDepths(MAX_SHARDS_CNT, UNUSED_DEPTH),
+      patterns(MAX_SHARDS_CNT, 0),
+      slots(std::make_unique<std::atomic<shard_index_t>[]>(MAX_SHARDS_CNT)),
+      globalDepth(0) {
+  std::string filePath = getFilePath();
+  if (storage::fileExists(filePath)) {
+    load(storage::readFile(filePath));
+  } else {
+    try {
+      std::filesystem::create_directories(Shard::storageDirectoryPath);
+    } catch (const std::exception& exc) {
+      throw KVSException{KVSErrorType::FAILED_TO_CREATE_SHARD_DIRECTORY};
+    }
+    layout.resize(size_t{1} << INITIAL_SHARD_DEPTH);
+    for (size_t i = 0; i < layout.size(); i++) {
+      layout[i] = i;
+      localDepths[i] = INITIAL_SHARD_DEPTH;
+      patterns[i] = i;
+    }
+    save(layout);
+  }
+  for (size_t i = 0; i < MAX_SHARDS_CNT; i++)
+    slots[i].store(0, std::memory_order_relaxed);
+  publish();
+}
+
+void ShardDirectory::load(const ByteArray& bytes) {
+  Header header;
+  if (bytes.length() < sizeof(Header))
+    throw KVSException(KVSErrorType::SHARD_DIRECTORY_INVALID_BUILD_DATA);
+  std::memcpy(reinterpret_cast<char*>(&header), bytes.get(), sizeof(Header));
+  if (header.version != VERSION || header.globalDepth > MAX_SHARD_DEPTH ||
+      bytes.length() != sizeof(Header) + (size_t{1} << header.globalDepth) *
+                                             sizeof(shard_index_t))
+    throw KVSException(KVSErrorType::SHARD_DIRECTORY_INVALID_BUILD_DATA);
+  layout.resize(size_t{1} << header.globalDepth);
+  std::memcpy(reinterpret_cast<char*>(layout.data()),
+              bytes.get() + sizeof(Header),
+              layout.size() * sizeof(shard_index_t));
+
+  // a shard of the local depth d owns 2^(globalDepth - d) slots, the first of them is its pattern
+  std::vector<size_t> slotsCnts(MAX_SHARDS_CNT, 0);
+  for (size_t i = 0; i < layout.size(); i++) {
+    if (slotsCnts[layout[i]]++ == 0)
+      patterns[layout[i]] = i;
+  }
+  for (size_t shardIndex = 0; shardIndex < MAX_SHARDS_CNT; shardIndex++) {
+    size_t slotsCnt = slotsCnts[shardIndex];
+    if (slotsCnt == 0)
+      continue;
+    if ((slotsCnt & (slotsCnt - 1)) != 0)
+      throw KVSException(KVSErrorType::SHARD_DIRECTORY_INVALID_BUILD_DATA);
+    localDepths[shardIndex] = header.globalDepth - getDepth(slotsCnt);
+  }
+  for (size_t i = 0; i < layout.size(); i++) {
+    shard_index_t shardIndex = layout[i];
+    if ((i & getMask(localDepths[shardIndex])) != patterns[shardIndex])
+      throw KVSException(KVSErrorType::SHARD_DIRECTORY_INVALID_BUILD_DATA);
+  }
+}
+
+void ShardDirectory::save(const std::vector<shard_index_t>& newLayout) {
+  Header header{VERSION, getDepth(newLayout.size())};
+  ByteArray bytes(sizeof(Header) + newLayout.size() * sizeof(shard_index_t));
+  std::memcpy(bytes.get(), reinterpret_cast<const char*>(&header),
+              sizeof(Header));
+  std::memcpy(bytes.get() + sizeof(Header),
+              reinterpret_cast<const char*>(newLayout.data()),
+              newLayout.size() * sizeof(shard_index_t));
+  // the file is the commit point of a split or a merge, so it is replaced atomically
+  std::string newFilePath = getFilePath() + ":new";
+  storage::writeFile(newFilePath, bytes);
+  try {
+    storage::renameFile(newFilePath, getFilePath());
+  } catch (const std::exception& exc) {
+    throw KVSException(KVSErrorType::STORAGE_WRITE_FAILED);
+  }
+}
+
+shard_index_t ShardDirectory::getShardIndex(const HashedKey& key) const
+    noexcept {
+  uint8_t depth = globalDepth.load(std::memory_order_acquire);
+  return slots[key.getShardBits() & getMask(depth)].load(
+      std::memory_order_acquire);
+}
+
+std::vector<shard_index_t> ShardDirectory::getShardIndices() const {
+  std::lock_guard lock{mutex};
+  std::vector<shard_index_t> shardIndices;
+  for (size_t i = 0; i < MAX_SHARDS_CNT; i++) {
+    if (localDepths[i] <= MAX_SHARD_DEPTH)
+      shardIndices.push_back(i);
+  }
+  return shardIndices;
+}
+
+bool ShardDirectory::isUsed(shard_index_t shardIndex) const {
+  std::lock_guard lock{mutex};
+  return localDepths[shardIndex] <= MAX_SHARD_DEPTH;
+}
+
+uint8_t ShardDirectory::getGlobalDepth() const noexcept {
+  return globalDepth.load(std::memory_order_acquire);
+}
+
+uint8_t ShardDirectory::getLocalDepth(shard_index_t shardIndex) const {
+  std::lock_guard lock{mutex};
+  return localDepths[shardIndex];
+}
+
+bool ShardDirectory::canSplit(shard_index_t shardIndex) const {
+  std::lock_guard lock{mutex};
+  return localDepths[shardIndex] < MAX_SHARD_DEPTH;
+}
+
+bool ShardDirectory::isMovedBySplit(const HashedKey& key,
+                                    shard_index_t shardIndex) const {
+  std::lock_guard lock{mutex};
+  return (key.getShardBits() >> localDepths[shardIndex]) & 1;
+}
+
+shard_index_t ShardDirectory::allocateShardIndex() {
+  std::lock_guard lock{mutex};
+  auto it = std::find(localDepths.begin(), localDepths.end(), UNUSED_DEPTH);
+  if (it == localDepths.end())
+    throw KVSException(KVSErrorType::SHARD_OVERFLOW);
+  *it = RESERVED_DEPTH;
+  return it - localDepths.begin();
+}
+
+void ShardDirectory::releaseShardIndex(shard_index_t shardIndex) noexcept {
+  std::lock_guard lock{mutex};
+  if (localDepths[shardIndex] == RESERVED_DEPTH)
+    localDepths[shardIndex] = UNUSED_DEPTH;
+}
+
+void ShardDirectory::split(shard_index_t shardIndex,
+                           shard_index_t newShardIndex) {
+  std::lock_guard lock{mutex};
+  uint8_t depth = localDepths[shardIndex];
+  if (depth >= MAX_SHARD_DEPTH ||
+      localDepths[newShardIndex] != RESERVED_DEPTH)
+    throw KVSException(KVSErrorType::SHARD_OVERFLOW);
+
+  std::vector<shard_index_t> newLayout = layout;
+  if ((size_t{1} << depth) == newLayout.size())
+    newLayout.insert(newLayout.end(), layout.begin(), layout.end());
+  uint32_t newPattern = patterns[shardIndex] | (uint32_t{1} << depth);
+  for (size_t i = newPattern; i < newLayout.size(); i += size_t{2} << depth)
+    newLayout[i] = newShardIndex;
+  save(newLayout);
+
+  layout = std::move(newLayout);
+  localDepths[shardIndex] = localDepths[newShardIndex] = depth + 1;
+  patterns[newShardIndex] = newPattern;
+}
+
+std::optional<shard_index_t>
+ShardDirectory::getBuddy(shard_index_t shardIndex) const {
+  std::lock_guard lock{mutex};
+  uint8_t depth = localDepths[shardIndex];
+  if (depth <= INITIAL_SHARD_DEPTH || depth > MAX_SHARD_DEPTH)
+    return std::nullopt;
+  shard_index_t buddyIndex =
+      layout[patterns[shardIndex] ^ (uint32_t{1} << (depth - 1))];
+  if (localDepths[buddyIndex] != depth)
+    return std::nullopt;
+  return buddyIndex;
+}
+
+shard_index_t ShardDirectory::merge(shard_index_t shardIndex) {
+  std::optional<shard_index_t> buddyIndex = getBuddy(shardIndex);
+  if (!buddyIndex.has_value())
+    throw std::logic_error("the shard has no buddy to merge with");
+  std::lock_guard lock{mutex};
+  shard_index_t mergedIndex = std::min(shardIndex, buddyIndex.value());
+  shard_index_t removedIndex = std::max(shardIndex, buddyIndex.value());
+  uint8_t depth = localDepths[shardIndex];
+
+  std::vector<shard_index_t> newLayout = layout;
+  for (size_t i = patterns[removedIndex]; i < newLayout.size();
+       i += size_t{1} << depth)
+    newLayout[i] = mergedIndex;
+  save(newLayout);
+
+  layout = std::move(newLayout);
+  localDepths[mergedIndex] = depth - 1;
+  patterns[mergedIndex] &= getMask(depth - 1);
+  localDepths[removedIndex] = UNUSED_DEPTH;
+  return mergedIndex;
+}
+
+void ShardDirectory::publish() noexcept {
+  std::lock_guard lock{mutex};
+  for (size_t i = 0; i < layout.size(); i++) {
+    if (slots[i].load(std::memory_order_relaxed) != layout[i])
+      slots[i].store(layout[i], std::memory_order_release);
+  }
+  // readers of the old depth don't see the new half of the slots, so it has been filled before
+  globalDepth.store(getDepth(layout.size()), std::memory_order_release);
+}
+
+std::string ShardDirectory::getFilePath() noexcept {
+  return Shard::storageDirectoryPath + "directory";
+}
+
+} // namespace kvs::shard
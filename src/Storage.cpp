@@ -2,100 +2,385 @@
 #include "KVSException.h"
 
 #include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
 #include <filesystem>
+#include <memory>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace kvs::storage {
 
-ByteArray readFile(std::string filename) {
-  std::ifstream file(filename, std::ios::in | std::ios::binary);
-  try {
-    file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-  } catch (const std::exception& exc) {
-    throw KVSException(KVSErrorType::STORAGE_OPEN_FAILED);
+namespace {
+
+constexpr size_t COPY_BUFFER_SIZE = 1 << 20;
+
+thread_local IOOperationContext currentContext;
+
+/**
+ * @brief The stats of the operation the thread is in, null outside of any IOOperationScope.
+ *
+ */
+IOOperationStats* getCurrentOperationStats() noexcept {
+  if (currentContext.stats == nullptr)
+    return nullptr;
+  return &currentContext.stats
+              ->operationStats[static_cast<size_t>(currentContext.operation)];
+}
+
+void countSyscall(Syscall syscall) noexcept {
+  if (IOOperationStats* stats = getCurrentOperationStats())
+    ++stats->syscallsCnts[static_cast<size_t>(syscall)];
+}
+
+void countBytes(uint64_t readBytesCnt, uint64_t writtenBytesCnt) noexcept {
+  if (IOOperationStats* stats = getCurrentOperationStats()) {
+    stats->readBytesCnt += readBytesCnt;
+    stats->writtenBytesCnt += writtenBytesCnt;
   }
+}
 
-  size_t fileSize = std::filesystem::file_size(std::filesystem::path(filename));
-  ByteArray bytes(fileSize);
-  try {
-    file.read(bytes.get(), fileSize);
-  } catch (const std::exception& exc) {
-    throw KVSException(KVSErrorType::STORAGE_READ_FAILED);
+int openFile(const std::string& filename, int flags) noexcept {
+  countSyscall(Syscall::OPEN);
+  return ::open(filename.c_str(), flags | O_CLOEXEC, 0644);
+}
+
+int closeFile(int fd) noexcept {
+  countSyscall(Syscall::CLOSE);
+  return ::close(fd);
+}
+
+/**
+ * @brief Get the size of an open file.
+ *
+ * @return -1 on failure.
+ */
+ssize_t getOpenFileSize(int fd) noexcept {
+  countSyscall(Syscall::STAT);
+  struct stat fileStat;
+  if (::fstat(fd, &fileStat) != 0)
+    return -1;
+  return fileStat.st_size;
+}
+
+/**
+ * @brief An owned POSIX file descriptor.
+ *
+ */
+class FileDescriptor final {
+public:
+  FileDescriptor(const std::string& filename, int flags)
+      : fd{openFile(filename, flags)} {
+    if (fd < 0)
+      throw KVSException(KVSErrorType::STORAGE_OPEN_FAILED);
   }
-  try {
-    file.close();
-  } catch (const std::exception& exc) {
-    throw KVSException(KVSErrorType::STORAGE_CLOSE_FAILED);
+
+  FileDescriptor(const FileDescriptor&) = delete;
+  FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+  ~FileDescriptor() {
+    if (fd >= 0)
+      closeFile(fd);
+  }
+
+  int get() const noexcept { return fd; }
+
+  void close() {
+    int result = closeFile(fd);
+    fd = -1;
+    if (result != 0)
+      throw KVSException(KVSErrorType::STORAGE_CLOSE_FAILED);
+  }
+
+private:
+  int fd;
+};
+
+/**
+ * @brief Copy a range to the current position of the destination without passing the data through user space.
+ *
+ * @return false if the kernel can't copy between these files. Nothing is copied then.
+ */
+bool copyRangeInKernel([[maybe_unused]] int source,
+                       [[maybe_unused]] int destination,
+                       [[maybe_unused]] size_t offset,
+                       [[maybe_unused]] size_t length) {
+#ifdef __linux__
+  loff_t sourceOffset = offset;
+  bool copiedAny = false;
+  while (length > 0) {
+    countSyscall(Syscall::OTHER);
+    ssize_t copied = copy_file_range(source, &sourceOffset, destination,
+                                     nullptr, length, 0);
+    if (copied < 0) {
+      if (errno == EINTR)
+        continue;
+      if (!copiedAny && (errno == ENOSYS || errno == EXDEV ||
+                         errno == EINVAL || errno == EOPNOTSUPP))
+        return false;
+      throw KVSException(KVSErrorType::STORAGE_WRITE_FAILED);
+    }
+    if (copied == 0)
+      throw KVSException(KVSErrorType::STORAGE_READ_FAILED);
+    countBytes(copied, copied);
+    copiedAny = true;
+    length -= copied;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+/**
+ * @brief Read the whole range, failing at the end of file.
+ *
+ */
+void readAll(int fd, char* data, size_t length, size_t offset) {
+  while (length > 0) {
+    countSyscall(Syscall::READ);
+    ssize_t read = ::pread(fd, data, length, offset);
+    if (read < 0 && errno == EINTR)
+      continue;
+    if (read <= 0)
+      throw KVSException(KVSErrorType::STORAGE_READ_FAILED);
+    countBytes(read, 0);
+    data += read;
+    offset += read;
+    length -= read;
   }
+}
+
+void writeAll(int fd, const char* data, size_t length) {
+  while (length > 0) {
+    countSyscall(Syscall::WRITE);
+    ssize_t written = ::write(fd, data, length);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      throw KVSException(KVSErrorType::STORAGE_WRITE_FAILED);
+    countBytes(0, written);
+    data += written;
+    length -= written;
+  }
+}
+
+void writeAll(int fd, const char* data, size_t length, size_t offset) {
+  while (length > 0) {
+    countSyscall(Syscall::WRITE);
+    ssize_t written = ::pwrite(fd, data, length, offset);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      throw KVSException(KVSErrorType::STORAGE_WRITE_FAILED);
+    countBytes(0, written);
+    data += written;
+    offset += written;
+    length -= written;
+  }
+}
+
+} // namespace
+
+void SyscallStats::printPerOperation(std::ostream& out) const {
+  out << "operation,operations";
+  for (const char* name : SYSCALL_NAMES) out << "," << name;
+  out << ",read bytes,written bytes\n";
+  for (size_t i = 0; i < IO_OPERATIONS_CNT; ++i) {
+    const IOOperationStats& stats = operationStats[i];
+    uint64_t operationsCnt = stats.operationsCnt.load();
+    uint64_t syscallsCnt = 0;
+    for (const metrics::Counter& counter : stats.syscallsCnts)
+      syscallsCnt += counter.load();
+    if (operationsCnt == 0 && syscallsCnt == 0)
+      continue;
+    // calls outside of any scope aren't counted as operations, so they are summed up
+    double divisor = std::max<uint64_t>(1, operationsCnt);
+    out << IO_OPERATION_NAMES[i] << "," << operationsCnt;
+    for (const metrics::Counter& counter : stats.syscallsCnts)
+      out << "," << counter.load() / divisor;
+    out << "," << stats.readBytesCnt.load() / divisor << ","
+        << stats.writtenBytesCnt.load() / divisor << "\n";
+  }
+}
+
+IOOperationScope::IOOperationScope(SyscallStats& stats,
+                                   IOOperation operation) noexcept
+    : previousContext(currentContext) {
+  currentContext = IOOperationContext{&stats, operation};
+  if (previousContext.stats == nullptr)
+    ++getCurrentOperationStats()->operationsCnt;
+}
+
+IOOperationScope::IOOperationScope(const IOOperationContext& context) noexcept
+    : previousContext(currentContext) {
+  currentContext = context;
+}
+
+IOOperationScope::~IOOperationScope() { currentContext = previousContext; }
+
+IOOperationContext IOOperationScope::getCurrentContext() noexcept {
+  return currentContext;
+}
+
+size_t getFileSize(const std::string& filename) {
+  countSyscall(Syscall::STAT);
+  return std::filesystem::file_size(filename);
+}
+
+bool fileExists(const std::string& filename) {
+  countSyscall(Syscall::STAT);
+  return std::filesystem::exists(filename);
+}
+
+void renameFile(const std::string& oldFilename,
+                const std::string& newFilename) {
+  countSyscall(Syscall::RENAME);
+  std::filesystem::rename(oldFilename, newFilename);
+}
+
+bool removeFile(const std::string& filename,
+                std::error_code& errorCode) noexcept {
+  countSyscall(Syscall::OTHER);
+  return std::filesystem::remove(filename, errorCode);
+}
+
+ByteArray readFile(std::string filename) {
+  FileDescriptor file{filename, O_RDONLY};
+  ssize_t fileSize = getOpenFileSize(file.get());
+  if (fileSize < 0)
+    throw KVSException(KVSErrorType::STORAGE_READ_FAILED);
+  ByteArray bytes(fileSize);
+  readAll(file.get(), bytes.get(), fileSize, 0);
+  file.close();
   return bytes;
 }
 
 void writeFile(std::string filename, ByteArray bytes) {
-  std::ofstream file(filename,
-                     std::ios::out | std::ios::binary | std::ios::trunc);
-  try {
-    file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-  } catch (const std::exception& exc) {
-    throw KVSException(KVSErrorType::STORAGE_OPEN_FAILED);
+  FileDescriptor file{filename, O_WRONLY | O_CREAT | O_TRUNC};
+  writeAll(file.get(), bytes.get(), bytes.length());
+  file.close();
+}
+
+void copyFileRanges(const std::string& sourceFilename,
+                    const std::string& destinationFilename,
+                    const std::vector<std::pair<size_t, size_t>>& ranges,
+                    bool append) {
+  FileDescriptor source{sourceFilename, O_RDONLY};
+  FileDescriptor destination{destinationFilename,
+                             O_WRONLY | O_CREAT | (append ? 0 : O_TRUNC)};
+  // not O_APPEND, copy_file_range() refuses such a destination
+  if (append) {
+    countSyscall(Syscall::OTHER);
+    if (::lseek(destination.get(), 0, SEEK_END) < 0)
+      throw KVSException(KVSErrorType::STORAGE_WRITE_FAILED);
   }
-  try {
-    file.write(bytes.get(), bytes.length());
-  } catch (const std::exception& exc) {
-    throw KVSException(KVSErrorType::STORAGE_WRITE_FAILED);
+
+  bool inKernel = true;
+  std::unique_ptr<char[]> buffer;
+  size_t buffered = 0;
+  for (auto [offset, length] : ranges) {
+    if (inKernel) {
+      inKernel = copyRangeInKernel(source.get(), destination.get(), offset,
+                                   length);
+      if (inKernel)
+        continue;
+      buffer = std::make_unique<char[]>(COPY_BUFFER_SIZE);
+    }
+    // small ranges are gathered in the buffer and written together
+    while (length > 0) {
+      size_t chunk = std::min(length, COPY_BUFFER_SIZE - buffered);
+      countSyscall(Syscall::READ);
+      ssize_t read = ::pread(source.get(), buffer.get() + buffered, chunk,
+                             offset);
+      if (read < 0 && errno == EINTR)
+        continue;
+      if (read <= 0)
+        throw KVSException(KVSErrorType::STORAGE_READ_FAILED);
+      countBytes(read, 0);
+      buffered += read;
+      offset += read;
+      length -= read;
+      if (buffered == COPY_BUFFER_SIZE) {
+        writeAll(destination.get(), buffer.get(), buffered);
+        buffered = 0;
+      }
+    }
   }
-  try {
-    file.close();
-  } catch (const std::exception& exc) {
-    throw KVSException(KVSErrorType::STORAGE_CLOSE_FAILED);
+  writeAll(destination.get(), buffer.get(), buffered);
+  destination.close();
+}
+
+bool punchHoles([[maybe_unused]] const std::string& filename,
+                [[maybe_unused]] const std::vector<std::pair<size_t, size_t>>&
+                    ranges) {
+#ifdef __linux__
+  if (ranges.empty())
+    return true;
+  FileDescriptor file{filename, O_WRONLY};
+  for (auto [offset, length] : ranges) {
+    while (true) {
+      countSyscall(Syscall::OTHER);
+      if (::fallocate(file.get(), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      offset, length) == 0)
+        break;
+      if (errno == EINTR)
+        continue;
+      if (errno == EOPNOTSUPP || errno == ENOSYS)
+        return false;
+      throw KVSException(KVSErrorType::STORAGE_WRITE_FAILED);
+    }
   }
+  file.close();
+  return true;
+#else
+  return false;
+#endif
 }
 
 Storage::Storage(std::string filename)
-    : file{filename, std::ios::out | std::ios::in | std::ios::binary},
-      fileSize{std::filesystem::file_size(std::filesystem::path(filename))} {
-  try {
-    file.exceptions(std::fstream::failbit | std::fstream::badbit);
-  } catch (const std::exception& exc) {
+    : fd{openFile(filename, O_RDWR)}, fileSize{0} {
+  if (fd < 0)
+    throw KVSException(KVSErrorType::STORAGE_OPEN_FAILED);
+  ssize_t size = getOpenFileSize(fd);
+  if (size < 0) {
+    closeFile(fd);
     throw KVSException(KVSErrorType::STORAGE_OPEN_FAILED);
   }
+  fileSize = size;
+}
+
+Storage::Storage(Storage&& other) noexcept
+    : fd{other.fd}, fileSize{other.fileSize} {
+  other.fd = -1;
+}
+
+Storage::~Storage() {
+  if (fd >= 0)
+    closeFile(fd);
 }
 
 void Storage::close() {
-  try {
-    file.close();
-  } catch (const std::exception& exc) {
+  int result = closeFile(fd);
+  fd = -1;
+  if (result != 0)
     throw KVSException(KVSErrorType::STORAGE_CLOSE_FAILED);
-  }
 }
 
 ByteArray Storage::read(size_t offset, size_t length) {
   ByteArray bytes(length);
-  try {
-    file.seekg(offset);
-    file.read(bytes.get(), length);
-  } catch (const std::exception& exc) {
-    throw KVSException(KVSErrorType::STORAGE_READ_FAILED);
-  }
+  readAll(fd, bytes.get(), length, offset);
   return bytes;
 }
 
 void Storage::write(size_t offset, ByteArray bytes) {
-  try {
-    file.seekp(offset);
-    file.write(bytes.get(), bytes.length());
-  } catch (const std::exception& exc) {
-    throw KVSException(KVSErrorType::STORAGE_WRITE_FAILED);
-  }
+  writeAll(fd, bytes.get(), bytes.length(), offset);
   fileSize = std::max(fileSize, offset + bytes.length());
 }
 
 size_t Storage::append(ByteArray bytes) {
   size_t prevFileSize = fileSize;
-  try {
-    file.seekp(0, file.end);
-    file.write(bytes.get(), bytes.length());
-  } catch (const std::exception& exc) {
-    throw KVSException(KVSErrorType::STORAGE_WRITE_FAILED);
-  }
+  writeAll(fd, bytes.get(), bytes.length(), fileSize);
   fileSize += bytes.length();
   return prevFileSize;
 }
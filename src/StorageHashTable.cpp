@@ -64,13 +64,12 @@ size_t findNextByPredicate(const std::vector<Entry>& data, size_t fromIndex,
   return fromIndex;
 }
 
-void StorageHashTable::put(const Entry& entry) noexcept {
-  auto [key, ptr] = entry;
-  size_t keyIndex = hashKey(key) % data.size();
+void StorageHashTable::put(const HashedKey& key, Ptr ptr) noexcept {
+  size_t keyIndex = reduceRange(key.getStorageHashTableBits(), data.size());
 
-  auto entryCheck = [&entry](const Entry& e) {
+  auto entryCheck = [&key](const Entry& e) {
     return e.ptr == EMPTY_PTR || // either no such key before and new empty spot
-           e.key == entry.key; // or there is such key
+           e.key == key.getKey(); // or there is such key
   };
 
   if (!entryCheck(data[keyIndex])) {
@@ -80,14 +79,20 @@ void StorageHashTable::put(const Entry& entry) noexcept {
   }
   if (data[keyIndex].ptr == EMPTY_PTR)
     usedSize++;
-  data[keyIndex] = entry;
+  data[keyIndex] = Entry(key.getKey(), ptr);
 
   if (usedSize * MAP_LOAD_FACTOR > data.size())
     expand();
 }
 
-Ptr& StorageHashTable::get(const Key& key) noexcept {
-  size_t keyIndex = hashKey(key) % data.size();
+void StorageHashTable::put(const Entry& entry) noexcept {
+  put(HashedKey(entry.key), entry.ptr);
+}
+
+Ptr& StorageHashTable::get(const HashedKey& hashedKey) noexcept {
+  const Key& key = hashedKey.getKey();
+  size_t keyIndex =
+      reduceRange(hashedKey.getStorageHashTableBits(), data.size());
   if (data[keyIndex].key == key)
     return data[keyIndex].ptr;
   size_t newIndex = findNextByPredicate(
@@ -98,8 +103,10 @@ Ptr& StorageHashTable::get(const Key& key) noexcept {
 }
 
 // TODO fix copypaste
-const Ptr& StorageHashTable::get(const Key& key) const noexcept {
-  size_t keyIndex = hashKey(key) % data.size();
+const Ptr& StorageHashTable::get(const HashedKey& hashedKey) const noexcept {
+  const Key& key = hashedKey.getKey();
+  size_t keyIndex =
+      reduceRange(hashedKey.getStorageHashTableBits(), data.size());
   if (data[keyIndex].key == key)
     return data[keyIndex].ptr;
   size_t newIndex = findNextByPredicate(
@@ -118,6 +125,37 @@ std::vector<Entry> StorageHashTable::getEntries() const noexcept {
   return result;
 }
 
+size_t StorageHashTable::getUsedSize() const noexcept { return usedSize; }
+
+std::optional<Ptr> StorageHashTable::takeDeletedEntry() noexcept {
+  for (size_t i = 0; i < data.size(); i++) {
+    Ptr ptr = data[i].ptr;
+    if (ptr.getType() == PtrType::DELETED) {
+      removeAt(i);
+      return ptr;
+    }
+  }
+  return std::nullopt;
+}
+
+void StorageHashTable::removeAt(size_t index) noexcept {
+  auto next = [this](size_t i) { return i + 1 == data.size() ? 0 : i + 1; };
+  size_t hole = index;
+  for (size_t i = next(hole); data[i].ptr != EMPTY_PTR; i = next(i)) {
+    size_t home = reduceRange(HashedKey(data[i].key).getStorageHashTableBits(),
+                              data.size());
+    // an entry stays if its home is cyclically in (hole, i], otherwise it would be cut off by the hole
+    bool homeAfterHole =
+        hole < i ? (hole < home && home <= i) : (hole < home || home <= i);
+    if (!homeAfterHole) {
+      data[hole] = data[i];
+      hole = i;
+    }
+  }
+  data[hole] = Entry(Key(), EMPTY_PTR);
+  usedSize--;
+}
+
 void StorageHashTable::expand() {
   size_t newSize = data.size() * STORAGE_HASH_TABLE_EXPANSION_FACTOR;
   if (newSize > STORAGE_HASH_TABLE_MAX_SIZE)
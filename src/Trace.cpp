@@ -0,0 +1,144 @@
+#include "Trace.h"
+#include "KVSException.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace kvs::trace {
+
+namespace {
+
+constexpr char TRACE_MAGIC[8] = {'K', 'V', 'S', 'T', 'R', 'A', 'C', 'E'};
+constexpr uint32_t TRACE_VERSION = 1;
+
+/**
+ * @brief The buffered records are written once they take this many bytes.
+ *
+ */
+constexpr size_t TRACE_BUFFER_SIZE = 1 << 20;
+
+/**
+ * @brief The header is the magic bytes, the version, KEY_SIZE and whether the keys are full. A record is the timestamp
+ * in nanoseconds, the operation, the outcome, then the hash or the Key.
+ *
+ */
+template <typename T> void append(std::vector<char>& buffer, const T& value) {
+  const char* bytes = reinterpret_cast<const char*>(&value);
+  buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T> bool read(std::ifstream& file, T& value) {
+  return static_cast<bool>(
+      file.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+} // namespace
+
+Key TraceRecord::getReplayKey() const {
+  if (key.has_value())
+    return key.value();
+  ByteArray bytes{KEY_SIZE};
+  std::memset(bytes.get(), 0, KEY_SIZE);
+  std::memcpy(bytes.get(), &keyHash, std::min(sizeof(hash_t), KEY_SIZE));
+  return Key{bytes};
+}
+
+TraceWriter::TraceWriter(const std::string& filePath, bool fullKeys)
+    : fullKeys(fullKeys), start(std::chrono::steady_clock::now()),
+      file(filePath, std::ios::binary | std::ios::trunc) {
+  if (!file)
+    throw KVSException(KVSErrorType::STORAGE_OPEN_FAILED);
+  buffer.reserve(TRACE_BUFFER_SIZE);
+  buffer.insert(buffer.end(), std::begin(TRACE_MAGIC), std::end(TRACE_MAGIC));
+  append(buffer, TRACE_VERSION);
+  append(buffer, static_cast<uint32_t>(KEY_SIZE));
+  append(buffer, static_cast<uint8_t>(fullKeys));
+}
+
+TraceWriter::~TraceWriter() {
+  try {
+    flush();
+  } catch (const KVSException& exc) {
+  }
+}
+
+std::chrono::nanoseconds TraceWriter::getTimestamp() const noexcept {
+  return std::chrono::steady_clock::now() - start;
+}
+
+void TraceWriter::write(std::chrono::nanoseconds timestamp,
+                        TraceOperation operation, uint8_t outcome,
+                        const HashedKey& key) {
+  std::lock_guard lock{mutex};
+  append(buffer, static_cast<uint64_t>(timestamp.count()));
+  append(buffer, static_cast<uint8_t>(operation));
+  append(buffer, outcome);
+  if (fullKeys) {
+    const char* keyBytes = key.getKey().getBytes().get();
+    buffer.insert(buffer.end(), keyBytes, keyBytes + KEY_SIZE);
+  } else {
+    append(buffer, key.getLowHash());
+  }
+  if (buffer.size() >= TRACE_BUFFER_SIZE)
+    flushLocked();
+}
+
+void TraceWriter::flush() {
+  std::lock_guard lock{mutex};
+  flushLocked();
+}
+
+void TraceWriter::flushLocked() {
+  file.write(buffer.data(), buffer.size());
+  file.flush();
+  buffer.clear();
+  if (!file)
+    throw KVSException(KVSErrorType::STORAGE_WRITE_FAILED);
+}
+
+TraceReader::TraceReader(const std::string& filePath)
+    : fullKeys(false), file(filePath, std::ios::binary) {
+  if (!file)
+    throw KVSException(KVSErrorType::STORAGE_OPEN_FAILED);
+  char magic[sizeof(TRACE_MAGIC)];
+  uint32_t version = 0;
+  uint32_t keySize = 0;
+  uint8_t fullKeysFlag = 0;
+  if (!read(file, magic) || !read(file, version) || !read(file, keySize) ||
+      !read(file, fullKeysFlag) ||
+      std::memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0 ||
+      version != TRACE_VERSION || keySize != KEY_SIZE)
+    throw KVSException(KVSErrorType::TRACE_INVALID_DATA);
+  fullKeys = fullKeysFlag != 0;
+}
+
+bool TraceReader::hasFullKeys() const noexcept { return fullKeys; }
+
+std::optional<TraceRecord> TraceReader::next() {
+  uint64_t timestampNanos = 0;
+  if (!read(file, timestampNanos)) {
+    if (file.gcount() == 0)
+      return std::nullopt;
+    throw KVSException(KVSErrorType::TRACE_INVALID_DATA);
+  }
+  uint8_t operation = 0;
+  TraceRecord record;
+  if (!read(file, operation) || !read(file, record.outcome) ||
+      operation > static_cast<uint8_t>(TraceOperation::REMOVE))
+    throw KVSException(KVSErrorType::TRACE_INVALID_DATA);
+  record.timestamp = std::chrono::nanoseconds(timestampNanos);
+  record.operation = static_cast<TraceOperation>(operation);
+  if (fullKeys) {
+    ByteArray bytes{KEY_SIZE};
+    file.read(bytes.get(), KEY_SIZE);
+    record.key = Key{bytes};
+    record.keyHash = HashedKey{record.key.value()}.getLowHash();
+  } else {
+    read(file, record.keyHash);
+  }
+  if (!file)
+    throw KVSException(KVSErrorType::TRACE_INVALID_DATA);
+  return record;
+}
+
+} // namespace kvs::trace
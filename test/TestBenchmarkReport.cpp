@@ -0,0 +1,205 @@
+#include "BenchmarkReport.h"
+#include "doctest.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace benchmark;
+
+namespace test_kvs::benchmark_report {
+
+const std::string testDirectoryPath = "../.test-data/test-benchmark-report/";
+const std::string reportFilePath = testDirectoryPath + "report.json";
+
+void setUpTestDirectory() {
+  std::filesystem::create_directories(testDirectoryPath);
+}
+
+void clearTestDirectory() { std::filesystem::remove_all(testDirectoryPath); }
+
+std::vector<std::pair<double, uint64_t>>
+getSample(const std::vector<double>& values) {
+  std::vector<std::pair<double, uint64_t>> sample;
+  for (double value : values) sample.emplace_back(value, 1);
+  return sample;
+}
+
+BenchmarkResult createResult(const std::string& name,
+                             std::vector<double> throughputs) {
+  LatencyHistogram histogram;
+  // exact values, so that the histogram survives being restored from its buckets
+  for (uint64_t nanos : {10, 20, 20, 30, 100, 100}) histogram.record(nanos);
+  return BenchmarkResult{name,
+                         std::move(throughputs),
+                         {{"get", histogram}},
+                         {{"cycles", 1.5}},
+                         {{"rebuilt bytes", 0.25}}};
+}
+
+void writeFile(const std::string& text) {
+  std::ofstream file(reportFilePath);
+  file << text;
+}
+
+TEST_CASE("test Mann-Whitney test") {
+
+  SUBCASE("test separated samples") {
+    // U = 0, variance = 4 * 4 * 9 / 12 = 12, z = (8 - 0.5) / sqrt(12)
+    double pValue =
+        getMannWhitneyPValue(getSample({1, 2, 3, 4}), getSample({5, 6, 7, 8}));
+    CHECK(pValue == doctest::Approx(0.0303828).epsilon(1e-5));
+    // the test is two-sided
+    CHECK(getMannWhitneyPValue(getSample({5, 6, 7, 8}),
+                               getSample({1, 2, 3, 4})) ==
+          doctest::Approx(pValue));
+    CHECK(getMinMannWhitneyPValue(4, 4) == doctest::Approx(pValue));
+  }
+
+  SUBCASE("test ties") {
+    // ranks of the first sample: 1, 3, 3, 5.5, 8, so U = 20.5 - 15 = 5.5, and the ties of 2 (three times) and 3
+    // (twice) reduce the variance from 30 * 12 / 12 = 30 by 30 * (24 + 6) / (11 * 10 * 12) to 29.318
+    std::vector<std::pair<double, uint64_t>> first = {{1, 1}, {2, 2}, {3, 1},
+                                                      {5, 1}};
+    std::vector<std::pair<double, uint64_t>> second = {
+        {2, 1}, {3, 1}, {4, 1}, {6, 1}, {7, 1}, {8, 1}};
+    double pValue = getMannWhitneyPValue(first, second);
+    CHECK(pValue == doctest::Approx(0.0964798).epsilon(1e-5));
+    // a value with a count is the same as the value repeated
+    CHECK(getMannWhitneyPValue(getSample({1, 2, 2, 3, 5}),
+                               getSample({2, 3, 4, 6, 7, 8})) ==
+          doctest::Approx(pValue));
+  }
+
+  SUBCASE("test equal samples") {
+    CHECK(getMannWhitneyPValue(getSample({1, 2, 3}), getSample({1, 2, 3})) ==
+          doctest::Approx(1));
+    // all values tie, so there is no variance
+    CHECK(getMannWhitneyPValue(getSample({7, 7}), getSample({7, 7, 7})) == 1);
+  }
+
+  SUBCASE("test too few values") {
+    CHECK(getMannWhitneyPValue(getSample({1}), getSample({5, 6, 7})) == 1);
+    CHECK(getMinMannWhitneyPValue(1, 100) == 1);
+  }
+
+  SUBCASE("test min sample size") {
+    CHECK(getMinMannWhitneyPValue(5, 5) >= 0.01);
+    CHECK(getMinMannWhitneyPValue(6, 6) < 0.01);
+    CHECK(getMinSampleSize(0.01) == 6);
+    CHECK(getMinSampleSize(0.05) == 4);
+    for (size_t size : {2, 3, 7, 20}) {
+      std::vector<double> smaller, larger;
+      for (size_t i = 0; i < size; i++) smaller.push_back(i);
+      for (size_t i = 0; i <= size; i++) larger.push_back(size + i);
+      CHECK(getMinMannWhitneyPValue(size, size + 1) ==
+            doctest::Approx(getMannWhitneyPValue(getSample(smaller),
+                                                 getSample(larger))));
+    }
+  }
+}
+
+TEST_CASE("test BenchmarkReport") {
+
+  setUpTestDirectory();
+
+  SUBCASE("test save and load") {
+    BenchmarkReport report("bench \"quoted\" command");
+    report.addResult(createResult("first", {1000.5, 2000.25}));
+    report.addResult(createResult("no throughput", {}));
+    report.save(reportFilePath);
+
+    BenchmarkReport loaded = BenchmarkReport::load(reportFilePath);
+    CHECK(loaded.getMetadata()["command"].getString() ==
+          "bench \"quoted\" command");
+    CHECK(loaded.getMetadata()["constants"]["KEY_SIZE"].getNumber() ==
+          report.getMetadata()["constants"]["KEY_SIZE"].getNumber());
+    REQUIRE(loaded.getResults().size() == 2);
+    for (size_t i = 0; i < 2; i++) {
+      const BenchmarkResult& result = report.getResults()[i];
+      const BenchmarkResult& loadedResult = loaded.getResults()[i];
+      CHECK(loadedResult.name == result.name);
+      CHECK(loadedResult.throughputs == result.throughputs);
+      REQUIRE(loadedResult.latencies.size() == 1);
+      CHECK(loadedResult.latencies[0].first == "get");
+      const LatencyHistogram& histogram = result.latencies[0].second;
+      const LatencyHistogram& loadedHistogram =
+          loadedResult.latencies[0].second;
+      CHECK(loadedHistogram.getCount() == histogram.getCount());
+      CHECK(loadedHistogram.getMean() == doctest::Approx(histogram.getMean()));
+      for (double percentile : {0.0, 50.0, 99.0, 100.0})
+        CHECK(loadedHistogram.getPercentile(percentile) ==
+              histogram.getPercentile(percentile));
+      CHECK(loadedResult.perfCountsPerOperation ==
+            result.perfCountsPerOperation);
+      // extra metrics stay apart from the counters
+      CHECK(loadedResult.extraMetrics == result.extraMetrics);
+    }
+  }
+
+  SUBCASE("test optional fields") {
+    // counters and metrics may be missing, e.g. in reports saved before they were added
+    writeFile("{\"metadata\": {}, \"benchmarks\": [{\"name\": \"a\", "
+              "\"throughputs\": [1], \"latencies\": {}}]}");
+    BenchmarkReport loaded = BenchmarkReport::load(reportFilePath);
+    REQUIRE(loaded.getResults().size() == 1);
+    CHECK(loaded.getResults()[0].perfCountsPerOperation.empty());
+    CHECK(loaded.getResults()[0].extraMetrics.empty());
+  }
+
+  SUBCASE("test invalid reports") {
+    CHECK_THROWS_AS(BenchmarkReport::load(testDirectoryPath + "missing"),
+                    std::invalid_argument);
+    for (const char* text :
+         {"{\"metadata\": {}, \"benchmarks\": [", "[]", "{\"metadata\": {}}",
+          "{\"metadata\": {}, \"benchmarks\": [{\"throughputs\": []}]}",
+          "{\"metadata\": {}, \"benchmarks\": [{\"name\": \"a\", "
+          "\"throughputs\": [], \"latencies\": {\"get\": {\"buckets\": "
+          "[[1, 2]]}}}]}"}) {
+      writeFile(text);
+      CHECK_THROWS_AS(BenchmarkReport::load(reportFilePath),
+                      std::invalid_argument);
+    }
+  }
+
+  SUBCASE("test compare reports") {
+    ComparisonConfig config;
+    BenchmarkReport baseline("baseline");
+    BenchmarkReport current("current");
+    // enough repetitions for the test, and a throughput drop of a half
+    baseline.addResult(
+        createResult("tested", {100, 101, 102, 103, 104, 105}));
+    current.addResult(createResult("tested", {50, 51, 52, 53, 54, 55}));
+    // a single throughput can't ever differ significantly
+    baseline.addResult(createResult("single", {100}));
+    current.addResult(createResult("single", {50}));
+    baseline.addResult(createResult("unchanged", {100}));
+    current.addResult(createResult("unchanged", {98}));
+    current.addResult(createResult("new", {100}));
+
+    std::vector<MetricComparison> comparisons =
+        compareReports(baseline, current, config);
+    // throughput and the mean, p50 and p99 of get for each of the three benchmarks of both reports
+    REQUIRE(comparisons.size() == 12);
+    for (const MetricComparison& comparison : comparisons) {
+      CAPTURE(comparison.benchmark);
+      CAPTURE(comparison.metric);
+      if (comparison.metric != "throughput") {
+        // the latencies are the same, and 6 of them are just enough
+        CHECK(comparison.isTested);
+        CHECK(!comparison.isRegression);
+        continue;
+      }
+      CHECK(comparison.isTested == (comparison.benchmark == "tested"));
+      CHECK(comparison.isRegression == (comparison.benchmark != "unchanged"));
+    }
+  }
+
+  clearTestDirectory();
+}
+
+} // namespace test_kvs::benchmark_report
@@ -50,7 +50,7 @@ TEST_CASE("test BloomFilter") {
     std::uniform_int_distribution<__uint128_t> distr;
     const size_t OPS = 5000; // ! see constants
 
-    BloomFilter filter;
+    BloomFilter filter(OPS);
     std::unordered_set<Key> set(OPS);
     size_t totalChecks = 0, filterMisses = 0;
     for (size_t i = 0; i < OPS; i++) {
@@ -73,6 +73,56 @@ TEST_CASE("test BloomFilter") {
     }
     MESSAGE(std::string("filter missed ") + std::to_string(filterMisses) +
             " out of " + std::to_string(totalChecks) + " checks");
+    CHECK(filterMisses < totalChecks * BLOOM_FILTER_FALSE_POSITIVE_RATE * 5);
+  }
+  SUBCASE("test sizing") {
+    CHECK(BloomFilter::getBitsPerKey(0.01) ==
+          doctest::Approx(9.585).epsilon(0.001));
+    BloomFilter filter(100, 0.01);
+    CHECK(filter.getExpectedKeysCnt() == 100);
+    CHECK(filter.getCountersCnt() == 1280); // ten cache lines
+    CHECK(filter.getHashFunctionsCnt() == 9);
+
+    for (size_t i = 0; i < 100; i++) filter.add(generateKey(i));
+    CHECK_FALSE(filter.isOverflowed());
+    filter.add(generateKey(100));
+    CHECK(filter.isOverflowed());
+  }
+  SUBCASE("test remove") {
+    BloomFilter filter(1000);
+    for (size_t i = 0; i < 1000; i++) filter.add(generateKey(i));
+    CHECK(filter.getKeysCnt() == 1000);
+    for (size_t i = 0; i < 1000; i += 2) filter.remove(generateKey(i));
+    CHECK(filter.getKeysCnt() == 500);
+
+    size_t removedFound = 0;
+    for (size_t i = 0; i < 1000; i++) {
+      if (i % 2 == 1)
+        REQUIRE(filter.checkExist(generateKey(i)));
+      else if (filter.checkExist(generateKey(i)))
+        removedFound++;
+    }
+    CHECK(removedFound < 500 * BLOOM_FILTER_FALSE_POSITIVE_RATE * 5);
+
+    for (size_t i = 1; i < 1000; i += 2) filter.remove(generateKey(i));
+    for (size_t i = 0; i < 1000; i++)
+      CHECK_FALSE(filter.checkExist(generateKey(i)));
+  }
+  SUBCASE("test batch check") {
+    BloomFilter filter(500);
+    std::vector<HashedKey> keys;
+    for (size_t i = 0; i < 1003; i++) {
+      keys.push_back(generateKey(i));
+      if (i % 2 == 0)
+        filter.add(keys.back());
+    }
+    std::vector<bool> result = filter.checkExist(keys);
+    REQUIRE(result.size() == keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+      REQUIRE(result[i] == filter.checkExist(keys[i]));
+      if (i % 2 == 0)
+        REQUIRE(result[i]);
+    }
   }
 }
 
@@ -5,6 +5,7 @@
 #include <iostream>
 #include <random>
 #include <sstream>
+#include <thread>
 #include <unordered_map>
 
 namespace kvs_test::cache_map {
@@ -92,10 +93,16 @@ TEST_CASE("test CacheMap") {
     CHECK((opt = map.putOrDisplace(e1), !opt.has_value()));
     CHECK((opt = map.putOrDisplace(e2), !opt.has_value()));
     CHECK((opt = map.putOrDisplace(e3), !opt.has_value()));
-    // displacement lags one op behind
-    CHECK((opt = map.putOrDisplace(e4), !opt.has_value()));
+    REQUIRE(map.getUsedSize() == map.getCapacity());
+    // overwriting a present Key at capacity takes no room
+    CHECK((opt = map.putOrDisplace(e3), !opt.has_value()));
+    CHECK(map.get(e3.key) == e3.ptr);
+    CHECK((opt = map.putOrDisplace(e4), opt.has_value()));
+    CHECK(!(opt->key == e4.key));
+    CHECK(map.get(e4.key) == e4.ptr);
     CHECK((opt = map.putOrDisplace(e5), opt.has_value()));
     CHECK((opt = map.putOrDisplace(e6), opt.has_value()));
+    CHECK(map.getUsedSize() == map.getCapacity());
 
     for (size_t i = 10; i < 5000; i++)
       map.putOrDisplace(Entry(generateKey(i), p2)); // probabilistic
@@ -107,6 +114,83 @@ TEST_CASE("test CacheMap") {
     CHECK(map.get(e6.key) == EMPTY_PTR);
   }
 
+  SUBCASE("test resize") {
+    CacheMap map(100);
+    for (size_t i = 0; i < 50; i++)
+      REQUIRE_FALSE(map.putOrDisplace(Entry(generateKey(i), p1)).has_value());
+    CHECK(map.getUsedSize() == 50);
+
+    // puts and resize() fill a stripe up to the same capacity
+    CacheMap fullMap(1000);
+    for (size_t i = 0; i < 2000; i++)
+      fullMap.putOrDisplace(Entry(generateKey(i), p1));
+    CHECK(fullMap.getUsedSize() == fullMap.getCapacity());
+    CHECK(fullMap.resize(1000).empty());
+    CHECK(fullMap.getUsedSize() == fullMap.getCapacity());
+
+    std::vector<Entry> displaced = map.resize(200);
+    CHECK(displaced.empty());
+    CHECK(map.getSize() == 200);
+    CHECK(map.getUsedSize() == 50);
+    for (size_t i = 0; i < 50; i++) CHECK(map.get(generateKey(i)) == p1);
+
+    displaced = map.resize(30);
+    CHECK(map.getSize() == 30);
+    CHECK(map.getUsedSize() == map.getCapacity());
+    CHECK(displaced.size() + map.getUsedSize() == 50);
+    for (const Entry& e : displaced) CHECK(map.get(e.key) == EMPTY_PTR);
+    size_t present = 0;
+    for (size_t i = 0; i < 50; i++) {
+      if (map.get(generateKey(i)) == p1)
+        present++;
+    }
+    CHECK(present == map.getUsedSize());
+
+    CHECK(CacheMap::getSizeForMemoryBudget(0) == CacheMap::MIN_SIZE);
+    CHECK(CacheMap::getSizeForMemoryBudget(1000 * CacheMap::SLOT_MEMORY_SIZE) ==
+          1000);
+    CHECK(map.getMemoryFootprint() >= 30 * CacheMap::SLOT_MEMORY_SIZE);
+  }
+
+  SUBCASE("test concurrent") {
+    // every thread owns its keys, while the threads displace each other's entries
+    constexpr size_t threadsCnt = 4;
+    constexpr size_t keysPerThread = 2000;
+    CacheMap map(1000);
+    std::vector<std::vector<ptr_t>> lastPtrs(
+        threadsCnt, std::vector<ptr_t>(keysPerThread, Ptr::EMPTY_PTR_V));
+    std::vector<size_t> mismatchesCnts(threadsCnt, 0);
+    auto worker = [&](size_t threadIndex) {
+      std::mt19937_64 threadGen(threadIndex);
+      for (size_t i = 0; i < 20000; i++) {
+        size_t k = threadGen() % keysPerThread;
+        Key key = generateKey(threadIndex * keysPerThread + k);
+        ptr_t p = threadGen() % Ptr::NONEXISTENT_V;
+        if (threadGen() & 1) {
+          map.putOrDisplace(Entry(key, Ptr(p)));
+          lastPtrs[threadIndex][k] = p;
+        } else {
+          // the entry is either untouched or displaced by another thread
+          ptr_t got = map.get(key).getRaw();
+          if (got != lastPtrs[threadIndex][k] && got != Ptr::EMPTY_PTR_V)
+            mismatchesCnts[threadIndex]++;
+        }
+      }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < threadsCnt; i++) threads.emplace_back(worker, i);
+    for (std::thread& thread : threads) thread.join();
+
+    for (size_t i = 0; i < threadsCnt; i++) CHECK(mismatchesCnts[i] == 0);
+    std::vector<Entry> entries = map.getEntries();
+    CHECK(entries.size() == map.getUsedSize());
+    CHECK(entries.size() <= map.getCapacity() + 64);
+    for (const Entry& e : entries) {
+      size_t k = keyget(e.key);
+      CHECK(e.ptr.getRaw() == lastPtrs[k / keysPerThread][k % keysPerThread]);
+    }
+  }
+
   SUBCASE("test stress") {
     std::random_device rd;
     std::mt19937_64 gen(rd());
@@ -0,0 +1,104 @@
+#include "CacheSimulator.h"
+#include "doctest.h"
+
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace benchmark;
+using namespace kvs::trace;
+using namespace kvs::utils;
+
+namespace test_kvs::cache_simulator {
+
+const std::string testDirectoryPath = "../.test-data/test-cache-simulator/";
+const std::string traceFilePath = testDirectoryPath + "trace";
+
+void setUpTestDirectory() {
+  std::filesystem::create_directories(testDirectoryPath);
+}
+
+void clearTestDirectory() { std::filesystem::remove_all(testDirectoryPath); }
+
+HashedKey generateKey(size_t value) {
+  ByteArray byteArray{KEY_SIZE};
+  std::memset(byteArray.get(), 0, KEY_SIZE);
+  std::memcpy(byteArray.get(), reinterpret_cast<char*>(&value), sizeof(size_t));
+  return HashedKey{Key{byteArray}};
+}
+
+/**
+ * @brief With a capacity of 3 the simulated map holds 3 entries, so the 4th missing Key displaces one. FIFO and LRU
+ * part at the 5th access: FIFO displaces the removed key 1, LRU the untouched key 2.
+ *
+ */
+void writeTrace() {
+  const std::vector<std::pair<TraceOperation, size_t>> accesses = {
+      {TraceOperation::ADD, 1},    {TraceOperation::REMOVE, 2},
+      {TraceOperation::ADD, 3},    {TraceOperation::REMOVE, 1},
+      {TraceOperation::GET, 4},    {TraceOperation::GET, 1},
+      {TraceOperation::GET, 2},    {TraceOperation::GET, 3},
+      {TraceOperation::ADD, 5}};
+  TraceWriter writer{traceFilePath, false};
+  for (const auto& [operation, value] : accesses)
+    writer.write(writer.getTimestamp(), operation, 0, generateKey(value));
+}
+
+TEST_CASE("test cache simulator") {
+
+  setUpTestDirectory();
+  writeTrace();
+  TraceReader reader{traceFilePath};
+  SampledTrace trace{reader, 1};
+
+  SUBCASE("test exact sampling") {
+    CHECK(trace.getSamplingRate() == 1);
+    CHECK(trace.getRecordsCnt() == 9);
+    CHECK(trace.getSampledKeysCnt() == 5);
+    REQUIRE(trace.getAccesses().size() == 9);
+    CHECK(trace.getAccesses()[0].keyHash == generateKey(1).getLowHash());
+    CHECK(trace.getAccesses()[0].operation == TraceOperation::ADD);
+  }
+
+  SUBCASE("test fifo") {
+    // 1 is displaced as DELETED by 4, then 2, 3 and 4 in insertion order
+    SimulationResult result = simulate(trace, DisplacementPolicy::FIFO, 3);
+    CHECK(result.capacity == 3);
+    CHECK(result.hitsCnt == 1);
+    CHECK(result.negativeHitsCnt == 0);
+    CHECK(result.missesCnt == 8);
+    CHECK(result.pushesCnt == 1);
+  }
+
+  SUBCASE("test lru") {
+    // 2 is displaced by 4, so 1 is still known as DELETED until 5 displaces it
+    SimulationResult result = simulate(trace, DisplacementPolicy::LRU, 3);
+    CHECK(result.hitsCnt == 1);
+    CHECK(result.negativeHitsCnt == 1);
+    CHECK(result.missesCnt == 7);
+    CHECK(result.pushesCnt == 1);
+  }
+
+  SUBCASE("test every policy") {
+    for (DisplacementPolicy policy :
+         {DisplacementPolicy::RANDOM, DisplacementPolicy::FIFO,
+          DisplacementPolicy::LRU, DisplacementPolicy::CLOCK}) {
+      SimulationResult result = simulate(trace, policy, 3);
+      CHECK(result.hitsCnt + result.negativeHitsCnt + result.missesCnt == 9);
+      // the first access to every Key misses
+      CHECK(result.missesCnt >= 5);
+      // a map that holds every Key only misses the first access to each
+      SimulationResult unbounded = simulate(trace, policy, 5);
+      CHECK(unbounded.missesCnt == 5);
+      CHECK(unbounded.hitsCnt == 2);
+      CHECK(unbounded.negativeHitsCnt == 2);
+      CHECK(unbounded.pushesCnt == 0);
+    }
+  }
+
+  clearTestDirectory();
+}
+
+} // namespace test_kvs::cache_simulator
@@ -0,0 +1,67 @@
+#include "Json.h"
+#include "doctest.h"
+
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+using benchmark::JsonValue;
+
+namespace test_kvs::json {
+
+std::string print(const JsonValue& value) {
+  std::stringstream text;
+  value.print(text);
+  return text.str();
+}
+
+TEST_CASE("test json") {
+
+  SUBCASE("test parse") {
+    JsonValue value = JsonValue::parse(
+        " {\"number\": -1.5e3, \"array\": [true, false, null, \"\"],\n"
+        "  \"object\": {\"escaped\": \"a\\\"b\\\\c\\n\\u0001\"}, \"empty\": {}} ");
+    CHECK(value.isObject());
+    CHECK(value["number"].getNumber() == -1500);
+    const JsonValue::Array& array = value["array"].getArray();
+    REQUIRE(array.size() == 4);
+    CHECK(array[0].getBool());
+    CHECK(!array[1].getBool());
+    CHECK(array[2].isNull());
+    CHECK(array[3].getString().empty());
+    CHECK(value["object"]["escaped"].getString() == "a\"b\\c\n\x01");
+    CHECK(value["empty"].getObject().empty());
+    CHECK(value.contains("array"));
+    CHECK(!value.contains("missing"));
+    CHECK(!value["array"].contains("missing"));
+  }
+
+  SUBCASE("test print and parse back") {
+    JsonValue value = JsonValue::Object{
+        {"string", "quote \" backslash \\ tab \t"},
+        {"numbers", JsonValue::Array{0.0, 42.0, -0.25, 1e15}},
+        {"nested", JsonValue::Object{{"flag", true}, {"nothing", JsonValue{}}}}};
+    std::string text = print(value);
+    CHECK(print(JsonValue::parse(text)) == text);
+    CHECK(JsonValue::parse(text)["string"].getString() ==
+          "quote \" backslash \\ tab \t");
+  }
+
+  SUBCASE("test malformed documents") {
+    for (const char* text :
+         {"", "{", "[1, 2", "[1,]", "{\"a\" 1}", "{\"a\": 1,}", "{a: 1}",
+          "tru", "\"unterminated", "\"\\u12\"", "1 2", "-", "[1] x"})
+      CHECK_THROWS_AS(JsonValue::parse(text), std::invalid_argument);
+  }
+
+  SUBCASE("test wrong types") {
+    JsonValue value = JsonValue::parse("{\"number\": 1}");
+    CHECK_THROWS_AS(value["number"].getString(), std::invalid_argument);
+    CHECK_THROWS_AS(value["number"].getArray(), std::invalid_argument);
+    CHECK_THROWS_AS(value.getNumber(), std::invalid_argument);
+    CHECK_THROWS_AS(value["missing"], std::invalid_argument);
+    CHECK_THROWS_AS(value["number"]["member"], std::invalid_argument);
+  }
+}
+
+} // namespace test_kvs::json
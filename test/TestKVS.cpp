@@ -1,7 +1,10 @@
 #include "KVS.h"
 #include "doctest.h"
+#include <chrono>
 #include <filesystem>
 #include <random>
+#include <sstream>
+#include <thread>
 #include <unordered_map>
 
 namespace std {
@@ -119,6 +122,446 @@ TEST_CASE("test KVS") {
     CHECK(!optVal.has_value());
   }
 
+  SUBCASE("test cache map resize") {
+    KVS kvs{1000 * CacheMap::SLOT_MEMORY_SIZE};
+    CHECK(kvs.getCacheMapCapacity() == 666);
+    CHECK(kvs.getCacheMapMemoryFootprint() >= 1000 * CacheMap::SLOT_MEMORY_SIZE);
+
+    std::unordered_map<Key, Value> mapKVS;
+    for (size_t i = 0; i < 500; ++i) {
+      Key key = generateNewRandomKey(mapKVS);
+      Value value = generateRandomValue();
+      kvs.add(key, value);
+      mapKVS[key] = value;
+    }
+    size_t removedCnt = 0;
+    for (auto it = mapKVS.begin(); removedCnt < 100; ++removedCnt) {
+      kvs.remove(it->first);
+      it = mapKVS.erase(it);
+    }
+
+    kvs.resizeCacheMap(100 * CacheMap::SLOT_MEMORY_SIZE);
+    CHECK(kvs.getCacheMapCapacity() == 66);
+    for (const auto& [key, value] : mapKVS) {
+      std::optional<Value> optValue = kvs.get(key);
+      REQUIRE(optValue.has_value());
+      REQUIRE(optValue.value() == value);
+    }
+
+    kvs.resizeCacheMap(10000 * CacheMap::SLOT_MEMORY_SIZE);
+    CHECK(kvs.getCacheMapCapacity() == 6666);
+    for (const auto& [key, value] : mapKVS) {
+      std::optional<Value> optValue = kvs.get(key);
+      REQUIRE(optValue.has_value());
+      REQUIRE(optValue.value() == value);
+    }
+  }
+
+  SUBCASE("test reopen after checkpoint") {
+    std::unordered_map<Key, Value> mapKVS;
+    std::vector<Key> removedKeys;
+    {
+      KVS kvs;
+      for (size_t i = 0; i < 1000; ++i) {
+        Key key = generateNewRandomKey(mapKVS);
+        Value value = generateRandomValue();
+        kvs.add(key, value);
+        mapKVS[key] = value;
+      }
+      for (auto it = mapKVS.begin(); removedKeys.size() < 200;) {
+        kvs.remove(it->first);
+        removedKeys.push_back(it->first);
+        it = mapKVS.erase(it);
+      }
+      kvs.checkpoint();
+    }
+
+    KVS kvs;
+    for (const auto& [key, value] : mapKVS) {
+      std::optional<Value> optValue = kvs.get(key);
+      REQUIRE(optValue.has_value());
+      REQUIRE(optValue.value() == value);
+    }
+    for (const Key& key : removedKeys) REQUIRE_FALSE(kvs.get(key).has_value());
+  }
+
+  SUBCASE("test background compaction") {
+    KVS kvs;
+    // keys of a single shard, so that removing most of them requires a rebuild
+    shard_index_t shardIndex = 0;
+    std::vector<Key> keys;
+    while (keys.size() < 20) {
+      Key key = generateRandomKey();
+      if (kvs.getShardIndex(key) == shardIndex)
+        keys.push_back(key);
+    }
+    std::vector<Value> values;
+    for (const Key& key : keys) {
+      values.push_back(generateRandomValue());
+      kvs.add(key, values.back());
+    }
+
+    // the 11th removal leaves fewer alive values than half of the 20 stored ones
+    size_t removedCnt = 11;
+    auto removeAndCompact = [&]() {
+      for (size_t i = 0; i < removedCnt; ++i) kvs.remove(keys[i]);
+      kvs.waitForCompactions();
+      for (size_t i = 0; i < keys.size(); ++i) {
+        std::optional<Value> optValue = kvs.get(keys[i]);
+        REQUIRE(optValue.has_value() == (i >= removedCnt));
+        if (optValue.has_value())
+          REQUIRE(optValue.value() == values[i]);
+      }
+    };
+
+    SUBCASE("rewrite") {
+      ShardBuilder::rewriteFragmentation = 0;
+      removeAndCompact();
+      CHECK(std::filesystem::file_size(Shard::getValuesFilePath(shardIndex)) ==
+            (keys.size() - removedCnt) * VALUE_SIZE);
+    }
+
+    SUBCASE("punch holes") {
+      ShardBuilder::rewriteFragmentation = 1;
+      uint64_t holePunchesCnt = kvs.getRebuildStats().holePunchesCnt;
+      removeAndCompact();
+      CHECK(kvs.getRebuildStats().holePunchesCnt == holePunchesCnt + 1);
+      CHECK(std::filesystem::file_size(Shard::getValuesFilePath(shardIndex)) ==
+            keys.size() * VALUE_SIZE);
+
+      // the removed keys come back into the holes
+      for (size_t i = 0; i < removedCnt; ++i) kvs.add(keys[i], values[i]);
+      CHECK(std::filesystem::file_size(Shard::getValuesFilePath(shardIndex)) ==
+            keys.size() * VALUE_SIZE);
+      for (size_t i = 0; i < keys.size(); ++i)
+        REQUIRE(kvs.get(keys[i]) == values[i]);
+    }
+    ShardBuilder::rewriteFragmentation = COMPACTION_REWRITE_FRAGMENTATION;
+  }
+
+  SUBCASE("test compaction scheduler") {
+    CompactionConfig compactionConfig;
+    compactionConfig.threadsCnt = 2;
+    // the index written by the first compaction takes the budget for seconds
+    compactionConfig.bytesPerSecond = 100;
+    KVS kvs{CACHE_MAP_SIZE * CacheMap::SLOT_MEMORY_SIZE, compactionConfig};
+
+    // makes a compaction of the shard required, with removedCnt dead values
+    auto addGarbage = [&kvs](shard_index_t shardIndex, size_t removedCnt) {
+      std::vector<Key> keys;
+      while (keys.size() < 20) {
+        Key key = generateRandomKey();
+        if (kvs.getShardIndex(key) == shardIndex)
+          keys.push_back(key);
+      }
+      for (const Key& key : keys) kvs.add(key, generateRandomValue());
+      for (size_t i = 0; i < removedCnt; ++i) kvs.remove(keys[i]);
+    };
+
+    addGarbage(0, 11);
+    CompactionStats stats = kvs.getCompactionStats();
+    for (size_t i = 0; i < 10000 && stats.compactionsCnt == 0; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      stats = kvs.getCompactionStats();
+    }
+    REQUIRE(stats.compactionsCnt == 1);
+    CHECK(stats.reclaimedBytesCnt == 11 * VALUE_SIZE);
+    CHECK(stats.writtenBytesCnt > 0);
+
+    addGarbage(1, 11);
+    addGarbage(2, 15);
+    stats = kvs.getCompactionStats();
+    CHECK(stats.compactionsCnt == 1);
+    CHECK(stats.queuedShardsCnt == 2);
+    CHECK(stats.queuedGarbageBytesCnt == 26 * VALUE_SIZE);
+  }
+
+  SUBCASE("test shard split and merge") {
+    // far more keys of a single initial shard than it can hold
+    std::vector<Key> keys;
+    std::vector<Value> values;
+    {
+      KVS kvs{100 * CacheMap::SLOT_MEMORY_SIZE};
+      shard_index_t shardIndex = 0;
+      while (keys.size() < 4 * SHARD_MAX_KEYS_CNT) {
+        Key key = generateRandomKey();
+        if (kvs.getShardIndex(key) == shardIndex) {
+          keys.push_back(key);
+          values.push_back(generateRandomValue());
+        }
+      }
+      uint64_t splitsCnt = kvs.getRebuildStats().splitsCnt;
+      std::vector<KeyValue> keyValues;
+      for (size_t i = 0; i < keys.size(); ++i) {
+        if (i % 2 == 0)
+          kvs.add(keys[i], values[i]);
+        else
+          keyValues.push_back(KeyValue{keys[i], values[i]});
+      }
+      kvs.multiPut(keyValues);
+      CHECK(kvs.getRebuildStats().splitsCnt >= splitsCnt + 3);
+      for (size_t i = 0; i < keys.size(); ++i)
+        REQUIRE(kvs.get(keys[i]) == values[i]);
+      kvs.checkpoint();
+    }
+
+    KVS kvs;
+    for (size_t i = 0; i < keys.size(); ++i)
+      REQUIRE(kvs.get(keys[i]) == values[i]);
+
+    // the few keys left fit into the initial shard again
+    size_t keptCnt = 10;
+    uint64_t mergesCnt = kvs.getRebuildStats().mergesCnt;
+    for (size_t i = keptCnt; i < keys.size(); ++i) kvs.remove(keys[i]);
+    kvs.waitForCompactions();
+    CHECK(kvs.getRebuildStats().mergesCnt > mergesCnt);
+    for (size_t i = 0; i < keys.size(); ++i) {
+      std::optional<Value> optValue = kvs.get(keys[i]);
+      REQUIRE(optValue.has_value() == (i < keptCnt));
+      if (optValue.has_value())
+        REQUIRE(optValue.value() == values[i]);
+    }
+  }
+
+  SUBCASE("test stats") {
+    KVS kvs;
+    KVSStats stats = kvs.stats();
+    // the counters belong to the instance, earlier ones in the process don't show up
+    CHECK(stats.ioStats.valuesWrittenBytesCnt == 0);
+    CHECK(stats.ioStats.indexReadsCnt == 0);
+    CHECK(stats.filterStats.negativesCnt == 0);
+    CHECK(stats.rebuildStats.rebuildsCnt == 0);
+    CHECK(stats.rebuildStats.copiedBytesCnt == 0);
+    auto getOperationsCnt = [&stats](storage::IOOperation operation) {
+      return stats.syscallStats.operationStats[static_cast<size_t>(operation)]
+          .operationsCnt.load();
+    };
+    CHECK(getOperationsCnt(storage::IOOperation::ADD) == 0);
+    uint64_t valuesWrittenBytesCnt = stats.ioStats.valuesWrittenBytesCnt;
+    uint64_t indexWritesCnt = stats.ioStats.indexWritesCnt;
+
+    Key k1 = generateRandomKey();
+    kvs.add(k1, generateRandomValue());
+    CHECK(kvs.get(k1).has_value());
+    Key k2 = generateRandomKey();
+    CHECK(!kvs.get(k2).has_value());
+    CHECK(!kvs.get(k2).has_value());
+    kvs.remove(k1);
+    CHECK(kvs.multiGet({k1, k2}) == std::vector<std::optional<Value>>(2));
+
+    stats = kvs.stats();
+    CHECK(getOperationsCnt(storage::IOOperation::ADD) == 1);
+    CHECK(getOperationsCnt(storage::IOOperation::GET) == 3);
+    CHECK(getOperationsCnt(storage::IOOperation::REMOVE) == 1);
+    CHECK(getOperationsCnt(storage::IOOperation::MULTI_GET) == 1);
+    CHECK(stats.cacheMapStats.hitsCnt == 1);
+    CHECK(stats.cacheMapStats.negativeHitsCnt == 3);
+    CHECK(stats.cacheMapStats.missesCnt == 1);
+    CHECK(stats.cacheMapUsedSize == 2);
+    CHECK(stats.ioStats.valuesWrittenBytesCnt >=
+          valuesWrittenBytesCnt + VALUE_SIZE);
+    CHECK(stats.ioStats.indexWritesCnt > indexWritesCnt);
+    size_t aliveValuesCnt = 0;
+    for (const ShardStats& shardStats : stats.shardStats) {
+      aliveValuesCnt += shardStats.aliveValuesCnt;
+      CHECK(shardStats.aliveValuesCnt <= shardStats.totalValuesCnt);
+    }
+    CHECK(aliveValuesCnt == 0);
+
+    std::ostringstream text;
+    stats.printText(text);
+    CHECK(text.str().find("cache_map.hits: 1\n") != std::string::npos);
+    std::ostringstream json;
+    stats.printJSON(json);
+    CHECK(json.str().find("\"cache_map.misses\":1,") != std::string::npos);
+
+    std::ostringstream dump;
+    kvs.startStatsDump(dump, std::chrono::milliseconds(1), true);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    kvs.stopStatsDump();
+    CHECK(dump.str().rfind("{\"cache_map.hits\":1,", 0) == 0);
+  }
+
+  SUBCASE("test trace") {
+    const std::string traceFilePath = testDirectoryPath + "trace";
+    KVS kvs;
+    Key k1 = generateRandomKey();
+    Key k2 = generateRandomKey();
+    kvs.add(k1, generateRandomValue());
+    kvs.startTrace(traceFilePath, true);
+    kvs.get(k1);
+    kvs.add(k1, generateRandomValue());
+    kvs.get(k2);
+    kvs.remove(k1);
+    kvs.stopTrace();
+    kvs.get(k1);
+
+    trace::TraceReader reader{traceFilePath};
+    std::vector<trace::TraceRecord> records;
+    while (std::optional<trace::TraceRecord> record = reader.next())
+      records.push_back(record.value());
+    REQUIRE(records.size() == 4);
+    CHECK(records[0].operation == trace::TraceOperation::GET);
+    CHECK(records[0].outcome == trace::CACHE_HIT);
+    CHECK(records[1].operation == trace::TraceOperation::ADD);
+    CHECK(records[1].outcome == trace::CACHE_HIT);
+    CHECK(records[2].operation == trace::TraceOperation::GET);
+    CHECK(records[2].key.value() == k2);
+    // a Key of a fresh shard is either rejected by the filter or a false positive
+    CHECK((records[2].outcome == trace::BLOOM_REJECT ||
+           records[2].outcome == trace::DISK_READ));
+    CHECK(records[3].operation == trace::TraceOperation::REMOVE);
+    CHECK((records[3].outcome & trace::CACHE_HIT));
+    for (size_t i = 1; i < records.size(); ++i)
+      CHECK(records[i - 1].timestamp <= records[i].timestamp);
+  }
+
+  SUBCASE("test batch operations") {
+    // a small cache and a small key pool cause displacements, rebuilds and repeated keys within a batch
+    KVS kvs{100 * CacheMap::SLOT_MEMORY_SIZE};
+    std::unordered_map<Key, Value> mapKVS;
+    std::vector<Key> keyPool;
+    for (size_t i = 0; i < 300; ++i) keyPool.push_back(generateRandomKey());
+    std::uniform_int_distribution<size_t> keyDistr(0, keyPool.size() - 1);
+
+    for (size_t batchIndex = 0; batchIndex < 300; ++batchIndex) {
+      std::vector<Key> keys;
+      for (size_t i = 0; i < 100; ++i) keys.push_back(keyPool[keyDistr(gen)]);
+
+      switch (generateRandomOperationCode()) {
+      case 0: {
+        std::vector<std::optional<Value>> values = kvs.multiGet(keys);
+        REQUIRE(values.size() == keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) {
+          const auto& it = mapKVS.find(keys[i]);
+          if (it == mapKVS.end()) {
+            REQUIRE_FALSE(values[i].has_value());
+          } else {
+            REQUIRE(values[i].has_value());
+            REQUIRE(values[i].value() == it->second);
+          }
+        }
+        break;
+      }
+      case 1: {
+        kvs.multiRemove(keys);
+        for (const Key& key : keys) mapKVS.erase(key);
+        break;
+      }
+      case 2: {
+        std::vector<KeyValue> keyValues;
+        for (const Key& key : keys) {
+          keyValues.push_back(KeyValue{key, generateRandomValue()});
+          mapKVS[key] = keyValues.back().value;
+        }
+        kvs.multiPut(keyValues);
+        break;
+      }
+      }
+    }
+
+    for (const Key& key : keyPool) {
+      const auto& it = mapKVS.find(key);
+      std::optional<Value> optValue = kvs.get(key);
+      REQUIRE(optValue.has_value() == (it != mapKVS.end()));
+      if (optValue.has_value())
+        REQUIRE(optValue.value() == it->second);
+    }
+  }
+
+  SUBCASE("test syscalls of batch operations") {
+    KVS kvs;
+    std::vector<Key> keys;
+    std::vector<KeyValue> keyValues;
+    for (size_t i = 0; i < 200; ++i) {
+      keys.push_back(generateRandomKey());
+      keyValues.push_back(KeyValue{keys.back(), generateRandomValue()});
+    }
+    kvs.multiPut(keyValues);
+    uint64_t valuesReadBytesCnt = kvs.stats().ioStats.valuesReadBytesCnt;
+    kvs.multiGet(keys);
+
+    KVSStats stats = kvs.stats();
+    const storage::IOOperationStats& multiGetStats =
+        stats.syscallStats.operationStats[static_cast<size_t>(
+            storage::IOOperation::MULTI_GET)];
+    CHECK(multiGetStats.operationsCnt.load() == 1);
+    // the values are read by the worker threads of the batch, which count for the batch operation
+    CHECK(stats.ioStats.valuesReadBytesCnt - valuesReadBytesCnt ==
+          keys.size() * VALUE_SIZE);
+    CHECK(multiGetStats.readBytesCnt.load() == keys.size() * VALUE_SIZE);
+  }
+
+  SUBCASE("test concurrent operations") {
+    // every thread owns its keys, while a small cache makes threads displace each other's entries
+    constexpr size_t threadsCnt = 4;
+    KVS kvs{50 * CacheMap::SLOT_MEMORY_SIZE};
+    std::vector<std::vector<Key>> keyPools(threadsCnt);
+    for (auto& keyPool : keyPools) {
+      for (size_t i = 0; i < 100; ++i) keyPool.push_back(generateRandomKey());
+    }
+    std::vector<Value> valuePool;
+    for (size_t i = 0; i < 50; ++i) valuePool.push_back(generateRandomValue());
+
+    std::vector<std::unordered_map<Key, Value>> mapKVSs(threadsCnt);
+    std::vector<size_t> mismatchesCnts(threadsCnt, 0);
+    auto worker = [&](size_t threadIndex) {
+      std::mt19937_64 threadGen(threadIndex);
+      const std::vector<Key>& keyPool = keyPools[threadIndex];
+      std::unordered_map<Key, Value>& mapKVS = mapKVSs[threadIndex];
+      for (size_t i = 0; i < 2000; ++i) {
+        const Key& key = keyPool[threadGen() % keyPool.size()];
+        switch (threadGen() % 4) {
+        case 0: {
+          std::optional<Value> optValue = kvs.get(key);
+          const auto& it = mapKVS.find(key);
+          if (optValue.has_value() != (it != mapKVS.end()) ||
+              (optValue.has_value() && !(optValue.value() == it->second)))
+            ++mismatchesCnts[threadIndex];
+          break;
+        }
+        case 1: {
+          kvs.remove(key);
+          mapKVS.erase(key);
+          break;
+        }
+        case 2: {
+          const Value& value = valuePool[threadGen() % valuePool.size()];
+          kvs.add(key, value);
+          mapKVS[key] = value;
+          break;
+        }
+        case 3: {
+          std::vector<Key> keys;
+          for (size_t j = 0; j < 10; ++j)
+            keys.push_back(keyPool[threadGen() % keyPool.size()]);
+          std::vector<std::optional<Value>> values = kvs.multiGet(keys);
+          for (size_t j = 0; j < keys.size(); ++j) {
+            const auto& it = mapKVS.find(keys[j]);
+            if (values[j].has_value() != (it != mapKVS.end()))
+              ++mismatchesCnts[threadIndex];
+          }
+          break;
+        }
+        }
+      }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < threadsCnt; ++i) threads.emplace_back(worker, i);
+    for (std::thread& thread : threads) thread.join();
+
+    for (size_t i = 0; i < threadsCnt; ++i) {
+      CHECK(mismatchesCnts[i] == 0);
+      for (const Key& key : keyPools[i]) {
+        const auto& it = mapKVSs[i].find(key);
+        std::optional<Value> optValue = kvs.get(key);
+        REQUIRE(optValue.has_value() == (it != mapKVSs[i].end()));
+        if (optValue.has_value())
+          REQUIRE(optValue.value() == it->second);
+      }
+    }
+  }
+
   SUBCASE("stress test") {
     size_t setupElementsSize = 1e4;
     size_t operationsNumber = 9e4;
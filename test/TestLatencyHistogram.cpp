@@ -0,0 +1,163 @@
+#include "LatencyHistogram.h"
+#include "doctest.h"
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+using benchmark::LatencyHistogram;
+
+namespace test_kvs::latency_histogram {
+
+constexpr uint64_t EXACT_VALUES_CNT = uint64_t{1}
+                                      << LatencyHistogram::SUB_BUCKET_BITS;
+
+/**
+ * @brief The bucket a single recorded value falls into.
+ *
+ */
+LatencyHistogram::Bucket getBucketOf(uint64_t nanos) {
+  LatencyHistogram histogram;
+  histogram.record(nanos);
+  std::vector<LatencyHistogram::Bucket> buckets = histogram.getBuckets();
+  REQUIRE(buckets.size() == 1);
+  return buckets[0];
+}
+
+void checkBucketOf(uint64_t nanos) {
+  LatencyHistogram::Bucket bucket = getBucketOf(nanos);
+  CHECK(bucket.count == 1);
+  CHECK(bucket.lower <= nanos);
+  CHECK(nanos <= bucket.upper);
+  // a bucket is narrower than 2^-(SUB_BUCKET_BITS - 1) of its values
+  CHECK(bucket.upper - bucket.lower <
+        (bucket.lower >> (LatencyHistogram::SUB_BUCKET_BITS - 1)));
+  // both bounds map back to the same bucket
+  LatencyHistogram::Bucket lowerBucket = getBucketOf(bucket.lower);
+  CHECK(lowerBucket.lower == bucket.lower);
+  CHECK(lowerBucket.upper == bucket.upper);
+  LatencyHistogram::Bucket upperBucket = getBucketOf(bucket.upper);
+  CHECK(upperBucket.lower == bucket.lower);
+  CHECK(upperBucket.upper == bucket.upper);
+}
+
+TEST_CASE("test LatencyHistogram") {
+
+  SUBCASE("test exact values") {
+    for (uint64_t nanos = 0; nanos < EXACT_VALUES_CNT; nanos++) {
+      LatencyHistogram::Bucket bucket = getBucketOf(nanos);
+      CHECK(bucket.lower == nanos);
+      CHECK(bucket.upper == nanos);
+    }
+  }
+
+  SUBCASE("test bucket boundaries") {
+    for (uint8_t k = LatencyHistogram::SUB_BUCKET_BITS; k < 64; k++) {
+      uint64_t powerOfTwo = uint64_t{1} << k;
+      CHECK(getBucketOf(powerOfTwo).lower == powerOfTwo);
+      CHECK(getBucketOf(powerOfTwo - 1).upper == powerOfTwo - 1);
+      checkBucketOf(powerOfTwo - 1);
+      checkBucketOf(powerOfTwo);
+      checkBucketOf(powerOfTwo + 1);
+    }
+  }
+
+  SUBCASE("test consecutive buckets") {
+    // the buckets tile the values without gaps or overlaps
+    uint64_t nanos = EXACT_VALUES_CNT;
+    while (nanos < (uint64_t{1} << 20)) {
+      LatencyHistogram::Bucket bucket = getBucketOf(nanos);
+      REQUIRE(bucket.lower == nanos);
+      nanos = bucket.upper + 1;
+    }
+  }
+
+  SUBCASE("test values near UINT64_MAX") {
+    LatencyHistogram::Bucket bucket = getBucketOf(UINT64_MAX);
+    CHECK(bucket.upper == UINT64_MAX);
+    checkBucketOf(UINT64_MAX);
+    checkBucketOf(UINT64_MAX - 1);
+    checkBucketOf(bucket.lower - 1);
+
+    LatencyHistogram histogram;
+    histogram.record(UINT64_MAX);
+    CHECK(histogram.getMax() == UINT64_MAX);
+    CHECK(histogram.getPercentile(50) == UINT64_MAX);
+  }
+
+  SUBCASE("test percentiles") {
+    LatencyHistogram histogram;
+    CHECK(histogram.getPercentile(50) == 0);
+    CHECK(histogram.getMin() == 0);
+
+    for (uint64_t nanos = 1; nanos <= 100; nanos++) histogram.record(nanos);
+    CHECK(histogram.getCount() == 100);
+    CHECK(histogram.getPercentile(0) == 1);
+    CHECK(histogram.getPercentile(1) == 1);
+    CHECK(histogram.getPercentile(50) == 50);
+    CHECK(histogram.getPercentile(99.5) == 100);
+    CHECK(histogram.getPercentile(100) == 100);
+    CHECK(histogram.getMean() == doctest::Approx(50.5));
+
+    SUBCASE("test percentile within a bucket") {
+      LatencyHistogram wideHistogram;
+      wideHistogram.record(1000000);
+      wideHistogram.record(1000001);
+      wideHistogram.record(2000000);
+      // the upper bound of the bucket, but never beyond the recorded values
+      uint64_t upper = getBucketOf(1000000).upper;
+      CHECK(upper > 1000001);
+      CHECK(wideHistogram.getPercentile(0) == upper);
+      CHECK(wideHistogram.getPercentile(50) == upper);
+      CHECK(wideHistogram.getPercentile(100) == 2000000);
+
+      LatencyHistogram clampedHistogram;
+      clampedHistogram.record(1000000);
+      clampedHistogram.record(1000001);
+      CHECK(clampedHistogram.getPercentile(0) == 1000001);
+    }
+  }
+
+  SUBCASE("test merge") {
+    std::mt19937_64 gen(42);
+    std::lognormal_distribution<double> distr(10, 2);
+    LatencyHistogram all, first, second;
+    for (size_t i = 0; i < 10000; i++) {
+      uint64_t nanos = distr(gen);
+      all.record(nanos);
+      (i % 3 == 0 ? first : second).record(nanos);
+    }
+    LatencyHistogram merged;
+    merged.merge(first);
+    merged.merge(second);
+    // merging an empty histogram changes nothing
+    merged.merge(LatencyHistogram{});
+
+    CHECK(merged.getCount() == all.getCount());
+    CHECK(merged.getMin() == all.getMin());
+    CHECK(merged.getMax() == all.getMax());
+    CHECK(merged.getMean() == doctest::Approx(all.getMean()));
+    for (double percentile : {0.0, 50.0, 90.0, 99.0, 99.9, 100.0})
+      CHECK(merged.getPercentile(percentile) == all.getPercentile(percentile));
+    std::vector<LatencyHistogram::Bucket> mergedBuckets = merged.getBuckets();
+    std::vector<LatencyHistogram::Bucket> allBuckets = all.getBuckets();
+    REQUIRE(mergedBuckets.size() == allBuckets.size());
+    for (size_t i = 0; i < allBuckets.size(); i++) {
+      CHECK(mergedBuckets[i].lower == allBuckets[i].lower);
+      CHECK(mergedBuckets[i].count == allBuckets[i].count);
+    }
+  }
+
+  SUBCASE("test record count") {
+    LatencyHistogram repeated, single;
+    repeated.record(12345, 3);
+    repeated.record(7, 0);
+    for (size_t i = 0; i < 3; i++) single.record(12345);
+    CHECK(repeated.getCount() == 3);
+    CHECK(repeated.getMin() == 12345);
+    CHECK(repeated.getPercentile(50) == single.getPercentile(50));
+    CHECK(repeated.getMean() == doctest::Approx(single.getMean()));
+  }
+}
+
+} // namespace test_kvs::latency_histogram
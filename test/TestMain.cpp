@@ -1,2 +1,4 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+// SIGSTKSZ is not a constant since glibc 2.34, which the signal handler of doctest 2.3.7 relies on
+#define DOCTEST_CONFIG_NO_POSIX_SIGNALS
 #include "doctest.h"
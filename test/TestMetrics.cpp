@@ -0,0 +1,44 @@
+#include "Metrics.h"
+#include "doctest.h"
+
+#include <thread>
+#include <vector>
+
+using namespace kvs::metrics;
+
+namespace test_kvs::metrics {
+
+TEST_CASE("test metrics") {
+
+  SUBCASE("test counter") {
+    Counter counter;
+    CHECK(counter == 0);
+    ++counter;
+    counter += 41;
+    CHECK(counter.load() == 42);
+
+    Counter snapshot = counter;
+    ++counter;
+    CHECK(snapshot == 42);
+    CHECK(counter == 43);
+
+    counter = 7;
+    CHECK(counter == 7);
+  }
+
+  SUBCASE("test concurrent counter") {
+    Counter counter;
+    const size_t threadsCnt = 2 * Counter::STRIPES_CNT + 1;
+    const uint64_t incrementsCnt = 10000;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < threadsCnt; ++i) {
+      threads.emplace_back([&counter, incrementsCnt]() {
+        for (uint64_t j = 0; j < incrementsCnt; ++j) ++counter;
+      });
+    }
+    for (std::thread& thread : threads) thread.join();
+    CHECK(counter == threadsCnt * incrementsCnt);
+  }
+}
+
+} // namespace test_kvs::metrics
@@ -65,7 +65,8 @@ std::vector<std::pair<Value, Ptr>> generateValuesAndPtrs(size_t size,
 TEST_CASE("test Shard") {
   setUpTestDirectory();
   shard_index_t shardIndex = 65;
-  Shard shard = ShardBuilder::createShard(shardIndex);
+  ShardCounters counters;
+  Shard shard = ShardBuilder::createShard(shardIndex, counters);
   std::string valuesFilePath = Shard::getValuesFilePath(shardIndex);
   std::string hashTableFilePath =
       Shard::getStorageHashTableFilePath(shardIndex);
@@ -205,16 +206,78 @@ TEST_CASE("test Shard") {
       for (values_cnt_t i = 0; i < valuesCnt; ++i) {
         auto [entry, value] = elements[i];
         auto [readEntry, readValue] = shard.readValue(shardIndex, entry.key);
+        CHECK(readEntry.key == entry.key);
         if (i % 3 == 0) {
           REQUIRE_FALSE(readValue.has_value());
+          // the index is read only on a filter false positive
+          CHECK((readEntry.ptr == entry.ptr ||
+                 readEntry.ptr.getType() == PtrType::EMPTY_PTR));
         } else {
           REQUIRE(readValue.has_value());
           CHECK(readValue.value() == value);
+          CHECK(readEntry.ptr == entry.ptr);
         }
-        CHECK(readEntry.key == entry.key);
-        CHECK(readEntry.ptr == entry.ptr);
       }
     }
+
+    SUBCASE("& test new keys reuse removed slots") {
+      size_t valuesFileSize = std::filesystem::file_size(valuesFilePath);
+      for (values_cnt_t i = 0; i < valuesCnt; i += 3)
+        shard.removeEntry(shardIndex, elements[i].first.key);
+      REQUIRE(shard.getFreeSlotsCnt() == 4);
+
+      std::vector<std::pair<Key, Value>> newElements;
+      for (values_cnt_t i = valuesCnt; i < valuesCnt + 4; ++i) {
+        newElements.emplace_back(generateKey(i), generateValue('A' + i));
+        Entry writeEntry = shard.writeValue(shardIndex, newElements.back().first,
+                                            newElements.back().second);
+        CHECK(writeEntry.ptr.getOffset() % (3 * VALUE_SIZE) == 0);
+      }
+      CHECK(shard.getFreeSlotsCnt() == 0);
+      CHECK(std::filesystem::file_size(valuesFilePath) == valuesFileSize);
+
+      for (const auto& [key, value] : newElements) {
+        auto [readEntry, readValue] = shard.readValue(shardIndex, key);
+        REQUIRE(readValue.has_value());
+        CHECK(readValue.value() == value);
+      }
+      for (values_cnt_t i = 0; i < valuesCnt; ++i) {
+        auto [readEntry, readValue] =
+            shard.readValue(shardIndex, elements[i].first.key);
+        CHECK(readValue.has_value() == (i % 3 != 0));
+      }
+
+      shard.writeValue(shardIndex, generateKey(valuesCnt + 4),
+                       generateValue(0));
+      CHECK(std::filesystem::file_size(valuesFilePath) ==
+            valuesFileSize + VALUE_SIZE);
+    }
+  }
+
+  SUBCASE("test filter stats") {
+    size_t valuesCnt = 40; // more than the initial filter is sized for
+    for (size_t i = 0; i < valuesCnt; ++i)
+      shard.writeValue(shardIndex, generateKey(i), generateValue(i));
+
+    counters.filterStats = kvs::bloom_filter::BloomFilterStats{};
+    for (size_t i = 0; i < valuesCnt; ++i) {
+      auto [readEntry, readValue] = shard.readValue(shardIndex, generateKey(i));
+      REQUIRE(readValue.has_value());
+    }
+    CHECK(counters.filterStats.truePositivesCnt == valuesCnt);
+
+    size_t absentKeysCnt = 1000;
+    for (size_t i = valuesCnt; i < valuesCnt + absentKeysCnt; ++i) {
+      auto [readEntry, readValue] = shard.readValue(shardIndex, generateKey(i));
+      REQUIRE_FALSE(readValue.has_value());
+    }
+    CHECK(counters.filterStats.negativesCnt +
+              counters.filterStats.falsePositivesCnt ==
+          absentKeysCnt);
+    MESSAGE(std::string("measured false positive rate ") +
+            std::to_string(counters.filterStats.getFalsePositiveRate()));
+    CHECK(counters.filterStats.getFalsePositiveRate() <
+          Shard::filterFalsePositiveRate * 5);
   }
 
   SUBCASE("stress test blackbox methods") {
@@ -243,10 +306,13 @@ TEST_CASE("test Shard") {
       case 1: { // remove
         auto [removeKey, removePtr] = shard.removeEntry(shardIndex, key);
         REQUIRE(removeKey == key);
-        if (visitedSet.find(key) == visitedSet.end()) {
+        if (kvsMap.find(key) != kvsMap.end()) {
+          REQUIRE(removePtr.getType() == PtrType::DELETED);
+        } else if (visitedSet.find(key) == visitedSet.end()) {
           REQUIRE(removePtr.getType() == PtrType::EMPTY_PTR);
         } else {
-          REQUIRE(removePtr.getType() == PtrType::DELETED);
+          REQUIRE((removePtr.getType() == PtrType::DELETED ||
+                   removePtr.getType() == PtrType::EMPTY_PTR));
         }
         kvsMap.erase(key);
         break;
@@ -261,7 +327,8 @@ TEST_CASE("test Shard") {
           if (visitedSet.find(key) == visitedSet.end()) {
             REQUIRE(readPtr.getType() == PtrType::EMPTY_PTR);
           } else {
-            REQUIRE(readPtr.getType() == PtrType::DELETED);
+            REQUIRE((readPtr.getType() == PtrType::DELETED ||
+                     readPtr.getType() == PtrType::EMPTY_PTR));
           }
         } else {
           REQUIRE(readValue.has_value());
@@ -37,10 +37,12 @@ Value generateValue(char seedChar) {
 
 TEST_CASE("test ShardBuilder") {
   setUpTestDirectory();
+  ShardCounters counters;
+  ShardBuilder::rewriteFragmentation = COMPACTION_REWRITE_FRAGMENTATION;
 
   SUBCASE("test createShard") {
     shard_index_t shardIndex = 65;
-    Shard shard = ShardBuilder::createShard(shardIndex);
+    Shard shard = ShardBuilder::createShard(shardIndex, counters);
 
     std::string valuesFilePath = Shard::getValuesFilePath(shardIndex);
     REQUIRE(std::filesystem::exists(valuesFilePath));
@@ -55,9 +57,68 @@ TEST_CASE("test ShardBuilder") {
     CHECK_FALSE(shard.isRebuildRequired(shardIndex));
   }
 
+  SUBCASE("test openShard") {
+    shard_index_t shardIndex = 65;
+    Shard shard = ShardBuilder::openShard(shardIndex, counters);
+    std::string metadataFilePath = Shard::getMetadataFilePath(shardIndex);
+    REQUIRE(std::filesystem::exists(Shard::getValuesFilePath(shardIndex)));
+    REQUIRE(std::filesystem::exists(metadataFilePath));
+    CHECK(shard.isMetadataSaved());
+
+    values_cnt_t valuesCnt = 10;
+    for (values_cnt_t i = 0; i < valuesCnt; ++i)
+      shard.writeValue(shardIndex, generateKey(i), generateValue(i));
+    shard.removeEntry(shardIndex, generateKey(0));
+    CHECK_FALSE(shard.isMetadataSaved());
+    CHECK_FALSE(std::filesystem::exists(metadataFilePath));
+
+    auto checkReopened = [&](Shard& reopened) {
+      for (values_cnt_t i = 1; i < valuesCnt; ++i) {
+        auto [readEntry, readValue] =
+            reopened.readValue(shardIndex, generateKey(i));
+        REQUIRE(readValue.has_value());
+        CHECK(readValue.value() == generateValue(i));
+      }
+      auto [readEntry, readValue] =
+          reopened.readValue(shardIndex, generateKey(0));
+      CHECK_FALSE(readValue.has_value());
+      // 1 removed out of 10 in both shards
+      CHECK(reopened.isRebuildRequired(shardIndex) ==
+            shard.isRebuildRequired(shardIndex));
+    };
+
+    SUBCASE("& reopen by scanning the index") {
+      Shard reopened = ShardBuilder::openShard(shardIndex, counters);
+      CHECK(reopened.isMetadataSaved());
+      CHECK(std::filesystem::exists(metadataFilePath));
+      checkReopened(reopened);
+    }
+
+    SUBCASE("& reopen from metadata") {
+      shard.saveMetadata(shardIndex);
+      Shard reopened = ShardBuilder::openShard(shardIndex, counters);
+      CHECK(reopened.isMetadataSaved());
+      checkReopened(reopened);
+    }
+
+    SUBCASE("& reopen with outdated metadata") {
+      shard.saveMetadata(shardIndex);
+      Storage storage(Shard::getValuesFilePath(shardIndex));
+      storage.append(generateValue(0).getBytes());
+      storage.close();
+      Shard reopened = ShardBuilder::openShard(shardIndex, counters);
+      for (values_cnt_t i = 1; i < valuesCnt; ++i) {
+        auto [readEntry, readValue] =
+            reopened.readValue(shardIndex, generateKey(i));
+        REQUIRE(readValue.has_value());
+      }
+    }
+  }
+
   SUBCASE("test rebuildShard") {
+    ShardBuilder::rewriteFragmentation = 0;
     shard_index_t shardIndex = 65;
-    Shard shard = ShardBuilder::createShard(shardIndex);
+    Shard shard = ShardBuilder::createShard(shardIndex, counters);
     std::string valuesFilePath = Shard::getValuesFilePath(shardIndex);
     std::string hashTableFilePath =
         Shard::getStorageHashTableFilePath(shardIndex);
@@ -118,6 +179,10 @@ TEST_CASE("test ShardBuilder") {
     REQUIRE(!newShard.isRebuildRequired(shardIndex));
     REQUIRE(std::filesystem::file_size(valuesFilePath) ==
             (valuesCnt - removedValuesCnt) * VALUE_SIZE);
+    // counted by the counters the old shard was created with
+    CHECK(counters.rebuildStats.rebuildsCnt == 1);
+    CHECK(counters.rebuildStats.copiedBytesCnt ==
+          (valuesCnt - removedValuesCnt) * VALUE_SIZE);
     for (values_cnt_t presentValue = removedValuesCnt; presentValue < valuesCnt;
          ++presentValue) {
       auto [entry, value] = elements[presentValue];
@@ -162,6 +227,72 @@ TEST_CASE("test ShardBuilder") {
     CHECK(otherShardEntryPtr == otherShardEntry.ptr);
   }
 
+  SUBCASE("test rebuildShard punching holes") {
+    ShardBuilder::rewriteFragmentation = 1;
+    shard_index_t shardIndex = 65;
+    Shard shard = ShardBuilder::createShard(shardIndex, counters);
+    std::string valuesFilePath = Shard::getValuesFilePath(shardIndex);
+
+    CacheMap cacheMap{CACHE_MAP_SIZE};
+    values_cnt_t valuesCnt = 15;
+    for (values_cnt_t i = 0; i < valuesCnt; ++i) {
+      Entry writeEntry =
+          shard.writeValue(shardIndex, generateKey(i), generateValue(i));
+      cacheMap.putOrDisplace(writeEntry);
+    }
+    values_cnt_t removedValuesCnt = 0;
+    while (!shard.isRebuildRequired(shardIndex)) {
+      Entry removeEntry =
+          shard.removeEntry(shardIndex, generateKey(removedValuesCnt));
+      cacheMap.putOrDisplace(
+          Entry{removeEntry.key, Ptr{PtrType::NONEXISTENT}});
+      ++removedValuesCnt;
+    }
+    REQUIRE(ShardBuilder::chooseCompactionMode(shard, shardIndex) ==
+            CompactionMode::PUNCH_HOLES);
+
+    auto [newShard, cacheMapDiff] =
+        ShardBuilder::rebuildShard(shard, shardIndex, cacheMap);
+    REQUIRE_FALSE(newShard.isRebuildRequired(shardIndex));
+    CHECK(cacheMapDiff.empty());
+    CHECK(newShard.getHolesCnt() == removedValuesCnt);
+    CHECK(newShard.getFreeSlotsCnt() == 0);
+    CHECK(std::filesystem::file_size(valuesFilePath) ==
+          valuesCnt * VALUE_SIZE);
+
+    // live values don't move, so the cached ptrs stay valid
+    for (values_cnt_t i = removedValuesCnt; i < valuesCnt; ++i) {
+      auto [readEntry, readValue] =
+          newShard.readValue(shardIndex, generateKey(i));
+      REQUIRE(readValue.has_value());
+      CHECK(readValue.value() == generateValue(i));
+      CHECK(readEntry.ptr == cacheMap.get(generateKey(i)));
+    }
+
+    SUBCASE("& new keys fill the holes") {
+      for (values_cnt_t i = valuesCnt; i < valuesCnt + removedValuesCnt; ++i)
+        newShard.writeValue(shardIndex, generateKey(i), generateValue(i));
+      CHECK(newShard.getHolesCnt() == 0);
+      CHECK(std::filesystem::file_size(valuesFilePath) ==
+            valuesCnt * VALUE_SIZE);
+      for (values_cnt_t i = removedValuesCnt; i < valuesCnt + removedValuesCnt;
+           ++i) {
+        auto [readEntry, readValue] =
+            newShard.readValue(shardIndex, generateKey(i));
+        REQUIRE(readValue.has_value());
+        CHECK(readValue.value() == generateValue(i));
+      }
+    }
+
+    SUBCASE("& reopen") {
+      CHECK(ShardBuilder::openShard(shardIndex, counters).getHolesCnt() ==
+            removedValuesCnt);
+      std::filesystem::remove(Shard::getMetadataFilePath(shardIndex));
+      CHECK(ShardBuilder::openShard(shardIndex, counters).getHolesCnt() ==
+            removedValuesCnt);
+    }
+  }
+
   clearTestDirectory();
 }
 
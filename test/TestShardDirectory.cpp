@@ -0,0 +1,155 @@
+#include "KVSException.h"
+#include "Shard.h"
+#include "ShardDirectory.h"
+#include "Storage.h"
+#include "doctest.h"
+
+#include <cstring>
+#include <filesystem>
+#include <string>
+
+using namespace kvs::shard;
+using namespace kvs::storage;
+using kvs::KVSException;
+
+namespace test_kvs::shard_directory {
+
+const std::string testDirectoryPath = "../.test-data/test-shard-directory/";
+
+void setUpTestDirectory() {
+  std::filesystem::create_directories(testDirectoryPath);
+  Shard::storageDirectoryPath = testDirectoryPath;
+}
+
+void clearTestDirectory() { std::filesystem::remove_all(testDirectoryPath); }
+
+Key generateKey(size_t value) {
+  ByteArray byteArray{KEY_SIZE};
+  std::memcpy(byteArray.get(), reinterpret_cast<char*>(&value), sizeof(size_t));
+  return Key{byteArray};
+}
+
+/**
+ * @brief Find a Key of the shard. With isMoved set, one that a split of the shard moves to the new shard.
+ *
+ */
+HashedKey findKey(const ShardDirectory& directory, shard_index_t shardIndex,
+                  bool isMoved) {
+  for (size_t i = 0;; ++i) {
+    HashedKey key{generateKey(i)};
+    if (directory.getShardIndex(key) == shardIndex &&
+        directory.isMovedBySplit(key, shardIndex) == isMoved)
+      return key;
+  }
+}
+
+TEST_CASE("test ShardDirectory") {
+  setUpTestDirectory();
+
+  SUBCASE("initial layout") {
+    ShardDirectory directory;
+    CHECK(std::filesystem::exists(ShardDirectory::getFilePath()));
+    CHECK(directory.getGlobalDepth() == INITIAL_SHARD_DEPTH);
+    std::vector<shard_index_t> shardIndices = directory.getShardIndices();
+    REQUIRE(shardIndices.size() == size_t{1} << INITIAL_SHARD_DEPTH);
+    for (shard_index_t i = 0; i < shardIndices.size(); ++i) {
+      CHECK(shardIndices[i] == i);
+      CHECK(directory.getLocalDepth(i) == INITIAL_SHARD_DEPTH);
+      CHECK_FALSE(directory.getBuddy(i).has_value());
+    }
+    for (size_t i = 0; i < 1000; ++i) {
+      HashedKey key{generateKey(i)};
+      CHECK(directory.getShardIndex(key) ==
+            (key.getShardBits() & ((1 << INITIAL_SHARD_DEPTH) - 1)));
+    }
+  }
+
+  SUBCASE("split and merge") {
+    ShardDirectory directory;
+    shard_index_t shardIndex = 5;
+    HashedKey keptKey = findKey(directory, shardIndex, false);
+    HashedKey movedKey = findKey(directory, shardIndex, true);
+
+    shard_index_t newShardIndex = directory.allocateShardIndex();
+    CHECK_FALSE(directory.isUsed(newShardIndex));
+    directory.split(shardIndex, newShardIndex);
+    // not visible before publish()
+    CHECK(directory.getShardIndex(movedKey) == shardIndex);
+    CHECK(directory.getGlobalDepth() == INITIAL_SHARD_DEPTH);
+    directory.publish();
+
+    CHECK(directory.getGlobalDepth() == INITIAL_SHARD_DEPTH + 1);
+    CHECK(directory.isUsed(newShardIndex));
+    CHECK(directory.getLocalDepth(shardIndex) == INITIAL_SHARD_DEPTH + 1);
+    CHECK(directory.getLocalDepth(newShardIndex) == INITIAL_SHARD_DEPTH + 1);
+    CHECK(directory.getShardIndex(keptKey) == shardIndex);
+    CHECK(directory.getShardIndex(movedKey) == newShardIndex);
+    CHECK(directory.getBuddy(shardIndex) == newShardIndex);
+    CHECK(directory.getBuddy(newShardIndex) == shardIndex);
+    // the other shards own both halves of the doubled directory
+    CHECK(directory.getLocalDepth(0) == INITIAL_SHARD_DEPTH);
+    CHECK_FALSE(directory.getBuddy(0).has_value());
+
+    SUBCASE("split without doubling") {
+      shard_index_t otherShardIndex = 7;
+      HashedKey otherMovedKey = findKey(directory, otherShardIndex, true);
+      shard_index_t otherNewShardIndex = directory.allocateShardIndex();
+      CHECK(otherNewShardIndex != newShardIndex);
+      directory.split(otherShardIndex, otherNewShardIndex);
+      directory.publish();
+      CHECK(directory.getGlobalDepth() == INITIAL_SHARD_DEPTH + 1);
+      CHECK(directory.getShardIndex(otherMovedKey) == otherNewShardIndex);
+      CHECK(directory.getShardIndex(movedKey) == newShardIndex);
+    }
+
+    SUBCASE("merge") {
+      CHECK(directory.merge(newShardIndex) == shardIndex);
+      directory.publish();
+      CHECK_FALSE(directory.isUsed(newShardIndex));
+      CHECK(directory.getLocalDepth(shardIndex) == INITIAL_SHARD_DEPTH);
+      CHECK(directory.getShardIndex(movedKey) == shardIndex);
+      // the directory never shrinks
+      CHECK(directory.getGlobalDepth() == INITIAL_SHARD_DEPTH + 1);
+      CHECK(directory.getShardIndices().size() ==
+            size_t{1} << INITIAL_SHARD_DEPTH);
+      // the released index is reused
+      CHECK(directory.allocateShardIndex() == newShardIndex);
+    }
+
+    SUBCASE("reload") {
+      ShardDirectory loaded;
+      CHECK(loaded.getGlobalDepth() == INITIAL_SHARD_DEPTH + 1);
+      CHECK(loaded.getShardIndex(keptKey) == shardIndex);
+      CHECK(loaded.getShardIndex(movedKey) == newShardIndex);
+      CHECK(loaded.getBuddy(newShardIndex) == shardIndex);
+      CHECK(loaded.getShardIndices() == directory.getShardIndices());
+    }
+  }
+
+  SUBCASE("released index") {
+    ShardDirectory directory;
+    shard_index_t newShardIndex = directory.allocateShardIndex();
+    directory.releaseShardIndex(newShardIndex);
+    CHECK_FALSE(directory.isUsed(newShardIndex));
+    CHECK_THROWS_AS(directory.split(0, newShardIndex), KVSException);
+    CHECK(directory.allocateShardIndex() == newShardIndex);
+  }
+
+  SUBCASE("corrupted file") {
+    { ShardDirectory directory; }
+    ByteArray bytes = readFile(ShardDirectory::getFilePath());
+    // the last slot taken by the shard of the one before doesn't fit its pattern
+    std::memcpy(bytes.get() + bytes.length() - sizeof(shard_index_t),
+                bytes.get() + bytes.length() - 2 * sizeof(shard_index_t),
+                sizeof(shard_index_t));
+    writeFile(ShardDirectory::getFilePath(), bytes);
+    CHECK_THROWS_AS(ShardDirectory{}, KVSException);
+
+    writeFile(ShardDirectory::getFilePath(), ByteArray{3});
+    CHECK_THROWS_AS(ShardDirectory{}, KVSException);
+  }
+
+  clearTestDirectory();
+}
+
+} // namespace test_kvs::shard_directory
@@ -1,7 +1,10 @@
+#include "KVSException.h"
 #include "Storage.h"
 #include "doctest.h"
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <thread>
 
 using namespace kvs::storage;
 using kvs::utils::ByteArray;
@@ -250,4 +253,132 @@ TEST_CASE("test Storage") {
   clearTestDirectory();
 }
 
+TEST_CASE("test copyFileRanges") {
+  setUpTestDirectory();
+  const std::string copyFilePath = testDirectoryPath + "copy.test";
+  auto readInt = [](const ByteArray& content, size_t index) {
+    return *reinterpret_cast<const uint32_t*>(content.get() +
+                                              index * sizeof(uint32_t));
+  };
+
+  SUBCASE("copy no ranges") {
+    copyFileRanges(filePath, copyFilePath, {});
+    CHECK(readFile(copyFilePath).length() == 0);
+  }
+
+  SUBCASE("copy several ranges") {
+    // integers [10, 20), [5, 6) and [1000, 100000]
+    std::vector<std::pair<size_t, size_t>> ranges{
+        {10 * sizeof(uint32_t), 10 * sizeof(uint32_t)},
+        {5 * sizeof(uint32_t), sizeof(uint32_t)},
+        {1000 * sizeof(uint32_t),
+         (maxContentInteger - 999) * sizeof(uint32_t)}};
+    // the destination is truncated
+    writeFile(copyFilePath, readFile(filePath));
+    copyFileRanges(filePath, copyFilePath, ranges);
+
+    ByteArray content = readFile(copyFilePath);
+    REQUIRE(content.length() ==
+            (10 + 1 + maxContentInteger - 999) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < 10; ++i) CHECK(readInt(content, i) == 10 + i);
+    CHECK(readInt(content, 10) == 5);
+    for (uint32_t i = 1000; i <= maxContentInteger; ++i)
+      REQUIRE(readInt(content, i - 1000 + 11) == i);
+  }
+
+  SUBCASE("copy a range beyond the end of file") {
+    CHECK_THROWS_AS(
+        copyFileRanges(filePath, copyFilePath, {{contentFileSize - 4, 8}}),
+        kvs::KVSException);
+  }
+
+  clearTestDirectory();
+}
+
+TEST_CASE("test syscallStats") {
+  setUpTestDirectory();
+  SyscallStats stats;
+  auto getSyscallsCnt = [&stats](IOOperation operation, Syscall syscall) {
+    return stats.operationStats[static_cast<size_t>(operation)]
+        .syscallsCnts[static_cast<size_t>(syscall)]
+        .load();
+  };
+  const IOOperationStats& getStats =
+      stats.operationStats[static_cast<size_t>(IOOperation::GET)];
+  const IOOperationStats& addStats =
+      stats.operationStats[static_cast<size_t>(IOOperation::ADD)];
+
+  SUBCASE("test only the outermost scope counts the operation") {
+    {
+      IOOperationScope scope{stats, IOOperation::GET};
+      IOOperationScope nestedScope{stats, IOOperation::ADD};
+    }
+    CHECK(getStats.operationsCnt.load() == 1);
+    CHECK(addStats.operationsCnt.load() == 0);
+  }
+
+  SUBCASE("test syscalls are counted for the operation in scope") {
+    {
+      IOOperationScope scope{stats, IOOperation::GET};
+      Storage storage(filePath);
+      ByteArray content = storage.read(0, sizeof(uint32_t));
+      {
+        // a nested scope takes over the syscalls until it ends
+        IOOperationScope nestedScope{stats, IOOperation::ADD};
+        storage.read(sizeof(uint32_t), sizeof(uint32_t));
+      }
+      storage.close();
+    }
+    {
+      IOOperationScope scope{stats, IOOperation::ADD};
+      Storage storage(filePath);
+      storage.append(serializeIntToByteArray(1));
+      storage.close();
+    }
+    CHECK(getSyscallsCnt(IOOperation::GET, Syscall::OPEN) == 1);
+    CHECK(getSyscallsCnt(IOOperation::GET, Syscall::READ) == 1);
+    CHECK(getSyscallsCnt(IOOperation::GET, Syscall::CLOSE) == 1);
+    CHECK(getStats.readBytesCnt.load() == sizeof(uint32_t));
+    CHECK(getSyscallsCnt(IOOperation::ADD, Syscall::READ) == 1);
+    CHECK(getSyscallsCnt(IOOperation::ADD, Syscall::WRITE) == 1);
+    CHECK(addStats.writtenBytesCnt.load() == sizeof(uint32_t));
+    CHECK(addStats.operationsCnt.load() == 1);
+  }
+
+  SUBCASE("test syscalls outside of any scope aren't counted") {
+    fileExists(filePath);
+    {
+      IOOperationScope scope{stats, IOOperation::GET};
+    }
+    getFileSize(filePath);
+    for (const IOOperationStats& operationStats : stats.operationStats) {
+      for (const kvs::metrics::Counter& counter : operationStats.syscallsCnts)
+        CHECK(counter.load() == 0);
+    }
+  }
+
+  SUBCASE("test a continued scope counts the syscalls of another thread") {
+    IOOperationContext outsideContext = IOOperationScope::getCurrentContext();
+    CHECK(outsideContext.stats == nullptr);
+    {
+      IOOperationScope scope{stats, IOOperation::GET};
+      IOOperationContext context = IOOperationScope::getCurrentContext();
+      CHECK(context.stats == &stats);
+      CHECK(context.operation == IOOperation::GET);
+      std::thread worker([&context]() {
+        IOOperationScope continuedScope{context};
+        getFileSize(filePath);
+      });
+      worker.join();
+      // a thread that doesn't continue the scope isn't counted
+      std::thread([]() { getFileSize(filePath); }).join();
+    }
+    CHECK(IOOperationScope::getCurrentContext().stats == nullptr);
+    CHECK(getSyscallsCnt(IOOperation::GET, Syscall::STAT) == 1);
+    CHECK(getStats.operationsCnt.load() == 1);
+  }
+
+  clearTestDirectory();
+}
+
 } // namespace test_kvs::storage
@@ -140,6 +140,34 @@ TEST_CASE("test StorageHashTable") {
       }
     }
 
+    SUBCASE("takeDeletedEntry()") {
+      StorageHashTable table(STORAGE_HASH_TABLE_INITIAL_SIZE);
+      size_t keysCnt = 40;
+      for (size_t i = 0; i < keysCnt; i++)
+        table.put(generateKey(i), Ptr{i * VALUE_SIZE, i % 3 != 0});
+
+      std::vector<size_t> takenOffsets;
+      while (std::optional<Ptr> ptr = table.takeDeletedEntry()) {
+        CHECK(ptr->getType() == PtrType::DELETED);
+        takenOffsets.push_back(ptr->getOffset());
+      }
+      CHECK(takenOffsets.size() == (keysCnt + 2) / 3);
+
+      for (size_t i = 0; i < keysCnt; i++) {
+        if (i % 3 == 0) {
+          CHECK(contains(takenOffsets, i * VALUE_SIZE));
+          CHECK(table.get(generateKey(i)) == EMPTY_PTR);
+        } else {
+          CHECK(table.get(generateKey(i)) == Ptr{i * VALUE_SIZE, true});
+        }
+      }
+
+      // overwrites must find the shifted entries instead of adding duplicates
+      for (size_t i = 1; i < keysCnt; i += 3)
+        table.put(generateKey(i), Ptr{i * VALUE_SIZE, false});
+      CHECK(table.getEntries().size() == keysCnt - takenOffsets.size());
+    }
+
     SUBCASE("stress") {
       std::random_device rd;
       std::mt19937_64 gen(rd());
@@ -0,0 +1,103 @@
+#include "KVSException.h"
+#include "Trace.h"
+#include "doctest.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+using namespace kvs::trace;
+using namespace kvs::utils;
+using kvs::KVSErrorType;
+using kvs::KVSException;
+
+namespace test_kvs::trace {
+
+const std::string testDirectoryPath = "../.test-data/test-trace/";
+const std::string traceFilePath = testDirectoryPath + "trace";
+
+void setUpTestDirectory() {
+  std::filesystem::create_directories(testDirectoryPath);
+}
+
+void clearTestDirectory() { std::filesystem::remove_all(testDirectoryPath); }
+
+Key generateKey(size_t value) {
+  ByteArray byteArray{KEY_SIZE};
+  std::memset(byteArray.get(), 0, KEY_SIZE);
+  std::memcpy(byteArray.get(), reinterpret_cast<char*>(&value), sizeof(size_t));
+  return Key{byteArray};
+}
+
+void writeTrace(bool fullKeys) {
+  TraceWriter writer{traceFilePath, fullKeys};
+  writer.write(std::chrono::nanoseconds(10), TraceOperation::ADD, DISK_READ,
+               HashedKey{generateKey(1)});
+  writer.write(std::chrono::nanoseconds(20), TraceOperation::GET, CACHE_HIT,
+               HashedKey{generateKey(1)});
+  writer.write(std::chrono::nanoseconds(30), TraceOperation::REMOVE,
+               DISK_READ | REBUILD_TRIGGERED, HashedKey{generateKey(2)});
+}
+
+TEST_CASE("test trace") {
+
+  setUpTestDirectory();
+
+  SUBCASE("test round trip") {
+    for (bool fullKeys : {false, true}) {
+      writeTrace(fullKeys);
+      TraceReader reader{traceFilePath};
+      CHECK(reader.hasFullKeys() == fullKeys);
+
+      std::optional<TraceRecord> record = reader.next();
+      REQUIRE(record.has_value());
+      CHECK(record->timestamp == std::chrono::nanoseconds(10));
+      CHECK(record->operation == TraceOperation::ADD);
+      CHECK(record->outcome == DISK_READ);
+      CHECK(record->keyHash == HashedKey{generateKey(1)}.getLowHash());
+      CHECK(record->key.has_value() == fullKeys);
+      Key replayKey = record->getReplayKey();
+      if (fullKeys)
+        CHECK(replayKey == generateKey(1));
+
+      record = reader.next();
+      REQUIRE(record.has_value());
+      CHECK(record->operation == TraceOperation::GET);
+      CHECK(record->getReplayKey() == replayKey);
+
+      record = reader.next();
+      REQUIRE(record.has_value());
+      CHECK(record->operation == TraceOperation::REMOVE);
+      CHECK(record->outcome == (DISK_READ | REBUILD_TRIGGERED));
+      CHECK(!(record->getReplayKey() == replayKey));
+
+      CHECK(!reader.next().has_value());
+    }
+  }
+
+  SUBCASE("test invalid trace") {
+    {
+      std::ofstream file{traceFilePath};
+      file << "not a trace";
+    }
+    CHECK_THROWS_AS(TraceReader{traceFilePath}, KVSException);
+
+    writeTrace(false);
+    std::filesystem::resize_file(traceFilePath,
+                                 std::filesystem::file_size(traceFilePath) - 1);
+    TraceReader reader{traceFilePath};
+    CHECK(reader.next().has_value());
+    CHECK(reader.next().has_value());
+    try {
+      reader.next();
+      FAIL("a truncated record was read");
+    } catch (const KVSException& exc) {
+      CHECK(exc.getType() == KVSErrorType::TRACE_INVALID_DATA);
+    }
+  }
+
+  clearTestDirectory();
+}
+
+} // namespace test_kvs::trace
@@ -0,0 +1,270 @@
+#include "Workload.h"
+#include "doctest.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace benchmark;
+
+namespace test_kvs::workload {
+
+const std::string testDirectoryPath = "../.test-data/test-workload/";
+const std::string workloadFilePath = testDirectoryPath + "workload";
+
+constexpr uint64_t ITEMS_CNT = 1000;
+constexpr size_t DRAWS_CNT = 200000;
+
+void setUpTestDirectory() {
+  std::filesystem::create_directories(testDirectoryPath);
+}
+
+void clearTestDirectory() { std::filesystem::remove_all(testDirectoryPath); }
+
+void writeFile(const std::string& text) {
+  std::ofstream file(workloadFilePath);
+  file << text;
+}
+
+/**
+ * @brief The probability of the first itemsCnt items of a Zipfian distribution over ITEMS_CNT items.
+ *
+ */
+double getHeadMass(uint64_t itemsCnt, double theta) {
+  double headSum = 0;
+  double sum = 0;
+  for (uint64_t i = 0; i < ITEMS_CNT; i++) {
+    double term = 1 / std::pow(i + 1, theta);
+    sum += term;
+    if (i < itemsCnt)
+      headSum += term;
+  }
+  return headSum / sum;
+}
+
+std::vector<size_t> getZipfianCounts(double theta) {
+  ZipfianGenerator zipfian(ITEMS_CNT, theta);
+  std::mt19937_64 gen(1);
+  std::vector<size_t> counts(ITEMS_CNT);
+  for (size_t i = 0; i < DRAWS_CNT; i++) {
+    uint64_t item = zipfian.next(gen, ITEMS_CNT);
+    REQUIRE(item < ITEMS_CNT);
+    counts[item]++;
+  }
+  return counts;
+}
+
+double getFrequency(const std::vector<size_t>& counts, size_t itemsCnt) {
+  size_t headCnt = 0;
+  for (size_t i = 0; i < itemsCnt; i++) headCnt += counts[i];
+  return static_cast<double>(headCnt) / DRAWS_CNT;
+}
+
+WorkloadConfig getConfig(KeyDistribution keyDistribution) {
+  WorkloadConfig config;
+  config.recordsCnt = ITEMS_CNT;
+  config.keyDistribution = keyDistribution;
+  return config;
+}
+
+TEST_CASE("test Zipfian distribution") {
+
+  SUBCASE("test skew") {
+    for (double theta : {0.5, 0.99}) {
+      std::vector<size_t> counts = getZipfianCounts(theta);
+      CHECK(std::max_element(counts.begin(), counts.end()) == counts.begin());
+      CHECK(counts[0] > counts[1]);
+      // the first two items are drawn exactly, the rest approximately
+      CHECK(getFrequency(counts, 1) ==
+            doctest::Approx(getHeadMass(1, theta)).epsilon(0.05));
+      CHECK(getFrequency(counts, 2) ==
+            doctest::Approx(getHeadMass(2, theta)).epsilon(0.05));
+      CHECK(getFrequency(counts, 10) ==
+            doctest::Approx(getHeadMass(10, theta)).epsilon(0.1));
+      CHECK(getFrequency(counts, 100) ==
+            doctest::Approx(getHeadMass(100, theta)).epsilon(0.1));
+    }
+    // a larger constant is more skewed
+    CHECK(getFrequency(getZipfianCounts(0.5), 10) <
+          getFrequency(getZipfianCounts(0.99), 10));
+  }
+
+  SUBCASE("test growing item count") {
+    ZipfianGenerator zipfian(10, 0.99);
+    std::mt19937_64 gen(1);
+    for (uint64_t itemsCnt : {10, 100, 50, 1000})
+      for (size_t i = 0; i < 1000; i++)
+        CHECK(zipfian.next(gen, itemsCnt) < itemsCnt);
+  }
+}
+
+TEST_CASE("test key distributions") {
+  std::atomic<uint64_t> recordsCnt = ITEMS_CNT;
+
+  SUBCASE("test Zipfian") {
+    Workload workload(getConfig(KeyDistribution::ZIPFIAN), recordsCnt, 1);
+    std::vector<size_t> counts(ITEMS_CNT);
+    for (size_t i = 0; i < DRAWS_CNT; i++) {
+      uint64_t keyNumber = workload.getNextKeyNumber();
+      REQUIRE(keyNumber < ITEMS_CNT);
+      counts[keyNumber]++;
+    }
+    CHECK(std::max_element(counts.begin(), counts.end()) == counts.begin());
+  }
+
+  SUBCASE("test scrambled Zipfian") {
+    Workload workload(getConfig(KeyDistribution::SCRAMBLED_ZIPFIAN),
+                      recordsCnt, 1);
+    std::vector<size_t> counts(ITEMS_CNT);
+    for (size_t i = 0; i < DRAWS_CNT; i++) {
+      uint64_t keyNumber = workload.getNextKeyNumber();
+      REQUIRE(keyNumber < ITEMS_CNT);
+      counts[keyNumber]++;
+    }
+    // still skewed, but the popular records aren't the first ones
+    size_t maxCnt = *std::max_element(counts.begin(), counts.end());
+    CHECK(maxCnt > 10 * DRAWS_CNT / ITEMS_CNT);
+    CHECK(counts[0] < maxCnt);
+  }
+
+  SUBCASE("test latest") {
+    Workload workload(getConfig(KeyDistribution::LATEST), recordsCnt, 1);
+    std::vector<size_t> counts(ITEMS_CNT);
+    for (size_t i = 0; i < DRAWS_CNT; i++) {
+      uint64_t keyNumber = workload.getNextKeyNumber();
+      REQUIRE(keyNumber < ITEMS_CNT);
+      counts[keyNumber]++;
+    }
+    CHECK(std::max_element(counts.begin(), counts.end()) ==
+          counts.begin() + ITEMS_CNT - 1);
+    CHECK(counts[ITEMS_CNT - 1] > counts[ITEMS_CNT - 2]);
+    CHECK(counts[ITEMS_CNT - 2] > counts[0]);
+
+    // an insert makes its record the most popular one
+    CHECK(workload.getInsertKeyNumber() == ITEMS_CNT);
+    CHECK(recordsCnt.load() == ITEMS_CNT + 1);
+    size_t newestCnt = 0;
+    for (size_t i = 0; i < DRAWS_CNT; i++) {
+      uint64_t keyNumber = workload.getNextKeyNumber();
+      REQUIRE(keyNumber <= ITEMS_CNT);
+      if (keyNumber == ITEMS_CNT)
+        newestCnt++;
+    }
+    CHECK(newestCnt > counts[ITEMS_CNT - 2]);
+  }
+
+  SUBCASE("test uniform") {
+    Workload workload(getConfig(KeyDistribution::UNIFORM), recordsCnt, 1);
+    std::vector<size_t> counts(ITEMS_CNT);
+    for (size_t i = 0; i < DRAWS_CNT; i++) {
+      uint64_t keyNumber = workload.getNextKeyNumber();
+      REQUIRE(keyNumber < ITEMS_CNT);
+      counts[keyNumber]++;
+    }
+    CHECK(*std::max_element(counts.begin(), counts.end()) <
+          2 * DRAWS_CNT / ITEMS_CNT);
+  }
+}
+
+TEST_CASE("test core workloads") {
+  const std::array<std::array<double, WORKLOAD_OPERATIONS_CNT>, 6>
+      expectedProportions = {{{0.5, 0.5, 0, 0, 0, 0},
+                              {0.95, 0.05, 0, 0, 0, 0},
+                              {1, 0, 0, 0, 0, 0},
+                              {0.95, 0, 0.05, 0, 0, 0},
+                              {0, 0, 0.05, 0, 0.95, 0},
+                              {0.5, 0, 0, 0, 0, 0.5}}};
+
+  SUBCASE("test proportions") {
+    for (char letter = 'a'; letter <= 'f'; letter++) {
+      CAPTURE(letter);
+      WorkloadConfig config = WorkloadConfig::getCoreWorkload(letter);
+      const std::array<double, WORKLOAD_OPERATIONS_CNT>& expected =
+          expectedProportions[letter - 'a'];
+      CHECK(config.proportions == expected);
+      CHECK(config.keyDistribution == (letter == 'd'
+                                           ? KeyDistribution::LATEST
+                                           : KeyDistribution::ZIPFIAN));
+
+      std::atomic<uint64_t> recordsCnt = ITEMS_CNT;
+      Workload workload(config, recordsCnt, 1);
+      std::array<size_t, WORKLOAD_OPERATIONS_CNT> counts{};
+      for (size_t i = 0; i < DRAWS_CNT; i++)
+        counts[static_cast<size_t>(workload.getNextOperation())]++;
+      for (size_t i = 0; i < WORKLOAD_OPERATIONS_CNT; i++)
+        CHECK(std::abs(static_cast<double>(counts[i]) / DRAWS_CNT -
+                       expected[i]) < 0.01);
+    }
+  }
+
+  SUBCASE("test unknown workload") {
+    CHECK_THROWS_AS(WorkloadConfig::getCoreWorkload('g'),
+                    std::invalid_argument);
+    CHECK_THROWS_AS(WorkloadConfig::getCoreWorkload('A'),
+                    std::invalid_argument);
+  }
+}
+
+TEST_CASE("test workload config") {
+  setUpTestDirectory();
+
+  SUBCASE("test load") {
+    writeFile("# a comment\n"
+              "\n"
+              "recordcount=500\n"
+              "operationcount=2000\n"
+              "readproportion=0\n"
+              "updateproportion=0.25\n"
+              "scanproportion=0.75\n"
+              "requestdistribution=uniform\n"
+              "zipfianconstant=0.5\n"
+              "maxscanlength=10\n");
+    WorkloadConfig config;
+    config.load(workloadFilePath);
+    CHECK(config.recordsCnt == 500);
+    CHECK(config.operationsCnt == 2000);
+    CHECK(config.proportions ==
+          std::array<double, WORKLOAD_OPERATIONS_CNT>{0, 0.25, 0, 0, 0.75, 0});
+    CHECK(config.keyDistribution == KeyDistribution::UNIFORM);
+    CHECK(config.zipfianConstant == 0.5);
+    CHECK(config.maxScanLength == 10);
+    CHECK_NOTHROW(config.validate());
+  }
+
+  SUBCASE("test invalid lines") {
+    for (const char* line :
+         {"recordcount", "unknownproperty=1", "recordcount=many",
+          "recordcount=-1", "readproportion=-0.5", "readproportion=nan",
+          "zipfianconstant=0", "zipfianconstant=1", "zipfianconstant=1.5",
+          "requestdistribution=hotspot"}) {
+      CAPTURE(line);
+      writeFile(std::string(line) + "\n");
+      WorkloadConfig config;
+      CHECK_THROWS_AS(config.load(workloadFilePath), std::invalid_argument);
+    }
+    WorkloadConfig config;
+    CHECK_THROWS_AS(config.load(testDirectoryPath + "missing"),
+                    std::invalid_argument);
+  }
+
+  SUBCASE("test all zero proportions") {
+    WorkloadConfig config;
+    config.set("readproportion", "0");
+    CHECK_THROWS_AS(config.validate(), std::invalid_argument);
+    // a later property may still make the mix valid
+    config.set("updateproportion", "1");
+    CHECK_NOTHROW(config.validate());
+  }
+
+  clearTestDirectory();
+}
+
+} // namespace test_kvs::workload
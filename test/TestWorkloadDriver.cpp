@@ -0,0 +1,193 @@
+#include "WorkloadDriver.h"
+#include "doctest.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace benchmark;
+using namespace kvs;
+
+namespace test_kvs::workload_driver {
+
+const std::string testDirectoryPath = "../.test-data/test-workload-driver/";
+
+constexpr uint64_t RECORDS_CNT = 1000;
+
+void setUpTestDirectory() {
+  std::filesystem::create_directories(testDirectoryPath);
+  Shard::storageDirectoryPath = testDirectoryPath;
+}
+
+void clearTestDirectory() { std::filesystem::remove_all(testDirectoryPath); }
+
+WorkloadConfig getConfig(uint64_t operationsCnt) {
+  WorkloadConfig config = WorkloadConfig::getCoreWorkload('a');
+  config.recordsCnt = RECORDS_CNT;
+  config.operationsCnt = operationsCnt;
+  return config;
+}
+
+uint64_t getHistogramsCount(const ThreadResult& result) {
+  uint64_t count = 0;
+  for (const LatencyHistogram& histogram : result.histograms)
+    count += histogram.getCount();
+  return count;
+}
+
+/**
+ * @brief The number of operations that took at least the given time.
+ *
+ */
+uint64_t getCountAtLeast(const ThreadResult& result, uint64_t nanos) {
+  uint64_t count = 0;
+  for (const LatencyHistogram& histogram : result.histograms) {
+    for (const LatencyHistogram::Bucket& bucket : histogram.getBuckets()) {
+      if (bucket.lower >= nanos)
+        count += bucket.count;
+    }
+  }
+  return count;
+}
+
+TEST_CASE("test WorkloadDriver") {
+  setUpTestDirectory();
+
+  SUBCASE("test thread split") {
+    KVS kvs;
+    WorkloadConfig config = getConfig(1000);
+    DriverConfig driverConfig;
+    driverConfig.threadsCnt = 3;
+    std::atomic<uint64_t> recordsCnt = 0;
+
+    std::vector<ThreadResult> loadResults =
+        loadWorkload(kvs, config, driverConfig, recordsCnt);
+    REQUIRE(loadResults.size() == 3);
+    // 1000 records don't split evenly among 3 threads
+    CHECK(loadResults[0].operationsCnt == 333);
+    CHECK(loadResults[1].operationsCnt == 333);
+    CHECK(loadResults[2].operationsCnt == 334);
+    CHECK(recordsCnt.load() == RECORDS_CNT);
+    for (const ThreadResult& result : loadResults) {
+      size_t insertIndex = static_cast<size_t>(WorkloadOperation::INSERT);
+      CHECK(result.histograms[insertIndex].getCount() == result.operationsCnt);
+      CHECK(getHistogramsCount(result) == result.operationsCnt);
+    }
+    // every record is inserted exactly once
+    for (uint64_t i = 0; i < RECORDS_CNT; i++)
+      CHECK(kvs.get(Workload::getKey(i)).has_value());
+
+    std::vector<ThreadResult> runResults =
+        runWorkload(kvs, config, driverConfig, recordsCnt);
+    REQUIRE(runResults.size() == 3);
+    ThreadResult merged;
+    for (const ThreadResult& result : runResults) {
+      CHECK(getHistogramsCount(result) == result.operationsCnt);
+      merged.merge(result);
+    }
+    CHECK(merged.operationsCnt == config.operationsCnt);
+    CHECK(getHistogramsCount(merged) == config.operationsCnt);
+    for (const ThreadResult& result : runResults)
+      CHECK(merged.seconds >= result.seconds);
+    // workload a only reads and updates
+    CHECK(merged.histograms[static_cast<size_t>(WorkloadOperation::READ)]
+                  .getCount() +
+              merged.histograms[static_cast<size_t>(WorkloadOperation::UPDATE)]
+                  .getCount() ==
+          config.operationsCnt);
+  }
+
+  SUBCASE("test open loop duration") {
+    KVS kvs;
+    WorkloadConfig config = getConfig(250);
+    DriverConfig driverConfig;
+    driverConfig.threadsCnt = 2;
+    driverConfig.targetRate = 500;
+    std::atomic<uint64_t> recordsCnt = 0;
+    loadWorkload(kvs, config, driverConfig, recordsCnt);
+
+    ThreadResult merged;
+    for (const ThreadResult& result :
+         runWorkload(kvs, config, driverConfig, recordsCnt))
+      merged.merge(result);
+    CHECK(merged.operationsCnt == config.operationsCnt);
+    // 250 operations at 500 per second take about half a second, the arrivals are random though
+    CHECK(merged.seconds > 0.35);
+    CHECK(merged.seconds < 1.5);
+  }
+
+  SUBCASE("test open loop stall") {
+    KVS kvs{RECORDS_CNT * CacheMap::SLOT_MEMORY_SIZE};
+    WorkloadConfig config = getConfig(5000);
+    DriverConfig driverConfig;
+    driverConfig.targetRate = 5000;
+    std::atomic<uint64_t> recordsCnt = 0;
+    loadWorkload(kvs, config, driverConfig, recordsCnt);
+
+    std::vector<ThreadResult> results;
+    std::thread driver([&]() {
+      results = runWorkload(kvs, config, driverConfig, recordsCnt);
+    });
+    // resizing the CacheMap locks out all operations while it builds the new map
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    auto stallBegin = std::chrono::steady_clock::now();
+    kvs.resizeCacheMap(4096 * RECORDS_CNT * CacheMap::SLOT_MEMORY_SIZE);
+    auto stall = std::chrono::steady_clock::now() - stallBegin;
+    driver.join();
+    REQUIRE(results.size() == 1);
+
+    uint64_t stallNanos =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(stall).count();
+    double stallSeconds = std::chrono::duration<double>(stall).count();
+    MESSAGE("stall of " << stallSeconds << " s");
+    REQUIRE(stallSeconds > 0.005);
+    // the operations due in the first half of the stall waited at least half of it, not just the one that ran into it
+    CHECK(getCountAtLeast(results[0], stallNanos / 2) >=
+          driverConfig.targetRate * stallSeconds / 4);
+  }
+
+  clearTestDirectory();
+}
+
+TEST_CASE("test DriverConfig") {
+  DriverConfig config;
+
+  SUBCASE("test set") {
+    CHECK(config.set("threadcount", "4"));
+    CHECK(config.threadsCnt == 4);
+    CHECK(config.set("threadcount", "0"));
+    CHECK(config.threadsCnt == 1);
+    CHECK(config.set("target", "1500.5"));
+    CHECK(config.targetRate == 1500.5);
+    CHECK(config.set("target", "0"));
+    CHECK(config.targetRate == 0);
+    CHECK(config.set("tracefile", "trace.bin"));
+    CHECK(config.traceFilePath == "trace.bin");
+    CHECK(config.set("tracefullkeys", "1"));
+    CHECK(config.traceFullKeys);
+    // workload properties are left to WorkloadConfig
+    CHECK_FALSE(config.set("readproportion", "1"));
+    CHECK_FALSE(config.set("repetitions", "3"));
+  }
+
+  SUBCASE("test invalid values") {
+    CHECK_THROWS_AS(config.set("threadcount", "many"), std::invalid_argument);
+    CHECK_THROWS_AS(config.set("threadcount", "-1"), std::invalid_argument);
+    CHECK_THROWS_AS(config.set("target", "fast"), std::invalid_argument);
+    CHECK_THROWS_AS(config.set("target", "-100"), std::invalid_argument);
+    CHECK_THROWS_AS(config.set("target", "nan"), std::invalid_argument);
+    CHECK_THROWS_AS(config.set("target", "inf"), std::invalid_argument);
+    CHECK_THROWS_AS(config.set("tracefullkeys", "yes"), std::invalid_argument);
+    // a rejected value leaves the property as it was
+    CHECK(config.threadsCnt == 1);
+    CHECK(config.targetRate == 0);
+  }
+}
+
+} // namespace test_kvs::workload_driver